@@ -0,0 +1,60 @@
+#!/bin/bash
+# Mide el rendimiento y el espacio desperdiciado de star con distintos tamaños de bloque.
+# Uso: benchmarks/block_size.sh [ruta de star] [tamaños...]
+# Variables: SMALL_FILES (archivos pequeños, 2000), SMALL_MAX (tamaño máximo de cada uno en bytes,
+# 8192), LARGE_MB (tamaño del archivo grande en MB, 256), JOBS (hilos para -j, 4)
+
+STAR=${1:-./star}
+shift
+SIZES=${@:-4K 16K 64K 256K 1M 4M}
+SMALL_FILES=${SMALL_FILES:-2000}
+SMALL_MAX=${SMALL_MAX:-8192}
+LARGE_MB=${LARGE_MB:-256}
+JOBS=${JOBS:-4}
+
+STAR=$(realpath "$STAR") || exit 1
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+# Generar la carga: muchos archivos pequeños y un archivo grande
+mkdir -p "$WORK/small" "$WORK/large" "$WORK/out"
+for i in $(seq 1 "$SMALL_FILES"); do
+    head -c $((RANDOM * SMALL_MAX / 32768 + 1)) /dev/urandom > "$WORK/small/f$i"
+done
+head -c $((LARGE_MB * 1024 * 1024)) /dev/urandom > "$WORK/large/big"
+
+# Devuelve los segundos que tarda un comando
+elapsed()
+{
+    local start end
+    start=$(date +%s.%N)
+    "$@" > /dev/null || exit 1
+    end=$(date +%s.%N)
+    awk -v s="$start" -v e="$end" 'BEGIN { print e - s }'
+}
+
+# Ejecuta una carga con un tamaño de bloque e imprime una línea de resultados
+run()
+{
+    local name=$1 size=$2 dir=$3
+    local input_bytes archive_bytes create extract
+    input_bytes=$(find "$dir" -type f -printf '%s\n' | awk '{ total += $1 } END { print total }')
+    rm -f "$WORK/a.star"
+    cd "$dir" || exit 1
+    sync
+    create=$(elapsed "$STAR" -c -j "$JOBS" --block-size="$size" -f "$WORK/a.star" *)
+    cd "$WORK/out" || exit 1
+    sync
+    extract=$(elapsed "$STAR" -x -j "$JOBS" -f "$WORK/a.star")
+    archive_bytes=$(stat -c %s "$WORK/a.star")
+    awk -v n="$name" -v s="$size" -v i="$input_bytes" -v a="$archive_bytes" -v c="$create" -v x="$extract" 'BEGIN {
+        printf "%-6s %-6s %12.0f %12.0f %9.1f%% %10.1f %10.1f\n", n, s, i, a, (a - i) * 100 / i,
+               i / 1048576 / (c > 0 ? c : 1e-9), i / 1048576 / (x > 0 ? x : 1e-9) }'
+    rm -f "$WORK"/out/*
+}
+
+printf "%-6s %-6s %12s %12s %10s %10s %10s\n" carga bloque entrada empaquetado sobrecosto "crear MB/s" "extr. MB/s"
+for size in $SIZES; do
+    run small "$size" "$WORK/small"
+    run large "$size" "$WORK/large"
+done
@@ -0,0 +1,45 @@
+#!/bin/bash
+# Compara dos resultados de benchmarks/suite.sh y marca las mediciones que empeoraron: las que
+# tardan más, hacen más llamadas de E/S o dejan un empaquetado más grande que la base por encima del
+# umbral. El tiempo tiene ruido, así que además tiene que crecer al menos 10 ms; las llamadas y el
+# tamaño solo cambian si cambia el programa.
+# Uso: benchmarks/compare.sh base.tsv nuevo.tsv [umbral en %, 10]
+# Retorna 1 si alguna medición empeoró
+
+BASE=$1
+NEW=$2
+THRESHOLD=${3:-10}
+
+if [ ! -f "$BASE" ] || [ ! -f "$NEW" ]; then
+    echo "Uso: $0 base.tsv nuevo.tsv [umbral en %]" >&2
+    exit 2
+fi
+
+awk -F'\t' -v threshold="$THRESHOLD" '
+    # Cambio relativo en %; con base 0 solo cuenta si el nuevo valor no es 0
+    function change(old, new) { return old > 0 ? (new - old) * 100 / old : (new > 0 ? 100 : 0) }
+    FNR == 1 { next }
+    { key = $2 "\t" $3 "\t" $4 "\t" $5 }
+    NR == FNR { seconds[key] = $6; archive[key] = $10; calls[key] = $11 + $12; next }
+    key in seconds {
+        time_change = change(seconds[key], $6)
+        calls_change = change(calls[key], $11 + $12)
+        size_change = change(archive[key], $10)
+        mark = ""
+        if (time_change > threshold && $6 - seconds[key] >= 0.01) mark = mark " tiempo"
+        if (calls_change > threshold) mark = mark " llamadas"
+        if (size_change > threshold) mark = mark " tamaño"
+        if (mark != "") worse++
+        printf "%-6s %-9s %-5s %-19s %9.4f %9.4f %+7.1f%% %7d %7d %+7.1f%% %+7.1f%%%s\n", $2, $3, $4, $5,
+               seconds[key], $6, time_change, calls[key], $11 + $12, calls_change, size_change,
+               mark != "" ? "  EMPEORÓ:" mark : ""
+        compared++
+    }
+    BEGIN {
+        printf "%-6s %-9s %-5s %-19s %9s %9s %8s %7s %7s %8s %8s\n", "carga", "contenido", "comp.", "operacion",
+               "base s", "nuevo s", "tiempo", "llam.", "llam.", "llamadas", "tamaño"
+    }
+    END {
+        printf "\n%d mediciones comparadas, %d empeoraron más de %s%%\n", compared, worse, threshold
+        exit worse > 0
+    }' "$BASE" "$NEW"
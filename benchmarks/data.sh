@@ -0,0 +1,30 @@
+# Generación de datos repetibles para benchmarks/suite.sh y tests/roundtrip.sh (se carga con source)
+# Requiere openssl.
+
+# Tabla de tr que reduce cada byte a uno de 8 símbolos (unos 3 bits por byte, comprimible)
+TEXT_MAP=$(for i in $(seq 32); do printf 'abcdefg '; done)
+
+# Escribe en la salida estándar un flujo infinito de bytes que solo depende de la semilla
+# Uso: stream contenido semilla
+stream()
+{
+    local key
+    key=$(printf '%s' "$2" | md5sum | cut -c1-32)
+    if [ "$1" = text ]; then
+        openssl enc -aes-128-ctr -K "$key" -iv 00000000000000000000000000000000 < /dev/zero 2> /dev/null |
+            tr '\000-\377' "$TEXT_MAP"
+    else
+        openssl enc -aes-128-ctr -K "$key" -iv 00000000000000000000000000000000 < /dev/zero 2> /dev/null
+    fi
+}
+
+# Crea archivos con contenido repetible a partir de líneas "nombre tamaño" de la entrada estándar
+# Uso: generate directorio contenido semilla
+generate()
+{
+    local name size
+    mkdir -p "$1"
+    while read -r name size; do
+        head -c "$size" <&3 > "$1/$name"
+    done 3< <(stream "$2" "$3")
+}
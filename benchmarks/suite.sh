@@ -0,0 +1,215 @@
+#!/bin/bash
+# Mide las operaciones de star (crear, listar, extraer, agregar, actualizar, eliminar y empacar)
+# con cargas sintéticas repetibles y escribe los resultados en TSV, una fila por medición. También
+# se mide un empaquetado fragmentado con ciclos de eliminar y agregar. Las llamadas de E/S y los
+# bytes que llegan al disco salen de /proc/<pid>/io: no dependen del ruido del reloj, así que sirven
+# para detectar regresiones entre versiones con benchmarks/compare.sh.
+# Uso: benchmarks/suite.sh [ruta de star] > resultados.tsv
+# Variables: SEED (semilla de los datos, 1), LOADS (cargas, "small large mixed"), CONTENTS
+# (contenidos: random no se comprime, text sí; "random text"), COMPRESS (valores de --compress,
+# "none zlib"), OPTIONS (opciones extra para -c, -r y -u, por ejemplo "--dedup"), SMALL_FILES
+# (archivos pequeños, 1000), SMALL_MAX (tamaño máximo de cada uno en bytes, 8192), LARGE_FILES
+# (archivos grandes, 2), LARGE_MB (tamaño de cada uno en MB, 128), CYCLES (ciclos de eliminar y
+# agregar, 5), REPEAT (repeticiones; se guarda la más rápida, 3), JOBS (hilos para -j, 1),
+# DROP_CACHES (1 para vaciar la caché de páginas antes de cada medición; requiere root), LABEL
+# (nombre de la versión en los resultados; por omisión el commit de git)
+# Requiere openssl para generar los datos.
+
+STAR=${1:-./star}
+SEED=${SEED:-1}
+LOADS=${LOADS:-small large mixed}
+CONTENTS=${CONTENTS:-random text}
+COMPRESS=${COMPRESS:-none zlib}
+OPTIONS=${OPTIONS:-}
+SMALL_FILES=${SMALL_FILES:-1000}
+SMALL_MAX=${SMALL_MAX:-8192}
+LARGE_FILES=${LARGE_FILES:-2}
+LARGE_MB=${LARGE_MB:-128}
+CYCLES=${CYCLES:-5}
+REPEAT=${REPEAT:-3}
+JOBS=${JOBS:-1}
+DROP_CACHES=${DROP_CACHES:-0}
+LABEL=${LABEL:-$(git -C "$(dirname "$0")" describe --always --dirty 2> /dev/null || echo star)}
+
+# EPOCHREALTIME usa el separador decimal del locale
+export LC_ALL=C
+
+STAR=$(realpath "$STAR") || exit 1
+command -v openssl > /dev/null || { echo "Se necesita openssl para generar los datos" >&2; exit 1; }
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+ARCHIVE=$WORK/a.star
+
+source "$(dirname "$0")/data.sh"
+
+# Imprime los archivos de una carga, una línea "nombre tamaño" por archivo
+# Uso: sizes carga
+sizes()
+{
+    awk -v load="$1" -v seed="$SEED" -v small="$SMALL_FILES" -v small_max="$SMALL_MAX" \
+        -v large="$LARGE_FILES" -v large_mb="$LARGE_MB" 'BEGIN {
+        srand(seed)
+        if (load == "small" || load == "mixed")
+            for (i = 0; i < (load == "small" ? small : small / 2); i++)
+                print "f" ++n, int(rand() * small_max) + 1
+        if (load == "mixed")
+            for (i = 0; i < 16; i++)
+                print "f" ++n, int(65536 * 2 ^ (rand() * 6))
+        if (load == "large" || load == "mixed")
+            for (i = 0; i < (load == "large" ? large : 1); i++)
+                print "f" ++n, large_mb * 1048576
+    }'
+}
+
+# Imprime la suma de los tamaños de los archivos indicados
+total_bytes()
+{
+    stat -c %s "$@" | awk '{ total += $1 } END { print total + 0 }'
+}
+
+# Lee los contadores de E/S de este shell, que incluyen los de los procesos hijos ya terminados
+read_io()
+{
+    local key value
+    while read -r key value; do
+        case $key in
+        syscr:) IO_READS=$value ;;
+        syscw:) IO_WRITES=$value ;;
+        read_bytes:) IO_READ_BYTES=$value ;;
+        write_bytes:) IO_WRITE_BYTES=$value ;;
+        esac
+    done < /proc/$BASHPID/io
+}
+
+# Llamadas de lectura que hace el propio read_io (se restan de cada medición)
+read_io
+IO_BASE=$IO_READS
+read_io
+IO_OVERHEAD=$((IO_READS - IO_BASE))
+
+# Mide un comando REPEAT veces y escribe una fila con la ejecución más rápida
+# Uso: measure operación bytes archivos preparación comando...
+# bytes: Datos que procesa la operación (para calcular MB/s; 0 si no aplica)
+# preparación: Comando que se ejecuta sin medir antes de cada repetición
+measure()
+{
+    local op=$1 bytes=$2 files=$3 prepare=$4
+    shift 4
+    local run start end elapsed best=-1 reads writes read_bytes write_bytes
+    for ((run = 0; run < REPEAT; run++)); do
+        eval "$prepare" || exit 1
+        if [ "$DROP_CACHES" = 1 ]; then
+            sync
+            echo 3 > /proc/sys/vm/drop_caches
+        fi
+        read_io
+        reads=$IO_READS writes=$IO_WRITES read_bytes=$IO_READ_BYTES write_bytes=$IO_WRITE_BYTES
+        start=$EPOCHREALTIME
+        "$@" > /dev/null || { echo "Falló $op: $*" >&2; exit 1; }
+        end=$EPOCHREALTIME
+        read_io
+        elapsed=$((10#${end/./} - 10#${start/./}))
+        if [ "$best" -lt 0 ] || [ "$elapsed" -lt "$best" ]; then
+            best=$elapsed
+            BEST_READS=$((IO_READS - reads - IO_OVERHEAD))
+            BEST_WRITES=$((IO_WRITES - writes))
+            BEST_READ_BYTES=$((IO_READ_BYTES - read_bytes))
+            BEST_WRITE_BYTES=$((IO_WRITE_BYTES - write_bytes))
+        fi
+    done
+    awk -v label="$LABEL" -v load="$LOAD" -v content="$CONTENT" -v compress="$CODEC" -v op="$op" \
+        -v us="$best" -v bytes="$bytes" -v files="$files" -v archive="$(stat -c %s "$ARCHIVE")" \
+        -v r="$BEST_READS" -v w="$BEST_WRITES" -v rb="$BEST_READ_BYTES" -v wb="$BEST_WRITE_BYTES" 'BEGIN {
+        printf "%s\t%s\t%s\t%s\t%s\t%.6f\t%.1f\t%d\t%.0f\t%.0f\t%d\t%d\t%.0f\t%.0f\n", label, load, content,
+               compress, op, us / 1e6, bytes / 1048576 / (us > 0 ? us / 1e6 : 1e-6), files, bytes, archive,
+               r, w, rb, wb }'
+}
+
+# Elimina y agrega archivos CYCLES veces; cada ciclo reemplaza otra décima parte de los archivos
+# por archivos nuevos, así que los huecos quedan repartidos por todo el empaquetado
+fragment()
+{
+    local cycle doomed
+    for ((cycle = 1; cycle <= CYCLES; cycle++)); do
+        mapfile -t doomed < "$DATA/cycle$cycle.delete"
+        "$STAR" --delete -f "$ARCHIVE" "${doomed[@]}" || return 1
+        cd "$DATA/cycle$cycle" || return 1
+        "$STAR" -r $CODEC_OPTION $OPTIONS -f "$ARCHIVE" * || return 1
+    done
+    cd "$WORK" || return 1
+}
+
+printf "version\tcarga\tcontenido\tcompresion\toperacion\tsegundos\tmb_s\tarchivos\tbytes\tempaquetado"
+printf "\tllamadas_lectura\tllamadas_escritura\tbytes_leidos_disco\tbytes_escritos_disco\n"
+for LOAD in $LOADS; do
+    for CONTENT in $CONTENTS; do
+        # Datos de la carga: los archivos originales, una décima parte con contenido nuevo (para
+        # -u), otros tantos archivos nuevos (para -r) y los archivos de cada ciclo (enlaces a los
+        # originales con otro nombre)
+        DATA=$WORK/data
+        rm -rf "$DATA"
+        sizes "$LOAD" > "$WORK/sizes"
+        generate "$DATA/base" "$CONTENT" "$SEED-$LOAD" < "$WORK/sizes"
+        total=$(wc -l < "$WORK/sizes")
+        step=$((total >= 10 ? total / (total / 10) : total))
+        awk -v step="$step" 'NR % step == 0' "$WORK/sizes" > "$WORK/selected"
+        generate "$DATA/update" "$CONTENT" "$SEED-$LOAD-update" < "$WORK/selected"
+        sed 's/^f/e/' "$WORK/selected" | generate "$DATA/append" "$CONTENT" "$SEED-$LOAD-append"
+        for ((cycle = 1; cycle <= CYCLES; cycle++)); do
+            mkdir -p "$DATA/cycle$cycle"
+            : > "$DATA/cycle$cycle.delete"
+            for ((i = cycle % step + (cycle % step == 0 ? step : 0); i <= total; i += step)); do
+                ln "$DATA/base/f$i" "$DATA/cycle$cycle/c${cycle}_f$i"
+                previous=$((cycle - step))
+                if [ "$previous" -ge 1 ]; then
+                    echo "c${previous}_f$i" >> "$DATA/cycle$cycle.delete"
+                else
+                    echo "f$i" >> "$DATA/cycle$cycle.delete"
+                fi
+            done
+        done
+        names=($(awk '{ print $1 }' "$WORK/sizes"))
+        selected=($(awk '{ print $1 }' "$WORK/selected"))
+        base_bytes=$(cd "$DATA/base" && total_bytes "${names[@]}")
+        update_bytes=$(cd "$DATA/update" && total_bytes "${selected[@]}")
+        append_bytes=$(cd "$DATA/append" && total_bytes *)
+        cycle_bytes=$(find "$DATA" -path '*/cycle*/*' -type f -printf '%s\n' | awk '{ t += $1 } END { print t + 0 }')
+        cycle_files=$(find "$DATA" -path '*/cycle*/*' -type f | wc -l)
+
+        for CODEC in $COMPRESS; do
+            CODEC_OPTION=
+            [ "$CODEC" != none ] && CODEC_OPTION=--compress=$CODEC
+            mkdir -p "$WORK/out"
+
+            cd "$DATA/base" || exit 1
+            measure create "$base_bytes" "$total" 'rm -f "$ARCHIVE"' \
+                "$STAR" -c -j "$JOBS" $CODEC_OPTION $OPTIONS -f "$ARCHIVE" "${names[@]}"
+            cp "$ARCHIVE" "$WORK/base.star"
+            measure list 0 "$total" : "$STAR" -t -f "$ARCHIVE"
+            cd "$WORK/out" || exit 1
+            measure extract "$base_bytes" "$total" 'rm -rf "$WORK"/out/*' "$STAR" -x -j "$JOBS" -f "$ARCHIVE"
+
+            cd "$DATA/append" || exit 1
+            measure append "$append_bytes" "${#selected[@]}" 'cp "$WORK/base.star" "$ARCHIVE"' \
+                "$STAR" -r $CODEC_OPTION $OPTIONS -f "$ARCHIVE" *
+            cd "$DATA/update" || exit 1
+            measure update "$update_bytes" "${#selected[@]}" 'cp "$WORK/base.star" "$ARCHIVE"' \
+                "$STAR" -u $CODEC_OPTION $OPTIONS -f "$ARCHIVE" "${selected[@]}"
+            measure delete 0 "${#selected[@]}" 'cp "$WORK/base.star" "$ARCHIVE"' \
+                "$STAR" --delete -f "$ARCHIVE" "${selected[@]}"
+
+            # El mismo empaquetado después de los ciclos de eliminar y agregar, y luego empacado
+            cd "$WORK" || exit 1
+            measure fragment "$cycle_bytes" "$cycle_files" 'cp "$WORK/base.star" "$ARCHIVE"' fragment
+            cp "$ARCHIVE" "$WORK/fragmented.star"
+            measure list_fragmented 0 "$total" : "$STAR" -t -f "$ARCHIVE"
+            cd "$WORK/out" || exit 1
+            measure extract_fragmented "$base_bytes" "$total" 'rm -rf "$WORK"/out/*' \
+                "$STAR" -x -j "$JOBS" -f "$ARCHIVE"
+            measure pack 0 "$total" 'cp "$WORK/fragmented.star" "$ARCHIVE"' "$STAR" -p -j "$JOBS" -f "$ARCHIVE"
+            measure extract_packed "$base_bytes" "$total" 'rm -rf "$WORK"/out/*' \
+                "$STAR" -x -j "$JOBS" -f "$ARCHIVE"
+            rm -rf "$WORK"/out/* "$ARCHIVE" "$WORK/base.star" "$WORK/fragmented.star"
+        done
+    done
+done
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -8,10 +9,62 @@
 #include <errno.h>
 #include <getopt.h>
 #include <math.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <limits.h>
+#include <stdint.h>
+#include <time.h>
+#include <zlib.h>
+#include <setjmp.h>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+#ifdef STAR_WITH_LZ4
+#include <lz4.h>
+#endif
+#ifdef STAR_WITH_ZSTD
+#include <zstd.h>
+#endif
+#ifdef STAR_WITH_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+#include "star.h"
 
-#define BLOCK_SIZE 262144       // Tamaño del bloque: 256K
-#define MAX_FILES 250           // Máximo número de archivos en el archivo
+#define DEFAULT_BLOCK_SIZE 262144 // Tamaño de bloque por omisión y del formato v1: 256K
+#define MIN_BLOCK_SIZE 4096       // Tamaño de bloque mínimo para --block-size
+#define MAX_BLOCK_SIZE 4194304    // Tamaño de bloque máximo para --block-size
+#define LEGACY_MAX_FILES 250    // Entradas del directorio fijo del formato v1
 #define MAX_FILENAME_LENGTH 256 // Longitud máxima para nombres de archivo
+#define TASK_CHUNK_BYTES 4194304  // Bytes por tarea en las operaciones paralelas (4MB)
+#define WRITE_BATCH_BYTES 4194304 // Máximo de bytes contiguos por escritura en add_file_to_star (4MB)
+#define TASK_CHUNK_BLOCKS (TASK_CHUNK_BYTES / block_size)   // Bloques por tarea (al menos 1)
+#define WRITE_BATCH_BLOCKS (WRITE_BATCH_BYTES / block_size) // Bloques por escritura (al menos 1)
+#define DIR_PAGE_ENTRIES 512    // Entradas por página del directorio
+#define DIR_PAGE_SIZE 262144    // Bytes de una página del directorio (sin importar el tamaño de bloque)
+#define TAIL_PACK_LIMIT (block_size / 2) // Colas más largas ocupan un bloque propio
+#define ALLOC_MAX_EXTENTS 8     // Rangos en los que se puede repartir un archivo nuevo sin espacio contiguo
+#define DIR_BLOOM_WORDS 64      // Palabras de 64 bits del filtro de Bloom de cada página (8 bits por entrada)
+#define STAR_MAGIC "\177STR"    // Firma del encabezado versionado (no puede ser el inicio de un nombre v1)
+#define STAR_VERSION 2          // Versión del formato que escribe este programa
+#define COMPRESS_FRAME_SIZE 262144 // Bytes de cada tramo comprimido (sin importar el tamaño de bloque)
+#define COMPRESS_BATCH_FRAMES 64 // Tramos que se comprimen en paralelo por lote (16MB)
+#define FRAME_RAW 0x80000000u    // Marca de tramo guardado sin comprimir en la tabla de tramos
+#define PACK_BUFFER_BYTES 67108864 // Búfer de copia por omisión de -p (64MB)
+#define PACK_TAIL_UNIT 0x80000000u // Marca de bloque de colas en las claves de orden de --pack-incremental
+#define ENTRY_HASHED 0x1         // Marca de entrada con content_hash (--hash)
+#define CONTENT_HASH_SEED 0xcbf29ce484222325ull // Valor inicial del hash de contenido
+#define STREAM_MAGIC "\177STS"  // Firma del formato de flujo (-f -)
+#define STREAM_VERSION 1        // Versión del formato de flujo
+#define STREAM_BUFFER_BYTES 262144 // Bytes por lectura y escritura del flujo (256K, cabe en la caché)
+#define STREAM_PIPE_BYTES 1048576   // Capacidad que se pide para el pipe del flujo (1MB)
+#define URING_BUFFER_BYTES 16777216 // Búferes registrados de io_uring, repartidos entre las peticiones en curso (16MB)
+#define URING_MIN_CHUNK 1048576     // Bytes mínimos de cada petición de io_uring (1MB; más si el bloque es mayor)
+#define POOL_BUFFER_BYTES WRITE_BATCH_BYTES // Bytes de cada búfer del grupo de búferes alineados (una tanda o una tarea)
+#define PIPELINE_SLOTS 4            // Búferes del grupo que usa una lectura anticipada (16MB en vuelo)
+#define DIRECT_ALIGN 4096           // Alineación de los búferes, posiciones y longitudes de la E/S con O_DIRECT
 
 // Estructura para análisis de fragmentación
 typedef struct
@@ -26,29 +79,241 @@ typedef struct
     int *block_status;         // Array para estado de bloques (1=usado, 0=libre)
 } FragmentationInfo;
 
-// Estructura que representa una entrada de archivo en el archivador
+// Estructura que representa un rango de bloques contiguos de un archivo
+typedef struct
+{
+    int start_block; // Índice del primer bloque del rango
+    int length;      // Número de bloques contiguos
+} Extent;
+
+// Estructura que representa una entrada de archivo en el archivador. Los últimos tail_length
+// bytes de los datos guardados pueden ir empaquetados en un bloque compartido con otros archivos
 typedef struct
 {
     char filename[MAX_FILENAME_LENGTH]; // Nombre del archivo
     off_t size;                         // Tamaño del archivo en bytes
     int start_block;                    // Índice del primer bloque de datos del archivo
+    int extent_index;                   // Posición del primer extent del archivo en la tabla
+    int extent_count;                   // Número de extents del archivo
+    int codec;                          // Códec de compresión (CODEC_NONE si se guarda tal cual)
+    off_t stored_size;                  // Bytes que ocupa el archivo dentro del archivador
+    int tail_block;                     // Bloque compartido con la cola del archivo (0 si no tiene)
+    int tail_offset;                    // Posición de la cola dentro del bloque compartido
+    int tail_length;                    // Bytes de la cola
+    int64_t mtime;                      // Fecha de modificación del archivo (segundos)
+    int mtime_nsec;                     // Nanosegundos de la fecha de modificación
+    unsigned int mode;                  // Tipo y permisos del archivo (st_mode)
+    unsigned int flags;                 // ENTRY_HASHED si content_hash es válido
+    uint64_t content_hash;              // Hash de 64 bits del contenido del archivo
 } FileEntry;
 
-// Estructura que representa un bloque de datos en el archivador
+// Bloque de datos del formato v1: el primer entero de cada bloque apunta al siguiente. En el
+// formato actual los bloques solo contienen datos
 typedef struct
 {
     int next_block;                               // Índice del siguiente bloque de datos (-1 si es el último)
-    unsigned char data[BLOCK_SIZE - sizeof(int)]; // Datos del bloque
+    unsigned char data[DEFAULT_BLOCK_SIZE - sizeof(int)]; // Datos del bloque (v1 siempre usa bloques de 256K)
 } DataBlock;
 
-// Estructura de encabezado para el archivador
+// Superbloque del archivador (bloque 0). El directorio se guarda en páginas de DIR_PAGE_SIZE bytes
+// descritas por la tabla de páginas; como las demás tablas y el mapa de bloques libres, va en
+// bloques contiguos
+typedef struct
+{
+    char magic[4];             // Firma STAR_MAGIC
+    int version;               // Versión del formato
+    int free_block_list;       // Sin uso (siempre -1)
+    int dir_table_block;       // Primer bloque de la tabla de páginas del directorio (0 si no hay)
+    int dir_table_blocks;      // Bloques contiguos que ocupa la tabla
+    int dir_page_count;        // Páginas del directorio
+    int dedup_table_block;     // Primer bloque de la tabla de deduplicación (0 si no hay)
+    int dedup_table_blocks;    // Bloques contiguos que ocupa la tabla
+    int dedup_entry_count;     // Entradas guardadas en la tabla
+    int checksum_table_block;  // Primer bloque de la tabla de sumas de verificación (0 si no hay)
+    int checksum_table_blocks; // Bloques contiguos que ocupa la tabla
+    int checksum_count;        // Bloques cubiertos por la tabla
+    int block_size;            // Tamaño de bloque en bytes
+    int tail_table_block;      // Primer bloque de la tabla de bloques de colas (0 si no hay)
+    int tail_table_blocks;     // Bloques contiguos que ocupa la tabla
+    int tail_entry_count;      // Entradas guardadas en la tabla
+    int free_map_block;        // Primer bloque del mapa de bloques libres (0 si no hay)
+    int free_map_blocks;       // Bloques contiguos que ocupa el mapa
+    int free_map_count;        // Bloques que cubre el mapa
+} StarSuperblock;
+
+// Página del directorio en disco: ocupa DIR_PAGE_SIZE bytes, con las entradas seguidas de sus extents
+// (el extent_index de cada entrada es relativo a la página)
+typedef struct
+{
+    int entry_count;                     // Entradas guardadas en la página
+    int extent_count;                    // Extents guardados después de las entradas
+    FileEntry entries[DIR_PAGE_ENTRIES]; // Entradas de archivo
+} DirPageHeader;
+
+// Extents que caben en una página del directorio después de las entradas
+#define DIR_PAGE_EXTENTS ((int)((DIR_PAGE_SIZE - sizeof(DirPageHeader)) / sizeof(Extent)))
+
+// Bloques contiguos que ocupa una página del directorio (uno si el bloque es mayor que la página)
+#define DIR_PAGE_BLOCKS (block_size < DIR_PAGE_SIZE ? DIR_PAGE_SIZE / block_size : 1)
+
+// Descripción de una página en la tabla de páginas; el filtro de Bloom permite buscar un nombre
+// sin leer las páginas que no lo contienen
+typedef struct
+{
+    int block;                       // Primer bloque de la página (0 si aún no se ha escrito)
+    int entry_count;                 // Entradas guardadas en la página
+    uint64_t bloom[DIR_BLOOM_WORDS]; // Filtro de Bloom de los nombres de la página
+} DirPageInfo;
+
+// Estado en memoria de una página del directorio
+typedef struct
+{
+    DirPageInfo info; // Descripción que se guarda en la tabla de páginas
+    int loaded;       // 1 si sus entradas ya están en header->files
+    int dirty;        // 1 si hay que reescribir la página
+    int extent_used;  // Extents de las entradas vivas de la página
+} DirPage;
+
+// Índice en memoria de los nombres cargados del directorio, por hash del nombre. Las entradas
+// eliminadas quedan con el nombre vacío hasta que se reescribe su página
+typedef struct
+{
+    int *buckets;      // Primera entrada de cada cubeta (-1 si vacía)
+    int *next;         // Siguiente entrada de la misma cubeta, por posición en header->files
+    int bucket_count;  // Número de cubetas (potencia de 2)
+    int capacity;      // Entradas que caben en next
+} FileIndex;
+
+// Encabezado del archivador en memoria. La página p del directorio ocupa las posiciones
+// [p * DIR_PAGE_ENTRIES, p * DIR_PAGE_ENTRIES + entry_count) de files; las posiciones de páginas
+// no cargadas, las eliminadas y las que sobran al final de una página tienen el nombre vacío
 typedef struct
 {
-    FileEntry files[MAX_FILES]; // Array de entradas de archivo
-    int file_count;             // Número de archivos en el archivador
-    int free_block_list;        // Cabeza de la lista de bloques libres (-1 si no hay)
+    char magic[4];             // Firma STAR_MAGIC
+    int version;               // Versión del formato (1 si se leyó un archivador v1)
+    int fd;                    // Archivador del que se cargan las páginas del directorio
+    FileEntry *files;          // Entradas de archivo por posición
+    int file_count;            // Una más que la última posición usada
+    int file_capacity;         // Capacidad del array de entradas
+    uint64_t *free_map;        // Mapa de bloques libres: un bit por bloque, 1 si está libre
+    int free_map_count;        // Bloques que cubre el mapa (los siguientes están en uso)
+    int free_map_capacity;     // Capacidad del mapa en bloques (múltiplo de 64)
+    int free_map_dirty;        // 1 si el mapa cambió
+    int free_map_block;        // Primer bloque del mapa guardado (0 si no hay)
+    int free_map_blocks;       // Bloques contiguos que ocupa el mapa guardado
+    Extent *extents;           // Extents de las páginas cargadas (extent_index apunta aquí)
+    int extent_count;          // Extents usados en el array
+    int extent_capacity;       // Capacidad del array de extents
+    DirPage *pages;            // Páginas del directorio
+    int page_count;            // Número de páginas
+    int page_capacity;         // Capacidad del array de páginas
+    int dir_dirty;             // 1 si la tabla de páginas cambió
+    FileIndex index;           // Índice de nombres de las entradas cargadas
+    int dir_table_block;       // Primer bloque de la tabla de páginas (0 si no hay)
+    int dir_table_blocks;      // Bloques contiguos que ocupa la tabla
+    int dedup_table_block;     // Primer bloque de la tabla de deduplicación (0 si no hay)
+    int dedup_table_blocks;    // Bloques contiguos que ocupa la tabla
+    int dedup_entry_count;     // Entradas guardadas en la tabla
+    int checksum_table_block;  // Primer bloque de la tabla de sumas de verificación (0 si no hay)
+    int checksum_table_blocks; // Bloques contiguos que ocupa la tabla
+    int checksum_count;        // Bloques cubiertos por la tabla
+    int tail_table_block;      // Primer bloque de la tabla de bloques de colas (0 si no hay)
+    int tail_table_blocks;     // Bloques contiguos que ocupa la tabla
+    int tail_entry_count;      // Entradas guardadas en la tabla
 } StarHeader;
 
+// Entrada de archivo del formato v1, sin firma ni extents
+typedef struct
+{
+    char filename[MAX_FILENAME_LENGTH]; // Nombre del archivo
+    off_t size;                         // Tamaño del archivo en bytes
+    int start_block;                    // Índice del primer bloque de datos del archivo
+} FileEntryV1;
+
+// Encabezado del formato v1
+typedef struct
+{
+    FileEntryV1 files[LEGACY_MAX_FILES]; // Array de entradas de archivo
+    int file_count;               // Número de archivos en el archivador
+    int free_block_list;          // Cabeza de la lista de bloques libres (-1 si no hay)
+} StarHeaderV1;
+
+// Entrada de la tabla de deduplicación: un bloque de datos identificado por el hash de su contenido
+typedef struct
+{
+    uint64_t hash; // Hash del contenido del bloque
+    int block;     // Índice del bloque en el archivador
+    int refcount;  // Referencias desde archivos (el bloque se libera al llegar a 0)
+} DedupEntry;
+
+// Tabla de deduplicación en memoria con dos índices encadenados: por hash y por bloque.
+// Las entradas que llegan a 0 referencias quedan en las cadenas y se descartan al guardar
+typedef struct
+{
+    DedupEntry *entries; // Entradas de la tabla
+    int count;           // Entradas usadas
+    int capacity;        // Capacidad del array de entradas
+    int *hash_buckets;   // Primera entrada de cada cubeta por hash (-1 si vacía)
+    int *hash_next;      // Siguiente entrada con la misma cubeta por hash
+    int *block_buckets;  // Primera entrada de cada cubeta por bloque (-1 si vacía)
+    int *block_next;     // Siguiente entrada con la misma cubeta por bloque
+    int bucket_count;    // Número de cubetas de cada índice
+    int dirty;           // 1 si hay cambios sin guardar
+} DedupTable;
+
+// Suma de verificación de un bloque de datos
+typedef struct
+{
+    uint32_t crc;    // CRC32C del contenido del bloque
+    uint32_t length; // Bytes cubiertos por el CRC (0 si el bloque no tiene suma de verificación)
+} BlockChecksum;
+
+// Tabla de sumas de verificación en memoria, indexada por número de bloque
+typedef struct
+{
+    BlockChecksum *entries;  // Suma de cada bloque
+    unsigned char *verified; // 1 si el bloque ya se comprobó en esta ejecución (no se guarda)
+    int count;               // Bloques cubiertos
+    int capacity;            // Capacidad de los arrays
+    int dirty;               // 1 si hay cambios sin guardar
+} ChecksumTable;
+
+// Bloque compartido con las colas de varios archivos
+typedef struct
+{
+    int block;    // Índice del bloque en el archivador
+    int used;     // Bytes ocupados desde el inicio del bloque (las colas nuevas van después)
+    int refcount; // Colas que apuntan al bloque (se libera al llegar a 0)
+} TailEntry;
+
+// Tabla de bloques de colas en memoria, con un índice por bloque. Como en la tabla de
+// deduplicación, las entradas que llegan a 0 referencias se descartan al guardar
+typedef struct
+{
+    TailEntry *entries;       // Entradas de la tabla
+    int count;                // Entradas usadas
+    int capacity;             // Capacidad del array de entradas
+    int *buckets;             // Primera entrada de cada cubeta (-1 si vacía)
+    int *next;                // Siguiente entrada de la misma cubeta
+    int bucket_count;         // Número de cubetas
+    int dirty;                // 1 si hay cambios sin guardar
+    int open_index;           // Entrada cuyo contenido está en open_data (-1 si ninguna)
+    unsigned char *open_data; // Contenido de ese bloque, para calcular su suma de verificación
+    int open_dirty;           // 1 si la suma de ese bloque no se ha recalculado
+} TailTable;
+
+// Rango contiguo de bytes de un archivo dentro del archivador
+typedef struct
+{
+    off_t archive_offset; // Posición de los datos en el archivador
+    off_t file_offset;    // Posición de los datos en el archivo
+    size_t length;        // Número de bytes
+} Segment;
+
+// Bloques ocupados por el encabezado: el superbloque, o el encabezado fijo de los formatos
+// anteriores, que cabe en un bloque de 256K; los bloques de datos empiezan después
+#define HEADER_BLOCKS 1
+
 // Estructura para mapear índices de bloques antiguos a nuevos durante la desfragmentación
 typedef struct
 {
@@ -56,9 +321,448 @@ typedef struct
     int new_block; // Índice de bloque nuevo después de la desfragmentación
 } BlockMapping;
 
+// Rango de bloques con datos que -p coloca de una vez (un extent, o varios que se solapan)
+typedef struct
+{
+    int start;   // Primer bloque en el archivador original
+    int length;  // Número de bloques
+    int current; // Primer bloque en la posición actual (cambia si se aparta)
+    int target;  // Primer bloque en el archivador compactado (-1 si aún no se ha colocado)
+} PackRun;
+
+// Códecs de compresión; el valor se guarda en FileEntry.codec
+enum
+{
+    CODEC_NONE = 0,
+    CODEC_ZLIB = 1,
+    CODEC_LZ4 = 2,
+    CODEC_ZSTD = 3,
+    CODEC_COUNT
+};
+
+// Operaciones de un códec. Un archivo comprimido se guarda como una tabla con la longitud de
+// cada tramo de COMPRESS_FRAME_SIZE bytes seguida de los tramos comprimidos de forma independiente
+typedef struct
+{
+    const char *name;                    // Nombre para --compress
+    size_t (*bound)(size_t length);      // Tamaño máximo de la salida comprimida (NULL si no está disponible)
+    size_t (*compress)(const unsigned char *src, size_t length, unsigned char *dst, size_t capacity);
+    int (*decompress)(const unsigned char *src, size_t length, unsigned char *dst, size_t original_length);
+} Codec;
+
+// Motores de extracción de datos, del más eficiente al más sencillo
+typedef enum
+{
+    EXTRACT_DIRECT,     // O_DIRECT: el archivador se lee sin caché, con un hilo que lee por adelantado
+    EXTRACT_IO_URING,   // io_uring: varias lecturas y escrituras en curso con búferes registrados
+    EXTRACT_COPY_RANGE, // copy_file_range: los datos no pasan por espacio de usuario
+    EXTRACT_PIPELINE,   // pread + pwrite por tramos de un búfer del grupo, verificados en el mismo búfer
+    EXTRACT_MMAP,       // archivador mapeado en memoria + write (una sola copia)
+    EXTRACT_READ_WRITE  // read + write por bloque (dos copias)
+} ExtractEngine;
+
+// Tarea de las operaciones paralelas: un tramo contiguo de un archivo dentro del archivador
+typedef struct
+{
+    int file_index;       // Índice del archivo en el encabezado
+    off_t archive_offset; // Posición del tramo en el archivador
+    off_t file_offset;    // Posición del tramo dentro del archivo
+    size_t length;        // Bytes del tramo
+} BlockTask;
+
+// Cola de tareas de un trabajador; el dueño toma del frente y los demás roban del final
+typedef struct
+{
+    BlockTask *tasks;
+    int head;
+    int tail;
+    int capacity;
+    pthread_mutex_t lock;
+} TaskQueue;
+
+// Función que procesa una tarea; recibe el contexto de la operación y el número de trabajador
+typedef void (*BlockTaskFn)(void *ctx, BlockTask *task, int worker_id);
+
+// Función que recibe cada tramo leído por uring_copy antes de escribirlo, con su posición de destino
+typedef void (*UringChunkFn)(off_t offset, unsigned char *data, size_t length);
+
+// Grupo fijo de búferes alineados de POOL_BUFFER_BYTES para las copias de datos: uno por hilo de
+// trabajo (al menos los de una lectura anticipada), reservados la primera vez que se piden y
+// reutilizados por todas las operaciones
+typedef struct
+{
+    unsigned char *memory;     // Memoria de todos los búferes (alineada a DIRECT_ALIGN)
+    unsigned char **free_list; // Búferes disponibles
+    int count;                 // Búferes del grupo (0 si aún no se reservaron)
+    int available;             // Búferes en free_list
+    pthread_mutex_t lock;      // Protege free_list y available
+    pthread_cond_t ready;      // Se avisa al devolver un búfer
+} BufferPool;
+
+// Tramo de una lectura anticipada
+typedef struct
+{
+    off_t offset;  // Posición de lectura en el origen
+    size_t length; // Bytes a leer (a lo sumo POOL_BUFFER_BYTES)
+    size_t skip;   // Bytes del principio del búfer que no se usan (los usa quien consume el tramo)
+    size_t used;   // Bytes que se usan después de skip
+    off_t target;  // Posición de destino de los datos
+} PipelineChunk;
+
+// Lectura anticipada de los tramos de un origen (ver pipeline_start)
+typedef struct
+{
+    int fd;                               // Descriptor de origen
+    int archive;                          // 1 si el origen es el archivador
+    PipelineChunk *chunks;                // Tramos a leer, en orden
+    int chunk_count;                      // Número de tramos
+    unsigned char *slots[PIPELINE_SLOTS]; // Anillo de búferes: el tramo i va en slots[i % slot_count]
+    ssize_t results[PIPELINE_SLOTS];      // Bytes leídos en cada búfer (-1 si falló la lectura)
+    int errors[PIPELINE_SLOTS];           // errno de la lectura fallida
+    int slot_count;                       // Búferes del anillo
+    int produced;                         // Tramos ya leídos
+    int consumed;                         // Tramos ya usados (sus búferes están libres)
+    int stop;                             // 1 para que el hilo de lectura termine
+    int threaded;                         // 1 si hay un hilo de lectura
+    pthread_t thread;                     // Hilo de lectura
+    pthread_mutex_t lock;                 // Protege produced, consumed, stop y los resultados
+    pthread_cond_t changed;               // Se avisa al leer o liberar un tramo
+} Pipeline;
+
+// Contadores de E/S y tiempos de la operación en curso (--stats=json). Los actualizan todos los
+// hilos de forma atómica con stats_add
+typedef struct
+{
+    long long bytes_read;          // Bytes leídos con read y pread (archivador y archivos)
+    long long bytes_written;       // Bytes escritos con write y pwrite
+    long long bytes_copied;        // Bytes copiados dentro del kernel con copy_file_range
+    long long bytes_mapped;        // Bytes leídos del archivador mapeado en memoria (sin llamadas)
+    long long read_calls;          // Llamadas a read y pread
+    long long write_calls;         // Llamadas a write y pwrite
+    long long lseek_calls;         // Llamadas a lseek
+    long long copy_calls;          // Llamadas a copy_file_range
+    long long uring_calls;         // Llamadas a io_uring_enter (sus bytes cuentan como leídos o escritos)
+    long long blocks_reused;       // Bloques reservados del mapa de bloques libres
+    long long blocks_appended;     // Bloques reservados al final del archivador
+    long long chain_reads;         // Bloques leídos al seguir las cadenas de los archivos v1
+    long long header_writes;       // Encabezados escritos (write_header)
+    double header_load_seconds;    // Tiempo en read_header
+    double header_flush_seconds;   // Tiempo en write_header
+    double wall_seconds;           // Tiempo de toda la operación
+} IoStats;
+
+#ifdef STAR_WITH_IO_URING
+// Anillo de io_uring con sus búferes registrados. Lo usa solo el hilo que lo creó; con -j las
+// operaciones paralelas ya mantienen varias peticiones en curso
+typedef struct
+{
+    int state;                 // 0 sin preparar, 1 disponible, -1 no disponible
+    pthread_t owner;           // Hilo que lo creó
+    int ring_fd;               // Descriptor del anillo
+    unsigned int *sq_tail;     // Cola de envío
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    struct io_uring_sqe *sqes; // Peticiones
+    unsigned int *cq_head;     // Cola de terminación
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned char *buffers;    // Búferes registrados, uno por petición en curso
+    size_t chunk;              // Bytes de cada búfer
+    int depth;                 // Número de búferes
+    unsigned int pending;      // Peticiones en la cola de envío aún no enviadas
+} IoUring;
+#endif
+
+// Argumento de cada hilo del grupo de trabajadores
+typedef struct
+{
+    TaskQueue *queues; // Una cola por trabajador
+    int worker_count;  // Número de trabajadores
+    BlockTaskFn fn;    // Función que procesa cada tarea
+    void *ctx;         // Contexto de la operación
+    int id;            // Número de este trabajador
+} PoolWorker;
+
+// Estado compartido por los trabajadores de la extracción paralela
+typedef struct
+{
+    int fd;                  // Descriptor del archivador
+    unsigned char *map;      // Archivador mapeado en memoria (NULL si no está disponible)
+    off_t map_size;          // Tamaño del mapeo
+    StarHeader *header;      // Encabezado del archivador
+    Segment **segments;      // Rangos de datos de cada archivo
+    int *pending_tasks;      // Tareas pendientes por archivo (la última descarta su caché)
+    ExtractEngine *engines;  // Motor de copia de cada trabajador
+} ParallelExtract;
+
+// Estado compartido por los trabajadores que comprimen un lote de tramos
+typedef struct
+{
+    int input_fd;            // Descriptor del archivo de entrada
+    const Codec *codec;      // Códec a usar
+    off_t batch_offset;      // Posición en el archivo del primer tramo del lote
+    unsigned char **input;   // Datos originales de cada tramo
+    unsigned char **output;  // Datos comprimidos de cada tramo
+    size_t *input_lengths;   // Bytes originales de cada tramo
+    size_t *output_lengths;  // Bytes comprimidos de cada tramo (0 si se guarda sin comprimir)
+} CompressBatch;
+
+// Estado compartido por los trabajadores que descomprimen un archivo
+typedef struct
+{
+    int fd;                // Descriptor del archivador
+    StarHeader *header;    // Encabezado del archivador
+    FileEntry *entry;      // Archivo a descomprimir
+    const Codec *codec;    // Códec del archivo
+    uint32_t *frame_table; // Longitud guardada de cada tramo (con la marca FRAME_RAW)
+    int file_fd;           // Descriptor del archivo de salida
+} DecompressFile;
+
+// Escritor secuencial de los datos guardados de un archivo: reserva bloques a medida que se llenan
+typedef struct
+{
+    int fd;                // Descriptor del archivador
+    StarHeader *header;    // Encabezado del archivador
+    unsigned char *buffer; // Datos pendientes de escribir (hasta WRITE_BATCH_BLOCKS bloques)
+    size_t used;           // Bytes pendientes en el buffer
+    int *blocks;           // Bloques reservados hasta ahora
+    int block_count;       // Número de bloques reservados
+    int block_capacity;    // Capacidad del array de bloques
+} StoredWriter;
+
+// Estado compartido por los trabajadores de --verify
+typedef struct
+{
+    int fd;                // Descriptor del archivador
+    unsigned char *map;    // Archivador mapeado en memoria (NULL si no está disponible)
+    off_t map_size;        // Tamaño del mapeo
+    StarHeader *header;    // Encabezado del archivador
+    int bad_blocks;        // Bloques cuyo CRC no coincide
+    int unchecked_blocks;  // Bloques sin suma de verificación
+} VerifyArchive;
+
+// Estado compartido por los trabajadores de la creación paralela
+typedef struct
+{
+    int fd;             // Descriptor del archivador
+    StarHeader *header; // Encabezado con los rangos de bloques ya reservados
+    int *input_fds;     // Descriptor de entrada de cada archivo
+} ParallelCreate;
+
+// Encabezado del formato de flujo. Un flujo se escribe y se lee en una sola pasada: cada archivo es
+// una StreamEntry seguida de sus datos y del CRC32C de los datos; una entrada con el nombre vacío
+// marca el fin de los datos y va seguida del directorio (las mismas entradas, con el CRC) y del pie
+typedef struct
+{
+    char magic[4]; // STREAM_MAGIC
+    int version;   // STREAM_VERSION
+} StreamHeader;
+
+// Entrada de un archivo del flujo; en la marca de fin, size es el número de entradas del directorio
+typedef struct
+{
+    char filename[MAX_FILENAME_LENGTH]; // Nombre del archivo (vacío en la marca de fin)
+    int64_t size;                       // Tamaño del archivo en bytes
+    int64_t data_offset;                // Posición de los datos en el flujo
+    int64_t mtime;                      // Fecha de modificación del archivo (segundos)
+    int mtime_nsec;                     // Nanosegundos de la fecha de modificación
+    unsigned int mode;                  // Tipo y permisos del archivo (st_mode)
+    uint32_t crc;                       // CRC32C de los datos (solo en el directorio)
+    int reserved;                       // Sin uso (0)
+} StreamEntry;
+
+// Pie del flujo: permite listar un flujo guardado en disco leyendo solo el directorio
+typedef struct
+{
+    int64_t directory_offset; // Posición del directorio en el flujo
+    int64_t file_count;       // Entradas del directorio
+    char magic[4];            // STREAM_MAGIC
+    int version;              // STREAM_VERSION
+} StreamFooter;
+
+// Recurso temporal de una llamada de la biblioteca: si la llamada falla a medias, fail_operation lo
+// libera antes de volver (ver library_track)
+typedef struct
+{
+    void (*release)(void *); // Función que lo libera (free, library_close, library_destroy_queues)
+    void *resource;          // Memoria, cola de tareas o descriptor (convertido con intptr_t)
+} LibraryResource;
+
+// Empaquetado abierto con la biblioteca (star.h). Entre llamadas guarda el tamaño de bloque y las
+// tablas que el resto del programa usa como variables globales; library_enter las intercambia
+struct StarArchive
+{
+    int fd;                       // Descriptor del empaquetado
+    int writable;                 // 1 si se abrió para escritura
+    int dirty;                    // 1 si hay cambios sin guardar
+    int broken;                   // 1 si una modificación falló a medias
+    StarHeader header;            // Encabezado, con las páginas del directorio ya cargadas
+    int block_size;               // Tamaño de bloque del empaquetado
+    DedupTable dedup_table;       // Tabla de deduplicación del empaquetado
+    ChecksumTable checksum_table; // Sumas de verificación del empaquetado
+    TailTable tail_table;         // Bloques de colas del empaquetado
+    Segment *segments;            // Rangos del último archivo leído con star_read
+    int segment_count;            // Número de rangos
+    int segment_index;            // Posición de ese archivo en el directorio (-1 si no hay)
+};
+
 // Variable global para el nivel de verbosidad
 int verbose_level = 0;
 
+// Número de hilos de trabajo (-j)
+int job_count = 1;
+
+// Códec con el que se guardan los archivos agregados (--compress)
+int compress_codec = CODEC_NONE;
+
+// Deduplicar los bloques de los archivos agregados (--dedup)
+int dedup_enabled = 0;
+
+// Tamaño de bloque del archivador abierto (lo fija read_header; al crear, --block-size)
+int block_size = DEFAULT_BLOCK_SIZE;
+
+// Bytes del búfer con el que -p mueve los bloques (--pack-buffer)
+long long pack_buffer_size = PACK_BUFFER_BYTES;
+
+// -p compacta en el mismo archivo en lugar de escribir un archivo temporal (--in-place)
+int pack_in_place_enabled = 0;
+
+// Guardar el hash del contenido de los archivos agregados y usarlo para detectar cambios (--hash)
+int hash_enabled = 0;
+
+// Presupuesto de --pack-incremental: milisegundos o bytes a mover (0 si no hay límite)
+long long pack_budget_ms = 0;
+long long pack_budget_bytes = 0;
+
+// Rango que escribe --cat: primer byte y número de bytes (-1 para llegar al final del archivo)
+long long cat_offset = 0;
+long long cat_length = -1;
+
+// Tabla de deduplicación del archivador abierto (la cargan read_header y la guarda write_header)
+DedupTable dedup_table;
+
+// Sumas de verificación de los bloques del archivador abierto (igual que dedup_table)
+ChecksumTable checksum_table;
+
+// Bloques de colas del archivador abierto (igual que dedup_table)
+TailTable tail_table;
+
+// Bloques dañados encontrados al extraer (los hilos lo actualizan de forma atómica)
+int corrupt_block_count = 0;
+
+// Usar io_uring para las copias grandes de -c, -r, -x y -p (--io-uring)
+int uring_enabled = 0;
+
+// Leer y escribir los datos del archivador con O_DIRECT y sacar de la caché de páginas lo que se lee
+// y escribe de los demás archivos (--direct)
+int direct_io = 0;
+
+// Segundo descriptor del archivador abierto, con O_DIRECT (-1 si no hay); lo abre direct_open
+int direct_fd = -1;
+
+// Contar las llamadas de E/S y escribir un resumen en JSON al terminar (--stats=json)
+int stats_enabled = 0;
+IoStats io_stats;
+
+// Búferes de las copias de datos (ver BufferPool)
+BufferPool buffer_pool = {NULL, NULL, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+// Función de la biblioteca en curso: si no es NULL, fail_operation vuelve a ella en lugar de
+// terminar el programa (solo desde el hilo que la llamó)
+jmp_buf *library_jump = NULL;
+pthread_t library_thread;
+
+// Recursos temporales de la llamada de la biblioteca en curso, en el orden en que se tomaron
+LibraryResource *library_resources = NULL;
+int library_resource_count = 0;
+int library_resource_capacity = 0;
+
+// Serializa todas las llamadas a la biblioteca del proceso (aun con empaquetados distintos), que
+// comparten el estado global
+pthread_mutex_t library_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#ifdef STAR_WITH_IO_URING
+// Anillo de io_uring (lo prepara uring_ready la primera vez que se usa)
+IoUring uring;
+#endif
+
+// Tablas del CRC32C por software (slicing-by-8) y uso de la instrucción de SSE4.2; las prepara crc32c_init
+uint32_t crc32c_table[8][256];
+int crc32c_use_hw = 0;
+pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+size_t zlib_bound(size_t length)
+{
+    return compressBound(length);
+}
+
+size_t zlib_compress(const unsigned char *src, size_t length, unsigned char *dst, size_t capacity)
+{
+    uLongf dst_length = capacity;
+    return compress2(dst, &dst_length, src, length, Z_BEST_SPEED) == Z_OK ? dst_length : 0;
+}
+
+int zlib_decompress(const unsigned char *src, size_t length, unsigned char *dst, size_t original_length)
+{
+    uLongf dst_length = original_length;
+    return uncompress(dst, &dst_length, src, length) == Z_OK && dst_length == original_length ? 0 : -1;
+}
+
+#ifdef STAR_WITH_LZ4
+size_t lz4_bound(size_t length)
+{
+    return LZ4_compressBound((int)length);
+}
+
+size_t lz4_compress(const unsigned char *src, size_t length, unsigned char *dst, size_t capacity)
+{
+    int n = LZ4_compress_default((const char *)src, (char *)dst, (int)length, (int)capacity);
+    return n > 0 ? (size_t)n : 0;
+}
+
+int lz4_decompress(const unsigned char *src, size_t length, unsigned char *dst, size_t original_length)
+{
+    int n = LZ4_decompress_safe((const char *)src, (char *)dst, (int)length, (int)original_length);
+    return n == (int)original_length ? 0 : -1;
+}
+#endif
+
+#ifdef STAR_WITH_ZSTD
+size_t zstd_bound(size_t length)
+{
+    return ZSTD_compressBound(length);
+}
+
+size_t zstd_compress(const unsigned char *src, size_t length, unsigned char *dst, size_t capacity)
+{
+    size_t n = ZSTD_compress(dst, capacity, src, length, 1);
+    return ZSTD_isError(n) ? 0 : n;
+}
+
+int zstd_decompress(const unsigned char *src, size_t length, unsigned char *dst, size_t original_length)
+{
+    size_t n = ZSTD_decompress(dst, original_length, src, length);
+    return !ZSTD_isError(n) && n == original_length ? 0 : -1;
+}
+#endif
+
+// Tabla de códecs indexada por su identificador; los que no se compilaron no tienen funciones
+const Codec codecs[CODEC_COUNT] = {
+    {"none", NULL, NULL, NULL},
+    {"zlib", zlib_bound, zlib_compress, zlib_decompress},
+#ifdef STAR_WITH_LZ4
+    {"lz4", lz4_bound, lz4_compress, lz4_decompress},
+#else
+    {"lz4", NULL, NULL, NULL},
+#endif
+#ifdef STAR_WITH_ZSTD
+    {"zstd", zstd_bound, zstd_compress, zstd_decompress},
+#else
+    {"zstd", NULL, NULL, NULL},
+#endif
+};
+
 // Prototipos de funciones
 void create_star(char *star_filename, int argc, char *argv[]);
 void extract_star(char *star_filename);
@@ -66,16 +770,218 @@ void list_star(char *star_filename);
 void delete_star(char *star_filename, int argc, char *argv[]);
 void append_star(char *star_filename, int argc, char *argv[]);
 void update_star(char *star_filename, int argc, char *argv[]);
+long long update_file_delta(int fd, StarHeader *header, int index, char *filename);
 void pack_star(char *star_filename);
+void pack_convert_v1(int *fd, char *star_filename, StarHeader *header);
+int pack_create_temp(int fd, char *star_filename, char *tmp_filename, size_t size);
+void pack_replace(int *fd, int new_fd, char *star_filename, char *tmp_filename);
+void pack_compact(int fd, int out_fd, StarHeader *header);
+void pack_incremental(char *star_filename);
+int pack_budget_allows(struct timespec *start, long long moved_bytes, long long bytes);
+int pack_file_shared(StarHeader *header, FileEntry *entry);
+void pack_defer_free(Extent **pending, int *count, int *capacity, int start_block, int length);
+void pack_commit(int fd, StarHeader *header, Extent **pending, int *count);
+void pack_write_header(int fd, StarHeader *header);
+void pack_relocate_file(int fd, StarHeader *header, int index, int target, unsigned char *buffer, int buffer_blocks,
+                        Extent **pending, int *pending_count, int *pending_capacity);
+void pack_relocate_tail(int fd, StarHeader *header, int tail_index, int target, unsigned char *buffer,
+                        Extent **pending, int *pending_count, int *pending_capacity);
+int free_map_find_hole(StarHeader *header, int count, int limit);
+int free_map_hole_before(StarHeader *header, int block);
+int pack_relocate_metadata(StarHeader *header);
+int pack_partial_slide(StarHeader *header, FileEntry *entry);
+int pack_slide_file(int fd, StarHeader *header, int index, unsigned char *buffer, int buffer_blocks,
+                    struct timespec *start, long long *moved_bytes);
+void parse_budget(const char *text);
+PackRun *pack_collect_runs(StarHeader *header, int *count);
+int pack_find_run(PackRun *runs, int count, int block);
+void pack_move(int fd, int out_fd, unsigned char *buffer, int buffer_blocks, int from, int to, int length);
+int pack_evict(int fd, unsigned char *buffer, int buffer_blocks, PackRun *runs, int run_count, int first,
+               int skip, int block, int length, int spill_block);
+int compare_pack_keys(const void *a, const void *b);
+int compare_pack_runs(const void *a, const void *b);
+void verify_star(char *star_filename);
 void verbose_print(const char *message, int level);
 int find_file_entry(StarHeader *header, char *filename);
+int file_index_find(StarHeader *header, const char *filename);
+uint64_t hash_filename(const char *filename);
+void file_index_rebuild(StarHeader *header);
+int file_index_add(StarHeader *header, int index);
+void file_index_remove(StarHeader *header, int index);
+void dir_bloom_bits(const char *filename, int bits[4]);
+void dir_bloom_add(DirPageInfo *info, const char *filename);
+int dir_bloom_test(DirPageInfo *info, const char *filename);
+void dir_reserve_files(StarHeader *header, int count);
+void extent_reserve(StarHeader *header, int count);
+int dir_new_page(StarHeader *header);
+int dir_add_entry(StarHeader *header, FileEntry *entry);
+void dir_load_page(StarHeader *header, int p);
+void load_directory(StarHeader *header);
+void dir_write_pages(int fd, StarHeader *header);
+void dir_load_table(int fd, StarHeader *header, int page_count);
+void dir_save_table(int fd, StarHeader *header);
+void free_header(StarHeader *header);
 void read_header(int fd, StarHeader *header);
 void write_header(int fd, StarHeader *header);
 void add_file_to_star(int fd, StarHeader *header, char *filename);
-void remove_file_from_star(int fd, StarHeader *header, char *filename);
+void remove_file_from_star(StarHeader *header, char *filename);
 void check_file_exists(char *filename);
 FragmentationInfo analyze_fragmentation(int fd, StarHeader *header);
 void print_fragmentation_visualization(FragmentationInfo *info, StarHeader *header);
+void extract_file_data(int fd, unsigned char *map, off_t map_size, StarHeader *header, FileEntry *entry,
+                       int file_fd, ExtractEngine *engine);
+void copy_payload_range(int fd, unsigned char *map, off_t map_size, off_t archive_offset, size_t length,
+                        int file_fd, off_t *file_offset, ExtractEngine *engine);
+Segment *file_segments(StarHeader *header, FileEntry *entry, int *count);
+size_t block_payload_size(StarHeader *header);
+int file_block_count(StarHeader *header, FileEntry *entry);
+void read_header_v1(int fd, StarHeader *header);
+void require_current_format(StarHeader *header);
+void assign_extents(StarHeader *header, FileEntry *entry, int *blocks, int count);
+const Codec *find_codec(int codec);
+int parse_codec(const char *name);
+int parse_block_size(const char *text);
+long long parse_size(const char *text);
+int valid_block_size(int size);
+void add_compressed_file(int fd, StarHeader *header, FileEntry *entry, int file_fd);
+void compress_task(void *arg, BlockTask *task, int worker_id);
+void extract_compressed_file(int fd, StarHeader *header, FileEntry *entry, int file_fd);
+void decompress_task(void *arg, BlockTask *task, int worker_id);
+void stored_io(int fd, StarHeader *header, FileEntry *entry, off_t stored_offset, void *buffer, size_t length, int writing);
+void stored_writer_append(StoredWriter *writer, const void *data, size_t length);
+void stored_writer_flush(StoredWriter *writer);
+void queue_task(TaskQueue *queue, BlockTask *task);
+void free_block(StarHeader *header, int block);
+void free_map_load(int fd, StarHeader *header, int block_count);
+void free_map_save(int fd, StarHeader *header);
+uint64_t hash_block(const unsigned char *data, size_t length);
+int add_deduplicated_file(int fd, StarHeader *header, FileEntry *entry, int file_fd);
+void dedup_load(int fd, StarHeader *header);
+void dedup_save(int fd, StarHeader *header);
+void dedup_reset(void);
+void dedup_rehash(int bucket_count);
+int dedup_insert(uint64_t hash, int block);
+int dedup_find_block(int block);
+void tail_reset(void);
+void tail_rehash(int bucket_count);
+int tail_insert(int block);
+int tail_find(int block);
+void tail_store(int fd, StarHeader *header, FileEntry *entry, const unsigned char *data, int length);
+int tail_pack_length(off_t size);
+void tail_copy(int fd, StarHeader *header, FileEntry *entry, int source_fd, off_t offset, int length);
+void tail_flush(void);
+void tail_release(StarHeader *header, int block);
+void tail_load(int fd, StarHeader *header);
+void tail_save(int fd, StarHeader *header);
+void crc32c_init(void);
+uint32_t crc32c(uint32_t crc, const unsigned char *data, size_t length);
+uint32_t crc32c_sw(uint32_t crc, const unsigned char *data, size_t length);
+uint32_t crc32c_hw(uint32_t crc, const unsigned char *data, size_t length);
+uint64_t content_hash(uint64_t hash, const unsigned char *data, size_t length);
+uint64_t file_content_hash(int file_fd);
+void entry_set_metadata(FileEntry *entry, const struct stat *st, int file_fd);
+int entry_unchanged(FileEntry *entry, const char *filename);
+void checksum_reserve(int block_count);
+void checksum_record(int block, const unsigned char *data, size_t length);
+void checksum_record_from_archive(int fd, int block);
+void checksum_clear(int block);
+void checksum_load(int fd, StarHeader *header);
+void checksum_save(int fd, StarHeader *header);
+int verify_block_range(int fd, unsigned char *map, off_t map_size, off_t archive_offset, size_t length,
+                       const char *filename, int *unchecked);
+int block_needs_check(int block, int *unchecked);
+int verify_block_data(int block, const unsigned char *data, const char *filename);
+void verify_task(void *arg, BlockTask *task, int worker_id);
+void extract_star_parallel(int fd, unsigned char *map, off_t map_size, StarHeader *header, ExtractEngine *engine);
+void extract_task(void *arg, BlockTask *task, int worker_id);
+void create_star_parallel(int fd, StarHeader *header, int file_count, char *files[]);
+void create_task(void *arg, BlockTask *task, int worker_id);
+TaskQueue *create_task_queues(int worker_count);
+void destroy_task_queues(TaskQueue *queues, int worker_count);
+void queue_file_tasks(TaskQueue *queue, int file_index, Segment *segments, int count);
+void run_task_pool(TaskQueue *queues, int worker_count, BlockTaskFn fn, void *ctx);
+void *pool_worker(void *arg);
+int append_block_index(int fd);
+void free_map_reserve(StarHeader *header, int block_count);
+void free_map_set(StarHeader *header, int start, int count, int is_free);
+int free_map_next_run(StarHeader *header, int from, int *length);
+int compare_runs_by_length(const void *a, const void *b);
+int compare_runs_by_start(const void *a, const void *b);
+int allocate_runs(int fd, StarHeader *header, int count, int max_runs, Extent *runs);
+int allocate_run(int fd, StarHeader *header, int count);
+int *allocate_blocks(int fd, StarHeader *header, int count);
+const char *extract_engine_name(ExtractEngine engine);
+void create_stream(int out_fd, int file_count, char *files[]);
+void extract_stream(int in_fd);
+void list_stream(int in_fd, const char *name);
+int is_stream(int fd);
+void cat_star(char *star_filename, char *filename, long long offset, long long length);
+void read_compressed_range(int fd, FileEntry *entry, Segment *segments, int segment_count, long long offset,
+                           long long length, unsigned char *buffer);
+void read_stored_range(int fd, FileEntry *entry, Segment *segments, int segment_count, off_t stored_offset,
+                       void *buffer, size_t length);
+void verify_range_or_fail(int fd, unsigned char *map, off_t map_size, off_t archive_offset, size_t length,
+                          const char *filename);
+int find_segment(Segment *segments, int count, off_t offset);
+long long cat_clamp_range(const char *filename, long long size, long long offset, long long length);
+void cat_stream(int fd, char *filename, long long offset, long long length);
+void fail_operation(void) __attribute__((noreturn));
+int uring_copy(int src_fd, off_t src_offset, int dst_fd, off_t dst_offset, size_t length, UringChunkFn on_chunk);
+void uring_record_checksums(off_t offset, unsigned char *data, size_t length);
+void *aligned_buffer(size_t size);
+unsigned char *pool_acquire(void);
+void pool_release(unsigned char *buffer);
+void pool_reset(void);
+void direct_open(const char *star_filename, int flags);
+void direct_close(int fd);
+ssize_t archive_pread(int fd, void *buffer, size_t length, off_t offset);
+ssize_t archive_pwrite(int fd, const void *buffer, size_t length, off_t offset);
+void cache_release(int fd, off_t offset, off_t length);
+void cache_release_behind(int fd, off_t offset, off_t length);
+void pipeline_start(Pipeline *pipeline, int fd, int archive, PipelineChunk *chunks, int count, int threaded);
+ssize_t pipeline_fill(Pipeline *pipeline, int index);
+void *pipeline_reader(void *arg);
+unsigned char *pipeline_next(Pipeline *pipeline, ssize_t *length);
+void pipeline_done(Pipeline *pipeline);
+void pipeline_finish(Pipeline *pipeline);
+int extract_segments(int fd, Segment *segments, int count, int file_fd, const char *filename, int *unchecked,
+                     int threaded);
+int same_device(int fd, int other_fd);
+void stats_add(long long *counter, long long value);
+void stats_phase(double *seconds, const struct timespec *start);
+void stats_print(const char *operation, const char *star_filename);
+void json_print_string(FILE *out, const char *text);
+ssize_t io_read(int fd, void *buffer, size_t length);
+ssize_t io_write(int fd, const void *buffer, size_t length);
+ssize_t io_pread(int fd, void *buffer, size_t length, off_t offset);
+ssize_t io_pwrite(int fd, const void *buffer, size_t length, off_t offset);
+off_t io_lseek(int fd, off_t offset, int whence);
+ssize_t io_copy_file_range(int in_fd, loff_t *in_offset, int out_fd, loff_t *out_offset, size_t length,
+                           unsigned int flags);
+#ifdef STAR_WITH_IO_URING
+int uring_ready(void);
+int uring_setup(void);
+void uring_queue(int opcode, int fd, off_t offset, int slot, size_t done, size_t length);
+#endif
+void library_enter(StarArchive *archive, jmp_buf *jump);
+void library_leave(StarArchive *archive);
+void library_swap_state(StarArchive *archive);
+void library_free_state(StarArchive *archive);
+void library_fill_entry(StarEntry *entry, FileEntry *file, int index);
+void library_track(void (*release)(void *), void *resource);
+void library_track_fd(int fd);
+void library_untrack(int count);
+void library_unwind(void);
+void library_close(void *fd);
+void library_destroy_queues(void *queues);
+int library_check_writable(StarArchive *archive);
+void stream_prepare_pipe(int fd);
+size_t stream_read(int fd, void *buffer, size_t length);
+void stream_read_exact(int fd, void *buffer, size_t length);
+void stream_write(int fd, const void *buffer, size_t length);
+void stream_read_header(int fd);
+void stream_check_entry(StreamEntry *entry);
+StreamEntry *stream_read_directory(int fd, int64_t count);
 
 // Función para comparar dos mapeos de bloques (usada en qsort)
 int compare_blocks(const void *a, const void *b)
@@ -92,10 +998,11 @@ void check_file_exists(char *filename)
     if (stat(filename, &buffer) != 0)
     {
         fprintf(stderr, "Error: El archivo '%s' no existe\n", filename);
-        exit(EXIT_FAILURE);
+        fail_operation();
     }
 }
 
+#ifndef STAR_LIBRARY
 // Función principal: analiza los argumentos de línea de comandos y llama a la función de operación correspondiente
 int main(int argc, char *argv[])
 {
@@ -107,8 +1014,10 @@ int main(int argc, char *argv[])
 
     int opt;
     int c_flag = 0, x_flag = 0, t_flag = 0, delete_flag = 0;
-    int u_flag = 0, r_flag = 0, p_flag = 0;
+    int u_flag = 0, r_flag = 0, p_flag = 0, verify_flag = 0, block_size_flag = 0;
+    int pack_incremental_flag = 0, budget_flag = 0, range_flag = 0;
     char *star_filename = NULL;
+    char *cat_filename = NULL;
 
     // Definir opciones largas para getopt_long
     struct option long_options[] = {
@@ -121,12 +1030,28 @@ int main(int argc, char *argv[])
         {"file", required_argument, 0, 'f'},
         {"append", no_argument, 0, 'r'},
         {"pack", no_argument, 0, 'p'},
+        {"jobs", required_argument, 0, 'j'},
+        {"compress", required_argument, 0, 1001},
+        {"dedup", no_argument, 0, 1002},
+        {"verify", no_argument, 0, 1003},
+        {"block-size", required_argument, 0, 1004},
+        {"pack-buffer", required_argument, 0, 1005},
+        {"pack-incremental", no_argument, 0, 1006},
+        {"budget", required_argument, 0, 1007},
+        {"hash", no_argument, 0, 1008},
+        {"cat", required_argument, 0, 1009},
+        {"offset", required_argument, 0, 1010},
+        {"length", required_argument, 0, 1011},
+        {"io-uring", no_argument, 0, 1012},
+        {"direct", no_argument, 0, 1013},
+        {"stats", required_argument, 0, 1014},
+        {"in-place", no_argument, 0, 1015},
         {0, 0, 0, 0}};
 
     int option_index = 0;
 
     // Analizar opciones de línea de comandos
-    while ((opt = getopt_long(argc, argv, "cxtrupvf:", long_options, &option_index)) != -1)
+    while ((opt = getopt_long(argc, argv, "cxtrupvf:j:", long_options, &option_index)) != -1)
     {
         switch (opt)
         {
@@ -157,6 +1082,88 @@ int main(int argc, char *argv[])
         case 1000: // --delete
             delete_flag = 1;
             break;
+        case 1001: // --compress=<códec>
+            compress_codec = parse_codec(optarg);
+            break;
+        case 1002: // --dedup
+            dedup_enabled = 1;
+            break;
+        case 1003: // --verify
+            verify_flag = 1;
+            break;
+        case 1004: // --block-size=<tamaño>
+            block_size = parse_block_size(optarg);
+            block_size_flag = 1;
+            break;
+        case 1005: // --pack-buffer=<tamaño>
+            pack_buffer_size = parse_size(optarg);
+            if (pack_buffer_size <= 0)
+            {
+                fprintf(stderr, "Tamaño de búfer no válido: '%s'\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 1006: // --pack-incremental
+            pack_incremental_flag = 1;
+            break;
+        case 1007: // --budget=<tiempo|bytes>
+            parse_budget(optarg);
+            budget_flag = 1;
+            break;
+        case 1008: // --hash
+            hash_enabled = 1;
+            break;
+        case 1009: // --cat=<archivo>
+            cat_filename = optarg;
+            break;
+        case 1010: // --offset=<bytes>
+            cat_offset = parse_size(optarg);
+            if (cat_offset < 0)
+            {
+                fprintf(stderr, "Posición no válida: '%s'\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            range_flag = 1;
+            break;
+        case 1011: // --length=<bytes>
+            cat_length = parse_size(optarg);
+            if (cat_length < 0)
+            {
+                fprintf(stderr, "Longitud no válida: '%s'\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            range_flag = 1;
+            break;
+        case 1012: // --io-uring
+#ifdef STAR_WITH_IO_URING
+            uring_enabled = 1;
+#else
+            fprintf(stderr, "io_uring no se incluyó al compilar este programa (-DSTAR_WITH_IO_URING)\n");
+            exit(EXIT_FAILURE);
+#endif
+            break;
+        case 1013: // --direct
+            direct_io = 1;
+            break;
+        case 1014: // --stats=json
+            if (strcmp(optarg, "json") != 0)
+            {
+                fprintf(stderr, "Formato de estadísticas no válido: '%s' (solo json)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            stats_enabled = 1;
+            break;
+        case 1015: // --in-place
+            pack_in_place_enabled = 1;
+            break;
+        case 'j':
+            job_count = atoi(optarg); // Hilos de trabajo
+            if (job_count < 1)
+            {
+                fprintf(stderr, "El número de hilos debe ser al menos 1\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
         default:
             fprintf(stderr, "Opción desconocida o uso incorrecto\n");
             exit(EXIT_FAILURE);
@@ -171,13 +1178,75 @@ int main(int argc, char *argv[])
     }
 
     // Asegurarse de que se especificó exactamente una operación principal
-    int operation_count = c_flag + x_flag + t_flag + delete_flag + r_flag + u_flag + p_flag;
+    int operation_count = c_flag + x_flag + t_flag + delete_flag + r_flag + u_flag + p_flag + verify_flag +
+                          pack_incremental_flag + (cat_filename != NULL);
     if (operation_count != 1)
     {
         fprintf(stderr, "Debe especificar exactamente una operación principal\n");
         exit(EXIT_FAILURE);
     }
 
+    // El tamaño de bloque se fija al crear; las demás operaciones usan el del archivador
+    if (block_size_flag && !c_flag)
+    {
+        fprintf(stderr, "La opción --block-size solo se puede usar al crear el empaquetado (-c)\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Con -f - el empaquetado es un flujo: -c lo escribe en la salida estándar y -x y -t lo leen
+    // de la entrada estándar en una sola pasada
+    int stream_flag = strcmp(star_filename, "-") == 0;
+    if (stream_flag && !c_flag && !x_flag && !t_flag)
+    {
+        fprintf(stderr, "Con -f - solo se puede crear (-c), extraer (-x) o listar (-t)\n");
+        exit(EXIT_FAILURE);
+    }
+    if (stream_flag && (compress_codec != CODEC_NONE || dedup_enabled || block_size_flag))
+    {
+        fprintf(stderr, "Las opciones --compress, --dedup y --block-size no se pueden usar con -f -\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (range_flag && !cat_filename)
+    {
+        fprintf(stderr, "Las opciones --offset y --length solo se pueden usar con --cat\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // --direct solo cambia las operaciones que copian datos entre el archivador y otros archivos
+    if (direct_io && (stream_flag || !(c_flag || x_flag || r_flag || u_flag || p_flag || pack_incremental_flag)))
+    {
+        fprintf(stderr, "La opción --direct solo se puede usar con -c, -x, -r, -u, -p y --pack-incremental "
+                        "(y no con -f -)\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (budget_flag && !pack_incremental_flag)
+    {
+        fprintf(stderr, "La opción --budget solo se puede usar con --pack-incremental\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (pack_in_place_enabled && !p_flag)
+    {
+        fprintf(stderr, "La opción --in-place solo se puede usar con -p\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Los tramos comprimidos no coinciden con los bloques, así que no se pueden deduplicar
+    if (dedup_enabled && compress_codec != CODEC_NONE)
+    {
+        fprintf(stderr, "Las opciones --dedup y --compress no se pueden combinar\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Con --stats se mide la operación completa y al terminar se escribe el resumen
+    const char *operation = c_flag ? "create" : x_flag ? "extract" : t_flag ? "list" : r_flag ? "append"
+                          : u_flag ? "update" : p_flag ? "pack" : pack_incremental_flag ? "pack_incremental"
+                          : cat_filename ? "cat" : verify_flag ? "verify" : "delete";
+    struct timespec stats_start;
+    clock_gettime(CLOCK_MONOTONIC, &stats_start);
+
     // Llamar a la función apropiada según la operación especificada
     if (c_flag)
     {
@@ -187,17 +1256,48 @@ int main(int argc, char *argv[])
             fprintf(stderr, "Debe especificar al menos un archivo para empaquetar\n");
             exit(EXIT_FAILURE);
         }
-        create_star(star_filename, argc - optind, &argv[optind]);
+        if (stream_flag)
+        {
+            // El flujo se queda con la salida estándar; los mensajes pasan a la salida de errores
+            int out_fd = dup(STDOUT_FILENO);
+            if (out_fd < 0 || isatty(out_fd))
+            {
+                fprintf(stderr, "No se escribirá el flujo en una terminal; redirija la salida estándar\n");
+                exit(EXIT_FAILURE);
+            }
+            fflush(stdout);
+            dup2(STDERR_FILENO, STDOUT_FILENO);
+            create_stream(out_fd, argc - optind, &argv[optind]);
+            close(out_fd);
+        }
+        else
+        {
+            create_star(star_filename, argc - optind, &argv[optind]);
+        }
     }
     else if (x_flag)
     {
         // Extraer archivos del archivador
-        extract_star(star_filename);
+        if (stream_flag)
+        {
+            extract_stream(STDIN_FILENO);
+        }
+        else
+        {
+            extract_star(star_filename);
+        }
     }
     else if (t_flag)
     {
         // Listar contenido del archivador
-        list_star(star_filename);
+        if (stream_flag)
+        {
+            list_stream(STDIN_FILENO, star_filename);
+        }
+        else
+        {
+            list_star(star_filename);
+        }
     }
     else if (r_flag)
     {
@@ -224,10 +1324,25 @@ int main(int argc, char *argv[])
         // Empacar (desfragmentar) el archivador
         pack_star(star_filename);
     }
-    else if (delete_flag)
+    else if (pack_incremental_flag)
     {
-        // Eliminar archivos del archivador
-        if (optind >= argc)
+        // Desfragmentar por pasos dentro del presupuesto
+        pack_incremental(star_filename);
+    }
+    else if (cat_filename)
+    {
+        // Escribir un archivo, o un rango de bytes, en la salida estándar
+        cat_star(star_filename, cat_filename, cat_offset, cat_length);
+    }
+    else if (verify_flag)
+    {
+        // Verificar las sumas de verificación de todos los bloques
+        verify_star(star_filename);
+    }
+    else if (delete_flag)
+    {
+        // Eliminar archivos del archivador
+        if (optind >= argc)
         {
             fprintf(stderr, "Debe especificar al menos un archivo para eliminar\n");
             exit(EXIT_FAILURE);
@@ -235,8 +1350,14 @@ int main(int argc, char *argv[])
         delete_star(star_filename, argc - optind, &argv[optind]);
     }
 
+    if (stats_enabled)
+    {
+        stats_phase(&io_stats.wall_seconds, &stats_start);
+        stats_print(operation, star_filename);
+    }
     return 0;
 }
+#endif
 
 /*
  * Función para crear un nuevo archivador
@@ -252,37 +1373,56 @@ void create_star(char *star_filename, int file_count, char *files[])
         check_file_exists(files[i]);
     }
 
-    // Abrir el archivo de archivado para escritura (crear o truncar)
-    int fd = open(star_filename, O_CREAT | O_WRONLY | O_TRUNC, 0666);
+    // Abrir el archivo de archivado para lectura y escritura (crear o truncar)
+    int fd = open(star_filename, O_CREAT | O_RDWR | O_TRUNC, 0666);
     if (fd < 0)
     {
         perror("Error al crear el archivo empaquetado");
-        exit(EXIT_FAILURE);
+        fail_operation();
     }
+    direct_open(star_filename, O_RDWR);
 
     // Inicializar el encabezado del archivador
     StarHeader header;
     memset(&header, 0, sizeof(StarHeader));
+    memcpy(header.magic, STAR_MAGIC, sizeof(header.magic));
+    header.version = STAR_VERSION;
+    header.fd = fd;
     header.file_count = 0;
-    header.free_block_list = -1; // Sin bloques libres inicialmente
 
-    // Escribir el encabezado vacío en el archivo de archivado
-    write_header(fd, &header);
+    if (job_count > 1 && compress_codec == CODEC_NONE && !dedup_enabled)
+    {
+        // Llenar rangos de bloques reservados en paralelo (con compresión o deduplicación el
+        // tamaño final no se conoce de antemano; en ese caso se usa la ruta secuencial)
+        create_star_parallel(fd, &header, file_count, files);
+    }
+    else
+    {
+        // Escribir el encabezado vacío en el archivo de archivado
+        write_header(fd, &header);
 
-    // Agregar cada archivo especificado al archivador
-    for (int i = 0; i < file_count; i++)
+        // Agregar cada archivo especificado al archivador
+        for (int i = 0; i < file_count; i++)
+        {
+            add_file_to_star(fd, &header, files[i]);
+        }
+    }
+
+    for (int i = 0; verbose_level >= 2 && i < header.file_count; i++)
     {
-        add_file_to_star(fd, &header, files[i]);
-        if (verbose_level >= 2)
+        if (header.files[i].filename[0] == '\0')
         {
-            printf("Archivo '%s' agregado:\n", files[i]);
-            printf("  Tamaño: %lld bytes\n", (long long)header.files[header.file_count - 1].size);
-            printf("  Bloque inicial: %d\n", header.files[header.file_count - 1].start_block);
+            continue;
         }
+        printf("Archivo '%s' agregado:\n", header.files[i].filename);
+        printf("  Tamaño: %lld bytes\n", (long long)header.files[i].size);
+        printf("  Bloque inicial: %d\n", header.files[i].start_block);
     }
 
     // Escribir el encabezado actualizado de nuevo en el archivador
     write_header(fd, &header);
+    free_header(&header);
+    direct_close(fd);
     close(fd);
 }
 
@@ -297,729 +1437,8521 @@ void extract_star(char *star_filename)
     if (fd < 0)
     {
         perror("Error al abrir el archivo empaquetado");
-        exit(EXIT_FAILURE);
+        fail_operation();
     }
 
-    // Leer el encabezado del archivador
+    // Un flujo guardado en disco se extrae igual que desde un pipe
+    if (is_stream(fd))
+    {
+        extract_stream(fd);
+        close(fd);
+        return;
+    }
+
+    // Leer el encabezado del archivador y todas las páginas del directorio
     StarHeader header;
     read_header(fd, &header);
+    load_directory(&header);
+    direct_open(star_filename, O_RDONLY);
 
-    // Extraer cada archivo en el archivador
-    for (int i = 0; i < header.file_count; i++)
+    // Mapear el archivador completo para seguir las cadenas de bloques sin llamadas a read();
+    // si no se puede mapear se usa el ciclo read/write tradicional. Con --direct no se mapea:
+    // las páginas del mapeo quedarían en la caché
+    ExtractEngine engine = EXTRACT_READ_WRITE;
+    unsigned char *map = NULL;
+    struct stat star_st;
+    if (fstat(fd, &star_st) == 0 && star_st.st_size > 0 && !direct_io)
     {
-        verbose_print("Extrayendo:", 1);
-        if (verbose_level >= 1)
-        {
-            printf(" %s\n", header.files[i].filename);
-        }
-
-        // Abrir el archivo de salida para escritura
-        int file_fd = open(header.files[i].filename, O_CREAT | O_WRONLY | O_TRUNC, 0666);
-        if (file_fd < 0)
+        void *addr = mmap(NULL, star_st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (addr != MAP_FAILED)
         {
-            perror("Error al crear archivo de salida");
-            close(fd);
-            exit(EXIT_FAILURE);
+            map = addr;
+            madvise(map, star_st.st_size, MADV_SEQUENTIAL);
+            engine = EXTRACT_COPY_RANGE;
         }
+    }
+    // Con --io-uring y sin -j se mantienen varias lecturas y escrituras en curso; si io_uring no
+    // está disponible copy_payload_range pasa a copy_file_range
+    if (uring_enabled && job_count == 1)
+    {
+        engine = EXTRACT_IO_URING;
+    }
+    if (direct_io)
+    {
+        engine = EXTRACT_DIRECT;
+    }
 
-        // Leer y escribir bloques de datos
-        int current_block = header.files[i].start_block;
-        off_t remaining_size = header.files[i].size;
-
-        while (remaining_size > 0 && current_block != -1)
+    // Con varios hilos, extraer los archivos en paralelo
+    if (job_count > 1)
+    {
+        extract_star_parallel(fd, map, star_st.st_size, &header, &engine);
+    }
+    else
+    {
+        // Extraer cada archivo en el archivador
+        for (int i = 0; i < header.file_count; i++)
         {
-            DataBlock block;
-            // Posicionarse en el bloque actual en el archivador
-            lseek(fd, current_block * BLOCK_SIZE, SEEK_SET);
-            // Leer el bloque de datos
-            if (read(fd, &block, sizeof(DataBlock)) != sizeof(DataBlock))
+            if (header.files[i].filename[0] == '\0')
             {
-                perror("Error al leer bloque de datos");
-                close(file_fd);
-                close(fd);
-                exit(EXIT_FAILURE);
+                continue;
+            }
+            verbose_print("Extrayendo:", 1);
+            if (verbose_level >= 1)
+            {
+                printf(" %s\n", header.files[i].filename);
             }
 
-            // Determinar cuántos bytes escribir (puede ser menos que el tamaño del bloque para el último bloque)
-            size_t bytes_to_write = remaining_size < sizeof(block.data) ? remaining_size : sizeof(block.data);
-
-            // Escribir datos en el archivo de salida
-            if (write(file_fd, block.data, bytes_to_write) != bytes_to_write)
+            // Abrir el archivo de salida para escritura
+            int file_fd = open(header.files[i].filename, O_CREAT | O_WRONLY | O_TRUNC, 0666);
+            if (file_fd < 0)
             {
-                perror("Error al escribir datos");
-                close(file_fd);
+                perror("Error al crear archivo de salida");
                 close(fd);
-                exit(EXIT_FAILURE);
+                fail_operation();
             }
 
-            remaining_size -= bytes_to_write;
-            current_block = block.next_block;
-        }
+            // Copiar los bloques de datos al archivo de salida
+            if (header.files[i].codec != CODEC_NONE)
+            {
+                extract_compressed_file(fd, &header, &header.files[i], file_fd);
+            }
+            else
+            {
+                extract_file_data(fd, map, star_st.st_size, &header, &header.files[i], file_fd, &engine);
+            }
 
-        close(file_fd);
+            cache_release(file_fd, 0, 0);
+            close(file_fd);
 
-        if (verbose_level >= 2)
-        {
-            printf("  Tamaño: %lld bytes\n", (long long)header.files[i].size);
-            printf("  Bloques extraídos: %d\n",
-                   (int)((header.files[i].size + sizeof(DataBlock) - 1) / sizeof(DataBlock)));
+            if (verbose_level >= 2)
+            {
+                printf("  Tamaño: %lld bytes\n", (long long)header.files[i].size);
+                printf("  Bloques extraídos: %d\n", file_block_count(&header, &header.files[i]));
+            }
         }
     }
 
+    if (verbose_level >= 1)
+    {
+        printf("Motor de extracción: %s\n", extract_engine_name(engine));
+    }
+
+    if (map)
+    {
+        munmap(map, star_st.st_size);
+    }
+    free_header(&header);
+    direct_close(fd);
     close(fd);
+
+    if (corrupt_block_count > 0)
+    {
+        fprintf(stderr, "Error: se encontraron %d bloques dañados; los archivos afectados no son confiables\n",
+                corrupt_block_count);
+        fail_operation();
+    }
 }
 
 /*
- * Función para listar el contenido del archivador
- * star_filename: Nombre del archivo de archivado a listar
+ * Función para copiar los datos de un archivo del archivador a un descriptor de salida
+ * fd: Descriptor de archivo del archivador
+ * map: Archivador mapeado en memoria (NULL si no está disponible)
+ * map_size: Tamaño del mapeo en bytes
+ * header: Encabezado del archivador
+ * entry: Entrada del archivo a extraer
+ * file_fd: Descriptor del archivo de salida
+ * engine: Motor a usar; se degrada a uno más sencillo si el kernel no soporta el actual
  */
-void list_star(char *star_filename)
+void extract_file_data(int fd, unsigned char *map, off_t map_size, StarHeader *header, FileEntry *entry,
+                       int file_fd, ExtractEngine *engine)
 {
-    // Abrir el archivo de archivado para lectura
-    int fd = open(star_filename, O_RDONLY);
-    if (fd < 0)
+    // copy_file_range entre sistemas de archivos distintos (por ejemplo, con la salida en otro
+    // disco) falla aunque no se copie nada, así que se prueba antes de empezar el archivo. Donde
+    // sí funciona copia de forma síncrona, así que con la salida en otro dispositivo se usa la
+    // lectura por tramos, que lee y escribe a la vez
+    loff_t probe = 0;
+    if (*engine == EXTRACT_COPY_RANGE &&
+        (!same_device(fd, file_fd) || io_copy_file_range(fd, &probe, file_fd, NULL, 0, 0) < 0))
     {
-        perror("Error al abrir el archivo empaquetado");
-        exit(EXIT_FAILURE);
+        *engine = EXTRACT_READ_WRITE;
     }
 
-    // Leer el encabezado del archivador
-    StarHeader header;
-    read_header(fd, &header);
-
-    printf("Contenido de '%s':\n", star_filename);
-    // Listar cada archivo en el archivador
-    for (int i = 0; i < header.file_count; i++)
+    // Cada extent es un solo rango de bytes, así que se copia con una sola operación grande
+    // después de comprobar las sumas de verificación de sus bloques
+    int segment_count;
+    int unchecked = 0;
+    Segment *segments = file_segments(header, entry, &segment_count);
+    for (int i = 0; i < segment_count; i++)
     {
-        printf("%s", header.files[i].filename);
-        if (verbose_level >= 1)
+        // Si los datos tienen que pasar por espacio de usuario, se leen por tramos grandes y se
+        // verifican en el mismo búfer en lugar de mapear el archivador
+        if (*engine == EXTRACT_MMAP || *engine == EXTRACT_READ_WRITE)
         {
-            printf(" (tamaño: %lld bytes)", (long long)header.files[i].size);
+            *engine = EXTRACT_PIPELINE;
         }
-        printf("\n");
-
-        if (verbose_level >= 2)
+        if (*engine == EXTRACT_DIRECT || *engine == EXTRACT_PIPELINE)
         {
-            int blocks = (header.files[i].size + sizeof(DataBlock) - 1) / sizeof(DataBlock);
-            printf("  Bloques: %d\n", blocks);
-            printf("  Bloque inicial: %d\n", header.files[i].start_block);
+            // Con O_DIRECT, o con la salida en otro dispositivo, un hilo lee los tramos siguientes
+            // mientras se escriben los anteriores; en el mismo disco solo competirían
+            int threaded = *engine == EXTRACT_DIRECT || !same_device(fd, file_fd);
+            corrupt_block_count += extract_segments(fd, segments + i, segment_count - i, file_fd, entry->filename,
+                                                    &unchecked, threaded);
+            break;
         }
+        corrupt_block_count += verify_block_range(fd, map, map_size, segments[i].archive_offset, segments[i].length,
+                                                  entry->filename, &unchecked);
+        copy_payload_range(fd, map, map_size, segments[i].archive_offset, segments[i].length, file_fd, NULL, engine);
     }
-
-    close(fd);
+    free(segments);
 }
 
 /*
- * Función para eliminar archivos del archivador
- * star_filename: Nombre del archivo de archivado
- * file_count: Número de archivos a eliminar
- * files: Array de nombres de archivos a eliminar
+ * Función para copiar un rango de bytes del archivador a un archivo de salida
+ * fd: Descriptor de archivo del archivador
+ * map: Archivador mapeado en memoria (NULL si no está disponible)
+ * map_size: Tamaño del mapeo en bytes
+ * archive_offset: Posición de los datos en el archivador
+ * length: Bytes a copiar
+ * file_fd: Descriptor del archivo de salida
+ * file_offset: Posición de escritura en la salida (se avanza), o NULL para usar la posición actual
+ * engine: Motor a usar; se degrada a uno más sencillo si el kernel no soporta el actual
  */
-void delete_star(char *star_filename, int file_count, char *files[])
+void copy_payload_range(int fd, unsigned char *map, off_t map_size, off_t archive_offset, size_t length,
+                        int file_fd, off_t *file_offset, ExtractEngine *engine)
 {
-    int fd = open(star_filename, O_RDWR);
-    if (fd < 0)
-    {
-        perror("Error al abrir el archivo empaquetado");
-        exit(EXIT_FAILURE);
-    }
-
-    StarHeader header;
-    read_header(fd, &header);
+    size_t copied = 0;
 
-    for (int i = 0; i < file_count; i++)
+    if (*engine == EXTRACT_IO_URING)
     {
-        int index = find_file_entry(&header, files[i]);
-        if (index != -1)
-        {
-            remove_file_from_star(fd, &header, files[i]);
-            printf("Archivo '%s' eliminado del empaquetado.\n", files[i]);
-        }
-        else
+        off_t position = file_offset ? *file_offset : io_lseek(file_fd, 0, SEEK_CUR);
+        if (uring_copy(fd, archive_offset, file_fd, position, length, NULL))
         {
-            fprintf(stderr, "El archivo '%s' no se encontró en el empaquetado.\n", files[i]);
+            if (file_offset)
+            {
+                *file_offset += length;
+            }
+            else
+            {
+                io_lseek(file_fd, position + length, SEEK_SET);
+            }
+            return;
         }
+        // io_uring no está disponible (o no desde este hilo): seguir con copy_file_range
+        *engine = EXTRACT_COPY_RANGE;
     }
 
-    // Write header before analysis
-    write_header(fd, &header);
-
-    // Analyze fragmentation after deletion
-    if (verbose_level >= 1)
+    if (*engine == EXTRACT_COPY_RANGE)
     {
-        FragmentationInfo frag_info = analyze_fragmentation(fd, &header);
-        if (frag_info.block_status != NULL)
+        // Copiar los datos directamente dentro del kernel
+        loff_t in_offset = archive_offset;
+        while (copied < length)
         {
-            print_fragmentation_visualization(&frag_info, &header);
-            free(frag_info.block_status);
+            ssize_t n = io_copy_file_range(fd, &in_offset, file_fd, (loff_t *)file_offset, length - copied, 0);
+            if (n <= 0)
+            {
+                if (n < 0 && errno != ENOSYS && errno != EXDEV && errno != EINVAL &&
+                    errno != EOPNOTSUPP && errno != EBADF)
+                {
+                    perror("Error al copiar datos");
+                    fail_operation();
+                }
+                // El kernel o el sistema de archivos no lo soporta: usar el mapeo si existe
+                *engine = map ? EXTRACT_MMAP : EXTRACT_READ_WRITE;
+                break;
+            }
+            copied += n;
         }
     }
-    close(fd);
-}
 
-/*
- * Función para agregar archivos al archivador
- * star_filename: Nombre del archivo de archivado
- * file_count: Número de archivos a agregar
- * files: Array de nombres de archivos a agregar
- */
-void append_star(char *star_filename, int file_count, char *files[])
-{
-    // Abrir el archivo de archivado para lectura y escritura
-    int fd = open(star_filename, O_RDWR);
-    if (fd < 0)
+    if (copied < length && *engine == EXTRACT_MMAP)
     {
-        perror("Error al abrir el archivo empaquetado");
-        exit(EXIT_FAILURE);
-    }
+        if (archive_offset + (off_t)length > map_size)
+        {
+            fprintf(stderr, "Error: datos fuera del archivador\n");
+            fail_operation();
+        }
 
-    // Leer el encabezado del archivador
-    StarHeader header;
-    read_header(fd, &header);
+        // Escribir desde el mapeo lo que no se copió con copy_file_range
+        while (copied < length)
+        {
+            ssize_t n = file_offset ? io_pwrite(file_fd, map + archive_offset + copied, length - copied, *file_offset)
+                                    : io_write(file_fd, map + archive_offset + copied, length - copied);
+            if (n <= 0)
+            {
+                perror("Error al escribir datos");
+                fail_operation();
+            }
+            copied += n;
+            stats_add(&io_stats.bytes_mapped, n);
+            if (file_offset)
+            {
+                *file_offset += n;
+            }
+        }
+    }
 
-    // Agregar cada archivo especificado al archivador
-    for (int i = 0; i < file_count; i++)
+    if (copied < length)
     {
-        if (header.file_count >= MAX_FILES)
+        // Leer y escribir bloque por bloque sin depender de la posición compartida del descriptor
+        unsigned char *buffer = malloc(block_size);
+        if (!buffer)
         {
-            fprintf(stderr, "Se alcanzó el número máximo de archivos en el empaquetado.\n");
-            close(fd);
-            exit(EXIT_FAILURE);
+            perror("Error de memoria");
+            fail_operation();
         }
-        if (find_file_entry(&header, files[i]) != -1)
+        while (copied < length)
         {
-            fprintf(stderr, "El archivo '%s' ya existe en el empaquetado. Use la opción -u para actualizarlo.\n", files[i]);
-            continue;
+            size_t chunk = length - copied < (size_t)block_size ? length - copied : (size_t)block_size;
+            if (io_pread(fd, buffer, chunk, archive_offset + copied) != (ssize_t)chunk)
+            {
+                perror("Error al leer bloque de datos");
+                fail_operation();
+            }
+            ssize_t n = file_offset ? io_pwrite(file_fd, buffer, chunk, *file_offset)
+                                    : io_write(file_fd, buffer, chunk);
+            if (n != (ssize_t)chunk)
+            {
+                perror("Error al escribir datos");
+                fail_operation();
+            }
+            copied += chunk;
+            if (file_offset)
+            {
+                *file_offset += chunk;
+            }
         }
-        add_file_to_star(fd, &header, files[i]);
+        free(buffer);
     }
-
-    // Escribir el encabezado actualizado de nuevo en el archivador
-    write_header(fd, &header);
-    close(fd);
 }
 
 /*
- * Función para actualizar archivos en el archivador
- * star_filename: Nombre del archivo de archivado
- * file_count: Número de archivos a actualizar
- * files: Array de nombres de archivos a actualizar
+ * Función para obtener los rangos de bytes que ocupan los datos guardados de un archivo
+ * Solo consulta la tabla de extents; no lee bloques de datos. La cola empaquetada, si hay, es
+ * el último rango.
+ * header: Encabezado del archivador
+ * entry: Entrada del archivo
+ * count: Se llena con el número de rangos
+ * Retorna: Array de rangos en orden (el llamador lo libera)
  */
-void update_star(char *star_filename, int file_count, char *files[])
+Segment *file_segments(StarHeader *header, FileEntry *entry, int *count)
 {
-    // Abrir el archivo de archivado para lectura y escritura
-    int fd = open(star_filename, O_RDWR);
-    if (fd < 0)
+    size_t payload_size = block_payload_size(header);
+    int capacity = (header->version == 1 ? file_block_count(header, entry) : entry->extent_count) + 1;
+    Segment *segments = malloc(capacity * sizeof(Segment));
+    if (!segments)
     {
-        perror("Error al abrir el archivo empaquetado");
-        exit(EXIT_FAILURE);
+        perror("Error de memoria");
+        fail_operation();
     }
 
-    // Leer el encabezado del archivador
-    StarHeader header;
-    read_header(fd, &header);
-
-    // Actualizar cada archivo especificado en el archivador
-    for (int i = 0; i < file_count; i++)
+    off_t data_size = entry->stored_size - entry->tail_length;
+    off_t file_offset = 0;
+    *count = 0;
+    for (int e = 0; e < entry->extent_count && file_offset < data_size; e++)
     {
-        int index = find_file_entry(&header, files[i]);
-        if (index != -1)
+        Extent *extent = &header->extents[entry->extent_index + e];
+        if (header->version == 1)
         {
-            // Eliminar la entrada de archivo antigua
-            remove_file_from_star(fd, &header, files[i]);
-            // Agregar el nuevo archivo
-            add_file_to_star(fd, &header, files[i]);
+            // En v1 cada bloque empieza con next_block: un rango por bloque
+            for (int b = 0; b < extent->length && file_offset < data_size; b++)
+            {
+                Segment *segment = &segments[(*count)++];
+                segment->archive_offset = (off_t)(extent->start_block + b) * block_size + offsetof(DataBlock, data);
+                segment->file_offset = file_offset;
+                segment->length = data_size - file_offset < (off_t)payload_size ? (size_t)(data_size - file_offset) : payload_size;
+                file_offset += segment->length;
+            }
         }
         else
         {
-            fprintf(stderr, "El archivo '%s' no existe en el empaquetado. Use la opción -r para agregarlo.\n", files[i]);
+            // En el formato actual un extent es un solo rango de bytes
+            off_t extent_bytes = (off_t)extent->length * block_size;
+            Segment *segment = &segments[(*count)++];
+            segment->archive_offset = (off_t)extent->start_block * block_size;
+            segment->file_offset = file_offset;
+            segment->length = data_size - file_offset < extent_bytes ? (size_t)(data_size - file_offset) : (size_t)extent_bytes;
+            file_offset += segment->length;
         }
     }
+    if (entry->tail_length > 0)
+    {
+        Segment *segment = &segments[(*count)++];
+        segment->archive_offset = (off_t)entry->tail_block * block_size + entry->tail_offset;
+        segment->file_offset = data_size;
+        segment->length = entry->tail_length;
+    }
+    return segments;
+}
 
-    // Escribir el encabezado actualizado de nuevo en el archivador
-    write_header(fd, &header);
-    close(fd);
+/*
+ * Función para obtener los bytes de datos que caben en un bloque
+ * header: Encabezado del archivador
+ * Retorna: Capacidad de un bloque (en v1 el bloque reserva espacio para next_block)
+ */
+size_t block_payload_size(StarHeader *header)
+{
+    return header->version == 1 ? sizeof(((DataBlock *)0)->data) : (size_t)block_size;
 }
 
-FragmentationInfo analyze_fragmentation(int fd, StarHeader *header)
+/*
+ * Función para obtener el número de bloques propios de un archivo (sin el bloque de colas)
+ * header: Encabezado del archivador
+ * entry: Entrada del archivo
+ * Retorna: Número de bloques
+ */
+int file_block_count(StarHeader *header, FileEntry *entry)
 {
-    FragmentationInfo info;
-    memset(&info, 0, sizeof(FragmentationInfo));
+    size_t payload_size = block_payload_size(header);
+    return (int)((entry->stored_size - entry->tail_length + payload_size - 1) / payload_size);
+}
 
-    // Get file size and calculate total blocks
-    off_t file_size = lseek(fd, 0, SEEK_END);
-    info.total_blocks = (file_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+/*
+ * Función para extraer todos los archivos con un grupo de hilos (-j)
+ * Los datos de cada archivo se dividen en tramos de hasta TASK_CHUNK_BLOCKS bloques que se escriben con
+ * desplazamientos explícitos, de modo que ningún hilo depende de la posición de otro. Los archivos
+ * de salida se crean aquí y cada tarea abre el suyo mientras lo escribe, así que no hay más de
+ * job_count descriptores de salida abiertos aunque el archivador tenga miles de archivos.
+ * fd: Descriptor de archivo del archivador
+ * map: Archivador mapeado en memoria (NULL si no está disponible)
+ * map_size: Tamaño del mapeo en bytes
+ * header: Encabezado del archivador
+ * engine: Motor de copia; se actualiza con el más sencillo que llegó a usarse
+ */
+void extract_star_parallel(int fd, unsigned char *map, off_t map_size, StarHeader *header, ExtractEngine *engine)
+{
+    ParallelExtract ctx;
+    memset(&ctx, 0, sizeof(ParallelExtract));
+    ctx.fd = fd;
+    ctx.map = map;
+    ctx.map_size = map_size;
+    ctx.header = header;
 
-    // Allocate block status array
-    info.block_status = calloc(info.total_blocks, sizeof(int));
-    if (!info.block_status)
+    ctx.segments = calloc(header->file_count + 1, sizeof(Segment *));
+    ctx.pending_tasks = calloc(header->file_count + 1, sizeof(int));
+    ctx.engines = calloc(job_count, sizeof(ExtractEngine));
+    int *segment_counts = calloc(header->file_count + 1, sizeof(int));
+    if (!ctx.segments || !ctx.pending_tasks || !ctx.engines || !segment_counts)
     {
-        fprintf(stderr, "Error: No se pudo asignar memoria\n");
-        return info;
+        perror("Error de memoria");
+        fail_operation();
     }
-
-    // Mark header blocks
-    int header_blocks = (sizeof(StarHeader) + BLOCK_SIZE - 1) / BLOCK_SIZE;
-    for (int i = 0; i < header_blocks && i < info.total_blocks; i++)
+    for (int w = 0; w < job_count; w++)
     {
-        info.block_status[i] = 1;
-        info.used_blocks++;
+        ctx.engines[w] = *engine;
     }
 
-    // Mark blocks used by files
+    // Crear los archivos de salida y obtener sus rangos de datos
+    TaskQueue *queues = create_task_queues(job_count);
     for (int i = 0; i < header->file_count; i++)
     {
-        int current_block = header->files[i].start_block;
-        while (current_block != -1 && current_block < info.total_blocks)
+        if (header->files[i].filename[0] == '\0')
         {
-            if (!info.block_status[current_block])
-            { // Only count if not already marked
-                info.block_status[current_block] = 1;
-                info.used_blocks++;
-            }
-
-            // Read next block
-            DataBlock block;
-            lseek(fd, current_block * BLOCK_SIZE, SEEK_SET);
-            if (read(fd, &block, sizeof(DataBlock)) != sizeof(DataBlock))
-            {
-                break;
-            }
-            current_block = block.next_block;
+            continue; // Posición vacía del directorio
+        }
+        verbose_print("Extrayendo:", 1);
+        if (verbose_level >= 1)
+        {
+            printf(" %s\n", header->files[i].filename);
         }
-    }
 
-    // Calculate free blocks
-    info.free_blocks = info.total_blocks - info.used_blocks;
-
-    // Analyze fragmentation
-    int current_free_chunk = 0;
-    info.fragmented_blocks = 0;
-    info.largest_free_chunk = 0;
-    info.smallest_free_chunk = info.total_blocks;
+        int file_fd = open(header->files[i].filename, O_CREAT | O_WRONLY | O_TRUNC, 0666);
+        if (file_fd < 0)
+        {
+            perror("Error al crear archivo de salida");
+            fail_operation();
+        }
+        // Reservar el tamaño final para que los tramos se escriban en cualquier orden
+        if (ftruncate(file_fd, header->files[i].size) != 0)
+        {
+            perror("Error al reservar archivo de salida");
+            close(file_fd);
+            fail_operation();
+        }
+        close(file_fd);
 
-    for (int i = 0; i < info.total_blocks; i++)
-    {
-        if (info.block_status[i] == 0)
+        // Los archivos comprimidos se extraen después, cada uno con todo el grupo de hilos
+        if (header->files[i].codec != CODEC_NONE)
         {
-            current_free_chunk++;
-            if (i == info.total_blocks - 1 || info.block_status[i + 1] == 1)
-            {
-                if (current_free_chunk > 0)
-                {
-                    // Update largest/smallest chunks
-                    if (current_free_chunk > info.largest_free_chunk)
-                    {
-                        info.largest_free_chunk = current_free_chunk;
-                    }
-                    if (current_free_chunk < info.smallest_free_chunk)
-                    {
-                        info.smallest_free_chunk = current_free_chunk;
-                    }
-                    // Count single blocks as fragmented
-                    if (current_free_chunk == 1)
-                    {
-                        info.fragmented_blocks++;
-                    }
-                }
-                current_free_chunk = 0;
-            }
+            continue;
         }
-    }
 
-    // If no free blocks were found, reset smallest_free_chunk
-    if (info.free_blocks == 0)
-    {
-        info.smallest_free_chunk = 0;
+        // Repartir los tramos: todos los de un archivo van a la misma cola
+        ctx.segments[i] = file_segments(header, &header->files[i], &segment_counts[i]);
+        TaskQueue *queue = &queues[i % job_count];
+        int queued = queue->tail;
+        queue_file_tasks(queue, i, ctx.segments[i], segment_counts[i]);
+        ctx.pending_tasks[i] = queue->tail - queued;
     }
 
-    // Calculate fragmentation ratio
-    info.fragmentation_ratio = info.free_blocks > 0 ? (float)info.fragmented_blocks / info.free_blocks : 0;
-
-    return info;
-}
+    run_task_pool(queues, job_count, extract_task, &ctx);
 
-void print_fragmentation_visualization(FragmentationInfo *info, StarHeader *header)
-{
-    if (!info || !info->block_status)
+    for (int i = 0; i < header->file_count; i++)
     {
-        fprintf(stderr, "Error: Información de fragmentación no válida\n");
-        return;
+        if (header->files[i].filename[0] != '\0' && header->files[i].codec != CODEC_NONE)
+        {
+            int file_fd = open(header->files[i].filename, O_WRONLY);
+            if (file_fd < 0)
+            {
+                perror("Error al abrir archivo de salida");
+                fail_operation();
+            }
+            extract_compressed_file(fd, header, &header->files[i], file_fd);
+            cache_release(file_fd, 0, 0);
+            close(file_fd);
+        }
     }
 
-    printf("\nEstado de Fragmentación:\n");
-    printf("------------------------\n");
-
-    // Basic block info - now with validation
-    printf("Bloques totales: %d\n", info->total_blocks);
-    printf("Bloques usados:  %d (%.1f%%)\n",
-           info->used_blocks,
-           (float)info->used_blocks / info->total_blocks * 100);
-    printf("Bloques libres: %d\n", info->free_blocks);
-
-    // Block distribution
-    printf("\nDistribución de bloques:\n");
-    printf("H = Header | █ = Usado | ░ = Libre\n");
-
-    printf("Bloque:  ");
-    for (int i = 0; i < info->total_blocks; i++)
+    if (verbose_level >= 2)
     {
-        printf("%-2d ", i);
+        for (int i = 0; i < header->file_count; i++)
+        {
+            if (header->files[i].filename[0] == '\0')
+            {
+                continue;
+            }
+            printf("%s:\n", header->files[i].filename);
+            printf("  Tamaño: %lld bytes\n", (long long)header->files[i].size);
+            printf("  Bloques extraídos: %d\n", file_block_count(header, &header->files[i]));
+        }
     }
-    printf("\nEstado:  ");
 
-    int header_blocks = (sizeof(StarHeader) + BLOCK_SIZE - 1) / BLOCK_SIZE;
-    for (int i = 0; i < info->total_blocks; i++)
+    // Reportar el motor más sencillo que llegó a usar algún trabajador
+    for (int w = 0; w < job_count; w++)
     {
-        if (i < header_blocks)
-        {
-            printf("H  ");
-        }
-        else if (info->block_status[i])
-        {
-            printf("█  ");
-        }
-        else
+        if (ctx.engines[w] > *engine)
         {
-            printf("░  ");
+            *engine = ctx.engines[w];
         }
     }
 
-    printf("\n\nContenido:\n");
+    // Limpieza
     for (int i = 0; i < header->file_count; i++)
     {
-        printf("- Bloque %d: %s (%lld bytes)\n",
-               header->files[i].start_block,
-               header->files[i].filename,
-               (long long)header->files[i].size);
-    }
-
-    if (info->fragmented_blocks > 0)
-    {
-        printf("\nFragmentación: %.1f%% (%d bloques)\n",
-               info->fragmentation_ratio * 100,
-               info->fragmented_blocks);
+        free(ctx.segments[i]);
     }
+    destroy_task_queues(queues, job_count);
+    free(segment_counts);
+    free(ctx.engines);
+    free(ctx.pending_tasks);
+    free(ctx.segments);
 }
 
 /*
- * Función para desfragmentar (empacar) el archivador
- * star_filename: Nombre del archivo de archivado
+ * Función para extraer un tramo de un archivo (tarea de extract_star_parallel)
+ * arg: Puntero a ParallelExtract
+ * task: Tramo a extraer
+ * worker_id: Número del trabajador que ejecuta la tarea
  */
-void pack_star(char *star_filename)
+void extract_task(void *arg, BlockTask *task, int worker_id)
 {
-    int fd = open(star_filename, O_RDWR);
-    if (fd < 0)
+    ParallelExtract *ctx = (ParallelExtract *)arg;
+    off_t file_offset = task->file_offset;
+
+    int unchecked = 0;
+    const char *filename = ctx->header->files[task->file_index].filename;
+    int file_fd = open(filename, O_WRONLY);
+    if (file_fd < 0)
     {
-        perror("Error al abrir el archivo empaquetado");
-        exit(EXIT_FAILURE);
+        perror("Error al abrir archivo de salida");
+        fail_operation();
     }
-
-    StarHeader orig_header;
-    read_header(fd, &orig_header);
-
-    // Análisis inicial
-    FragmentationInfo before_info = analyze_fragmentation(fd, &orig_header);
-    if (verbose_level >= 1)
+    int bad;
+    if (ctx->engines[worker_id] == EXTRACT_DIRECT)
     {
-        printf("\nAntes de desfragmentar:");
-        print_fragmentation_visualization(&before_info, &orig_header);
+        // Los demás trabajadores ya mantienen el disco ocupado: sin hilo de lectura anticipada
+        Segment segment = {task->archive_offset, task->file_offset, task->length};
+        bad = extract_segments(ctx->fd, &segment, 1, file_fd, filename, &unchecked, 0);
     }
-
-    // Si no hay archivos, salir
-    if (orig_header.file_count == 0)
+    else
     {
-        free(before_info.block_status);
-        close(fd);
-        return;
+        bad = verify_block_range(ctx->fd, ctx->map, ctx->map_size, task->archive_offset, task->length, filename,
+                                 &unchecked);
+        copy_payload_range(ctx->fd, ctx->map, ctx->map_size, task->archive_offset, task->length,
+                           file_fd, &file_offset, &ctx->engines[worker_id]);
     }
+    __atomic_add_fetch(&corrupt_block_count, bad, __ATOMIC_RELAXED);
 
-    // Crear nueva estructura header
-    StarHeader new_header;
-    memcpy(&new_header, &orig_header, sizeof(StarHeader));
-    new_header.free_block_list = -1;
-
-    // Calcular bloques del header
-    int header_blocks = (sizeof(StarHeader) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    // El último tramo terminado de un archivo descarta su caché
+    if (__atomic_sub_fetch(&ctx->pending_tasks[task->file_index], 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        cache_release(file_fd, 0, 0);
+    }
+    close(file_fd);
+}
 
-    // Crear buffer temporal para almacenar todos los bloques de datos
-    DataBlock *data_blocks = malloc(orig_header.file_count * sizeof(DataBlock));
-    if (!data_blocks)
+/*
+ * Función para crear el archivador con un grupo de hilos (-j)
+ * Se obtiene el tamaño de todas las entradas, se reserva un rango contiguo de bloques para
+ * cada archivo y los hilos llenan sus rangos con pwrite; el encabezado se escribe una vez al final.
+ * fd: Descriptor de archivo del archivador (vacío)
+ * header: Encabezado del archivador a llenar
+ * file_count: Número de archivos a agregar
+ * files: Array de nombres de archivos a agregar
+ */
+void create_star_parallel(int fd, StarHeader *header, int file_count, char *files[])
+{
+    ParallelCreate ctx;
+    ctx.fd = fd;
+    ctx.header = header;
+    ctx.input_fds = calloc(file_count + 1, sizeof(int));
+    int *slots = calloc(file_count + 1, sizeof(int)); // Posición de cada archivo en el directorio
+    if (!ctx.input_fds || !slots)
     {
         perror("Error de memoria");
-        free(before_info.block_status);
-        close(fd);
-        exit(EXIT_FAILURE);
+        fail_operation();
     }
 
-    // Primero, recopilar todos los bloques de datos en orden
-    int data_block_count = 0;
-    for (int i = 0; i < orig_header.file_count; i++)
+    // Reservar un rango contiguo de bloques (un solo extent) para cada archivo, justo después del encabezado
+    int next_block = HEADER_BLOCKS;
+    for (int i = 0; i < file_count; i++)
     {
-        // Leer el bloque de datos del archivo
-        lseek(fd, orig_header.files[i].start_block * BLOCK_SIZE, SEEK_SET);
-        if (read(fd, &data_blocks[data_block_count], sizeof(DataBlock)) == sizeof(DataBlock))
+        ctx.input_fds[i] = open(files[i], O_RDONLY);
+        if (ctx.input_fds[i] < 0)
         {
-            // Actualizar el header para el nuevo inicio de archivo
-            new_header.files[i].start_block = header_blocks + data_block_count;
-            data_block_count++;
+            perror("Error al abrir archivo de entrada");
+            fail_operation();
         }
-    }
+        struct stat st;
+        fstat(ctx.input_fds[i], &st);
 
-    // Segundo, escribir el nuevo header
-    lseek(fd, 0, SEEK_SET);
-    write_header(fd, &new_header);
-
-    // Tercero, escribir los bloques de datos de manera contigua
-    for (int i = 0; i < data_block_count; i++)
-    {
-        // Actualizar el puntero al siguiente bloque
-        data_blocks[i].next_block = (i < data_block_count - 1) ? (header_blocks + i + 1) : -1;
+        FileEntry entry;
+        memset(&entry, 0, sizeof(FileEntry));
+        strncpy(entry.filename, files[i], MAX_FILENAME_LENGTH);
+        entry.filename[MAX_FILENAME_LENGTH - 1] = '\0'; // Asegurar terminación nula
+        entry.size = st.st_size;
+        entry.codec = CODEC_NONE;
+        entry.stored_size = st.st_size;
+        entry.start_block = -1;
+        entry.extent_index = header->extent_count;
+        entry.extent_count = 0;
+        entry.tail_length = tail_pack_length(entry.size);
+        entry_set_metadata(&entry, &st, ctx.input_fds[i]);
 
-        // Escribir el bloque en su nueva posición
-        lseek(fd, (header_blocks + i) * BLOCK_SIZE, SEEK_SET);
-        if (write(fd, &data_blocks[i], sizeof(DataBlock)) != sizeof(DataBlock))
+        int block_count = file_block_count(header, &entry);
+        if (block_count > 0)
         {
-            perror("Error al escribir bloque");
-            free(data_blocks);
-            free(before_info.block_status);
-            close(fd);
-            exit(EXIT_FAILURE);
+            entry.start_block = next_block;
+            entry.extent_count = 1;
+            extent_reserve(header, 1);
+            header->extents[header->extent_count].start_block = next_block;
+            header->extents[header->extent_count].length = block_count;
+            header->extent_count++;
+            next_block += block_count;
         }
+        slots[i] = dir_add_entry(header, &entry);
     }
 
-    // Truncar el archivo al nuevo tamaño
-    int total_blocks = header_blocks + data_block_count;
-    off_t new_size = total_blocks * BLOCK_SIZE;
-    if (ftruncate(fd, new_size) != 0)
+    // Fijar el tamaño final para que los hilos no extiendan el archivo de forma concurrente, y
+    // ampliar la tabla de sumas para que los hilos solo escriban en sus propias entradas
+    if (ftruncate(fd, (off_t)next_block * block_size) != 0)
     {
-        perror("Error al truncar archivo");
+        perror("Error al reservar el archivo empaquetado");
+        fail_operation();
     }
 
-    // Análisis final
-    FragmentationInfo after_info = analyze_fragmentation(fd, &new_header);
-    if (verbose_level >= 1)
+    // Las colas se empaquetan antes de repartir los tramos, en bloques después de los rangos
+    for (int i = 0; i < file_count; i++)
     {
-        printf("\nDespués de desfragmentar:");
-        print_fragmentation_visualization(&after_info, &new_header);
-
-        int blocks_saved = before_info.total_blocks - after_info.total_blocks;
-        printf("\nResumen de optimización:\n");
-        printf("- Tamaño antes: %d bloques (%ld bytes)\n",
-               before_info.total_blocks, (long)before_info.total_blocks * BLOCK_SIZE);
-        printf("- Tamaño después: %d bloques (%ld bytes)\n",
-               after_info.total_blocks, (long)after_info.total_blocks * BLOCK_SIZE);
-        if (blocks_saved > 0)
+        FileEntry *entry = &header->files[slots[i]];
+        if (entry->tail_length > 0)
         {
-            printf("- Espacio recuperado: %d bloques (%ld bytes)\n",
-                   blocks_saved, (long)blocks_saved * BLOCK_SIZE);
+            tail_copy(fd, header, entry, ctx.input_fds[i], entry->size - entry->tail_length, entry->tail_length);
         }
     }
+    checksum_reserve(append_block_index(fd));
 
-    // Limpieza
-    free(data_blocks);
-    free(before_info.block_status);
-    free(after_info.block_status);
-    close(fd);
-}
-
-/*
- * Función para agregar un archivo al archivador
- * fd: Descriptor de archivo del archivador
- * header: Puntero al encabezado del archivador
- * filename: Nombre del archivo a agregar
- */
-void add_file_to_star(int fd, StarHeader *header, char *filename)
-{
-    if (header->file_count >= MAX_FILES)
+    // Repartir los tramos (sin la cola): todos los de un archivo van a la misma cola
+    TaskQueue *queues = create_task_queues(job_count);
+    for (int i = 0; i < file_count; i++)
     {
-        fprintf(stderr, "Se alcanzó el número máximo de archivos en el empaquetado.\n");
-        exit(EXIT_FAILURE);
+        int segment_count;
+        Segment *segments = file_segments(header, &header->files[slots[i]], &segment_count);
+        if (header->files[slots[i]].tail_length > 0)
+        {
+            segment_count--;
+        }
+        queue_file_tasks(&queues[i % job_count], i, segments, segment_count);
+        free(segments);
     }
+    run_task_pool(queues, job_count, create_task, &ctx);
 
-    // Copiar el nombre del archivo en la entrada de archivo
-    strncpy(header->files[header->file_count].filename, filename, MAX_FILENAME_LENGTH);
-    header->files[header->file_count].filename[MAX_FILENAME_LENGTH - 1] = '\0'; // Asegurar terminación nula
-
-    // Abrir el archivo de entrada para lectura
-    int file_fd = open(filename, O_RDONLY);
-    if (file_fd < 0)
+    for (int i = 0; i < file_count; i++)
     {
-        perror("Error al abrir archivo de entrada");
-        exit(EXIT_FAILURE);
-    }
+        cache_release(ctx.input_fds[i], 0, 0);
+        close(ctx.input_fds[i]);
 
-    // Obtener el tamaño del archivo de entrada
-    struct stat st;
-    fstat(file_fd, &st);
-    header->files[header->file_count].size = st.st_size;
+        char message[300];
+        snprintf(message, sizeof(message), "Archivo '%s' agregado al empaquetado.", files[i]);
+        verbose_print(message, 1);
+    }
 
-    int start_block = -1;              // Índice del primer bloque de datos para el archivo
-    int prev_block_index = -1;         // Índice del bloque de datos anterior
-    off_t remaining_size = st.st_size; // Bytes restantes por leer del archivo de entrada
+    destroy_task_queues(queues, job_count);
+    free(ctx.input_fds);
+    free(slots);
+}
 
-    // Leer el archivo de entrada y escribir bloques de datos en el archivador
-    while (remaining_size > 0)
-    {
-        int current_block;
-        // Verificar si hay bloques libres para reutilizar
-        if (header->free_block_list != -1)
-        {
-            // Reutilizar un bloque libre
-            current_block = header->free_block_list;
-            DataBlock free_block;
-            lseek(fd, current_block * BLOCK_SIZE, SEEK_SET);
-            read(fd, &free_block, sizeof(DataBlock));
-            header->free_block_list = free_block.next_block; // Actualizar lista de bloques libres
-        }
-        else
-        {
-            // No hay bloques libres; agregar al final del archivador
-            current_block = lseek(fd, 0, SEEK_END) / BLOCK_SIZE;
-        }
+/*
+ * Función para escribir un tramo de un archivo (tarea de create_star_parallel)
+ * Los bloques del tramo son contiguos en el archivador, así que se escriben con un solo pwrite.
+ * arg: Puntero a ParallelCreate
+ * task: Tramo a escribir
+ * worker_id: Número del trabajador que ejecuta la tarea
+ */
+void create_task(void *arg, BlockTask *task, int worker_id)
+{
+    (void)worker_id;
+    ParallelCreate *ctx = (ParallelCreate *)arg;
+    int input_fd = ctx->input_fds[task->file_index];
 
-        if (start_block == -1)
-        {
-            start_block = current_block; // Establecer bloque inicial para el archivo
-        }
+    // El tramo cabe en un búfer del grupo (TASK_CHUNK_BYTES); el último bloque se completa con ceros
+    size_t padded_length = (task->length + block_size - 1) / block_size * block_size;
+    unsigned char *buffer = pool_acquire();
 
-        // Inicializar un nuevo bloque de datos
-        DataBlock block;
-        memset(&block, 0, sizeof(DataBlock));
-        ssize_t bytes_read = read(file_fd, block.data, sizeof(block.data));
+    size_t filled = 0;
+    while (filled < task->length)
+    {
+        ssize_t bytes_read = io_pread(input_fd, buffer + filled, task->length - filled, task->file_offset + filled);
         if (bytes_read < 0)
         {
             perror("Error al leer el archivo");
-            close(file_fd);
-            exit(EXIT_FAILURE);
+            fail_operation();
         }
-
-        block.next_block = -1; // Inicializar next_block como -1
-
-        // Escribir el bloque de datos en el archivador
-        lseek(fd, current_block * BLOCK_SIZE, SEEK_SET);
-        write(fd, &block, sizeof(DataBlock));
-
-        // Actualizar next_block del bloque anterior para apuntar al bloque actual
-        if (prev_block_index != -1)
+        if (bytes_read == 0)
         {
-            lseek(fd, prev_block_index * BLOCK_SIZE, SEEK_SET);
-            DataBlock prev_block;
-            read(fd, &prev_block, sizeof(DataBlock));
-            prev_block.next_block = current_block;
-            lseek(fd, prev_block_index * BLOCK_SIZE, SEEK_SET);
-            write(fd, &prev_block, sizeof(DataBlock));
+            break; // El archivo se acortó después de obtener su tamaño
         }
-
-        prev_block_index = current_block;
-        remaining_size -= bytes_read;
+        filled += bytes_read;
     }
+    memset(buffer + filled, 0, padded_length - filled);
+    cache_release(input_fd, task->file_offset, filled);
 
-    // Actualizar la entrada de archivo con el bloque inicial
-    header->files[header->file_count].start_block = start_block;
-    header->file_count++;
-
-    close(file_fd);
-
-    // Mensaje consolidado de verbosidad
-    char message[300];
-    snprintf(message, sizeof(message), "Archivo '%s' agregado al empaquetado.", filename);
-    verbose_print(message, 1);
+    if (archive_pwrite(ctx->fd, buffer, padded_length, task->archive_offset) != (ssize_t)padded_length)
+    {
+        perror("Error al escribir bloque");
+        fail_operation();
+    }
+    for (size_t done = 0; done < padded_length; done += block_size)
+    {
+        checksum_record((int)((task->archive_offset + (off_t)done) / block_size), buffer + done, block_size);
+    }
+    pool_release(buffer);
 }
 
 /*
- * Función para eliminar un archivo del archivador
- * fd: Descriptor de archivo del archivador
- * header: Puntero al encabezado del archivador
- * filename: Nombre del archivo a eliminar
+ * Función para crear una cola de tareas por trabajador
+ * worker_count: Número de trabajadores
+ * Retorna: Array de colas (se libera con destroy_task_queues)
  */
-void remove_file_from_star(int fd, StarHeader *header, char *filename)
+TaskQueue *create_task_queues(int worker_count)
 {
-    int index = find_file_entry(header, filename);
-    if (index == -1)
-    {
-        fprintf(stderr, "El archivo '%s' no se encontró en el empaquetado.\n", filename);
-        return;
-    }
-
-    // Agregar los bloques del archivo a la lista de bloques libres
-    int current_block = header->files[index].start_block;
-    while (current_block != -1)
+    TaskQueue *queues = calloc(worker_count, sizeof(TaskQueue));
+    if (!queues)
     {
-        DataBlock block;
-        lseek(fd, current_block * BLOCK_SIZE, SEEK_SET);
-        read(fd, &block, sizeof(DataBlock));
-
-        int next_block = block.next_block;
-
-        // Agregar el bloque a la lista de bloques libres
-        block.next_block = header->free_block_list;
-        header->free_block_list = current_block;
-
-        // Escribir el bloque actualizado de nuevo en el archivador
-        lseek(fd, current_block * BLOCK_SIZE, SEEK_SET);
-        write(fd, &block, sizeof(DataBlock));
-
-        current_block = next_block;
+        perror("Error de memoria");
+        fail_operation();
     }
-
-    // Eliminar la entrada de archivo del encabezado
-    for (int j = index; j < header->file_count - 1; j++)
+    for (int w = 0; w < worker_count; w++)
     {
-        header->files[j] = header->files[j + 1];
+        pthread_mutex_init(&queues[w].lock, NULL);
     }
-    header->file_count--;
+    return queues;
 }
 
 /*
- * Función para imprimir un mensaje basado en el nivel de verbosidad
- * message: El mensaje a imprimir
- * level: El nivel de verbosidad requerido para imprimir el mensaje
+ * Función para liberar las colas de tareas
+ * queues: Array de colas
+ * worker_count: Número de colas
  */
-void verbose_print(const char *message, int level)
+void destroy_task_queues(TaskQueue *queues, int worker_count)
 {
-    if (verbose_level >= level)
+    for (int w = 0; w < worker_count; w++)
     {
-        printf("%s\n", message);
+        free(queues[w].tasks);
+        pthread_mutex_destroy(&queues[w].lock);
     }
+    free(queues);
 }
 
 /*
- * Función para encontrar el índice de una entrada de archivo en el encabezado del archivador
- * header: Puntero al encabezado del archivador
- * filename: Nombre del archivo a encontrar
- * Retorna: Índice del archivo en el encabezado, o -1 si no se encuentra
+ * Función para dividir los rangos de un archivo en tramos de hasta TASK_CHUNK_BLOCKS bloques y encolarlos
+ * queue: Cola que recibe los tramos (crece según haga falta)
+ * file_index: Índice del archivo
+ * segments: Rangos de datos del archivo
+ * count: Número de rangos
  */
-int find_file_entry(StarHeader *header, char *filename)
+void queue_file_tasks(TaskQueue *queue, int file_index, Segment *segments, int count)
 {
-    for (int i = 0; i < header->file_count; i++)
+    size_t max_length = (size_t)TASK_CHUNK_BYTES;
+    for (int i = 0; i < count; i++)
     {
-        if (strcmp(header->files[i].filename, filename) == 0)
+        for (size_t done = 0; done < segments[i].length; done += max_length)
         {
-            return i;
+            BlockTask task;
+            task.file_index = file_index;
+            task.archive_offset = segments[i].archive_offset + done;
+            task.file_offset = segments[i].file_offset + done;
+            task.length = segments[i].length - done < max_length ? segments[i].length - done : max_length;
+            queue_task(queue, &task);
         }
     }
-    return -1;
 }
 
 /*
- * Función para leer el encabezado del archivador desde el archivo
- * fd: Descriptor de archivo del archivador
- * header: Puntero a la estructura de encabezado a llenar
+ * Función para agregar una tarea al final de una cola (la cola crece según haga falta)
+ * queue: Cola que recibe la tarea
+ * task: Tarea a copiar en la cola
  */
-void read_header(int fd, StarHeader *header)
+void queue_task(TaskQueue *queue, BlockTask *task)
 {
-    lseek(fd, 0, SEEK_SET); // Posicionarse al inicio del archivo
-    read(fd, header, sizeof(StarHeader));
+    if (queue->tail == queue->capacity)
+    {
+        queue->capacity = queue->capacity ? queue->capacity * 2 : 64;
+        queue->tasks = realloc(queue->tasks, queue->capacity * sizeof(BlockTask));
+        if (!queue->tasks)
+        {
+            perror("Error de memoria");
+            fail_operation();
+        }
+    }
+    queue->tasks[queue->tail++] = *task;
 }
 
 /*
- * Función para escribir el encabezado del archivador en el archivo
- * fd: Descriptor de archivo del archivador
- * header: Puntero a la estructura de encabezado a escribir
+ * Función para ejecutar todas las tareas encoladas en un grupo de hilos
+ * Los trabajadores ociosos roban tareas del final de las demás colas, así un archivo
+ * grande no deja hilos sin trabajo.
+ * queues: Una cola por trabajador, ya llena
+ * worker_count: Número de trabajadores
+ * fn: Función que procesa cada tarea
+ * ctx: Contexto de la operación que se pasa a fn
  */
-void write_header(int fd, StarHeader *header)
+void run_task_pool(TaskQueue *queues, int worker_count, BlockTaskFn fn, void *ctx)
 {
-    lseek(fd, 0, SEEK_SET); // Posicionarse al inicio del archivo
-    write(fd, header, sizeof(StarHeader));
-}
\ No newline at end of file
+    // Con un solo trabajador las tareas se procesan en el hilo que llama (así un error dentro de
+    // una tarea vuelve a la función de la biblioteca que la inició)
+    if (worker_count == 1)
+    {
+        PoolWorker worker = {queues, worker_count, fn, ctx, 0};
+        pool_worker(&worker);
+        return;
+    }
+
+    pthread_t *threads = malloc(worker_count * sizeof(pthread_t));
+    PoolWorker *workers = malloc(worker_count * sizeof(PoolWorker));
+    if (!threads || !workers)
+    {
+        perror("Error de memoria");
+        fail_operation();
+    }
+
+    for (int w = 0; w < worker_count; w++)
+    {
+        workers[w].queues = queues;
+        workers[w].worker_count = worker_count;
+        workers[w].fn = fn;
+        workers[w].ctx = ctx;
+        workers[w].id = w;
+        if (pthread_create(&threads[w], NULL, pool_worker, &workers[w]) != 0)
+        {
+            perror("Error al crear hilo");
+            fail_operation();
+        }
+    }
+    for (int w = 0; w < worker_count; w++)
+    {
+        pthread_join(threads[w], NULL);
+    }
+
+    free(threads);
+    free(workers);
+}
+
+/*
+ * Función ejecutada por cada hilo del grupo de trabajadores
+ * arg: Puntero a PoolWorker
+ */
+void *pool_worker(void *arg)
+{
+    PoolWorker *worker = (PoolWorker *)arg;
+
+    while (1)
+    {
+        BlockTask task;
+        int found = 0;
+
+        // Tomar del frente de la cola propia; si está vacía, robar del final de las demás
+        for (int k = 0; k < worker->worker_count && !found; k++)
+        {
+            TaskQueue *queue = &worker->queues[(worker->id + k) % worker->worker_count];
+            pthread_mutex_lock(&queue->lock);
+            if (queue->head < queue->tail)
+            {
+                task = k == 0 ? queue->tasks[queue->head++] : queue->tasks[--queue->tail];
+                found = 1;
+            }
+            pthread_mutex_unlock(&queue->lock);
+        }
+        if (!found)
+        {
+            break; // No se agregan tareas nuevas: todas las colas vacías significa que terminamos
+        }
+
+        worker->fn(worker->ctx, &task, worker->id);
+    }
+    return NULL;
+}
+
+/*
+ * Función para obtener un códec por su identificador
+ * codec: Identificador guardado en FileEntry.codec
+ * Retorna: Códec; sale del programa si no existe o no se compiló
+ */
+const Codec *find_codec(int codec)
+{
+    if (codec < 0 || codec >= CODEC_COUNT || (codec != CODEC_NONE && !codecs[codec].compress))
+    {
+        fprintf(stderr, "Error: códec de compresión %d no disponible en este programa\n", codec);
+        fail_operation();
+    }
+    return &codecs[codec];
+}
+
+/*
+ * Función para interpretar el nombre de un códec de --compress
+ * name: Nombre del códec
+ * Retorna: Identificador del códec; sale del programa si no existe o no se compiló
+ */
+int parse_codec(const char *name)
+{
+    for (int i = 0; i < CODEC_COUNT; i++)
+    {
+        if (strcmp(codecs[i].name, name) == 0)
+        {
+            if (i != CODEC_NONE && !codecs[i].compress)
+            {
+                fprintf(stderr, "El códec '%s' no se incluyó al compilar este programa\n", name);
+                fail_operation();
+            }
+            return i;
+        }
+    }
+    fprintf(stderr, "Códec de compresión desconocido: '%s'\n", name);
+    fail_operation();
+}
+
+/*
+ * Función para interpretar el argumento de --block-size (bytes, o con sufijo K o M)
+ * text: Tamaño indicado por el usuario, por ejemplo "4K", "1M" o "65536"
+ * Retorna: Tamaño de bloque en bytes (termina el programa si no es válido)
+ */
+int parse_block_size(const char *text)
+{
+    long long size = parse_size(text);
+    if (size > MAX_BLOCK_SIZE || !valid_block_size((int)size))
+    {
+        fprintf(stderr, "Tamaño de bloque no válido: '%s' (debe ser una potencia de 2 entre 4K y 4M)\n", text);
+        fail_operation();
+    }
+    return (int)size;
+}
+
+/*
+ * Función para interpretar un tamaño en bytes, con sufijo K, M o G opcional
+ * text: Tamaño indicado por el usuario, por ejemplo "64M"
+ * Retorna: Tamaño en bytes, o -1 si el texto no es válido
+ */
+long long parse_size(const char *text)
+{
+    char *end;
+    long long size = strtoll(text, &end, 10);
+    if (*end == 'K' || *end == 'k')
+    {
+        size *= 1024;
+        end++;
+    }
+    else if (*end == 'M' || *end == 'm')
+    {
+        size *= 1024 * 1024;
+        end++;
+    }
+    else if (*end == 'G' || *end == 'g')
+    {
+        size *= 1024 * 1024 * 1024;
+        end++;
+    }
+    return end == text || *end != '\0' || size < 0 ? -1 : size;
+}
+
+/*
+ * Función para comprobar que un tamaño de bloque se puede usar
+ * size: Tamaño de bloque en bytes
+ * Retorna: 1 si es una potencia de 2 entre MIN_BLOCK_SIZE y MAX_BLOCK_SIZE, 0 si no
+ */
+int valid_block_size(int size)
+{
+    return size >= MIN_BLOCK_SIZE && size <= MAX_BLOCK_SIZE && (size & (size - 1)) == 0;
+}
+
+/*
+ * Función para guardar un archivo comprimido
+ * El archivo se divide en tramos de COMPRESS_FRAME_SIZE bytes que se comprimen de forma independiente
+ * (así se puede leer cualquier tramo sin descomprimir los anteriores). Los datos guardados son
+ * una tabla con la longitud comprimida de cada tramo seguida de los tramos. Cada lote de
+ * COMPRESS_BATCH_FRAMES tramos se comprime en paralelo con el grupo de hilos (-j). Si lo que queda
+ * después del último bloque completo es a lo sumo medio bloque, va a un bloque de colas.
+ * fd: Descriptor de archivo del archivador
+ * header: Puntero al encabezado del archivador
+ * entry: Entrada del archivo, con nombre y tamaño ya llenos
+ * file_fd: Descriptor del archivo de entrada
+ */
+void add_compressed_file(int fd, StarHeader *header, FileEntry *entry, int file_fd)
+{
+    const Codec *codec = find_codec(compress_codec);
+    int frame_count = (int)((entry->size + COMPRESS_FRAME_SIZE - 1) / COMPRESS_FRAME_SIZE);
+    size_t table_size = frame_count * sizeof(uint32_t);
+    uint32_t *frame_table = calloc(frame_count + 1, sizeof(uint32_t));
+
+    CompressBatch batch;
+    batch.input_fd = file_fd;
+    batch.codec = codec;
+    batch.input = calloc(COMPRESS_BATCH_FRAMES, sizeof(unsigned char *));
+    batch.output = calloc(COMPRESS_BATCH_FRAMES, sizeof(unsigned char *));
+    batch.input_lengths = calloc(COMPRESS_BATCH_FRAMES, sizeof(size_t));
+    batch.output_lengths = calloc(COMPRESS_BATCH_FRAMES, sizeof(size_t));
+    library_track(free, frame_table);
+    library_track(free, batch.input);
+    library_track(free, batch.output);
+    library_track(free, batch.input_lengths);
+    library_track(free, batch.output_lengths);
+    if (!frame_table || !batch.input || !batch.output || !batch.input_lengths || !batch.output_lengths)
+    {
+        perror("Error de memoria");
+        fail_operation();
+    }
+    for (int k = 0; k < COMPRESS_BATCH_FRAMES; k++)
+    {
+        batch.input[k] = malloc(COMPRESS_FRAME_SIZE);
+        batch.output[k] = malloc(codec->bound(COMPRESS_FRAME_SIZE));
+        library_track(free, batch.input[k]);
+        library_track(free, batch.output[k]);
+        if (!batch.input[k] || !batch.output[k])
+        {
+            perror("Error de memoria");
+            fail_operation();
+        }
+    }
+
+    // El array de bloques se reserva para el peor caso (todos los tramos sin comprimir), así no
+    // cambia de dirección y se puede registrar con library_track
+    StoredWriter writer;
+    memset(&writer, 0, sizeof(StoredWriter));
+    writer.fd = fd;
+    writer.header = header;
+    writer.buffer = malloc((size_t)WRITE_BATCH_BYTES);
+    writer.block_capacity = (int)((table_size + entry->size) / block_size) + 2;
+    writer.blocks = malloc(writer.block_capacity * sizeof(int));
+    library_track(free, writer.buffer);
+    library_track(free, writer.blocks);
+    if (!writer.buffer || !writer.blocks)
+    {
+        perror("Error de memoria");
+        fail_operation();
+    }
+
+    // Reservar espacio para la tabla de tramos; se escribe al final, cuando se conocen las longitudes
+    memset(frame_table, 0, table_size);
+    stored_writer_append(&writer, frame_table, table_size);
+    off_t stored_size = table_size;
+
+    for (int first = 0; first < frame_count; first += COMPRESS_BATCH_FRAMES)
+    {
+        int count = frame_count - first < COMPRESS_BATCH_FRAMES ? frame_count - first : COMPRESS_BATCH_FRAMES;
+        batch.batch_offset = (off_t)first * COMPRESS_FRAME_SIZE;
+
+        // Comprimir los tramos del lote en paralelo
+        TaskQueue *queues = create_task_queues(job_count);
+        library_track(library_destroy_queues, queues);
+        for (int k = 0; k < count; k++)
+        {
+            BlockTask task;
+            task.file_index = 0;
+            task.archive_offset = 0;
+            task.file_offset = batch.batch_offset + (off_t)k * COMPRESS_FRAME_SIZE;
+            task.length = entry->size - task.file_offset < COMPRESS_FRAME_SIZE ? (size_t)(entry->size - task.file_offset) : COMPRESS_FRAME_SIZE;
+            queue_task(&queues[k % job_count], &task);
+        }
+        run_task_pool(queues, job_count, compress_task, &batch);
+        library_untrack(1);
+        destroy_task_queues(queues, job_count);
+
+        // Escribir los tramos en orden; los que no se reducen se guardan sin comprimir
+        for (int k = 0; k < count; k++)
+        {
+            if (batch.output_lengths[k] > 0)
+            {
+                stored_writer_append(&writer, batch.output[k], batch.output_lengths[k]);
+                frame_table[first + k] = (uint32_t)batch.output_lengths[k];
+                stored_size += batch.output_lengths[k];
+            }
+            else
+            {
+                stored_writer_append(&writer, batch.input[k], batch.input_lengths[k]);
+                frame_table[first + k] = (uint32_t)batch.input_lengths[k] | FRAME_RAW;
+                stored_size += batch.input_lengths[k];
+            }
+        }
+    }
+
+    // La parte de la tabla de tramos que sigue en el búfer se completa ahí, antes de escribirla
+    size_t flushed = (size_t)writer.block_count * block_size;
+    if (flushed < table_size)
+    {
+        memcpy(writer.buffer, (unsigned char *)frame_table + flushed, table_size - flushed);
+    }
+
+    // Escribir los bloques completos y dejar la cola en el búfer para el bloque de colas
+    entry->codec = compress_codec;
+    entry->stored_size = stored_size;
+    int tail = tail_pack_length(stored_size);
+    writer.used -= tail;
+    size_t tail_position = writer.used;
+    stored_writer_flush(&writer);
+    assign_extents(header, entry, writer.blocks, writer.block_count);
+    if (tail > 0)
+    {
+        tail_store(fd, header, entry, writer.buffer + tail_position, tail);
+    }
+
+    // La parte de la tabla que ya se había escrito se reescribe con las longitudes definitivas y
+    // se actualizan las sumas de verificación de los bloques que ocupa
+    if (flushed > 0 && table_size > 0)
+    {
+        size_t written = table_size < flushed ? table_size : flushed;
+        stored_io(fd, header, entry, 0, frame_table, written, 1);
+        for (int b = 0; b < (int)((written + block_size - 1) / block_size); b++)
+        {
+            checksum_record_from_archive(fd, writer.blocks[b]);
+        }
+    }
+
+    library_untrack(7 + 2 * COMPRESS_BATCH_FRAMES);
+    for (int k = 0; k < COMPRESS_BATCH_FRAMES; k++)
+    {
+        free(batch.input[k]);
+        free(batch.output[k]);
+    }
+    free(batch.input);
+    free(batch.output);
+    free(batch.input_lengths);
+    free(batch.output_lengths);
+    free(writer.buffer);
+    free(writer.blocks);
+    free(frame_table);
+}
+
+/*
+ * Función para leer y comprimir un tramo de un archivo (tarea de add_compressed_file)
+ * arg: Puntero a CompressBatch
+ * task: Tramo a comprimir (file_offset y length dentro del archivo de entrada)
+ * worker_id: Número del trabajador que ejecuta la tarea
+ */
+void compress_task(void *arg, BlockTask *task, int worker_id)
+{
+    (void)worker_id;
+    CompressBatch *batch = (CompressBatch *)arg;
+    int k = (int)((task->file_offset - batch->batch_offset) / COMPRESS_FRAME_SIZE);
+
+    size_t filled = 0;
+    while (filled < task->length)
+    {
+        ssize_t bytes_read = io_pread(batch->input_fd, batch->input[k] + filled, task->length - filled, task->file_offset + filled);
+        if (bytes_read < 0)
+        {
+            perror("Error al leer el archivo");
+            fail_operation();
+        }
+        if (bytes_read == 0)
+        {
+            break; // El archivo se acortó después de obtener su tamaño
+        }
+        filled += bytes_read;
+    }
+    memset(batch->input[k] + filled, 0, task->length - filled);
+    batch->input_lengths[k] = task->length;
+
+    size_t compressed = batch->codec->compress(batch->input[k], task->length, batch->output[k], batch->codec->bound(COMPRESS_FRAME_SIZE));
+    batch->output_lengths[k] = compressed < task->length ? compressed : 0;
+}
+
+/*
+ * Función para extraer un archivo comprimido
+ * Cada tramo se lee, se descomprime y se escribe en su posición de forma independiente, así
+ * que todos los tramos se reparten entre el grupo de hilos (-j).
+ * fd: Descriptor de archivo del archivador
+ * header: Puntero al encabezado del archivador
+ * entry: Entrada del archivo a extraer
+ * file_fd: Descriptor del archivo de salida
+ */
+void extract_compressed_file(int fd, StarHeader *header, FileEntry *entry, int file_fd)
+{
+    // Comprobar las sumas de verificación de los datos guardados antes de descomprimir
+    int unchecked = 0;
+    for (int e = 0; e < entry->extent_count; e++)
+    {
+        Extent *extent = &header->extents[entry->extent_index + e];
+        corrupt_block_count += verify_block_range(fd, NULL, 0, (off_t)extent->start_block * block_size,
+                                                  (size_t)extent->length * block_size, entry->filename, &unchecked);
+    }
+    if (entry->tail_length > 0)
+    {
+        corrupt_block_count += verify_block_range(fd, NULL, 0, (off_t)entry->tail_block * block_size + entry->tail_offset,
+                                                  entry->tail_length, entry->filename, &unchecked);
+    }
+
+    int frame_count = (int)((entry->size + COMPRESS_FRAME_SIZE - 1) / COMPRESS_FRAME_SIZE);
+    size_t table_size = frame_count * sizeof(uint32_t);
+    uint32_t *frame_table = malloc(table_size + sizeof(uint32_t));
+    if (!frame_table)
+    {
+        perror("Error de memoria");
+        fail_operation();
+    }
+    stored_io(fd, header, entry, 0, frame_table, table_size, 0);
+
+    // Reservar el tamaño final para que los tramos se escriban en cualquier orden
+    if (ftruncate(file_fd, entry->size) != 0)
+    {
+        perror("Error al reservar archivo de salida");
+        fail_operation();
+    }
+
+    DecompressFile ctx;
+    ctx.fd = fd;
+    ctx.header = header;
+    ctx.entry = entry;
+    ctx.codec = find_codec(entry->codec);
+    ctx.frame_table = frame_table;
+    ctx.file_fd = file_fd;
+
+    TaskQueue *queues = create_task_queues(job_count);
+    off_t stored_offset = table_size;
+    for (int k = 0; k < frame_count; k++)
+    {
+        // archive_offset es la posición del tramo dentro de los datos guardados del archivo
+        BlockTask task;
+        task.file_index = 0;
+        task.archive_offset = stored_offset;
+        task.file_offset = (off_t)k * COMPRESS_FRAME_SIZE;
+        task.length = frame_table[k] & ~FRAME_RAW;
+        if (stored_offset + (off_t)task.length > entry->stored_size)
+        {
+            fprintf(stderr, "Error: tabla de tramos dañada en '%s'\n", entry->filename);
+            fail_operation();
+        }
+        queue_task(&queues[k % job_count], &task);
+        stored_offset += task.length;
+    }
+    run_task_pool(queues, job_count, decompress_task, &ctx);
+    destroy_task_queues(queues, job_count);
+    free(frame_table);
+}
+
+/*
+ * Función para leer, descomprimir y escribir un tramo (tarea de extract_compressed_file)
+ * arg: Puntero a DecompressFile
+ * task: Tramo a descomprimir
+ * worker_id: Número del trabajador que ejecuta la tarea
+ */
+void decompress_task(void *arg, BlockTask *task, int worker_id)
+{
+    (void)worker_id;
+    DecompressFile *ctx = (DecompressFile *)arg;
+    size_t original_length = ctx->entry->size - task->file_offset < COMPRESS_FRAME_SIZE
+                                 ? (size_t)(ctx->entry->size - task->file_offset)
+                                 : COMPRESS_FRAME_SIZE;
+
+    unsigned char *stored = malloc(task->length + 1);
+    unsigned char *plain = malloc(COMPRESS_FRAME_SIZE);
+    if (!stored || !plain)
+    {
+        perror("Error de memoria");
+        fail_operation();
+    }
+    stored_io(ctx->fd, ctx->header, ctx->entry, task->archive_offset, stored, task->length, 0);
+
+    unsigned char *data = stored;
+    if (!(ctx->frame_table[task->file_offset / COMPRESS_FRAME_SIZE] & FRAME_RAW))
+    {
+        if (ctx->codec->decompress(stored, task->length, plain, original_length) != 0)
+        {
+            fprintf(stderr, "Error: no se pudo descomprimir '%s'\n", ctx->entry->filename);
+            fail_operation();
+        }
+        data = plain;
+    }
+    else if (task->length != original_length)
+    {
+        fprintf(stderr, "Error: tabla de tramos dañada en '%s'\n", ctx->entry->filename);
+        fail_operation();
+    }
+
+    if (io_pwrite(ctx->file_fd, data, original_length, task->file_offset) != (ssize_t)original_length)
+    {
+        perror("Error al escribir datos");
+        fail_operation();
+    }
+    free(stored);
+    free(plain);
+}
+
+/*
+ * Función para leer o escribir un rango de los datos guardados de un archivo
+ * La posición se traduce a posiciones del archivador a través de los extents del archivo y,
+ * después del último extent, de la cola empaquetada.
+ * fd: Descriptor de archivo del archivador
+ * header: Puntero al encabezado del archivador
+ * entry: Entrada del archivo
+ * stored_offset: Posición dentro de los datos guardados del archivo
+ * buffer: Datos a escribir o destino de la lectura
+ * length: Número de bytes
+ * writing: 1 para escribir, 0 para leer
+ */
+void stored_io(int fd, StarHeader *header, FileEntry *entry, off_t stored_offset, void *buffer, size_t length, int writing)
+{
+    unsigned char *bytes = buffer;
+    off_t extent_start = 0;
+    for (int e = 0; e < entry->extent_count && length > 0; e++)
+    {
+        Extent *extent = &header->extents[entry->extent_index + e];
+        off_t extent_bytes = (off_t)extent->length * block_size;
+        if (stored_offset < extent_start + extent_bytes)
+        {
+            off_t within = stored_offset - extent_start;
+            size_t chunk = extent_bytes - within < (off_t)length ? (size_t)(extent_bytes - within) : length;
+            off_t archive_offset = (off_t)extent->start_block * block_size + within;
+            ssize_t n = writing ? io_pwrite(fd, bytes, chunk, archive_offset)
+                                : io_pread(fd, bytes, chunk, archive_offset);
+            if (n != (ssize_t)chunk)
+            {
+                perror(writing ? "Error al escribir bloque" : "Error al leer bloque de datos");
+                fail_operation();
+            }
+            bytes += chunk;
+            stored_offset += chunk;
+            length -= chunk;
+        }
+        extent_start += extent_bytes;
+    }
+    off_t within = stored_offset - extent_start;
+    if (length > 0 && entry->tail_length > 0 && within >= 0 && within + (off_t)length <= entry->tail_length)
+    {
+        off_t archive_offset = (off_t)entry->tail_block * block_size + entry->tail_offset + within;
+        ssize_t n = writing ? io_pwrite(fd, bytes, length, archive_offset) : io_pread(fd, bytes, length, archive_offset);
+        if (n != (ssize_t)length)
+        {
+            perror(writing ? "Error al escribir bloque" : "Error al leer bloque de datos");
+            fail_operation();
+        }
+        length = 0;
+    }
+    if (length > 0)
+    {
+        fprintf(stderr, "Error: datos fuera de los extents de '%s'\n", entry->filename);
+        fail_operation();
+    }
+}
+
+/*
+ * Función para agregar datos al final de los datos guardados de un archivo
+ * writer: Escritor del archivo
+ * data: Datos a agregar
+ * length: Número de bytes
+ */
+void stored_writer_append(StoredWriter *writer, const void *data, size_t length)
+{
+    const unsigned char *bytes = data;
+    size_t capacity = (size_t)WRITE_BATCH_BYTES;
+    while (length > 0)
+    {
+        size_t chunk = capacity - writer->used < length ? capacity - writer->used : length;
+        memcpy(writer->buffer + writer->used, bytes, chunk);
+        writer->used += chunk;
+        bytes += chunk;
+        length -= chunk;
+        if (writer->used == capacity)
+        {
+            stored_writer_flush(writer);
+        }
+    }
+}
+
+/*
+ * Función para escribir los datos pendientes de un escritor en bloques recién reservados
+ * El último bloque se completa con ceros.
+ * writer: Escritor del archivo
+ */
+void stored_writer_flush(StoredWriter *writer)
+{
+    if (writer->used == 0)
+    {
+        return;
+    }
+
+    int count = (int)((writer->used + block_size - 1) / block_size);
+    memset(writer->buffer + writer->used, 0, (size_t)count * block_size - writer->used);
+    int *blocks = allocate_blocks(writer->fd, writer->header, count);
+    library_track(free, blocks);
+
+    // Escribir cada grupo de bloques consecutivos con un solo pwrite
+    int b = 0;
+    while (b < count)
+    {
+        int run = 1;
+        while (b + run < count && blocks[b + run] == blocks[b] + run)
+        {
+            run++;
+        }
+        ssize_t bytes = (ssize_t)run * block_size;
+        if (io_pwrite(writer->fd, writer->buffer + (size_t)b * block_size, bytes, (off_t)blocks[b] * block_size) != bytes)
+        {
+            perror("Error al escribir bloque");
+            fail_operation();
+        }
+        for (int k = b; k < b + run; k++)
+        {
+            checksum_record(blocks[k], writer->buffer + (size_t)k * block_size, block_size);
+        }
+        b += run;
+    }
+
+    if (writer->block_count + count > writer->block_capacity)
+    {
+        writer->block_capacity = (writer->block_count + count) * 2;
+        writer->blocks = realloc(writer->blocks, writer->block_capacity * sizeof(int));
+        if (!writer->blocks)
+        {
+            perror("Error de memoria");
+            fail_operation();
+        }
+    }
+    memcpy(writer->blocks + writer->block_count, blocks, count * sizeof(int));
+    writer->block_count += count;
+    writer->used = 0;
+    library_untrack(1);
+    free(blocks);
+}
+
+/*
+ * Función para calcular el hash de 64 bits del contenido de un bloque (algoritmo XXH64)
+ * data: Datos del bloque
+ * length: Número de bytes
+ * Retorna: Hash del contenido
+ */
+uint64_t hash_block(const unsigned char *data, size_t length)
+{
+    const uint64_t p1 = 11400714785074694791ULL, p2 = 14029467366897019727ULL;
+    const uint64_t p3 = 1609587929392839161ULL, p4 = 9650029242287828579ULL, p5 = 2870177450012600261ULL;
+#define STAR_ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+    const unsigned char *end = data + length;
+    uint64_t h;
+
+    if (length >= 32)
+    {
+        uint64_t v[4] = {p1 + p2, p2, 0, -p1};
+        while (data + 32 <= end)
+        {
+            for (int i = 0; i < 4; i++)
+            {
+                uint64_t lane;
+                memcpy(&lane, data + i * 8, sizeof(lane));
+                v[i] += lane * p2;
+                v[i] = STAR_ROTL64(v[i], 31) * p1;
+            }
+            data += 32;
+        }
+        h = STAR_ROTL64(v[0], 1) + STAR_ROTL64(v[1], 7) + STAR_ROTL64(v[2], 12) + STAR_ROTL64(v[3], 18);
+        for (int i = 0; i < 4; i++)
+        {
+            uint64_t k = STAR_ROTL64(v[i] * p2, 31) * p1;
+            h = (h ^ k) * p1 + p4;
+        }
+    }
+    else
+    {
+        h = p5;
+    }
+    h += length;
+
+    while (data + 8 <= end)
+    {
+        uint64_t lane;
+        memcpy(&lane, data, sizeof(lane));
+        h ^= STAR_ROTL64(lane * p2, 31) * p1;
+        h = STAR_ROTL64(h, 27) * p1 + p4;
+        data += 8;
+    }
+    while (data < end)
+    {
+        h ^= (*data++) * p5;
+        h = STAR_ROTL64(h, 11) * p1;
+    }
+#undef STAR_ROTL64
+
+    h ^= h >> 33;
+    h *= p2;
+    h ^= h >> 29;
+    h *= p3;
+    h ^= h >> 32;
+    return h;
+}
+
+/*
+ * Función para guardar un archivo reutilizando los bloques que ya existen en el archivador
+ * Cada bloque leído se busca por su hash en la tabla de deduplicación y se compara byte a byte
+ * con el candidato antes de reutilizarlo. Los bloques nuevos de cada lote se escriben juntos. Una
+ * cola de a lo sumo medio bloque no se deduplica: va a un bloque de colas.
+ * fd: Descriptor de archivo del archivador
+ * header: Puntero al encabezado del archivador
+ * entry: Entrada del archivo, con nombre y tamaño ya llenos
+ * file_fd: Descriptor del archivo de entrada
+ * Retorna: Número de bloques que se reutilizaron
+ */
+int add_deduplicated_file(int fd, StarHeader *header, FileEntry *entry, int file_fd)
+{
+    entry->tail_length = tail_pack_length(entry->size);
+    int block_count = file_block_count(header, entry);
+    int *blocks = malloc((block_count > 0 ? block_count : 1) * sizeof(int));
+    unsigned char *batch = malloc((size_t)WRITE_BATCH_BYTES);
+    unsigned char *candidate = malloc(block_size);
+    int *new_slots = malloc(WRITE_BATCH_BLOCKS * sizeof(int));
+    int *slot_of = malloc(WRITE_BATCH_BLOCKS * sizeof(int));
+    int *slot_refs = malloc(WRITE_BATCH_BLOCKS * sizeof(int));
+    uint64_t *slot_hash = malloc(WRITE_BATCH_BLOCKS * sizeof(uint64_t));
+    library_track(free, blocks);
+    library_track(free, batch);
+    library_track(free, candidate);
+    library_track(free, new_slots);
+    library_track(free, slot_of);
+    library_track(free, slot_refs);
+    library_track(free, slot_hash);
+    if (!blocks || !batch || !candidate || !new_slots || !slot_of || !slot_refs || !slot_hash)
+    {
+        perror("Error de memoria");
+        fail_operation();
+    }
+
+    int shared = 0;
+    for (int first = 0; first < block_count; first += WRITE_BATCH_BLOCKS)
+    {
+        int count = block_count - first < WRITE_BATCH_BLOCKS ? block_count - first : WRITE_BATCH_BLOCKS;
+        size_t bytes = (size_t)count * block_size;
+        size_t filled = 0;
+        while (filled < bytes)
+        {
+            ssize_t bytes_read = io_read(file_fd, batch + filled, bytes - filled);
+            if (bytes_read < 0)
+            {
+                perror("Error al leer el archivo");
+                fail_operation();
+            }
+            if (bytes_read == 0)
+            {
+                break; // Fin del archivo
+            }
+            filled += bytes_read;
+        }
+        memset(batch + filled, 0, bytes - filled);
+
+        // Primera pasada: buscar cada bloque en la tabla o entre los bloques nuevos del mismo lote,
+        // que aún no están escritos y se comparan en memoria
+        int new_count = 0;
+        for (int k = 0; k < count; k++)
+        {
+            unsigned char *data = batch + (size_t)k * block_size;
+            uint64_t hash = hash_block(data, block_size);
+            int match = -1;
+            if (dedup_table.bucket_count > 0)
+            {
+                for (int i = dedup_table.hash_buckets[hash % dedup_table.bucket_count]; i != -1 && match == -1;
+                     i = dedup_table.hash_next[i])
+                {
+                    DedupEntry *existing = &dedup_table.entries[i];
+                    if (existing->hash != hash || existing->refcount <= 0)
+                    {
+                        continue;
+                    }
+                    if (io_pread(fd, candidate, block_size, (off_t)existing->block * block_size) != block_size)
+                    {
+                        perror("Error al leer bloque de datos");
+                        fail_operation();
+                    }
+                    if (memcmp(candidate, data, block_size) == 0)
+                    {
+                        match = i;
+                    }
+                }
+            }
+            if (match != -1)
+            {
+                dedup_table.entries[match].refcount++;
+                dedup_table.dirty = 1;
+                blocks[first + k] = dedup_table.entries[match].block;
+                shared++;
+                continue;
+            }
+
+            slot_of[k] = -1;
+            for (int n = 0; n < new_count && slot_of[k] == -1; n++)
+            {
+                if (slot_hash[n] == hash && memcmp(batch + (size_t)new_slots[n] * block_size, data, block_size) == 0)
+                {
+                    slot_of[k] = n;
+                }
+            }
+            if (slot_of[k] == -1)
+            {
+                slot_hash[new_count] = hash;
+                slot_refs[new_count] = 0;
+                new_slots[new_count] = k;
+                slot_of[k] = new_count++;
+            }
+            else
+            {
+                shared++;
+            }
+            slot_refs[slot_of[k]]++;
+            blocks[first + k] = -1;
+        }
+
+        // Segunda pasada: reservar juntos los bloques nuevos y registrarlos en la tabla
+        if (new_count > 0)
+        {
+            int *allocated = allocate_blocks(fd, header, new_count);
+            library_track(free, allocated);
+            for (int n = 0; n < new_count; n++)
+            {
+                int index = dedup_insert(slot_hash[n], allocated[n]);
+                dedup_table.entries[index].refcount = slot_refs[n];
+            }
+            for (int k = 0; k < count; k++)
+            {
+                if (blocks[first + k] == -1)
+                {
+                    blocks[first + k] = allocated[slot_of[k]];
+                }
+            }
+            library_untrack(1);
+            free(allocated);
+        }
+
+        // Escribir los bloques nuevos, agrupando los que son consecutivos en el lote y en el archivador
+        int n = 0;
+        while (n < new_count)
+        {
+            int run = 1;
+            while (n + run < new_count && new_slots[n + run] == new_slots[n] + run &&
+                   blocks[first + new_slots[n + run]] == blocks[first + new_slots[n]] + run)
+            {
+                run++;
+            }
+            ssize_t run_bytes = (ssize_t)run * block_size;
+            if (io_pwrite(fd, batch + (size_t)new_slots[n] * block_size, run_bytes,
+                       (off_t)blocks[first + new_slots[n]] * block_size) != run_bytes)
+            {
+                perror("Error al escribir bloque");
+                fail_operation();
+            }
+            for (int k = n; k < n + run; k++)
+            {
+                checksum_record(blocks[first + new_slots[k]], batch + (size_t)new_slots[k] * block_size, block_size);
+            }
+            n += run;
+        }
+    }
+
+    assign_extents(header, entry, blocks, block_count);
+    if (entry->tail_length > 0)
+    {
+        tail_copy(fd, header, entry, file_fd, entry->size - entry->tail_length, entry->tail_length);
+    }
+    library_untrack(7);
+    free(slot_hash);
+    free(slot_refs);
+    free(slot_of);
+    free(new_slots);
+    free(candidate);
+    free(batch);
+    free(blocks);
+    return shared;
+}
+
+/*
+ * Función para cargar la tabla de deduplicación del archivador
+ * fd: Descriptor de archivo del archivador
+ * header: Puntero al encabezado del archivador
+ */
+void dedup_load(int fd, StarHeader *header)
+{
+    dedup_reset();
+    if (header->dedup_table_block <= 0 || header->dedup_entry_count <= 0)
+    {
+        return;
+    }
+
+    dedup_table.capacity = header->dedup_entry_count;
+    dedup_table.entries = malloc(dedup_table.capacity * sizeof(DedupEntry));
+    if (!dedup_table.entries)
+    {
+        perror("Error de memoria");
+        fail_operation();
+    }
+    ssize_t bytes = (ssize_t)header->dedup_entry_count * sizeof(DedupEntry);
+    if (io_pread(fd, dedup_table.entries, bytes, (off_t)header->dedup_table_block * block_size) != bytes)
+    {
+        perror("Error al leer la tabla de deduplicación");
+        fail_operation();
+    }
+    dedup_table.count = header->dedup_entry_count;
+    dedup_rehash(dedup_table.count * 2);
+}
+
+/*
+ * Función para guardar la tabla de deduplicación en bloques contiguos del archivador
+ * Los bloques de la tabla anterior se liberan y las entradas sin referencias se descartan.
+ * fd: Descriptor de archivo del archivador
+ * header: Puntero al encabezado del archivador
+ */
+void dedup_save(int fd, StarHeader *header)
+{
+    for (int b = 0; b < header->dedup_table_blocks; b++)
+    {
+        free_block(header, header->dedup_table_block + b);
+    }
+    header->dedup_table_block = 0;
+    header->dedup_table_blocks = 0;
+    header->dedup_entry_count = 0;
+
+    int live = 0;
+    for (int i = 0; i < dedup_table.count; i++)
+    {
+        if (dedup_table.entries[i].refcount > 0)
+        {
+            dedup_table.entries[live++] = dedup_table.entries[i];
+        }
+    }
+    dedup_table.count = live;
+    dedup_rehash(live * 2);
+    dedup_table.dirty = 0;
+    if (live == 0)
+    {
+        return;
+    }
+
+    size_t bytes = (size_t)live * sizeof(DedupEntry);
+    int blocks = (int)((bytes + block_size - 1) / block_size);
+    int start = allocate_run(fd, header, blocks);
+    unsigned char *buffer = calloc(blocks, block_size);
+    if (!buffer)
+    {
+        perror("Error de memoria");
+        fail_operation();
+    }
+    library_track(free, buffer);
+    memcpy(buffer, dedup_table.entries, bytes);
+    if (io_pwrite(fd, buffer, (size_t)blocks * block_size, (off_t)start * block_size) != (ssize_t)blocks * block_size)
+    {
+        perror("Error al escribir la tabla de deduplicación");
+        fail_operation();
+    }
+    library_untrack(1);
+    free(buffer);
+
+    header->dedup_table_block = start;
+    header->dedup_table_blocks = blocks;
+    header->dedup_entry_count = live;
+}
+
+/*
+ * Función para vaciar la tabla de deduplicación en memoria
+ */
+void dedup_reset(void)
+{
+    free(dedup_table.entries);
+    free(dedup_table.hash_buckets);
+    free(dedup_table.hash_next);
+    free(dedup_table.block_buckets);
+    free(dedup_table.block_next);
+    memset(&dedup_table, 0, sizeof(DedupTable));
+}
+
+/*
+ * Función para reconstruir los índices por hash y por bloque de la tabla de deduplicación
+ * bucket_count: Número de cubetas de cada índice
+ */
+void dedup_rehash(int bucket_count)
+{
+    if (bucket_count < 64)
+    {
+        bucket_count = 64;
+    }
+    free(dedup_table.hash_buckets);
+    free(dedup_table.block_buckets);
+    dedup_table.hash_buckets = malloc(bucket_count * sizeof(int));
+    dedup_table.block_buckets = malloc(bucket_count * sizeof(int));
+    dedup_table.hash_next = realloc(dedup_table.hash_next, (dedup_table.capacity + 1) * sizeof(int));
+    dedup_table.block_next = realloc(dedup_table.block_next, (dedup_table.capacity + 1) * sizeof(int));
+    if (!dedup_table.hash_buckets || !dedup_table.block_buckets || !dedup_table.hash_next || !dedup_table.block_next)
+    {
+        perror("Error de memoria");
+        fail_operation();
+    }
+    dedup_table.bucket_count = bucket_count;
+    memset(dedup_table.hash_buckets, -1, bucket_count * sizeof(int));
+    memset(dedup_table.block_buckets, -1, bucket_count * sizeof(int));
+
+    for (int i = 0; i < dedup_table.count; i++)
+    {
+        DedupEntry *entry = &dedup_table.entries[i];
+        int hash_bucket = (int)(entry->hash % bucket_count);
+        int block_bucket = entry->block % bucket_count;
+        dedup_table.hash_next[i] = dedup_table.hash_buckets[hash_bucket];
+        dedup_table.hash_buckets[hash_bucket] = i;
+        dedup_table.block_next[i] = dedup_table.block_buckets[block_bucket];
+        dedup_table.block_buckets[block_bucket] = i;
+    }
+}
+
+/*
+ * Función para agregar un bloque nuevo a la tabla de deduplicación con una referencia
+ * hash: Hash del contenido del bloque
+ * block: Índice del bloque en el archivador
+ * Retorna: Posición de la entrada en la tabla
+ */
+int dedup_insert(uint64_t hash, int block)
+{
+    if (dedup_table.count == dedup_table.capacity)
+    {
+        dedup_table.capacity = dedup_table.capacity ? dedup_table.capacity * 2 : 256;
+        dedup_table.entries = realloc(dedup_table.entries, dedup_table.capacity * sizeof(DedupEntry));
+        dedup_table.hash_next = realloc(dedup_table.hash_next, (dedup_table.capacity + 1) * sizeof(int));
+        dedup_table.block_next = realloc(dedup_table.block_next, (dedup_table.capacity + 1) * sizeof(int));
+        if (!dedup_table.entries || !dedup_table.hash_next || !dedup_table.block_next)
+        {
+            perror("Error de memoria");
+            fail_operation();
+        }
+    }
+
+    int index = dedup_table.count++;
+    dedup_table.entries[index].hash = hash;
+    dedup_table.entries[index].block = block;
+    dedup_table.entries[index].refcount = 1;
+    dedup_table.dirty = 1;
+
+    if (dedup_table.count > dedup_table.bucket_count)
+    {
+        // Rehacer los índices con más cubetas; esto también enlaza la entrada nueva
+        dedup_rehash(dedup_table.count * 2);
+        return index;
+    }
+    int hash_bucket = (int)(hash % dedup_table.bucket_count);
+    int block_bucket = block % dedup_table.bucket_count;
+    dedup_table.hash_next[index] = dedup_table.hash_buckets[hash_bucket];
+    dedup_table.hash_buckets[hash_bucket] = index;
+    dedup_table.block_next[index] = dedup_table.block_buckets[block_bucket];
+    dedup_table.block_buckets[block_bucket] = index;
+    return index;
+}
+
+/*
+ * Función para buscar la entrada de deduplicación de un bloque
+ * block: Índice del bloque en el archivador
+ * Retorna: Posición de la entrada con referencias, o -1 si el bloque no está deduplicado
+ */
+int dedup_find_block(int block)
+{
+    if (dedup_table.bucket_count == 0)
+    {
+        return -1;
+    }
+    for (int i = dedup_table.block_buckets[block % dedup_table.bucket_count]; i != -1; i = dedup_table.block_next[i])
+    {
+        if (dedup_table.entries[i].block == block && dedup_table.entries[i].refcount > 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Función para vaciar la tabla de bloques de colas en memoria
+ */
+void tail_reset(void)
+{
+    free(tail_table.entries);
+    free(tail_table.buckets);
+    free(tail_table.next);
+    free(tail_table.open_data);
+    memset(&tail_table, 0, sizeof(TailTable));
+    tail_table.open_index = -1;
+}
+
+/*
+ * Función para reconstruir el índice por bloque de la tabla de bloques de colas
+ * bucket_count: Número de cubetas
+ */
+void tail_rehash(int bucket_count)
+{
+    if (bucket_count < 64)
+    {
+        bucket_count = 64;
+    }
+    free(tail_table.buckets);
+    tail_table.buckets = malloc(bucket_count * sizeof(int));
+    tail_table.next = realloc(tail_table.next, (tail_table.capacity + 1) * sizeof(int));
+    if (!tail_table.buckets || !tail_table.next)
+    {
+        perror("Error de memoria");
+        fail_operation();
+    }
+    tail_table.bucket_count = bucket_count;
+    memset(tail_table.buckets, -1, bucket_count * sizeof(int));
+
+    for (int i = 0; i < tail_table.count; i++)
+    {
+        int bucket = tail_table.entries[i].block % bucket_count;
+        tail_table.next[i] = tail_table.buckets[bucket];
+        tail_table.buckets[bucket] = i;
+    }
+}
+
+/*
+ * Función para agregar un bloque de colas vacío a la tabla
+ * block: Índice del bloque en el archivador
+ * Retorna: Posición de la nueva entrada
+ */
+int tail_insert(int block)
+{
+    if (tail_table.count == tail_table.capacity)
+    {
+        tail_table.capacity = tail_table.capacity ? tail_table.capacity * 2 : 64;
+        tail_table.entries = realloc(tail_table.entries, tail_table.capacity * sizeof(TailEntry));
+        if (!tail_table.entries)
+        {
+            perror("Error de memoria");
+            fail_operation();
+        }
+        tail_rehash(tail_table.capacity * 2);
+    }
+
+    int index = tail_table.count++;
+    tail_table.entries[index].block = block;
+    tail_table.entries[index].used = 0;
+    tail_table.entries[index].refcount = 0;
+    int bucket = block % tail_table.bucket_count;
+    tail_table.next[index] = tail_table.buckets[bucket];
+    tail_table.buckets[bucket] = index;
+    tail_table.dirty = 1;
+    return index;
+}
+
+/*
+ * Función para buscar la entrada de un bloque de colas
+ * block: Índice del bloque en el archivador
+ * Retorna: Posición de la entrada con referencias, o -1 si el bloque no es un bloque de colas
+ */
+int tail_find(int block)
+{
+    if (tail_table.bucket_count == 0)
+    {
+        return -1;
+    }
+    for (int i = tail_table.buckets[block % tail_table.bucket_count]; i != -1; i = tail_table.next[i])
+    {
+        if (tail_table.entries[i].block == block && tail_table.entries[i].refcount > 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Función para guardar la cola de un archivo en un bloque compartido
+ * La cola va después de las que ya están en el último bloque de colas; si no cabe, se reserva un
+ * bloque nuevo y se escribe completo (con ceros) para que su suma de verificación cubra todo el
+ * bloque. Después solo se escriben los bytes de cada cola; la suma se calcula en tail_flush.
+ * fd: Descriptor de archivo del archivador
+ * header: Puntero al encabezado del archivador
+ * entry: Entrada del archivo (se llenan tail_block, tail_offset y tail_length)
+ * data: Bytes de la cola
+ * length: Número de bytes (hasta TAIL_PACK_LIMIT)
+ */
+void tail_store(int fd, StarHeader *header, FileEntry *entry, const unsigned char *data, int length)
+{
+    if (!tail_table.open_data && !(tail_table.open_data = malloc(block_size)))
+    {
+        perror("Error de memoria");
+        fail_operation();
+    }
+
+    int index = tail_table.count - 1;
+    int new_block = index < 0 || tail_table.entries[index].refcount == 0 ||
+                    tail_table.entries[index].used + length > block_size;
+    if (new_block || tail_table.open_index != index)
+    {
+        tail_flush();
+    }
+    if (new_block)
+    {
+        int *blocks = allocate_blocks(fd, header, 1);
+        index = tail_insert(blocks[0]);
+        free(blocks);
+        memset(tail_table.open_data, 0, block_size);
+        tail_table.open_index = index;
+    }
+    TailEntry *tail = &tail_table.entries[index];
+    if (tail_table.open_index != index)
+    {
+        // Leer las colas que ya tiene el bloque (de una ejecución anterior)
+        memset(tail_table.open_data, 0, block_size);
+        if (io_pread(fd, tail_table.open_data, tail->used, (off_t)tail->block * block_size) != tail->used)
+        {
+            perror("Error al leer bloque de colas");
+            fail_operation();
+        }
+        tail_table.open_index = index;
+    }
+
+    memcpy(tail_table.open_data + tail->used, data, length);
+    off_t offset = (off_t)tail->block * block_size + (new_block ? 0 : tail->used);
+    const unsigned char *bytes = new_block ? tail_table.open_data : data;
+    ssize_t count = new_block ? block_size : length;
+    if (io_pwrite(fd, bytes, count, offset) != count)
+    {
+        perror("Error al escribir bloque de colas");
+        fail_operation();
+    }
+    tail_table.open_dirty = 1;
+
+    entry->tail_block = tail->block;
+    entry->tail_offset = tail->used;
+    entry->tail_length = length;
+    tail->used += length;
+    tail->refcount++;
+    tail_table.dirty = 1;
+}
+
+/*
+ * Función para calcular cuántos bytes del final de un archivo se empaquetan en un bloque de colas
+ * size: Tamaño del archivo
+ * Retorna: Bytes de la cola (0 si el archivo termina en un bloque completo o la cola es grande)
+ */
+int tail_pack_length(off_t size)
+{
+    int tail = (int)(size % block_size);
+    return tail <= TAIL_PACK_LIMIT ? tail : 0;
+}
+
+/*
+ * Función para copiar la cola de un archivo desde otro descriptor a un bloque de colas
+ * fd: Descriptor de archivo del archivador
+ * header: Puntero al encabezado del archivador
+ * entry: Entrada del archivo
+ * source_fd: Descriptor del que se lee la cola
+ * offset: Posición de la cola en source_fd
+ * length: Bytes de la cola
+ */
+void tail_copy(int fd, StarHeader *header, FileEntry *entry, int source_fd, off_t offset, int length)
+{
+    unsigned char *data = malloc(length);
+    if (!data)
+    {
+        perror("Error de memoria");
+        fail_operation();
+    }
+    library_track(free, data);
+    if (io_pread(source_fd, data, length, offset) != length)
+    {
+        perror("Error al leer la cola del archivo");
+        fail_operation();
+    }
+    tail_store(fd, header, entry, data, length);
+    library_untrack(1);
+    free(data);
+}
+
+/*
+ * Función para registrar la suma de verificación del bloque de colas abierto
+ * Se llama al cambiar de bloque y antes de guardar la tabla de sumas, para no recalcularla con
+ * cada cola.
+ */
+void tail_flush(void)
+{
+    if (tail_table.open_dirty && tail_table.open_index != -1)
+    {
+        checksum_record(tail_table.entries[tail_table.open_index].block, tail_table.open_data, block_size);
+    }
+    tail_table.open_dirty = 0;
+}
+
+/*
+ * Función para quitar la referencia de una cola a su bloque compartido
+ * El bloque se libera cuando ya no tiene colas; el espacio de las colas quitadas de un bloque que
+ * sigue en uso se recupera al empacar (-p).
+ * header: Puntero al encabezado del archivador
+ * block: Bloque de la cola
+ */
+void tail_release(StarHeader *header, int block)
+{
+    int index = tail_find(block);
+    if (index == -1)
+    {
+        fprintf(stderr, "Advertencia: el bloque %d no está en la tabla de colas\n", block);
+        return;
+    }
+    tail_table.dirty = 1;
+    if (--tail_table.entries[index].refcount > 0)
+    {
+        return;
+    }
+    if (tail_table.open_index == index)
+    {
+        tail_table.open_index = -1;
+        tail_table.open_dirty = 0;
+    }
+    free_block(header, block);
+}
+
+/*
+ * Función para cargar la tabla de bloques de colas del archivador
+ * fd: Descriptor de archivo del archivador
+ * header: Puntero al encabezado del archivador
+ */
+void tail_load(int fd, StarHeader *header)
+{
+    tail_reset();
+    if (header->tail_table_block <= 0 || header->tail_entry_count <= 0)
+    {
+        return;
+    }
+
+    tail_table.capacity = header->tail_entry_count;
+    tail_table.entries = malloc(tail_table.capacity * sizeof(TailEntry));
+    if (!tail_table.entries)
+    {
+        perror("Error de memoria");
+        fail_operation();
+    }
+    ssize_t bytes = (ssize_t)header->tail_entry_count * sizeof(TailEntry);
+    if (io_pread(fd, tail_table.entries, bytes, (off_t)header->tail_table_block * block_size) != bytes)
+    {
+        perror("Error al leer la tabla de colas");
+        fail_operation();
+    }
+    tail_table.count = header->tail_entry_count;
+    tail_rehash(tail_table.count * 2);
+}
+
+/*
+ * Función para guardar la tabla de bloques de colas en bloques contiguos del archivador
+ * Los bloques de la tabla anterior se liberan y las entradas sin referencias se descartan.
+ * fd: Descriptor de archivo del archivador
+ * header: Puntero al encabezado del archivador
+ */
+void tail_save(int fd, StarHeader *header)
+{
+    for (int b = 0; b < header->tail_table_blocks; b++)
+    {
+        free_block(header, header->tail_table_block + b);
+    }
+    header->tail_table_block = 0;
+    header->tail_table_blocks = 0;
+    header->tail_entry_count = 0;
+
+    int live = 0;
+    for (int i = 0; i < tail_table.count; i++)
+    {
+        if (tail_table.entries[i].refcount > 0)
+        {
+            if (tail_table.open_index == i)
+            {
+                tail_table.open_index = live;
+            }
+            tail_table.entries[live++] = tail_table.entries[i];
+        }
+    }
+    if (tail_table.open_index >= live)
+    {
+        tail_table.open_index = -1;
+    }
+    tail_table.count = live;
+    tail_rehash(live * 2);
+    tail_table.dirty = 0;
+    if (live == 0)
+    {
+        return;
+    }
+
+    size_t bytes = (size_t)live * sizeof(TailEntry);
+    int blocks = (int)((bytes + block_size - 1) / block_size);
+    int start = allocate_run(fd, header, blocks);
+    unsigned char *buffer = calloc(blocks, block_size);
+    if (!buffer)
+    {
+        perror("Error de memoria");
+        fail_operation();
+    }
+    library_track(free, buffer);
+    memcpy(buffer, tail_table.entries, bytes);
+    if (io_pwrite(fd, buffer, (size_t)blocks * block_size, (off_t)start * block_size) != (ssize_t)blocks * block_size)
+    {
+        perror("Error al escribir la tabla de colas");
+        fail_operation();
+    }
+    library_untrack(1);
+    free(buffer);
+
+    header->tail_table_block = start;
+    header->tail_table_blocks = blocks;
+    header->tail_entry_count = live;
+}
+
+/*
+ * Función para preparar el cálculo de CRC32C
+ * Construye las tablas de slicing-by-8 y, en x86-64, detecta si el procesador tiene la
+ * instrucción crc32 de SSE4.2. Se ejecuta una sola vez (pthread_once).
+ */
+void crc32c_init(void)
+{
+    for (int i = 0; i < 256; i++)
+    {
+        uint32_t crc = i;
+        for (int k = 0; k < 8; k++)
+        {
+            crc = crc & 1 ? (crc >> 1) ^ 0x82F63B78u : crc >> 1; // Polinomio de Castagnoli (reflejado)
+        }
+        crc32c_table[0][i] = crc;
+    }
+    for (int i = 0; i < 256; i++)
+    {
+        for (int t = 1; t < 8; t++)
+        {
+            crc32c_table[t][i] = (crc32c_table[t - 1][i] >> 8) ^ crc32c_table[0][crc32c_table[t - 1][i] & 0xff];
+        }
+    }
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    crc32c_use_hw = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+/*
+ * Función para calcular el CRC32C de un rango de bytes
+ * crc: CRC de los datos anteriores (0 para empezar)
+ * data: Datos
+ * length: Número de bytes
+ * Retorna: CRC32C acumulado
+ */
+uint32_t crc32c(uint32_t crc, const unsigned char *data, size_t length)
+{
+    pthread_once(&crc32c_once, crc32c_init);
+    return crc32c_use_hw ? crc32c_hw(crc, data, length) : crc32c_sw(crc, data, length);
+}
+
+/*
+ * Función para calcular el CRC32C por software, procesando 8 bytes por iteración (slicing-by-8)
+ * crc: CRC de los datos anteriores (0 para empezar)
+ * data: Datos
+ * length: Número de bytes
+ * Retorna: CRC32C acumulado
+ */
+uint32_t crc32c_sw(uint32_t crc, const unsigned char *data, size_t length)
+{
+    crc = ~crc;
+    while (length >= 8)
+    {
+        uint32_t low = crc ^ ((uint32_t)data[0] | (uint32_t)data[1] << 8 | (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24);
+        uint32_t high = (uint32_t)data[4] | (uint32_t)data[5] << 8 | (uint32_t)data[6] << 16 | (uint32_t)data[7] << 24;
+        crc = crc32c_table[7][low & 0xff] ^ crc32c_table[6][(low >> 8) & 0xff] ^
+              crc32c_table[5][(low >> 16) & 0xff] ^ crc32c_table[4][low >> 24] ^
+              crc32c_table[3][high & 0xff] ^ crc32c_table[2][(high >> 8) & 0xff] ^
+              crc32c_table[1][(high >> 16) & 0xff] ^ crc32c_table[0][high >> 24];
+        data += 8;
+        length -= 8;
+    }
+    while (length-- > 0)
+    {
+        crc = crc32c_table[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+#if defined(__x86_64__)
+/*
+ * Función para calcular el CRC32C con la instrucción crc32 de SSE4.2 (8 bytes por instrucción)
+ * Solo se llama si crc32c_init detectó soporte en el procesador.
+ * crc: CRC de los datos anteriores (0 para empezar)
+ * data: Datos
+ * length: Número de bytes
+ * Retorna: CRC32C acumulado
+ */
+__attribute__((target("sse4.2"))) uint32_t crc32c_hw(uint32_t crc, const unsigned char *data, size_t length)
+{
+    uint64_t value = ~crc;
+    while (length > 0 && ((uintptr_t)data & 7) != 0)
+    {
+        value = _mm_crc32_u8((uint32_t)value, *data++);
+        length--;
+    }
+    while (length >= 8)
+    {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        value = _mm_crc32_u64(value, word);
+        data += 8;
+        length -= 8;
+    }
+    while (length-- > 0)
+    {
+        value = _mm_crc32_u8((uint32_t)value, *data++);
+    }
+    return ~(uint32_t)value;
+}
+#else
+// Sin SSE4.2 disponible en esta arquitectura se usa siempre la versión por software
+uint32_t crc32c_hw(uint32_t crc, const unsigned char *data, size_t length)
+{
+    return crc32c_sw(crc, data, length);
+}
+#endif
+
+/*
+ * Función para acumular el hash de 64 bits del contenido de un archivo (--hash)
+ * Cada palabra de 8 bytes se combina con xor, multiplicación y rotación; cada paso es biyectivo,
+ * así que cambiar una sola palabra siempre cambia el hash. Los tramos intermedios deben tener
+ * un múltiplo de 8 bytes.
+ * hash: Hash de los datos anteriores (CONTENT_HASH_SEED para empezar)
+ * data: Datos
+ * length: Número de bytes
+ * Retorna: Hash acumulado
+ */
+uint64_t content_hash(uint64_t hash, const unsigned char *data, size_t length)
+{
+    const uint64_t prime = 0x100000001b3ull;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * prime;
+        hash = hash << 29 | hash >> 35;
+    }
+    for (; i < length; i++)
+    {
+        hash = (hash ^ data[i]) * prime;
+    }
+    return hash;
+}
+
+/*
+ * Función para calcular el hash del contenido de un archivo
+ * file_fd: Descriptor del archivo (se lee con pread, sin mover su posición)
+ * Retorna: Hash del contenido
+ */
+uint64_t file_content_hash(int file_fd)
+{
+    unsigned char *buffer = malloc((size_t)WRITE_BATCH_BYTES);
+    if (!buffer)
+    {
+        perror("Error de memoria");
+        fail_operation();
+    }
+    library_track(free, buffer);
+    uint64_t hash = CONTENT_HASH_SEED;
+    off_t offset = 0;
+    for (;;)
+    {
+        // Llenar el búfer completo para que los tramos intermedios midan siempre lo mismo
+        size_t filled = 0;
+        while (filled < (size_t)WRITE_BATCH_BYTES)
+        {
+            ssize_t bytes_read = io_pread(file_fd, buffer + filled, WRITE_BATCH_BYTES - filled, offset + filled);
+            if (bytes_read < 0)
+            {
+                perror("Error al leer el archivo");
+                fail_operation();
+            }
+            if (bytes_read == 0)
+            {
+                break; // Fin del archivo
+            }
+            filled += bytes_read;
+        }
+        hash = content_hash(hash, buffer, filled);
+        offset += filled;
+        if (filled < (size_t)WRITE_BATCH_BYTES)
+        {
+            break;
+        }
+    }
+    library_untrack(1);
+    free(buffer);
+    return hash;
+}
+
+/*
+ * Función para guardar en una entrada la fecha de modificación y el modo de un archivo, y con
+ * --hash el hash de su contenido
+ * entry: Entrada del archivo
+ * st: Estado del archivo
+ * file_fd: Descriptor del archivo
+ */
+void entry_set_metadata(FileEntry *entry, const struct stat *st, int file_fd)
+{
+    entry->mtime = st->st_mtim.tv_sec;
+    entry->mtime_nsec = (int)st->st_mtim.tv_nsec;
+    entry->mode = st->st_mode;
+    entry->flags &= ~ENTRY_HASHED;
+    if (hash_enabled)
+    {
+        entry->content_hash = file_content_hash(file_fd);
+        entry->flags |= ENTRY_HASHED;
+    }
+}
+
+/*
+ * Función para saber si un archivo sigue igual que su entrada en el archivador
+ * Tienen que coincidir el tamaño y el modo, y además la fecha de modificación o, con --hash, el
+ * hash del contenido. Las entradas convertidas de v1 (sin modo) y, con --hash, las que no tienen
+ * hash se consideran cambiadas.
+ * entry: Entrada del archivo
+ * filename: Nombre del archivo
+ * Retorna: 1 si no cambió, 0 si cambió o no se puede saber
+ */
+int entry_unchanged(FileEntry *entry, const char *filename)
+{
+    struct stat st;
+    if (stat(filename, &st) != 0 || entry->mode == 0 || st.st_size != entry->size || st.st_mode != entry->mode)
+    {
+        return 0;
+    }
+    if (!hash_enabled)
+    {
+        return st.st_mtim.tv_sec == entry->mtime && st.st_mtim.tv_nsec == entry->mtime_nsec;
+    }
+    if (!(entry->flags & ENTRY_HASHED))
+    {
+        return 0;
+    }
+    int file_fd = open(filename, O_RDONLY);
+    if (file_fd < 0)
+    {
+        return 0;
+    }
+    uint64_t hash = file_content_hash(file_fd);
+    close(file_fd);
+    return hash == entry->content_hash;
+}
+
+/*
+ * Función para ampliar la tabla de sumas de verificación hasta cubrir un número de bloques
+ * Los bloques nuevos quedan sin suma. Debe llamarse antes de que varios hilos registren bloques.
+ * block_count: Número de bloques a cubrir
+ */
+void checksum_reserve(int block_count)
+{
+    if (block_count <= checksum_table.count)
+    {
+        return;
+    }
+    if (block_count > checksum_table.capacity)
+    {
+        int capacity = checksum_table.capacity ? checksum_table.capacity : 256;
+        while (capacity < block_count)
+        {
+            capacity *= 2;
+        }
+        checksum_table.entries = realloc(checksum_table.entries, capacity * sizeof(BlockChecksum));
+        checksum_table.verified = realloc(checksum_table.verified, capacity);
+        if (!checksum_table.entries || !checksum_table.verified)
+        {
+            perror("Error de memoria");
+            fail_operation();
+        }
+        checksum_table.capacity = capacity;
+    }
+    memset(checksum_table.entries + checksum_table.count, 0, (block_count - checksum_table.count) * sizeof(BlockChecksum));
+    memset(checksum_table.verified + checksum_table.count, 0, block_count - checksum_table.count);
+    checksum_table.count = block_count;
+}
+
+/*
+ * Función para registrar la suma de verificación de un bloque recién escrito
+ * Se puede llamar desde varios hilos si checksum_reserve ya cubre el bloque.
+ * block: Índice del bloque
+ * data: Contenido escrito en el bloque
+ * length: Bytes escritos
+ */
+void checksum_record(int block, const unsigned char *data, size_t length)
+{
+    checksum_reserve(block + 1);
+    checksum_table.entries[block].crc = crc32c(0, data, length);
+    checksum_table.entries[block].length = (uint32_t)length;
+    checksum_table.verified[block] = 0;
+    __atomic_store_n(&checksum_table.dirty, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Función para registrar la suma de verificación de un bloque leyéndolo del archivador
+ * fd: Descriptor de archivo del archivador
+ * block: Índice del bloque
+ */
+void checksum_record_from_archive(int fd, int block)
+{
+    unsigned char *buffer = calloc(1, block_size);
+    if (!buffer)
+    {
+        perror("Error de memoria");
+        fail_operation();
+    }
+    library_track(free, buffer);
+    if (io_pread(fd, buffer, block_size, (off_t)block * block_size) < 0)
+    {
+        perror("Error al leer bloque de datos");
+        fail_operation();
+    }
+    checksum_record(block, buffer, block_size);
+    library_untrack(1);
+    free(buffer);
+}
+
+/*
+ * Función para quitar la suma de verificación de un bloque que deja de tener datos
+ * block: Índice del bloque
+ */
+void checksum_clear(int block)
+{
+    if (block < checksum_table.count && checksum_table.entries[block].length != 0)
+    {
+        checksum_table.entries[block].crc = 0;
+        checksum_table.entries[block].length = 0;
+        checksum_table.verified[block] = 0;
+        checksum_table.dirty = 1;
+    }
+}
+
+/*
+ * Función para cargar la tabla de sumas de verificación del archivador
+ * fd: Descriptor de archivo del archivador
+ * header: Puntero al encabezado del archivador
+ */
+void checksum_load(int fd, StarHeader *header)
+{
+    free(checksum_table.entries);
+    free(checksum_table.verified);
+    memset(&checksum_table, 0, sizeof(ChecksumTable));
+    if (header->checksum_table_block <= 0 || header->checksum_count <= 0)
+    {
+        return;
+    }
+
+    checksum_reserve(header->checksum_count);
+    ssize_t bytes = (ssize_t)header->checksum_count * sizeof(BlockChecksum);
+    if (io_pread(fd, checksum_table.entries, bytes, (off_t)header->checksum_table_block * block_size) != bytes)
+    {
+        perror("Error al leer la tabla de sumas de verificación");
+        fail_operation();
+    }
+}
+
+/*
+ * Función para guardar la tabla de sumas de verificación en bloques contiguos del archivador
+ * Los bloques de la tabla anterior se liberan.
+ * fd: Descriptor de archivo del archivador
+ * header: Puntero al encabezado del archivador
+ */
+void checksum_save(int fd, StarHeader *header)
+{
+    for (int b = 0; b < header->checksum_table_blocks; b++)
+    {
+        free_block(header, header->checksum_table_block + b);
+    }
+    header->checksum_table_block = 0;
+    header->checksum_table_blocks = 0;
+    header->checksum_count = 0;
+
+    // Los bloques finales sin suma (libres o de metadatos) no se guardan
+    while (checksum_table.count > 0 && checksum_table.entries[checksum_table.count - 1].length == 0)
+    {
+        checksum_table.count--;
+    }
+    checksum_table.dirty = 0;
+    if (checksum_table.count == 0)
+    {
+        return;
+    }
+
+    size_t bytes = (size_t)checksum_table.count * sizeof(BlockChecksum);
+    int blocks = (int)((bytes + block_size - 1) / block_size);
+    int start = allocate_run(fd, header, blocks);
+    unsigned char *buffer = calloc(blocks, block_size);
+    if (!buffer)
+    {
+        perror("Error de memoria");
+        fail_operation();
+    }
+    library_track(free, buffer);
+    memcpy(buffer, checksum_table.entries, bytes);
+    if (io_pwrite(fd, buffer, (size_t)blocks * block_size, (off_t)start * block_size) != (ssize_t)blocks * block_size)
+    {
+        perror("Error al escribir la tabla de sumas de verificación");
+        fail_operation();
+    }
+    library_untrack(1);
+    free(buffer);
+
+    header->checksum_table_block = start;
+    header->checksum_table_blocks = blocks;
+    header->checksum_count = checksum_table.count;
+}
+
+/*
+ * Función para comprobar las sumas de verificación de los bloques que cubre un rango del archivador
+ * Cada bloque dañado se reporta en stderr. Los bloques correctos se marcan para no volver a
+ * comprobarlos (un bloque de colas lo comparten varios archivos).
+ * fd: Descriptor de archivo del archivador
+ * map: Archivador mapeado en memoria (NULL si no está disponible)
+ * map_size: Tamaño del mapeo en bytes
+ * archive_offset: Posición del rango en el archivador
+ * length: Bytes del rango
+ * filename: Archivo al que pertenecen los bloques (para los mensajes)
+ * unchecked: Se incrementa con los bloques que no tienen suma de verificación
+ * Retorna: Número de bloques dañados
+ */
+int verify_block_range(int fd, unsigned char *map, off_t map_size, off_t archive_offset, size_t length,
+                       const char *filename, int *unchecked)
+{
+    if (length == 0)
+    {
+        return 0;
+    }
+
+    int bad = 0;
+    unsigned char *buffer = NULL;
+    int first = (int)(archive_offset / block_size);
+    int last = (int)((archive_offset + (off_t)length - 1) / block_size);
+    for (int b = first; b <= last; b++)
+    {
+        if (!block_needs_check(b, unchecked))
+        {
+            continue;
+        }
+
+        BlockChecksum *expected = &checksum_table.entries[b];
+        off_t offset = (off_t)b * block_size;
+        const unsigned char *data;
+        if (map && offset + (off_t)expected->length <= map_size)
+        {
+            data = map + offset;
+            stats_add(&io_stats.bytes_mapped, expected->length);
+        }
+        else
+        {
+            if (!buffer)
+            {
+                buffer = malloc(block_size);
+                if (!buffer)
+                {
+                    perror("Error de memoria");
+                    fail_operation();
+                }
+                library_track(free, buffer);
+            }
+            memset(buffer, 0, block_size);
+            if (io_pread(fd, buffer, expected->length, offset) < 0)
+            {
+                perror("Error al leer bloque de datos");
+                fail_operation();
+            }
+            data = buffer;
+        }
+        bad += verify_block_data(b, data, filename);
+    }
+    if (buffer)
+    {
+        library_untrack(1);
+    }
+    free(buffer);
+    return bad;
+}
+
+/*
+ * Función para saber si hay que comprobar la suma de verificación de un bloque
+ * block: Índice del bloque
+ * unchecked: Se incrementa si el bloque no tiene suma de verificación
+ * Retorna: 1 si tiene suma y aún no se comprobó, 0 si no
+ */
+int block_needs_check(int block, int *unchecked)
+{
+    if (block >= checksum_table.count || checksum_table.entries[block].length == 0)
+    {
+        (*unchecked)++;
+        return 0;
+    }
+    return !__atomic_load_n(&checksum_table.verified[block], __ATOMIC_RELAXED);
+}
+
+/*
+ * Función para comprobar la suma de verificación de un bloque ya leído
+ * Si el bloque está dañado se reporta en stderr; si no, se marca como comprobado.
+ * block: Índice del bloque (debe tener suma de verificación)
+ * data: Contenido del bloque (al menos la longitud que cubre su suma)
+ * filename: Archivo al que pertenece el bloque (para el mensaje)
+ * Retorna: 1 si el bloque está dañado, 0 si no
+ */
+int verify_block_data(int block, const unsigned char *data, const char *filename)
+{
+    BlockChecksum *expected = &checksum_table.entries[block];
+    uint32_t crc = crc32c(0, data, expected->length);
+    if (crc != expected->crc)
+    {
+        fprintf(stderr, "Error: bloque %d de '%s' dañado (CRC32C esperado %08x, calculado %08x)\n",
+                block, filename, expected->crc, crc);
+        return 1;
+    }
+    __atomic_store_n(&checksum_table.verified[block], 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/*
+ * Función para verificar la integridad de todos los bloques de datos del archivador (--verify)
+ * Cada bloque se comprueba una sola vez aunque lo compartan varios archivos. Los tramos se
+ * reparten entre el grupo de hilos (-j, o un hilo por procesador) y se leen del archivador
+ * mapeado en memoria, sin escribir ninguna salida.
+ * star_filename: Nombre del archivo de archivado a verificar
+ */
+void verify_star(char *star_filename)
+{
+    int fd = open(star_filename, O_RDONLY);
+    if (fd < 0)
+    {
+        perror("Error al abrir el archivo empaquetado");
+        fail_operation();
+    }
+
+    StarHeader header;
+    read_header(fd, &header);
+    load_directory(&header);
+
+    VerifyArchive ctx;
+    memset(&ctx, 0, sizeof(VerifyArchive));
+    ctx.fd = fd;
+    ctx.header = &header;
+    struct stat star_st;
+    if (fstat(fd, &star_st) == 0 && star_st.st_size > 0)
+    {
+        void *addr = mmap(NULL, star_st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (addr != MAP_FAILED)
+        {
+            ctx.map = addr;
+            ctx.map_size = star_st.st_size;
+            madvise(ctx.map, ctx.map_size, MADV_SEQUENTIAL);
+        }
+    }
+
+    int worker_count = job_count > 1 ? job_count : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (worker_count < 1)
+    {
+        worker_count = 1;
+    }
+
+    // Encolar los bloques de cada extent que no se hayan visto, en tramos contiguos
+    int total_blocks = (int)((star_st.st_size + block_size - 1) / block_size);
+    unsigned char *seen = calloc(total_blocks + 1, 1);
+    if (!seen)
+    {
+        perror("Error de memoria");
+        fail_operation();
+    }
+    TaskQueue *queues = create_task_queues(worker_count);
+    int task_count = 0;
+    int block_count = 0;
+    for (int i = 0; i < header.file_count; i++)
+    {
+        FileEntry *entry = &header.files[i];
+        for (int e = 0; e < entry->extent_count; e++)
+        {
+            Extent *extent = &header.extents[entry->extent_index + e];
+            int b = extent->start_block;
+            int end = extent->start_block + extent->length;
+            while (b < end)
+            {
+                if (b >= total_blocks || seen[b])
+                {
+                    b++;
+                    continue;
+                }
+                int run = 0;
+                while (b + run < end && b + run < total_blocks && !seen[b + run] && run < TASK_CHUNK_BLOCKS)
+                {
+                    seen[b + run] = 1;
+                    run++;
+                }
+
+                BlockTask task;
+                task.file_index = i;
+                task.archive_offset = (off_t)b * block_size;
+                task.file_offset = 0;
+                task.length = (size_t)run * block_size;
+                queue_task(&queues[task_count++ % worker_count], &task);
+                block_count += run;
+                b += run;
+            }
+        }
+
+        // El bloque de colas lo comparten varios archivos: se encola con el primero
+        if (entry->tail_length > 0 && entry->tail_block < total_blocks && !seen[entry->tail_block])
+        {
+            seen[entry->tail_block] = 1;
+            BlockTask task;
+            task.file_index = i;
+            task.archive_offset = (off_t)entry->tail_block * block_size;
+            task.file_offset = 0;
+            task.length = block_size;
+            queue_task(&queues[task_count++ % worker_count], &task);
+            block_count++;
+        }
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    run_task_pool(queues, worker_count, verify_task, &ctx);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    int checked = block_count - ctx.unchecked_blocks;
+    double megabytes = (double)checked * block_size / (1024.0 * 1024.0);
+    printf("Bloques verificados: %d (%.1f MB en %.2f s", checked, megabytes, seconds);
+    if (seconds > 0)
+    {
+        printf(", %.1f MB/s", megabytes / seconds);
+    }
+    printf(", %d hilos)\n", worker_count);
+    if (ctx.unchecked_blocks > 0)
+    {
+        printf("Bloques sin suma de verificación: %d\n", ctx.unchecked_blocks);
+    }
+    if (verbose_level >= 1)
+    {
+        printf("Implementación de CRC32C: %s\n", crc32c_use_hw ? "SSE4.2" : "slicing-by-8");
+    }
+
+    destroy_task_queues(queues, worker_count);
+    free(seen);
+    if (ctx.map)
+    {
+        munmap(ctx.map, ctx.map_size);
+    }
+    free_header(&header);
+    close(fd);
+
+    if (ctx.bad_blocks > 0)
+    {
+        fflush(stdout);
+        fprintf(stderr, "Bloques dañados: %d\n", ctx.bad_blocks);
+        fail_operation();
+    }
+    printf("El empaquetado está íntegro.\n");
+}
+
+/*
+ * Función para verificar un tramo de bloques (tarea de verify_star)
+ * arg: Puntero a VerifyArchive
+ * task: Tramo a verificar
+ * worker_id: Número del trabajador que ejecuta la tarea
+ */
+void verify_task(void *arg, BlockTask *task, int worker_id)
+{
+    (void)worker_id;
+    VerifyArchive *ctx = (VerifyArchive *)arg;
+    int unchecked = 0;
+    int bad = verify_block_range(ctx->fd, ctx->map, ctx->map_size, task->archive_offset, task->length,
+                                 ctx->header->files[task->file_index].filename, &unchecked);
+    __atomic_add_fetch(&ctx->bad_blocks, bad, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&ctx->unchecked_blocks, unchecked, __ATOMIC_RELAXED);
+}
+
+/*
+ * Función para obtener el nombre legible de un motor de extracción
+ * engine: Motor de extracción
+ * Retorna: Nombre del motor
+ */
+const char *extract_engine_name(ExtractEngine engine)
+{
+    switch (engine)
+    {
+    case EXTRACT_DIRECT:
+        return "O_DIRECT (sin caché de páginas, con lectura anticipada)";
+    case EXTRACT_IO_URING:
+        return "io_uring (varias peticiones en curso)";
+    case EXTRACT_COPY_RANGE:
+        return "copy_file_range (sin copia en espacio de usuario)";
+    case EXTRACT_PIPELINE:
+        return "pread + pwrite por tramos";
+    case EXTRACT_MMAP:
+        return "mmap + write";
+    default:
+        return "read + write";
+    }
+}
+
+#ifdef STAR_WITH_IO_URING
+/*
+ * Función para saber si se puede usar el anillo de io_uring; la primera vez lo prepara
+ * Retorna: 1 si el anillo se puede usar desde este hilo, 0 si no (kernel sin io_uring,
+ * io_uring deshabilitado, u otro hilo o bloques mayores que los búferes)
+ */
+int uring_ready(void)
+{
+    if (uring.state == 0)
+    {
+        uring.owner = pthread_self();
+        uring.state = uring_setup() ? 1 : -1;
+        if (uring.state < 0)
+        {
+            verbose_print("io_uring no está disponible; se usa la E/S síncrona.", 1);
+        }
+    }
+    return uring.state > 0 && pthread_equal(uring.owner, pthread_self()) && (size_t)block_size <= uring.chunk;
+}
+
+/*
+ * Función para crear el anillo de io_uring, mapear sus colas y registrar sus búferes
+ * Retorna: 1 si se pudo, 0 si no
+ */
+int uring_setup(void)
+{
+    uring.chunk = block_size > URING_MIN_CHUNK ? (size_t)block_size : URING_MIN_CHUNK;
+    uring.depth = (int)(URING_BUFFER_BYTES / uring.chunk);
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    uring.ring_fd = (int)syscall(__NR_io_uring_setup, uring.depth, &params);
+    if (uring.ring_fd < 0)
+    {
+        return 0;
+    }
+
+    // Mapear las colas de envío y de terminación y el array de peticiones
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        sq_size = cq_size = sq_size > cq_size ? sq_size : cq_size;
+    }
+    unsigned char *sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring.ring_fd,
+                             IORING_OFF_SQ_RING);
+    unsigned char *cq = (params.features & IORING_FEAT_SINGLE_MMAP)
+                            ? sq
+                            : mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                   uring.ring_fd, IORING_OFF_CQ_RING);
+    uring.sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, uring.ring_fd, IORING_OFF_SQES);
+    uring.buffers = mmap(NULL, URING_BUFFER_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (sq == MAP_FAILED || cq == MAP_FAILED || uring.sqes == MAP_FAILED || uring.buffers == MAP_FAILED)
+    {
+        close(uring.ring_fd);
+        return 0;
+    }
+    uring.sq_tail = (unsigned int *)(sq + params.sq_off.tail);
+    uring.sq_mask = (unsigned int *)(sq + params.sq_off.ring_mask);
+    uring.sq_array = (unsigned int *)(sq + params.sq_off.array);
+    uring.cq_head = (unsigned int *)(cq + params.cq_off.head);
+    uring.cq_tail = (unsigned int *)(cq + params.cq_off.tail);
+    uring.cq_mask = (unsigned int *)(cq + params.cq_off.ring_mask);
+    uring.cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    // Registrar los búferes: el kernel los fija una vez en lugar de en cada petición
+    struct iovec *iov = malloc(uring.depth * sizeof(struct iovec));
+    if (!iov)
+    {
+        close(uring.ring_fd);
+        return 0;
+    }
+    for (int i = 0; i < uring.depth; i++)
+    {
+        iov[i].iov_base = uring.buffers + (size_t)i * uring.chunk;
+        iov[i].iov_len = uring.chunk;
+    }
+    int registered = (int)syscall(__NR_io_uring_register, uring.ring_fd, IORING_REGISTER_BUFFERS, iov, uring.depth);
+    free(iov);
+    if (registered < 0)
+    {
+        close(uring.ring_fd);
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Función para poner en la cola de envío una lectura o escritura sobre el búfer de un tramo
+ * opcode: IORING_OP_READ_FIXED o IORING_OP_WRITE_FIXED
+ * fd: Descriptor del archivo
+ * offset: Posición en el archivo
+ * slot: Búfer registrado (cada búfer tiene a lo sumo una petición en curso)
+ * done: Bytes del búfer ya transferidos (la petición sigue desde ahí)
+ * length: Bytes restantes
+ */
+void uring_queue(int opcode, int fd, off_t offset, int slot, size_t done, size_t length)
+{
+    unsigned int tail = *uring.sq_tail;
+    unsigned int index = tail & *uring.sq_mask;
+    struct io_uring_sqe *sqe = &uring.sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->off = offset + done;
+    sqe->addr = (uint64_t)(uintptr_t)(uring.buffers + (size_t)slot * uring.chunk + done);
+    sqe->len = length;
+    sqe->buf_index = slot;
+    sqe->user_data = ((uint64_t)slot << 1) | (opcode == IORING_OP_WRITE_FIXED);
+    uring.sq_array[index] = index;
+    __atomic_store_n(uring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+    uring.pending++;
+}
+
+/*
+ * Función para copiar un rango de bytes entre dos archivos con io_uring: se mantienen varias
+ * lecturas en curso mientras se escriben los tramos ya leídos. Si el origen y el destino son el
+ * mismo archivo, los rangos no deben solaparse a menos de URING_BUFFER_BYTES de distancia.
+ * src_fd: Descriptor de origen
+ * src_offset: Posición en el origen
+ * dst_fd: Descriptor de destino
+ * dst_offset: Posición en el destino
+ * length: Bytes a copiar; lo que falte en el origen se escribe como ceros
+ * on_chunk: Función que recibe cada tramo antes de escribirlo (NULL si no hace falta)
+ * Retorna: 1 si se copió, 0 si io_uring no está disponible (el llamador usa la ruta síncrona)
+ */
+int uring_copy(int src_fd, off_t src_offset, int dst_fd, off_t dst_offset, size_t length, UringChunkFn on_chunk)
+{
+    if (length == 0 || !uring_enabled || !uring_ready())
+    {
+        return length == 0;
+    }
+
+    // Estado de cada búfer: tramo asignado y bytes transferidos de la petición en curso
+    off_t slot_offset[URING_BUFFER_BYTES / URING_MIN_CHUNK];
+    size_t slot_length[URING_BUFFER_BYTES / URING_MIN_CHUNK];
+    size_t slot_done[URING_BUFFER_BYTES / URING_MIN_CHUNK];
+    size_t next = 0;
+    size_t written = 0;
+    for (int slot = 0; slot < uring.depth && next < length; slot++)
+    {
+        slot_offset[slot] = next;
+        slot_length[slot] = length - next < uring.chunk ? length - next : uring.chunk;
+        slot_done[slot] = 0;
+        uring_queue(IORING_OP_READ_FIXED, src_fd, src_offset + next, slot, 0, slot_length[slot]);
+        next += slot_length[slot];
+    }
+
+    while (written < length)
+    {
+        // Enviar lo pendiente y esperar al menos una terminación
+        int submitted = (int)syscall(__NR_io_uring_enter, uring.ring_fd, uring.pending, 1, IORING_ENTER_GETEVENTS,
+                                     NULL, 0);
+        if (submitted < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("Error de io_uring");
+            uring.state = -1; // Quedan peticiones en curso: no se vuelve a usar el anillo
+            fail_operation();
+        }
+        uring.pending -= submitted;
+        stats_add(&io_stats.uring_calls, 1);
+
+        unsigned int head = *uring.cq_head;
+        while (head != __atomic_load_n(uring.cq_tail, __ATOMIC_ACQUIRE))
+        {
+            struct io_uring_cqe *cqe = &uring.cqes[head & *uring.cq_mask];
+            int slot = (int)(cqe->user_data >> 1);
+            int writing = (int)(cqe->user_data & 1);
+            int result = cqe->res;
+            head++;
+            __atomic_store_n(uring.cq_head, head, __ATOMIC_RELEASE);
+
+            if ((result < 0 && result != -EINTR && result != -EAGAIN) || (writing && result == 0))
+            {
+                errno = result < 0 ? -result : ENOSPC; // Una escritura de 0 bytes no avanzaría nunca
+                perror(writing ? "Error al escribir bloque" : "Error al leer bloque de datos");
+                uring.state = -1;
+                fail_operation();
+            }
+            unsigned char *buffer = uring.buffers + (size_t)slot * uring.chunk;
+            slot_done[slot] += result > 0 ? result : 0;
+            stats_add(writing ? &io_stats.bytes_written : &io_stats.bytes_read, result > 0 ? result : 0);
+
+            if (!writing && result == 0)
+            {
+                // Fin del origen: el resto del tramo se escribe como ceros
+                memset(buffer + slot_done[slot], 0, slot_length[slot] - slot_done[slot]);
+                slot_done[slot] = slot_length[slot];
+            }
+            if (slot_done[slot] < slot_length[slot])
+            {
+                // Transferencia parcial o interrumpida: continuar donde quedó
+                uring_queue(writing ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED, writing ? dst_fd : src_fd,
+                            (writing ? dst_offset : src_offset) + slot_offset[slot], slot, slot_done[slot],
+                            slot_length[slot] - slot_done[slot]);
+            }
+            else if (!writing)
+            {
+                if (on_chunk)
+                {
+                    on_chunk(dst_offset + slot_offset[slot], buffer, slot_length[slot]);
+                }
+                slot_done[slot] = 0;
+                uring_queue(IORING_OP_WRITE_FIXED, dst_fd, dst_offset + slot_offset[slot], slot, 0,
+                            slot_length[slot]);
+            }
+            else
+            {
+                written += slot_length[slot];
+                if (next < length)
+                {
+                    // El búfer queda libre: leer el siguiente tramo
+                    slot_offset[slot] = next;
+                    slot_length[slot] = length - next < uring.chunk ? length - next : uring.chunk;
+                    slot_done[slot] = 0;
+                    uring_queue(IORING_OP_READ_FIXED, src_fd, src_offset + next, slot, 0, slot_length[slot]);
+                    next += slot_length[slot];
+                }
+            }
+        }
+    }
+    return 1;
+}
+#else
+int uring_copy(int src_fd, off_t src_offset, int dst_fd, off_t dst_offset, size_t length, UringChunkFn on_chunk)
+{
+    (void)src_fd;
+    (void)src_offset;
+    (void)dst_fd;
+    (void)dst_offset;
+    (void)on_chunk;
+    return length == 0;
+}
+#endif
+
+/*
+ * Función para registrar las sumas de verificación de los bloques de un tramo copiado con
+ * io_uring (on_chunk de add_file_to_star)
+ * offset: Posición del tramo en el archivador (alineada a bloque)
+ * data: Datos del tramo
+ * length: Bytes del tramo (múltiplo del tamaño de bloque)
+ */
+void uring_record_checksums(off_t offset, unsigned char *data, size_t length)
+{
+    for (size_t done = 0; done < length; done += block_size)
+    {
+        checksum_record((int)((offset + done) / block_size), data + done, block_size);
+    }
+}
+
+/*
+ * Función para reservar memoria alineada a DIRECT_ALIGN (se libera con free)
+ * size: Bytes a reservar
+ * Retorna: Memoria reservada
+ */
+void *aligned_buffer(size_t size)
+{
+    void *buffer;
+    if (posix_memalign(&buffer, DIRECT_ALIGN, size) != 0)
+    {
+        perror("Error de memoria");
+        fail_operation();
+    }
+    return buffer;
+}
+
+/*
+ * Función para tomar un búfer del grupo; espera si todos están en uso
+ * La primera vez se reserva el grupo completo, con un búfer por hilo de trabajo (-j) y al menos
+ * PIPELINE_SLOTS, así que la memoria de las copias no depende del tamaño de los datos ni del
+ * número de archivos. Cada hilo usa a la vez un búfer o una lectura anticipada.
+ * Retorna: Búfer de POOL_BUFFER_BYTES bytes alineado a DIRECT_ALIGN
+ */
+unsigned char *pool_acquire(void)
+{
+    pthread_mutex_lock(&buffer_pool.lock);
+    if (buffer_pool.count == 0)
+    {
+        int count = job_count > PIPELINE_SLOTS ? job_count : PIPELINE_SLOTS;
+        buffer_pool.memory = aligned_buffer((size_t)count * POOL_BUFFER_BYTES);
+        buffer_pool.free_list = malloc(count * sizeof(unsigned char *));
+        if (!buffer_pool.free_list)
+        {
+            perror("Error de memoria");
+            fail_operation();
+        }
+        buffer_pool.count = count;
+        pool_reset();
+    }
+    while (buffer_pool.available == 0)
+    {
+        pthread_cond_wait(&buffer_pool.ready, &buffer_pool.lock);
+    }
+    unsigned char *buffer = buffer_pool.free_list[--buffer_pool.available];
+    pthread_mutex_unlock(&buffer_pool.lock);
+    return buffer;
+}
+
+/*
+ * Función para devolver un búfer al grupo
+ * buffer: Búfer obtenido con pool_acquire
+ */
+void pool_release(unsigned char *buffer)
+{
+    pthread_mutex_lock(&buffer_pool.lock);
+    buffer_pool.free_list[buffer_pool.available++] = buffer;
+    pthread_cond_signal(&buffer_pool.ready);
+    pthread_mutex_unlock(&buffer_pool.lock);
+}
+
+/*
+ * Función para marcar todos los búferes del grupo como disponibles
+ * Solo se llama cuando ningún hilo puede tener un búfer: al reservar el grupo y al empezar una
+ * llamada de la biblioteca (una llamada que falló vuelve con longjmp sin devolver el suyo).
+ */
+void pool_reset(void)
+{
+    for (int i = 0; i < buffer_pool.count; i++)
+    {
+        buffer_pool.free_list[i] = buffer_pool.memory + (size_t)i * POOL_BUFFER_BYTES;
+    }
+    buffer_pool.available = buffer_pool.count;
+}
+
+/*
+ * Función para abrir el segundo descriptor del archivador, con O_DIRECT (--direct)
+ * Los datos de los archivos se leen y escriben por este descriptor, sin pasar por la caché de
+ * páginas; los metadatos y las colas, que no ocupan bloques completos, siguen usando el
+ * descriptor normal. Si el sistema de archivos no acepta O_DIRECT se sigue sin él (con -v se avisa).
+ * star_filename: Nombre del archivo de archivado (ya abierto con el descriptor normal)
+ * flags: O_RDONLY u O_RDWR
+ */
+void direct_open(const char *star_filename, int flags)
+{
+    if (!direct_io)
+    {
+        return;
+    }
+    direct_fd = open(star_filename, flags | O_DIRECT);
+    if (direct_fd < 0 && verbose_level >= 1)
+    {
+        printf("O_DIRECT no está disponible en este sistema de archivos; se usa la E/S con caché.\n");
+    }
+}
+
+/*
+ * Función para cerrar el descriptor con O_DIRECT y sacar de la caché las páginas del archivador
+ * que se leyeron o escribieron por el descriptor normal
+ * fd: Descriptor normal del archivador
+ */
+void direct_close(int fd)
+{
+    if (!direct_io)
+    {
+        return;
+    }
+    cache_release(fd, 0, 0);
+    if (direct_fd >= 0)
+    {
+        close(direct_fd);
+        direct_fd = -1;
+    }
+}
+
+/*
+ * Función para sumar a un contador de --stats (no hace nada si no se pidió)
+ * counter: Contador de io_stats
+ * value: Cantidad a sumar
+ */
+void stats_add(long long *counter, long long value)
+{
+    if (stats_enabled)
+    {
+        __atomic_add_fetch(counter, value, __ATOMIC_RELAXED);
+    }
+}
+
+/*
+ * Función para sumar a un tiempo de --stats lo transcurrido desde start
+ * seconds: Tiempo de io_stats
+ * start: Momento de inicio (CLOCK_MONOTONIC)
+ */
+void stats_phase(double *seconds, const struct timespec *start)
+{
+    if (stats_enabled)
+    {
+        struct timespec end;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        *seconds += (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+    }
+}
+
+/*
+ * Función para escribir una cadena JSON entre comillas
+ * out: Flujo de salida
+ * text: Cadena a escribir
+ */
+void json_print_string(FILE *out, const char *text)
+{
+    fputc('"', out);
+    for (const unsigned char *c = (const unsigned char *)text; *c; c++)
+    {
+        if (*c == '"' || *c == '\\')
+        {
+            fprintf(out, "\\%c", *c);
+        }
+        else if (*c < 0x20)
+        {
+            fprintf(out, "\\u%04x", *c);
+        }
+        else
+        {
+            fputc(*c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+/*
+ * Función para escribir en la salida de errores los contadores de la operación en una línea JSON
+ * (--stats=json). El tiempo de los datos es el de la operación menos la carga y la escritura del
+ * encabezado, así que incluye también el cálculo (sumas de verificación, compresión).
+ * operation: Nombre de la operación
+ * star_filename: Nombre del archivador
+ */
+void stats_print(const char *operation, const char *star_filename)
+{
+    double data_seconds = io_stats.wall_seconds - io_stats.header_load_seconds - io_stats.header_flush_seconds;
+    fprintf(stderr, "{\"operation\":\"%s\",\"archive\":", operation);
+    json_print_string(stderr, star_filename);
+    fprintf(stderr,
+            ",\"wall_seconds\":%.6f,\"phases\":{\"header_load\":%.6f,\"data\":%.6f,\"header_flush\":%.6f},"
+            "\"bytes_read\":%lld,\"bytes_written\":%lld,\"bytes_copied\":%lld,\"bytes_mapped\":%lld,"
+            "\"read_calls\":%lld,\"write_calls\":%lld,\"lseek_calls\":%lld,\"copy_calls\":%lld,"
+            "\"uring_calls\":%lld,\"blocks_reused\":%lld,\"blocks_appended\":%lld,\"chain_reads\":%lld,"
+            "\"header_writes\":%lld}\n",
+            io_stats.wall_seconds, io_stats.header_load_seconds, data_seconds > 0 ? data_seconds : 0,
+            io_stats.header_flush_seconds, io_stats.bytes_read, io_stats.bytes_written, io_stats.bytes_copied,
+            io_stats.bytes_mapped, io_stats.read_calls, io_stats.write_calls, io_stats.lseek_calls,
+            io_stats.copy_calls, io_stats.uring_calls, io_stats.blocks_reused, io_stats.blocks_appended,
+            io_stats.chain_reads, io_stats.header_writes);
+}
+
+/*
+ * Funciones de E/S que cuentan las llamadas y los bytes para --stats; se comportan igual que las
+ * llamadas del sistema del mismo nombre (y conservan errno)
+ */
+ssize_t io_read(int fd, void *buffer, size_t length)
+{
+    ssize_t n = read(fd, buffer, length);
+    stats_add(&io_stats.read_calls, 1);
+    stats_add(&io_stats.bytes_read, n > 0 ? n : 0);
+    return n;
+}
+
+ssize_t io_write(int fd, const void *buffer, size_t length)
+{
+    ssize_t n = write(fd, buffer, length);
+    stats_add(&io_stats.write_calls, 1);
+    stats_add(&io_stats.bytes_written, n > 0 ? n : 0);
+    return n;
+}
+
+ssize_t io_pread(int fd, void *buffer, size_t length, off_t offset)
+{
+    ssize_t n = pread(fd, buffer, length, offset);
+    stats_add(&io_stats.read_calls, 1);
+    stats_add(&io_stats.bytes_read, n > 0 ? n : 0);
+    return n;
+}
+
+ssize_t io_pwrite(int fd, const void *buffer, size_t length, off_t offset)
+{
+    ssize_t n = pwrite(fd, buffer, length, offset);
+    stats_add(&io_stats.write_calls, 1);
+    stats_add(&io_stats.bytes_written, n > 0 ? n : 0);
+    return n;
+}
+
+off_t io_lseek(int fd, off_t offset, int whence)
+{
+    stats_add(&io_stats.lseek_calls, 1);
+    return lseek(fd, offset, whence);
+}
+
+ssize_t io_copy_file_range(int in_fd, loff_t *in_offset, int out_fd, loff_t *out_offset, size_t length,
+                           unsigned int flags)
+{
+    ssize_t n = copy_file_range(in_fd, in_offset, out_fd, out_offset, length, flags);
+    stats_add(&io_stats.copy_calls, 1);
+    stats_add(&io_stats.bytes_copied, n > 0 ? n : 0);
+    return n;
+}
+
+/*
+ * Función para leer datos del archivador, con O_DIRECT si está abierto y la petición está alineada
+ * fd: Descriptor normal del archivador
+ * buffer: Destino de los datos
+ * length: Bytes a leer
+ * offset: Posición en el archivador
+ * Retorna: Lo mismo que pread
+ */
+ssize_t archive_pread(int fd, void *buffer, size_t length, off_t offset)
+{
+    if (direct_fd >= 0 && ((uintptr_t)buffer | (uintptr_t)offset | length) % DIRECT_ALIGN == 0)
+    {
+        ssize_t n = io_pread(direct_fd, buffer, length, offset);
+        if (n >= 0 || errno != EINVAL)
+        {
+            return n;
+        }
+        // El dispositivo pide una alineación mayor: leer esta petición con la caché
+    }
+    return io_pread(fd, buffer, length, offset);
+}
+
+/*
+ * Función para escribir datos en el archivador, con O_DIRECT si está abierto y la petición está
+ * alineada
+ * fd: Descriptor normal del archivador
+ * buffer: Datos a escribir
+ * length: Bytes a escribir
+ * offset: Posición en el archivador
+ * Retorna: Lo mismo que pwrite
+ */
+ssize_t archive_pwrite(int fd, const void *buffer, size_t length, off_t offset)
+{
+    if (direct_fd >= 0 && ((uintptr_t)buffer | (uintptr_t)offset | length) % DIRECT_ALIGN == 0)
+    {
+        ssize_t n = io_pwrite(direct_fd, buffer, length, offset);
+        if (n >= 0 || errno != EINVAL)
+        {
+            return n;
+        }
+    }
+    return io_pwrite(fd, buffer, length, offset);
+}
+
+/*
+ * Función para sacar de la caché de páginas un rango de un archivo ya leído o escrito (--direct)
+ * Las páginas modificadas se escriben primero, porque POSIX_FADV_DONTNEED no descarta las sucias.
+ * fd: Descriptor del archivo
+ * offset: Primer byte del rango
+ * length: Bytes del rango (0 para llegar al final del archivo)
+ */
+void cache_release(int fd, off_t offset, off_t length)
+{
+    if (!direct_io)
+    {
+        return;
+    }
+    sync_file_range(fd, offset, length,
+                    SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+    posix_fadvise(fd, offset, length, POSIX_FADV_DONTNEED);
+}
+
+/*
+ * Función para sacar de la caché la salida escrita antes de un tramo, sin esperar al tramo mismo
+ * (--direct). El tramo se empieza a escribir en el disco y se descarta en la llamada siguiente,
+ * así que la escritura sigue mientras se lee el próximo tramo y la caché no crece.
+ * fd: Descriptor del archivo de salida
+ * offset: Posición del tramo recién escrito
+ * length: Bytes del tramo (a lo sumo POOL_BUFFER_BYTES)
+ */
+void cache_release_behind(int fd, off_t offset, off_t length)
+{
+    if (!direct_io)
+    {
+        return;
+    }
+    sync_file_range(fd, offset, length, SYNC_FILE_RANGE_WRITE);
+    off_t previous = offset > POOL_BUFFER_BYTES ? offset - POOL_BUFFER_BYTES : 0;
+    if (previous < offset)
+    {
+        cache_release(fd, previous, offset - previous);
+    }
+}
+
+/*
+ * Función para empezar una lectura anticipada
+ * Con threaded, un hilo lee los tramos en orden en un anillo de PIPELINE_SLOTS búferes del grupo
+ * mientras el llamador escribe los ya leídos, así que el origen y el destino trabajan a la vez.
+ * El llamador lo pide cuando el núcleo no solapa por sí solo las lecturas con las escrituras: el
+ * archivador leído con O_DIRECT, la salida en otro dispositivo, o un archivo de entrada que se
+ * copia al archivador. Sin hilo cada tramo se lee en pipeline_next, con un solo búfer.
+ * pipeline: Lectura a preparar (se termina con pipeline_finish)
+ * fd: Descriptor de origen
+ * archive: 1 si el origen es el archivador (se lee con archive_pread), 0 si es un archivo de entrada
+ * chunks: Tramos a leer, en orden (deben seguir existiendo hasta pipeline_finish)
+ * count: Número de tramos
+ * threaded: 1 si se puede leer en otro hilo (no en la biblioteca ni en los trabajadores de -j)
+ */
+void pipeline_start(Pipeline *pipeline, int fd, int archive, PipelineChunk *chunks, int count, int threaded)
+{
+    memset(pipeline, 0, sizeof(Pipeline));
+    pipeline->fd = fd;
+    pipeline->archive = archive;
+    pipeline->chunks = chunks;
+    pipeline->chunk_count = count;
+    pipeline->slot_count = threaded && count > 1 ? PIPELINE_SLOTS : 1;
+    for (int i = 0; i < pipeline->slot_count; i++)
+    {
+        pipeline->slots[i] = pool_acquire();
+    }
+    pthread_mutex_init(&pipeline->lock, NULL);
+    pthread_cond_init(&pipeline->changed, NULL);
+    if (pipeline->slot_count > 1)
+    {
+        if (pthread_create(&pipeline->thread, NULL, pipeline_reader, pipeline) == 0)
+        {
+            pipeline->threaded = 1;
+            return;
+        }
+        // Sin hilo se lee en pipeline_next con un solo búfer
+        while (pipeline->slot_count > 1)
+        {
+            pool_release(pipeline->slots[--pipeline->slot_count]);
+        }
+    }
+}
+
+/*
+ * Función para leer un tramo completo (menos solo al llegar al final del origen)
+ * pipeline: Lectura anticipada
+ * index: Tramo a leer
+ * Retorna: Bytes leídos, o -1 con errno si falló la lectura
+ */
+ssize_t pipeline_fill(Pipeline *pipeline, int index)
+{
+    PipelineChunk *chunk = &pipeline->chunks[index];
+    unsigned char *buffer = pipeline->slots[index % pipeline->slot_count];
+    size_t filled = 0;
+    while (filled < chunk->length)
+    {
+        size_t wanted = chunk->length - filled;
+        off_t offset = chunk->offset + (off_t)filled;
+        ssize_t n = pipeline->archive ? archive_pread(pipeline->fd, buffer + filled, wanted, offset)
+                                      : io_pread(pipeline->fd, buffer + filled, wanted, offset);
+        if (n < 0)
+        {
+            return -1;
+        }
+        if (n == 0)
+        {
+            break; // Fin del origen
+        }
+        filled += n;
+    }
+    return (ssize_t)filled;
+}
+
+/*
+ * Función del hilo de lectura anticipada: llena los búferes libres en orden
+ * arg: Puntero a Pipeline
+ * Retorna: NULL
+ */
+void *pipeline_reader(void *arg)
+{
+    Pipeline *pipeline = (Pipeline *)arg;
+    for (int i = 0; i < pipeline->chunk_count; i++)
+    {
+        pthread_mutex_lock(&pipeline->lock);
+        while (!pipeline->stop && i - pipeline->consumed >= pipeline->slot_count)
+        {
+            pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+        }
+        int stop = pipeline->stop;
+        pthread_mutex_unlock(&pipeline->lock);
+        if (stop)
+        {
+            break;
+        }
+
+        ssize_t n = pipeline_fill(pipeline, i);
+        int error = errno;
+
+        pthread_mutex_lock(&pipeline->lock);
+        pipeline->results[i % pipeline->slot_count] = n;
+        pipeline->errors[i % pipeline->slot_count] = error;
+        pipeline->produced = i + 1;
+        pthread_cond_broadcast(&pipeline->changed);
+        pthread_mutex_unlock(&pipeline->lock);
+        if (n < 0)
+        {
+            break; // El llamador reporta el error al llegar a este tramo
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Función para obtener el siguiente tramo leído; el búfer es válido hasta pipeline_done
+ * pipeline: Lectura anticipada
+ * length: Se llena con los bytes leídos, o -1 si falló la lectura (con errno)
+ * Retorna: Búfer con los datos del tramo
+ */
+unsigned char *pipeline_next(Pipeline *pipeline, ssize_t *length)
+{
+    int index = pipeline->consumed;
+    int slot = index % pipeline->slot_count;
+    if (!pipeline->threaded)
+    {
+        *length = pipeline_fill(pipeline, index);
+        return pipeline->slots[slot];
+    }
+
+    pthread_mutex_lock(&pipeline->lock);
+    while (pipeline->produced <= index)
+    {
+        pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+    }
+    *length = pipeline->results[slot];
+    errno = pipeline->errors[slot];
+    pthread_mutex_unlock(&pipeline->lock);
+    return pipeline->slots[slot];
+}
+
+/*
+ * Función para devolver el búfer del tramo actual al hilo de lectura
+ * pipeline: Lectura anticipada
+ */
+void pipeline_done(Pipeline *pipeline)
+{
+    pthread_mutex_lock(&pipeline->lock);
+    pipeline->consumed++;
+    pthread_cond_broadcast(&pipeline->changed);
+    pthread_mutex_unlock(&pipeline->lock);
+}
+
+/*
+ * Función para terminar una lectura anticipada, aunque queden tramos sin leer, y devolver sus
+ * búferes al grupo. Se debe llamar antes de fail_operation si la lectura sigue en curso.
+ * pipeline: Lectura anticipada
+ */
+void pipeline_finish(Pipeline *pipeline)
+{
+    if (pipeline->threaded)
+    {
+        pthread_mutex_lock(&pipeline->lock);
+        pipeline->stop = 1;
+        pthread_cond_broadcast(&pipeline->changed);
+        pthread_mutex_unlock(&pipeline->lock);
+        pthread_join(pipeline->thread, NULL);
+    }
+    for (int i = 0; i < pipeline->slot_count; i++)
+    {
+        pool_release(pipeline->slots[i]);
+    }
+    pthread_mutex_destroy(&pipeline->lock);
+    pthread_cond_destroy(&pipeline->changed);
+}
+
+/*
+ * Función para saber si dos archivos abiertos están en el mismo dispositivo
+ * fd: Descriptor del primer archivo
+ * other_fd: Descriptor del segundo archivo
+ * Retorna: 1 si están en el mismo dispositivo o no se puede saber, 0 si no
+ */
+int same_device(int fd, int other_fd)
+{
+    struct stat st, other_st;
+    if (fstat(fd, &st) != 0 || fstat(other_fd, &other_st) != 0)
+    {
+        return 1;
+    }
+    return st.st_dev == other_st.st_dev;
+}
+
+/*
+ * Función para copiar rangos del archivador a un archivo de salida pasando por espacio de usuario
+ * Se leen bloques completos y alineados (así sirven para O_DIRECT con --direct) y sus sumas de
+ * verificación se comprueban en el mismo búfer, así que cada bloque se lee una sola vez.
+ * fd: Descriptor normal del archivador
+ * segments: Rangos a copiar, con su posición en el archivo de salida
+ * count: Número de rangos
+ * file_fd: Descriptor del archivo de salida
+ * filename: Archivo al que pertenecen los bloques (para los mensajes)
+ * unchecked: Se incrementa con los bloques que no tienen suma de verificación
+ * threaded: 1 para leer por adelantado en otro hilo mientras se escribe
+ * Retorna: Número de bloques dañados
+ */
+int extract_segments(int fd, Segment *segments, int count, int file_fd, const char *filename, int *unchecked,
+                     int threaded)
+{
+    // Partir los rangos en tramos de un búfer; una cola empaquetada empieza dentro de su bloque,
+    // así que su tramo empieza al principio del bloque
+    int chunk_count = 0;
+    for (int i = 0; i < count; i++)
+    {
+        chunk_count += (int)((segments[i].archive_offset % block_size + segments[i].length + POOL_BUFFER_BYTES - 1) /
+                             POOL_BUFFER_BYTES);
+    }
+    PipelineChunk *chunks = malloc((chunk_count + 1) * sizeof(PipelineChunk));
+    if (!chunks)
+    {
+        perror("Error de memoria");
+        fail_operation();
+    }
+    chunk_count = 0;
+    for (int i = 0; i < count; i++)
+    {
+        for (size_t copied = 0; copied < segments[i].length;)
+        {
+            off_t start = segments[i].archive_offset + (off_t)copied;
+            PipelineChunk *chunk = &chunks[chunk_count++];
+            chunk->skip = (size_t)(start % block_size);
+            chunk->used = segments[i].length - copied < POOL_BUFFER_BYTES - chunk->skip ? segments[i].length - copied
+                                                                                        : POOL_BUFFER_BYTES - chunk->skip;
+            chunk->offset = start - (off_t)chunk->skip;
+            chunk->length = (chunk->skip + chunk->used + block_size - 1) / block_size * block_size;
+            chunk->target = segments[i].file_offset + (off_t)copied;
+            copied += chunk->used;
+        }
+    }
+
+    Pipeline pipeline;
+    pipeline_start(&pipeline, fd, 1, chunks, chunk_count, threaded);
+    int bad = 0;
+    for (int c = 0; c < chunk_count; c++)
+    {
+        PipelineChunk *chunk = &chunks[c];
+        ssize_t n;
+        unsigned char *buffer = pipeline_next(&pipeline, &n);
+        if (n < (ssize_t)(chunk->skip + chunk->used))
+        {
+            if (n >= 0)
+            {
+                fprintf(stderr, "Error: datos fuera del archivador\n");
+            }
+            else
+            {
+                perror("Error al leer bloque de datos");
+            }
+            pipeline_finish(&pipeline);
+            fail_operation();
+        }
+        memset(buffer + n, 0, chunk->length - n); // El último bloque del archivador puede estar incompleto
+
+        int first = (int)(chunk->offset / block_size);
+        int last = (int)((chunk->offset + (off_t)(chunk->skip + chunk->used) - 1) / block_size);
+        for (int b = first; b <= last; b++)
+        {
+            if (block_needs_check(b, unchecked))
+            {
+                bad += verify_block_data(b, buffer + (size_t)(b - first) * block_size, filename);
+            }
+        }
+
+        for (size_t written = 0; written < chunk->used;)
+        {
+            ssize_t w = io_pwrite(file_fd, buffer + chunk->skip + written, chunk->used - written,
+                               chunk->target + (off_t)written);
+            if (w <= 0)
+            {
+                perror("Error al escribir datos");
+                pipeline_finish(&pipeline);
+                fail_operation();
+            }
+            written += w;
+        }
+        cache_release_behind(file_fd, chunk->target, chunk->used);
+        pipeline_done(&pipeline);
+    }
+    pipeline_finish(&pipeline);
+    free(chunks);
+    return bad;
+}
+
+/*
+ * Función para escribir en la salida estándar un rango de bytes de un archivo del archivador
+ * Solo se cargan las páginas del directorio que pueden contener el nombre, y el rango se busca
+ * entre los extents del archivo con una búsqueda binaria; no se recorre la cadena de bloques.
+ * star_filename: Nombre del archivo de archivado
+ * filename: Archivo a leer
+ * offset: Primer byte a escribir
+ * length: Bytes a escribir (-1 para llegar al final del archivo)
+ */
+void cat_star(char *star_filename, char *filename, long long offset, long long length)
+{
+    int fd = open(star_filename, O_RDONLY);
+    if (fd < 0)
+    {
+        perror("Error al abrir el archivo empaquetado");
+        fail_operation();
+    }
+
+    if (is_stream(fd))
+    {
+        cat_stream(fd, filename, offset, length);
+        close(fd);
+        return;
+    }
+
+    StarHeader header;
+    read_header(fd, &header);
+    int index = find_file_entry(&header, filename);
+    if (index == -1)
+    {
+        fprintf(stderr, "El archivo '%s' no se encontró en el empaquetado.\n", filename);
+        fail_operation();
+    }
+    FileEntry *entry = &header.files[index];
+    length = cat_clamp_range(filename, entry->size, offset, length);
+
+    int segment_count;
+    Segment *segments = file_segments(&header, entry, &segment_count);
+    if (entry->codec != CODEC_NONE)
+    {
+        read_compressed_range(fd, entry, segments, segment_count, offset, length, NULL);
+    }
+    else
+    {
+        // Los datos sin comprimir se copian tal cual: con el archivador mapeado se escriben
+        // desde el mapeo, o con copy_file_range si la salida es un archivo
+        ExtractEngine engine = EXTRACT_READ_WRITE;
+        unsigned char *map = NULL;
+        struct stat star_st;
+        if (fstat(fd, &star_st) == 0 && star_st.st_size > 0)
+        {
+            void *addr = mmap(NULL, star_st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (addr != MAP_FAILED)
+            {
+                map = addr;
+                engine = EXTRACT_COPY_RANGE;
+            }
+        }
+
+        off_t position = offset;
+        off_t end = offset + length;
+        for (int i = find_segment(segments, segment_count, position); i < segment_count && position < end; i++)
+        {
+            off_t within = position - segments[i].file_offset;
+            size_t chunk = segments[i].length - within < (size_t)(end - position) ? segments[i].length - within
+                                                                                   : (size_t)(end - position);
+            verify_range_or_fail(fd, map, star_st.st_size, segments[i].archive_offset + within, chunk, filename);
+            copy_payload_range(fd, map, star_st.st_size, segments[i].archive_offset + within, chunk, STDOUT_FILENO,
+                               NULL, &engine);
+            position += chunk;
+        }
+        if (map)
+        {
+            munmap(map, star_st.st_size);
+        }
+    }
+
+    free(segments);
+    free_header(&header);
+    close(fd);
+}
+
+/*
+ * Función para leer un rango de un archivo comprimido: solo se leen y descomprimen los tramos
+ * que cubren el rango
+ * fd: Descriptor de archivo del archivador
+ * entry: Entrada del archivo
+ * segments: Rangos de los datos guardados del archivo (de file_segments)
+ * segment_count: Número de rangos
+ * offset: Primer byte a leer
+ * length: Bytes a leer (ya recortados al tamaño del archivo)
+ * buffer: Destino de los datos, o NULL para escribirlos en la salida estándar
+ */
+void read_compressed_range(int fd, FileEntry *entry, Segment *segments, int segment_count, long long offset,
+                           long long length, unsigned char *buffer)
+{
+    if (length == 0)
+    {
+        return;
+    }
+
+    int frame_count = (int)((entry->size + COMPRESS_FRAME_SIZE - 1) / COMPRESS_FRAME_SIZE);
+    size_t table_size = frame_count * sizeof(uint32_t);
+    uint32_t *frame_table = malloc(table_size + sizeof(uint32_t));
+    unsigned char *stored = malloc(COMPRESS_FRAME_SIZE);
+    unsigned char *plain = malloc(COMPRESS_FRAME_SIZE);
+    library_track(free, frame_table);
+    library_track(free, stored);
+    library_track(free, plain);
+    if (!frame_table || !stored || !plain)
+    {
+        perror("Error de memoria");
+        fail_operation();
+    }
+    read_stored_range(fd, entry, segments, segment_count, 0, frame_table, table_size);
+
+    // Posición del primer tramo del rango: la tabla más los tramos anteriores
+    int first = (int)(offset / COMPRESS_FRAME_SIZE);
+    int last = (int)((offset + length - 1) / COMPRESS_FRAME_SIZE);
+    off_t stored_offset = table_size;
+    for (int k = 0; k < first; k++)
+    {
+        stored_offset += frame_table[k] & ~FRAME_RAW;
+    }
+
+    const Codec *codec = find_codec(entry->codec);
+    for (int k = first; k <= last; k++)
+    {
+        off_t frame_offset = (off_t)k * COMPRESS_FRAME_SIZE;
+        size_t original_length = entry->size - frame_offset < COMPRESS_FRAME_SIZE
+                                     ? (size_t)(entry->size - frame_offset)
+                                     : COMPRESS_FRAME_SIZE;
+        size_t stored_length = frame_table[k] & ~FRAME_RAW;
+        if (stored_length > COMPRESS_FRAME_SIZE || stored_offset + (off_t)stored_length > entry->stored_size)
+        {
+            fprintf(stderr, "Error: tabla de tramos dañada en '%s'\n", entry->filename);
+            fail_operation();
+        }
+        read_stored_range(fd, entry, segments, segment_count, stored_offset, stored, stored_length);
+        stored_offset += stored_length;
+
+        unsigned char *data = stored;
+        if (!(frame_table[k] & FRAME_RAW))
+        {
+            if (codec->decompress(stored, stored_length, plain, original_length) != 0)
+            {
+                fprintf(stderr, "Error: no se pudo descomprimir '%s'\n", entry->filename);
+                fail_operation();
+            }
+            data = plain;
+        }
+        else if (stored_length != original_length)
+        {
+            fprintf(stderr, "Error: tabla de tramos dañada en '%s'\n", entry->filename);
+            fail_operation();
+        }
+
+        // Recortar el primer y el último tramo al rango pedido
+        off_t from = offset > frame_offset ? offset - frame_offset : 0;
+        off_t to = offset + length < frame_offset + (off_t)original_length ? offset + length - frame_offset
+                                                                           : (off_t)original_length;
+        if (buffer)
+        {
+            memcpy(buffer + (frame_offset + from - offset), data + from, to - from);
+        }
+        else
+        {
+            stream_write(STDOUT_FILENO, data + from, to - from);
+        }
+    }
+
+    library_untrack(3);
+    free(plain);
+    free(stored);
+    free(frame_table);
+}
+
+/*
+ * Función para leer un rango de los datos guardados de un archivo, comprobando antes las sumas
+ * de verificación de los bloques que lo contienen
+ * fd: Descriptor de archivo del archivador
+ * entry: Entrada del archivo
+ * segments: Rangos de los datos guardados del archivo (de file_segments)
+ * segment_count: Número de rangos
+ * stored_offset: Posición dentro de los datos guardados
+ * buffer: Destino de los datos
+ * length: Bytes a leer
+ */
+void read_stored_range(int fd, FileEntry *entry, Segment *segments, int segment_count, off_t stored_offset,
+                       void *buffer, size_t length)
+{
+    unsigned char *bytes = buffer;
+    for (int i = find_segment(segments, segment_count, stored_offset); i < segment_count && length > 0; i++)
+    {
+        off_t within = stored_offset - segments[i].file_offset;
+        size_t chunk = segments[i].length - within < length ? segments[i].length - within : length;
+        verify_range_or_fail(fd, NULL, 0, segments[i].archive_offset + within, chunk, entry->filename);
+        if (io_pread(fd, bytes, chunk, segments[i].archive_offset + within) != (ssize_t)chunk)
+        {
+            perror("Error al leer bloque de datos");
+            fail_operation();
+        }
+        bytes += chunk;
+        stored_offset += chunk;
+        length -= chunk;
+    }
+    if (length > 0)
+    {
+        fprintf(stderr, "Error: datos fuera de los extents de '%s'\n", entry->filename);
+        fail_operation();
+    }
+}
+
+/*
+ * Función para comprobar las sumas de verificación de un rango antes de escribirlo; a diferencia
+ * de -x, un bloque dañado detiene la salida antes de escribir sus datos
+ * fd: Descriptor de archivo del archivador
+ * map: Archivador mapeado en memoria (NULL si no está disponible)
+ * map_size: Tamaño del mapeo en bytes
+ * archive_offset: Posición del rango en el archivador
+ * length: Bytes del rango
+ * filename: Archivo al que pertenecen los bloques (para los mensajes)
+ */
+void verify_range_or_fail(int fd, unsigned char *map, off_t map_size, off_t archive_offset, size_t length,
+                          const char *filename)
+{
+    int unchecked = 0;
+    if (verify_block_range(fd, map, map_size, archive_offset, length, filename, &unchecked) > 0)
+    {
+        fprintf(stderr, "Error: el rango pedido de '%s' contiene bloques dañados\n", filename);
+        fail_operation();
+    }
+}
+
+/*
+ * Función para buscar el rango que contiene una posición del archivo (búsqueda binaria; los
+ * rangos de file_segments están ordenados y son contiguos)
+ * segments: Rangos del archivo
+ * count: Número de rangos
+ * offset: Posición buscada
+ * Retorna: Índice del rango, o count si la posición está después del último
+ */
+int find_segment(Segment *segments, int count, off_t offset)
+{
+    int low = 0;
+    int high = count;
+    while (low < high)
+    {
+        int mid = low + (high - low) / 2;
+        if (segments[mid].file_offset + (off_t)segments[mid].length <= offset)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+/*
+ * Función para comprobar y recortar el rango pedido con --offset y --length
+ * filename: Archivo a leer (para los mensajes)
+ * size: Tamaño del archivo
+ * offset: Primer byte pedido
+ * length: Bytes pedidos (-1 para llegar al final)
+ * Retorna: Bytes a escribir, sin pasar del final del archivo
+ */
+long long cat_clamp_range(const char *filename, long long size, long long offset, long long length)
+{
+    if (offset > size)
+    {
+        fprintf(stderr, "Error: la posición %lld está fuera de '%s' (%lld bytes)\n", offset, filename, size);
+        fail_operation();
+    }
+    return length < 0 || length > size - offset ? size - offset : length;
+}
+
+/*
+ * Función para escribir en la salida estándar un rango de un archivo de un flujo guardado en
+ * disco: el pie indica dónde está el directorio y cada entrada la posición de sus datos
+ * fd: Descriptor del flujo
+ * filename: Archivo a leer
+ * offset: Primer byte a escribir
+ * length: Bytes a escribir (-1 para llegar al final del archivo)
+ */
+void cat_stream(int fd, char *filename, long long offset, long long length)
+{
+    off_t end = io_lseek(fd, 0, SEEK_END);
+    StreamFooter footer;
+    if (end < (off_t)(sizeof(StreamHeader) + sizeof(StreamEntry) + sizeof(StreamFooter)) ||
+        io_pread(fd, &footer, sizeof(StreamFooter), end - sizeof(StreamFooter)) != sizeof(StreamFooter) ||
+        memcmp(footer.magic, STREAM_MAGIC, sizeof(footer.magic)) != 0 || footer.file_count < 0 ||
+        footer.directory_offset + footer.file_count * (int64_t)sizeof(StreamEntry) + (int64_t)sizeof(StreamFooter) != end)
+    {
+        fprintf(stderr, "Error: el pie del flujo no es válido\n");
+        fail_operation();
+    }
+
+    StreamEntry entry;
+    int found = 0;
+    for (int64_t i = 0; i < footer.file_count && !found; i++)
+    {
+        if (io_pread(fd, &entry, sizeof(StreamEntry), footer.directory_offset + i * sizeof(StreamEntry)) != sizeof(StreamEntry))
+        {
+            perror("Error al leer el directorio del flujo");
+            fail_operation();
+        }
+        stream_check_entry(&entry);
+        found = strcmp(entry.filename, filename) == 0;
+    }
+    if (!found)
+    {
+        fprintf(stderr, "El archivo '%s' no se encontró en el empaquetado.\n", filename);
+        fail_operation();
+    }
+
+    length = cat_clamp_range(filename, entry.size, offset, length);
+    if (entry.data_offset + entry.size > footer.directory_offset)
+    {
+        fprintf(stderr, "Error: entrada no válida en el flujo\n");
+        fail_operation();
+    }
+    ExtractEngine engine = EXTRACT_COPY_RANGE;
+    copy_payload_range(fd, NULL, 0, entry.data_offset + offset, length, STDOUT_FILENO, NULL, &engine);
+}
+
+/*
+ * Función para listar el contenido del archivador
+ * star_filename: Nombre del archivo de archivado a listar
+ */
+void list_star(char *star_filename)
+{
+    // Abrir el archivo de archivado para lectura
+    int fd = open(star_filename, O_RDONLY);
+    if (fd < 0)
+    {
+        perror("Error al abrir el archivo empaquetado");
+        fail_operation();
+    }
+
+    if (is_stream(fd))
+    {
+        list_stream(fd, star_filename);
+        close(fd);
+        return;
+    }
+
+    // Leer el encabezado del archivador
+    StarHeader header;
+    read_header(fd, &header);
+
+    printf("Contenido de '%s':\n", star_filename);
+    // Listar cada archivo en el archivador; las páginas del directorio se leen a medida que se recorren
+    for (int i = 0; i < header.file_count; i++)
+    {
+        if (i % DIR_PAGE_ENTRIES == 0)
+        {
+            dir_load_page(&header, i / DIR_PAGE_ENTRIES);
+        }
+        if (header.files[i].filename[0] == '\0')
+        {
+            continue;
+        }
+        printf("%s", header.files[i].filename);
+        if (verbose_level >= 1)
+        {
+            printf(" (tamaño: %lld bytes", (long long)header.files[i].size);
+            if (header.files[i].codec != CODEC_NONE)
+            {
+                printf(", %s: %lld bytes", find_codec(header.files[i].codec)->name,
+                       (long long)header.files[i].stored_size);
+            }
+            printf(")");
+        }
+        printf("\n");
+
+        if (verbose_level >= 2)
+        {
+            printf("  Bloques: %d\n", file_block_count(&header, &header.files[i]));
+            printf("  Bloque inicial: %d\n", header.files[i].start_block);
+            printf("  Extents: %d\n", header.files[i].extent_count);
+            if (header.files[i].tail_length > 0)
+            {
+                printf("  Cola: %d bytes en el bloque %d (posición %d)\n", header.files[i].tail_length,
+                       header.files[i].tail_block, header.files[i].tail_offset);
+            }
+            if (header.files[i].mode != 0)
+            {
+                time_t mtime = (time_t)header.files[i].mtime;
+                char date[64];
+                strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", localtime(&mtime));
+                printf("  Modificado: %s; modo: %o\n", date, header.files[i].mode);
+            }
+            if (header.files[i].flags & ENTRY_HASHED)
+            {
+                printf("  Hash: %016llx\n", (unsigned long long)header.files[i].content_hash);
+            }
+        }
+    }
+
+    free_header(&header);
+    close(fd);
+}
+
+/*
+ * Función para crear un empaquetado en formato de flujo, escrito en una sola pasada sin volver
+ * atrás, de modo que la salida puede ser un pipe
+ * out_fd: Descriptor de salida del flujo
+ * file_count: Número de archivos a agregar
+ * files: Array de nombres de archivos a agregar
+ */
+void create_stream(int out_fd, int file_count, char *files[])
+{
+    if (file_count <= 0)
+    {
+        fprintf(stderr, "Debe especificar al menos un archivo para empaquetar\n");
+        fail_operation();
+    }
+
+    // Verificar que cada archivo existe antes de proceder
+    for (int i = 0; i < file_count; i++)
+    {
+        check_file_exists(files[i]);
+    }
+
+    stream_prepare_pipe(out_fd);
+    unsigned char *buffer = malloc(STREAM_BUFFER_BYTES);
+    StreamEntry *directory = calloc((size_t)file_count, sizeof(StreamEntry));
+    if (!buffer || !directory)
+    {
+        perror("Error al reservar memoria para el flujo");
+        fail_operation();
+    }
+
+    StreamHeader stream_header;
+    memset(&stream_header, 0, sizeof(StreamHeader));
+    memcpy(stream_header.magic, STREAM_MAGIC, sizeof(stream_header.magic));
+    stream_header.version = STREAM_VERSION;
+    stream_write(out_fd, &stream_header, sizeof(StreamHeader));
+    int64_t offset = sizeof(StreamHeader);
+
+    for (int i = 0; i < file_count; i++)
+    {
+        int file_fd = open(files[i], O_RDONLY);
+        struct stat st;
+        if (file_fd < 0 || fstat(file_fd, &st) != 0)
+        {
+            perror("Error al abrir archivo de entrada");
+            fail_operation();
+        }
+        posix_fadvise(file_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+        // La entrada va delante de los datos; el CRC se conoce al terminar y se escribe detrás
+        StreamEntry *entry = &directory[i];
+        strncpy(entry->filename, files[i], MAX_FILENAME_LENGTH - 1);
+        entry->size = st.st_size;
+        entry->data_offset = offset + sizeof(StreamEntry);
+        entry->mtime = st.st_mtim.tv_sec;
+        entry->mtime_nsec = st.st_mtim.tv_nsec;
+        entry->mode = st.st_mode;
+        stream_write(out_fd, entry, sizeof(StreamEntry));
+
+        uint32_t crc = 0;
+        int64_t remaining = st.st_size;
+        while (remaining > 0)
+        {
+            size_t chunk = remaining < STREAM_BUFFER_BYTES ? (size_t)remaining : STREAM_BUFFER_BYTES;
+            if (stream_read(file_fd, buffer, chunk) != chunk)
+            {
+                fprintf(stderr, "Error: el archivo '%s' cambió de tamaño mientras se leía\n", files[i]);
+                fail_operation();
+            }
+            crc = crc32c(crc, buffer, chunk);
+            stream_write(out_fd, buffer, chunk);
+            remaining -= chunk;
+        }
+        entry->crc = crc;
+        stream_write(out_fd, &crc, sizeof(crc));
+        offset = entry->data_offset + entry->size + sizeof(crc);
+        close(file_fd);
+
+        if (verbose_level >= 2)
+        {
+            printf("Archivo '%s' agregado:\n", entry->filename);
+            printf("  Tamaño: %lld bytes\n", (long long)entry->size);
+        }
+    }
+
+    // Marca de fin de los datos, directorio y pie
+    StreamEntry end;
+    memset(&end, 0, sizeof(StreamEntry));
+    end.size = file_count;
+    end.data_offset = offset + sizeof(StreamEntry);
+    stream_write(out_fd, &end, sizeof(StreamEntry));
+
+    StreamFooter footer;
+    memset(&footer, 0, sizeof(StreamFooter));
+    footer.directory_offset = end.data_offset;
+    footer.file_count = file_count;
+    memcpy(footer.magic, STREAM_MAGIC, sizeof(footer.magic));
+    footer.version = STREAM_VERSION;
+    stream_write(out_fd, directory, (size_t)file_count * sizeof(StreamEntry));
+    stream_write(out_fd, &footer, sizeof(StreamFooter));
+
+    free(directory);
+    free(buffer);
+}
+
+/*
+ * Función para extraer los archivos de un flujo en una sola pasada
+ * in_fd: Descriptor de entrada del flujo (un pipe o un archivo en su posición inicial)
+ */
+void extract_stream(int in_fd)
+{
+    stream_read_header(in_fd);
+    stream_prepare_pipe(in_fd);
+    unsigned char *buffer = malloc(STREAM_BUFFER_BYTES);
+    if (!buffer)
+    {
+        perror("Error al reservar memoria para el flujo");
+        fail_operation();
+    }
+
+    int corrupt_files = 0;
+    StreamEntry entry;
+    for (;;)
+    {
+        stream_read_exact(in_fd, &entry, sizeof(StreamEntry));
+        if (entry.filename[0] == '\0')
+        {
+            break;
+        }
+        stream_check_entry(&entry);
+
+        verbose_print("Extrayendo:", 1);
+        if (verbose_level >= 1)
+        {
+            printf(" %s\n", entry.filename);
+        }
+
+        // Abrir el archivo de salida para escritura
+        int file_fd = open(entry.filename, O_CREAT | O_WRONLY | O_TRUNC, 0666);
+        if (file_fd < 0)
+        {
+            perror("Error al crear archivo de salida");
+            fail_operation();
+        }
+
+        uint32_t crc = 0;
+        int64_t remaining = entry.size;
+        while (remaining > 0)
+        {
+            size_t chunk = remaining < STREAM_BUFFER_BYTES ? (size_t)remaining : STREAM_BUFFER_BYTES;
+            stream_read_exact(in_fd, buffer, chunk);
+            crc = crc32c(crc, buffer, chunk);
+            stream_write(file_fd, buffer, chunk);
+            remaining -= chunk;
+        }
+        close(file_fd);
+
+        uint32_t stored_crc;
+        stream_read_exact(in_fd, &stored_crc, sizeof(stored_crc));
+        if (crc != stored_crc)
+        {
+            fprintf(stderr, "Error: los datos de '%s' no coinciden con su suma de verificación\n", entry.filename);
+            corrupt_files++;
+        }
+
+        if (verbose_level >= 2)
+        {
+            printf("  Tamaño: %lld bytes\n", (long long)entry.size);
+        }
+    }
+
+    // Leer el directorio y el pie para confirmar que el flujo llegó completo
+    free(stream_read_directory(in_fd, entry.size));
+    free(buffer);
+
+    if (corrupt_files > 0)
+    {
+        fprintf(stderr, "Error: %d archivos dañados en el flujo; no son confiables\n", corrupt_files);
+        fail_operation();
+    }
+}
+
+/*
+ * Función para listar el contenido de un flujo. Si la entrada es un archivo se leen solo el pie y
+ * el directorio; si es un pipe se recorren los datos hasta la marca de fin
+ * in_fd: Descriptor de entrada del flujo
+ * name: Nombre del flujo para los mensajes
+ */
+void list_stream(int in_fd, const char *name)
+{
+    stream_read_header(in_fd);
+
+    StreamEntry *directory = NULL;
+    int64_t count = 0;
+    off_t end = io_lseek(in_fd, 0, SEEK_END);
+    StreamFooter footer;
+    if (end >= (off_t)(sizeof(StreamHeader) + sizeof(StreamEntry) + sizeof(StreamFooter)) &&
+        io_pread(in_fd, &footer, sizeof(StreamFooter), end - sizeof(StreamFooter)) == sizeof(StreamFooter))
+    {
+        count = footer.file_count;
+        if (memcmp(footer.magic, STREAM_MAGIC, sizeof(footer.magic)) != 0 || count < 0 ||
+            footer.directory_offset + count * (int64_t)sizeof(StreamEntry) + (int64_t)sizeof(StreamFooter) != end)
+        {
+            fprintf(stderr, "Error: el pie del flujo no es válido\n");
+            fail_operation();
+        }
+        directory = malloc(count * sizeof(StreamEntry) + 1);
+        if (!directory ||
+            io_pread(in_fd, directory, count * sizeof(StreamEntry), footer.directory_offset) != (ssize_t)(count * sizeof(StreamEntry)))
+        {
+            perror("Error al leer el directorio del flujo");
+            fail_operation();
+        }
+    }
+    else
+    {
+        // Entrada no posicionable: saltar los datos de cada archivo hasta la marca de fin
+        stream_prepare_pipe(in_fd);
+        unsigned char *buffer = malloc(STREAM_BUFFER_BYTES);
+        if (!buffer)
+        {
+            perror("Error al reservar memoria para el flujo");
+            fail_operation();
+        }
+        StreamEntry entry;
+        for (;;)
+        {
+            stream_read_exact(in_fd, &entry, sizeof(StreamEntry));
+            if (entry.filename[0] == '\0')
+            {
+                break;
+            }
+            stream_check_entry(&entry);
+            int64_t remaining = entry.size + sizeof(uint32_t);
+            while (remaining > 0)
+            {
+                size_t chunk = remaining < STREAM_BUFFER_BYTES ? (size_t)remaining : STREAM_BUFFER_BYTES;
+                stream_read_exact(in_fd, buffer, chunk);
+                remaining -= chunk;
+            }
+        }
+        free(buffer);
+        count = entry.size;
+        directory = stream_read_directory(in_fd, count);
+    }
+
+    printf("Contenido de '%s':\n", name);
+    for (int64_t i = 0; i < count; i++)
+    {
+        stream_check_entry(&directory[i]);
+        printf("%s", directory[i].filename);
+        if (verbose_level >= 1)
+        {
+            printf(" (tamaño: %lld bytes)", (long long)directory[i].size);
+        }
+        printf("\n");
+
+        if (verbose_level >= 2)
+        {
+            time_t mtime = (time_t)directory[i].mtime;
+            char date[64];
+            strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", localtime(&mtime));
+            printf("  Posición: %lld\n", (long long)directory[i].data_offset);
+            printf("  Modificado: %s; modo: %o\n", date, directory[i].mode);
+            printf("  CRC32C: %08x\n", directory[i].crc);
+        }
+    }
+    free(directory);
+}
+
+/*
+ * Función para saber si un archivo abierto contiene un flujo en lugar de un archivador
+ * fd: Descriptor del archivo
+ * Retorna: 1 si empieza con la firma del flujo, 0 si no
+ */
+int is_stream(int fd)
+{
+    char magic[4];
+    return io_pread(fd, magic, sizeof(magic), 0) == sizeof(magic) && memcmp(magic, STREAM_MAGIC, sizeof(magic)) == 0;
+}
+
+/*
+ * Función para agrandar el búfer del pipe del flujo; con el de 64K por omisión los dos procesos
+ * se turnan en cada escritura. Si el descriptor no es un pipe no hace nada
+ * fd: Descriptor del flujo
+ */
+void stream_prepare_pipe(int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode))
+    {
+        fcntl(fd, F_SETPIPE_SZ, STREAM_PIPE_BYTES);
+    }
+}
+
+/*
+ * Función para leer hasta length bytes; un pipe puede entregar menos en cada read
+ * fd: Descriptor de entrada
+ * buffer: Destino de los datos
+ * length: Bytes a leer
+ * Retorna: Bytes leídos (menos de length solo al final de la entrada)
+ */
+size_t stream_read(int fd, void *buffer, size_t length)
+{
+    size_t done = 0;
+    while (done < length)
+    {
+        ssize_t n = io_read(fd, (unsigned char *)buffer + done, length - done);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0)
+        {
+            perror("Error al leer el flujo");
+            fail_operation();
+        }
+        if (n == 0)
+        {
+            break;
+        }
+        done += n;
+    }
+    return done;
+}
+
+/*
+ * Función para leer exactamente length bytes del flujo; sale del programa si termina antes
+ * fd: Descriptor de entrada
+ * buffer: Destino de los datos
+ * length: Bytes a leer
+ */
+void stream_read_exact(int fd, void *buffer, size_t length)
+{
+    if (stream_read(fd, buffer, length) != length)
+    {
+        fprintf(stderr, "Error: el flujo terminó antes de tiempo\n");
+        fail_operation();
+    }
+}
+
+/*
+ * Función para escribir length bytes completos, aunque write escriba menos en cada llamada
+ * fd: Descriptor de salida
+ * buffer: Datos a escribir
+ * length: Bytes a escribir
+ */
+void stream_write(int fd, const void *buffer, size_t length)
+{
+    size_t done = 0;
+    while (done < length)
+    {
+        ssize_t n = io_write(fd, (const unsigned char *)buffer + done, length - done);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            perror("Error al escribir el flujo");
+            fail_operation();
+        }
+        done += n;
+    }
+}
+
+/*
+ * Función para leer y comprobar el encabezado de un flujo
+ * fd: Descriptor de entrada del flujo
+ */
+void stream_read_header(int fd)
+{
+    StreamHeader stream_header;
+    stream_read_exact(fd, &stream_header, sizeof(StreamHeader));
+    if (memcmp(stream_header.magic, STREAM_MAGIC, sizeof(stream_header.magic)) != 0)
+    {
+        fprintf(stderr, "Error: la entrada no es un flujo de star\n");
+        fail_operation();
+    }
+    if (stream_header.version != STREAM_VERSION)
+    {
+        fprintf(stderr, "Error: versión de flujo no soportada: %d\n", stream_header.version);
+        fail_operation();
+    }
+}
+
+/*
+ * Función para comprobar una entrada leída del flujo antes de usarla
+ * entry: Entrada a comprobar
+ */
+void stream_check_entry(StreamEntry *entry)
+{
+    if (memchr(entry->filename, '\0', MAX_FILENAME_LENGTH) == NULL || entry->size < 0)
+    {
+        fprintf(stderr, "Error: entrada no válida en el flujo\n");
+        fail_operation();
+    }
+}
+
+/*
+ * Función para leer el directorio y el pie que siguen a la marca de fin de un flujo
+ * fd: Descriptor de entrada, situado después de la marca de fin
+ * count: Entradas del directorio (el tamaño de la marca de fin)
+ * Retorna: Entradas del directorio (el llamador debe liberarlas)
+ */
+StreamEntry *stream_read_directory(int fd, int64_t count)
+{
+    if (count < 0 || count > INT_MAX)
+    {
+        fprintf(stderr, "Error: la marca de fin del flujo no es válida\n");
+        fail_operation();
+    }
+    StreamEntry *directory = malloc(count * sizeof(StreamEntry) + 1);
+    if (!directory)
+    {
+        perror("Error al reservar memoria para el directorio del flujo");
+        fail_operation();
+    }
+    stream_read_exact(fd, directory, count * sizeof(StreamEntry));
+
+    StreamFooter footer;
+    stream_read_exact(fd, &footer, sizeof(StreamFooter));
+    if (memcmp(footer.magic, STREAM_MAGIC, sizeof(footer.magic)) != 0 || footer.file_count != count)
+    {
+        fprintf(stderr, "Error: el pie del flujo no es válido\n");
+        fail_operation();
+    }
+    return directory;
+}
+
+/*
+ * Función para eliminar archivos del archivador
+ * star_filename: Nombre del archivo de archivado
+ * file_count: Número de archivos a eliminar
+ * files: Array de nombres de archivos a eliminar
+ */
+void delete_star(char *star_filename, int file_count, char *files[])
+{
+    int fd = open(star_filename, O_RDWR);
+    if (fd < 0)
+    {
+        perror("Error al abrir el archivo empaquetado");
+        fail_operation();
+    }
+
+    StarHeader header;
+    read_header(fd, &header);
+    require_current_format(&header);
+
+    for (int i = 0; i < file_count; i++)
+    {
+        int index = find_file_entry(&header, files[i]);
+        if (index != -1)
+        {
+            remove_file_from_star(&header, files[i]);
+            printf("Archivo '%s' eliminado del empaquetado.\n", files[i]);
+        }
+        else
+        {
+            fprintf(stderr, "El archivo '%s' no se encontró en el empaquetado.\n", files[i]);
+        }
+    }
+
+    // Write header before analysis
+    write_header(fd, &header);
+
+    // Analyze fragmentation after deletion
+    if (verbose_level >= 1)
+    {
+        FragmentationInfo frag_info = analyze_fragmentation(fd, &header);
+        if (frag_info.block_status != NULL)
+        {
+            print_fragmentation_visualization(&frag_info, &header);
+            free(frag_info.block_status);
+        }
+    }
+    free_header(&header);
+    close(fd);
+}
+
+/*
+ * Función para agregar archivos al archivador
+ * star_filename: Nombre del archivo de archivado
+ * file_count: Número de archivos a agregar
+ * files: Array de nombres de archivos a agregar
+ */
+void append_star(char *star_filename, int file_count, char *files[])
+{
+    // Abrir el archivo de archivado para lectura y escritura
+    int fd = open(star_filename, O_RDWR);
+    if (fd < 0)
+    {
+        perror("Error al abrir el archivo empaquetado");
+        fail_operation();
+    }
+
+    // Leer el encabezado del archivador
+    StarHeader header;
+    read_header(fd, &header);
+    require_current_format(&header);
+    direct_open(star_filename, O_RDWR);
+
+    // Agregar cada archivo especificado al archivador; los que ya están sin cambios se saltan
+    int skipped = 0, added = 0;
+    long long skipped_bytes = 0, written_bytes = 0;
+    for (int i = 0; i < file_count; i++)
+    {
+        int index = find_file_entry(&header, files[i]);
+        if (index != -1 && entry_unchanged(&header.files[index], files[i]))
+        {
+            skipped++;
+            skipped_bytes += header.files[index].size;
+            char message[300];
+            snprintf(message, sizeof(message), "Archivo '%s' sin cambios.", files[i]);
+            verbose_print(message, 2);
+            continue;
+        }
+        if (index != -1)
+        {
+            fprintf(stderr, "El archivo '%s' ya existe en el empaquetado. Use la opción -u para actualizarlo.\n", files[i]);
+            continue;
+        }
+        add_file_to_star(fd, &header, files[i]);
+        added++;
+        written_bytes += header.files[find_file_entry(&header, files[i])].stored_size;
+    }
+    if (verbose_level >= 1)
+    {
+        printf("Archivos sin cambios: %d (%.1f MB sin reescribir); agregados: %d (%.1f MB escritos)\n",
+               skipped, skipped_bytes / (1024.0 * 1024.0), added, written_bytes / (1024.0 * 1024.0));
+    }
+
+    // Escribir el encabezado actualizado de nuevo en el archivador
+    write_header(fd, &header);
+    free_header(&header);
+    direct_close(fd);
+    close(fd);
+}
+
+/*
+ * Función para actualizar archivos en el archivador
+ * star_filename: Nombre del archivo de archivado
+ * file_count: Número de archivos a actualizar
+ * files: Array de nombres de archivos a actualizar
+ */
+void update_star(char *star_filename, int file_count, char *files[])
+{
+    // Abrir el archivo de archivado para lectura y escritura
+    int fd = open(star_filename, O_RDWR);
+    if (fd < 0)
+    {
+        perror("Error al abrir el archivo empaquetado");
+        fail_operation();
+    }
+
+    // Leer el encabezado del archivador
+    StarHeader header;
+    read_header(fd, &header);
+    require_current_format(&header);
+    direct_open(star_filename, O_RDWR);
+
+    // Actualizar cada archivo especificado en el archivador; los que no cambiaron se saltan
+    int skipped = 0, updated = 0;
+    long long skipped_bytes = 0, written_bytes = 0;
+    for (int i = 0; i < file_count; i++)
+    {
+        int index = find_file_entry(&header, files[i]);
+        if (index == -1)
+        {
+            fprintf(stderr, "El archivo '%s' no existe en el empaquetado. Use la opción -r para agregarlo.\n", files[i]);
+            continue;
+        }
+        if (entry_unchanged(&header.files[index], files[i]))
+        {
+            skipped++;
+            skipped_bytes += header.files[index].size;
+            char message[300];
+            snprintf(message, sizeof(message), "Archivo '%s' sin cambios.", files[i]);
+            verbose_print(message, 2);
+            continue;
+        }
+
+        // Reescribir solo los bloques que cambiaron; si no se puede, reemplazar el archivo
+        long long written = update_file_delta(fd, &header, index, files[i]);
+        if (written < 0)
+        {
+            // Eliminar la entrada de archivo antigua
+            remove_file_from_star(&header, files[i]);
+            // Agregar el nuevo archivo
+            add_file_to_star(fd, &header, files[i]);
+            written = header.files[find_file_entry(&header, files[i])].stored_size;
+        }
+        updated++;
+        written_bytes += written;
+    }
+    if (verbose_level >= 1)
+    {
+        printf("Archivos sin cambios: %d (%.1f MB sin reescribir); actualizados: %d (%.1f MB escritos)\n",
+               skipped, skipped_bytes / (1024.0 * 1024.0), updated, written_bytes / (1024.0 * 1024.0));
+    }
+
+    // Escribir el encabezado actualizado de nuevo en el archivador
+    write_header(fd, &header);
+    free_header(&header);
+    direct_close(fd);
+    close(fd);
+}
+
+/*
+ * Función para actualizar un archivo reescribiendo solo los bloques que cambiaron
+ * Cada bloque del archivo nuevo se compara con la suma de verificación del bloque guardado en la
+ * misma posición (o con el bloque mismo si no tiene suma) y solo se escriben los distintos. Si el
+ * archivo creció se reservan bloques al final de su cadena; si se achicó se liberan los que
+ * sobran. La cola se vuelve a empaquetar solo si cambió.
+ * fd: Descriptor de archivo del archivador
+ * header: Puntero al encabezado del archivador
+ * index: Posición del archivo en el directorio
+ * filename: Nombre del archivo a actualizar
+ * Retorna: Bytes escritos, o -1 si se debe reemplazar completo (comprimido, con bloques
+ * deduplicados, o con más extents de los que caben en su página)
+ */
+long long update_file_delta(int fd, StarHeader *header, int index, char *filename)
+{
+    FileEntry *entry = &header->files[index];
+    if (compress_codec != CODEC_NONE || dedup_enabled || entry->codec != CODEC_NONE || pack_file_shared(header, entry))
+    {
+        return -1;
+    }
+
+    int file_fd = open(filename, O_RDONLY);
+    if (file_fd < 0)
+    {
+        perror("Error al abrir archivo de entrada");
+        fail_operation();
+    }
+    struct stat st;
+    fstat(file_fd, &st);
+    int new_tail = tail_pack_length(st.st_size);
+    int new_count = (int)((st.st_size - new_tail + block_size - 1) / block_size);
+    int old_count = file_block_count(header, entry);
+
+    // Bloques actuales del archivo en orden, más los que hagan falta al final
+    int *blocks = malloc((new_count > old_count ? new_count : old_count) * sizeof(int) + sizeof(int));
+    if (!blocks)
+    {
+        perror("Error de memoria");
+        fail_operation();
+    }
+    int count = 0;
+    for (int e = 0; e < entry->extent_count; e++)
+    {
+        Extent *extent = &header->extents[entry->extent_index + e];
+        for (int b = 0; b < extent->length; b++)
+        {
+            blocks[count++] = extent->start_block + b;
+        }
+    }
+    if (new_count > count)
+    {
+        int *extra = allocate_blocks(fd, header, new_count - count);
+        memcpy(blocks + count, extra, (new_count - count) * sizeof(int));
+        free(extra);
+    }
+
+    // Si la cadena cambió, sus extents se vuelven a registrar al final del array en memoria
+    DirPage *page = &header->pages[index / DIR_PAGE_ENTRIES];
+    if (new_count != count)
+    {
+        FileEntry chain;
+        assign_extents(header, &chain, blocks, new_count);
+        if (page->extent_used - entry->extent_count + chain.extent_count > DIR_PAGE_EXTENTS)
+        {
+            header->extent_count -= chain.extent_count;
+            for (int k = count; k < new_count; k++)
+            {
+                free_block(header, blocks[k]);
+            }
+            free(blocks);
+            close(file_fd);
+            return -1;
+        }
+        for (int k = new_count; k < count; k++)
+        {
+            free_block(header, blocks[k]);
+        }
+        page->extent_used += chain.extent_count - entry->extent_count;
+        entry->start_block = chain.start_block;
+        entry->extent_index = chain.extent_index;
+        entry->extent_count = chain.extent_count;
+    }
+
+    unsigned char *batch = pool_acquire();
+    unsigned char *old = pool_acquire(); // Bloques guardados de la tanda que hay que comparar
+    unsigned char changed[WRITE_BATCH_BYTES / MIN_BLOCK_SIZE];
+    unsigned char *stored = malloc((size_t)block_size * 2); // La cola guardada y la nueva
+    if (!stored)
+    {
+        perror("Error de memoria");
+        fail_operation();
+    }
+
+    // Leer el archivo nuevo por tandas y escribir solo los bloques distintos, juntando los
+    // bloques consecutivos en una sola escritura
+    int rewritten = 0;
+    for (int done = 0; done < new_count; done += WRITE_BATCH_BLOCKS)
+    {
+        int run = new_count - done < WRITE_BATCH_BLOCKS ? new_count - done : WRITE_BATCH_BLOCKS;
+        size_t bytes = (size_t)run * block_size;
+        size_t filled = 0;
+        while (filled < bytes)
+        {
+            ssize_t bytes_read = io_pread(file_fd, batch + filled, bytes - filled, (off_t)done * block_size + filled);
+            if (bytes_read < 0)
+            {
+                perror("Error al leer el archivo");
+                fail_operation();
+            }
+            if (bytes_read == 0)
+            {
+                break; // Fin del archivo
+            }
+            filled += bytes_read;
+        }
+        memset(batch + filled, 0, bytes - filled);
+        cache_release(file_fd, (off_t)done * block_size, filled);
+
+        // Un CRC distinto basta para saber que el bloque cambió, pero uno igual no basta (un CRC
+        // de 32 bits coincide con muchos contenidos): esos bloques se leen del archivador,
+        // juntando los consecutivos en una sola lectura, y se comparan byte a byte
+        for (int k = 0; k < run; k++)
+        {
+            int block = blocks[done + k];
+            changed[k] = done + k >= count ||
+                         (block < checksum_table.count && checksum_table.entries[block].length == (uint32_t)block_size &&
+                          crc32c(0, batch + (size_t)k * block_size, block_size) != checksum_table.entries[block].crc);
+        }
+        for (int k = 0; k < run;)
+        {
+            if (changed[k])
+            {
+                k++;
+                continue;
+            }
+            int length = 1;
+            while (k + length < run && !changed[k + length] && blocks[done + k + length] == blocks[done + k] + length)
+            {
+                length++;
+            }
+            size_t span = (size_t)length * block_size;
+            ssize_t bytes_read = archive_pread(fd, old, span, (off_t)blocks[done + k] * block_size);
+            if (bytes_read < 0)
+            {
+                perror("Error al leer bloque de datos");
+                fail_operation();
+            }
+            memset(old + bytes_read, 0, span - bytes_read); // Último bloque incompleto
+            for (int j = k; j < k + length; j++)
+            {
+                size_t at = (size_t)(j - k) * block_size;
+                changed[j] = memcmp(old + at, batch + (size_t)j * block_size, block_size) != 0;
+            }
+            k += length;
+        }
+
+        int pending = 0; // Bloques distintos acumulados que terminan en k
+        for (int k = 0; k <= run; k++)
+        {
+            int is_changed = k < run && changed[k];
+            if (pending > 0 && (!is_changed || blocks[done + k] != blocks[done + k - 1] + 1))
+            {
+                int first = k - pending;
+                size_t length = (size_t)pending * block_size;
+                if (archive_pwrite(fd, batch + (size_t)first * block_size, length,
+                                   (off_t)blocks[done + first] * block_size) != (ssize_t)length)
+                {
+                    perror("Error al escribir bloque");
+                    fail_operation();
+                }
+                for (int j = first; j < k; j++)
+                {
+                    checksum_record(blocks[done + j], batch + (size_t)j * block_size, block_size);
+                }
+                rewritten += pending;
+                pending = 0;
+            }
+            pending += is_changed;
+        }
+    }
+    pool_release(old);
+    pool_release(batch);
+    free(blocks);
+
+    // La cola se deja donde está si no cambió
+    int tail_same = 0;
+    if (new_tail > 0 && new_tail == entry->tail_length)
+    {
+        if (io_pread(fd, stored, new_tail, (off_t)entry->tail_block * block_size + entry->tail_offset) != new_tail ||
+            io_pread(file_fd, stored + new_tail, new_tail, st.st_size - new_tail) != new_tail)
+        {
+            perror("Error al leer la cola del archivo");
+            fail_operation();
+        }
+        tail_same = memcmp(stored, stored + new_tail, new_tail) == 0;
+    }
+    free(stored);
+    if (!tail_same)
+    {
+        if (entry->tail_length > 0)
+        {
+            tail_release(header, entry->tail_block);
+        }
+        entry->tail_block = 0;
+        entry->tail_offset = 0;
+        entry->tail_length = new_tail;
+        if (new_tail > 0)
+        {
+            tail_copy(fd, header, entry, file_fd, st.st_size - new_tail, new_tail);
+        }
+    }
+    entry->size = st.st_size;
+    entry->stored_size = st.st_size;
+    entry_set_metadata(entry, &st, file_fd);
+    page->dirty = 1;
+    cache_release(file_fd, 0, 0);
+    close(file_fd);
+
+    char message[300];
+    snprintf(message, sizeof(message), "Archivo '%s' actualizado (%d de %d bloques reescritos%s).", filename,
+             rewritten, new_count, tail_same || new_tail == 0 ? "" : ", cola reescrita");
+    verbose_print(message, 1);
+    return (long long)rewritten * block_size + (tail_same ? 0 : new_tail);
+}
+
+FragmentationInfo analyze_fragmentation(int fd, StarHeader *header)
+{
+    FragmentationInfo info;
+    memset(&info, 0, sizeof(FragmentationInfo));
+
+    // Get file size and calculate total blocks
+    off_t file_size = io_lseek(fd, 0, SEEK_END);
+    info.total_blocks = (file_size + block_size - 1) / block_size;
+
+    // Allocate block status array
+    info.block_status = calloc(info.total_blocks, sizeof(int));
+    if (!info.block_status)
+    {
+        fprintf(stderr, "Error: No se pudo asignar memoria\n");
+        return info;
+    }
+
+    // The whole directory is needed to know which blocks are in use
+    load_directory(header);
+
+    // Mark header blocks
+    for (int i = 0; i < HEADER_BLOCKS && i < info.total_blocks; i++)
+    {
+        info.block_status[i] = 1;
+        info.used_blocks++;
+    }
+
+    // Mark blocks used by files (from the extent table, no block reads)
+    for (int i = 0; i < header->file_count; i++)
+    {
+        FileEntry *entry = &header->files[i];
+        for (int e = 0; e < entry->extent_count; e++)
+        {
+            Extent *extent = &header->extents[entry->extent_index + e];
+            for (int b = extent->start_block; b < extent->start_block + extent->length && b < info.total_blocks; b++)
+            {
+                if (!info.block_status[b])
+                { // Only count if not already marked
+                    info.block_status[b] = 1;
+                    info.used_blocks++;
+                }
+            }
+        }
+        // Packed tails share a block with other files
+        int tail = entry->tail_block;
+        if (entry->tail_length > 0 && tail < info.total_blocks && !info.block_status[tail])
+        {
+            info.block_status[tail] = 1;
+            info.used_blocks++;
+        }
+    }
+
+    // Mark blocks used by the directory pages and the tables
+    for (int p = 0; p < header->page_count; p++)
+    {
+        int first = header->pages[p].info.block;
+        for (int b = first; first > 0 && b < first + DIR_PAGE_BLOCKS && b < info.total_blocks; b++)
+        {
+            if (!info.block_status[b])
+            {
+                info.block_status[b] = 1;
+                info.used_blocks++;
+            }
+        }
+    }
+    int table_block[5] = {header->dir_table_block, header->dedup_table_block, header->checksum_table_block,
+                          header->tail_table_block, header->free_map_block};
+    int table_blocks[5] = {header->dir_table_blocks, header->dedup_table_blocks, header->checksum_table_blocks,
+                           header->tail_table_blocks, header->free_map_blocks};
+    for (int t = 0; t < 5; t++)
+    {
+        for (int b = table_block[t]; b < table_block[t] + table_blocks[t] && b < info.total_blocks; b++)
+        {
+            if (!info.block_status[b])
+            {
+                info.block_status[b] = 1;
+                info.used_blocks++;
+            }
+        }
+    }
+
+    // Calculate free blocks
+    info.free_blocks = info.total_blocks - info.used_blocks;
+
+    // Analyze fragmentation
+    int current_free_chunk = 0;
+    info.fragmented_blocks = 0;
+    info.largest_free_chunk = 0;
+    info.smallest_free_chunk = info.total_blocks;
+
+    for (int i = 0; i < info.total_blocks; i++)
+    {
+        if (info.block_status[i] == 0)
+        {
+            current_free_chunk++;
+            if (i == info.total_blocks - 1 || info.block_status[i + 1] == 1)
+            {
+                if (current_free_chunk > 0)
+                {
+                    // Update largest/smallest chunks
+                    if (current_free_chunk > info.largest_free_chunk)
+                    {
+                        info.largest_free_chunk = current_free_chunk;
+                    }
+                    if (current_free_chunk < info.smallest_free_chunk)
+                    {
+                        info.smallest_free_chunk = current_free_chunk;
+                    }
+                    // Count single blocks as fragmented
+                    if (current_free_chunk == 1)
+                    {
+                        info.fragmented_blocks++;
+                    }
+                }
+                current_free_chunk = 0;
+            }
+        }
+    }
+
+    // If no free blocks were found, reset smallest_free_chunk
+    if (info.free_blocks == 0)
+    {
+        info.smallest_free_chunk = 0;
+    }
+
+    // Calculate fragmentation ratio
+    info.fragmentation_ratio = info.free_blocks > 0 ? (float)info.fragmented_blocks / info.free_blocks : 0;
+
+    return info;
+}
+
+void print_fragmentation_visualization(FragmentationInfo *info, StarHeader *header)
+{
+    if (!info || !info->block_status)
+    {
+        fprintf(stderr, "Error: Información de fragmentación no válida\n");
+        return;
+    }
+
+    printf("\nEstado de Fragmentación:\n");
+    printf("------------------------\n");
+
+    // Basic block info - now with validation
+    printf("Bloques totales: %d\n", info->total_blocks);
+    printf("Bloques usados:  %d (%.1f%%)\n",
+           info->used_blocks,
+           (float)info->used_blocks / info->total_blocks * 100);
+    printf("Bloques libres: %d\n", info->free_blocks);
+
+    // Block distribution
+    printf("\nDistribución de bloques:\n");
+    printf("H = Header | █ = Usado | ░ = Libre\n");
+
+    printf("Bloque:  ");
+    for (int i = 0; i < info->total_blocks; i++)
+    {
+        printf("%-2d ", i);
+    }
+    printf("\nEstado:  ");
+
+    for (int i = 0; i < info->total_blocks; i++)
+    {
+        if (i < HEADER_BLOCKS)
+        {
+            printf("H  ");
+        }
+        else if (info->block_status[i])
+        {
+            printf("█  ");
+        }
+        else
+        {
+            printf("░  ");
+        }
+    }
+
+    printf("\n\nContenido:\n");
+    for (int i = 0; i < header->file_count; i++)
+    {
+        if (header->files[i].filename[0] == '\0')
+        {
+            continue;
+        }
+        printf("- Bloque %d: %s (%lld bytes)\n",
+               header->files[i].start_block,
+               header->files[i].filename,
+               (long long)header->files[i].size);
+    }
+
+    if (info->fragmented_blocks > 0)
+    {
+        printf("\nFragmentación: %.1f%% (%d bloques)\n",
+               info->fragmentation_ratio * 100,
+               info->fragmented_blocks);
+    }
+}
+
+/*
+ * Función para desfragmentar (empacar) el archivador
+ * El archivador compactado se escribe en un archivo temporal que reemplaza al original solo
+ * cuando está completo, así que si el proceso se interrumpe el original queda intacto. Con
+ * --in-place se compacta en el mismo archivo, sin espacio extra pero sin esa garantía. Los
+ * archivadores v1 siempre se reescriben en un archivo temporal en el formato actual.
+ * star_filename: Nombre del archivo de archivado
+ */
+void pack_star(char *star_filename)
+{
+    int fd = open(star_filename, O_RDWR);
+    if (fd < 0)
+    {
+        perror("Error al abrir el archivo empaquetado");
+        fail_operation();
+    }
+
+    StarHeader header;
+    read_header(fd, &header);
+    load_directory(&header);
+    direct_open(star_filename, O_RDWR);
+
+    // Análisis inicial (solo para mostrarlo: ocupa un entero por bloque)
+    FragmentationInfo before_info;
+    memset(&before_info, 0, sizeof(FragmentationInfo));
+    if (verbose_level >= 1)
+    {
+        before_info = analyze_fragmentation(fd, &header);
+        printf("\nAntes de desfragmentar:");
+        print_fragmentation_visualization(&before_info, &header);
+    }
+    int blocks_before = append_block_index(fd);
+
+    if (header.version == 1)
+    {
+        pack_convert_v1(&fd, star_filename, &header);
+    }
+    else if (pack_in_place_enabled)
+    {
+        pack_compact(fd, fd, &header);
+    }
+    else
+    {
+        char tmp_filename[PATH_MAX];
+        int new_fd = pack_create_temp(fd, star_filename, tmp_filename, sizeof(tmp_filename));
+        pack_compact(fd, new_fd, &header);
+        pack_replace(&fd, new_fd, star_filename, tmp_filename);
+        header.fd = fd;
+    }
+
+    // Análisis final
+    if (verbose_level >= 1)
+    {
+        FragmentationInfo after_info = analyze_fragmentation(fd, &header);
+        printf("\nDespués de desfragmentar:");
+        print_fragmentation_visualization(&after_info, &header);
+
+        int blocks_after = append_block_index(fd);
+        int blocks_saved = blocks_before - blocks_after;
+        printf("\nResumen de optimización:\n");
+        printf("- Tamaño antes: %d bloques (%lld bytes)\n", blocks_before, (long long)blocks_before * block_size);
+        printf("- Tamaño después: %d bloques (%lld bytes)\n", blocks_after, (long long)blocks_after * block_size);
+        if (blocks_saved > 0)
+        {
+            printf("- Espacio recuperado: %d bloques (%lld bytes)\n", blocks_saved, (long long)blocks_saved * block_size);
+        }
+        free(after_info.block_status);
+    }
+
+    // Limpieza
+    free(before_info.block_status);
+    free_header(&header);
+    direct_close(fd);
+    close(fd);
+}
+
+/*
+ * Función para convertir un archivador v1 al formato actual (parte de -p)
+ * Los bloques v1 empiezan con el enlace al siguiente, así que los datos se copian a un archivo
+ * temporal con cada archivo en un solo extent y ese archivo reemplaza al original.
+ * fd: Descriptor del archivador; se reemplaza por el del archivo nuevo
+ * star_filename: Nombre del archivo de archivado
+ * header: Encabezado v1 cargado; se reemplaza por el del archivo nuevo
+ */
+void pack_convert_v1(int *fd, char *star_filename, StarHeader *header)
+{
+    char tmp_filename[PATH_MAX];
+    int new_fd = pack_create_temp(*fd, star_filename, tmp_filename, sizeof(tmp_filename));
+
+    StarHeader new_header;
+    memset(&new_header, 0, sizeof(StarHeader));
+    memcpy(new_header.magic, STAR_MAGIC, sizeof(new_header.magic));
+    new_header.version = STAR_VERSION;
+    new_header.fd = new_fd;
+
+    ExtractEngine engine = EXTRACT_COPY_RANGE;
+    int next_block = HEADER_BLOCKS;
+    for (int i = 0; i < header->file_count; i++)
+    {
+        FileEntry *old_entry = &header->files[i];
+        if (old_entry->filename[0] == '\0')
+        {
+            continue;
+        }
+        FileEntry entry = *old_entry;
+        int block_count = file_block_count(&new_header, &entry);
+        int *blocks = malloc((block_count > 0 ? block_count : 1) * sizeof(int));
+        if (!blocks)
+        {
+            perror("Error de memoria");
+            fail_operation();
+        }
+        for (int k = 0; k < block_count; k++)
+        {
+            blocks[k] = next_block + k;
+        }
+
+        // Los bloques v1 tienen otra capacidad: copiar los datos a un rango nuevo
+        int segment_count;
+        Segment *segments = file_segments(header, old_entry, &segment_count);
+        off_t out_offset = (off_t)next_block * block_size;
+        for (int k = 0; k < segment_count; k++)
+        {
+            copy_payload_range(*fd, NULL, 0, segments[k].archive_offset, segments[k].length, new_fd, &out_offset, &engine);
+        }
+        free(segments);
+        next_block += block_count;
+
+        assign_extents(&new_header, &entry, blocks, block_count);
+        free(blocks);
+        dir_add_entry(&new_header, &entry);
+    }
+
+    // Completar el último bloque y calcular las sumas de verificación (v1 no las tiene)
+    if (ftruncate(new_fd, (off_t)next_block * block_size) != 0)
+    {
+        perror("Error al truncar archivo");
+    }
+    for (int b = HEADER_BLOCKS; b < next_block; b++)
+    {
+        checksum_record_from_archive(new_fd, b);
+    }
+    write_header(new_fd, &new_header);
+
+    pack_replace(fd, new_fd, star_filename, tmp_filename);
+    free_header(header);
+    *header = new_header;
+}
+
+/*
+ * Función para crear el archivo temporal en el que -p escribe el archivador nuevo
+ * Un temporal que quedó de una ejecución interrumpida se descarta. El archivo nuevo recibe los
+ * permisos del original.
+ * fd: Descriptor del archivador original
+ * star_filename: Nombre del archivo de archivado
+ * tmp_filename: Se llena con el nombre del archivo temporal
+ * size: Capacidad de tmp_filename
+ * Retorna: Descriptor del archivo temporal
+ */
+int pack_create_temp(int fd, char *star_filename, char *tmp_filename, size_t size)
+{
+    snprintf(tmp_filename, size, "%s.pack.tmp", star_filename);
+    int new_fd = open(tmp_filename, O_CREAT | O_RDWR | O_TRUNC, 0666);
+    if (new_fd < 0)
+    {
+        perror("Error al crear el archivo temporal");
+        fail_operation();
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0)
+    {
+        fchmod(new_fd, st.st_mode & 07777);
+    }
+    return new_fd;
+}
+
+/*
+ * Función para reemplazar el archivador por el archivo temporal ya completo
+ * Los datos se llevan al disco antes del rename, así que después de una caída queda el
+ * archivador anterior o el nuevo completo, nunca uno a medias.
+ * fd: Descriptor del archivador original; se reemplaza por el del archivo nuevo
+ * new_fd: Descriptor del archivo temporal
+ * star_filename: Nombre del archivo de archivado
+ * tmp_filename: Nombre del archivo temporal
+ */
+void pack_replace(int *fd, int new_fd, char *star_filename, char *tmp_filename)
+{
+    if (fsync(new_fd) != 0)
+    {
+        perror("Error al sincronizar el archivo temporal");
+        unlink(tmp_filename);
+        fail_operation();
+    }
+    if (rename(tmp_filename, star_filename) != 0)
+    {
+        perror("Error al reemplazar el archivo empaquetado");
+        unlink(tmp_filename);
+        fail_operation();
+    }
+    close(*fd);
+    *fd = new_fd;
+}
+
+/*
+ * Función para comparar dos claves de orden de -p (para qsort)
+ */
+int compare_pack_keys(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Función para comparar dos rangos de compactación por su bloque inicial (para qsort)
+ */
+int compare_pack_runs(const void *a, const void *b)
+{
+    return ((const PackRun *)a)->start - ((const PackRun *)b)->start;
+}
+
+/*
+ * Función para reunir los rangos de bloques con datos del archivador
+ * Cada extent y cada bloque de colas es un rango; los que se solapan (bloques deduplicados) se
+ * unen, así que cada extent queda dentro de un solo rango.
+ * header: Encabezado con todo el directorio cargado
+ * count: Se llena con el número de rangos
+ * Retorna: Array de rangos ordenado por bloque inicial (el llamador lo libera)
+ */
+PackRun *pack_collect_runs(StarHeader *header, int *count)
+{
+    int capacity = header->extent_count + header->file_count + 1;
+    PackRun *runs = malloc(capacity * sizeof(PackRun));
+    if (!runs)
+    {
+        perror("Error de memoria");
+        fail_operation();
+    }
+
+    int n = 0;
+    for (int i = 0; i < header->file_count; i++)
+    {
+        FileEntry *entry = &header->files[i];
+        if (entry->filename[0] == '\0')
+        {
+            continue;
+        }
+        for (int e = 0; e < entry->extent_count; e++)
+        {
+            runs[n].start = header->extents[entry->extent_index + e].start_block;
+            runs[n].length = header->extents[entry->extent_index + e].length;
+            n++;
+        }
+        if (entry->tail_length > 0)
+        {
+            runs[n].start = entry->tail_block;
+            runs[n].length = 1;
+            n++;
+        }
+    }
+    qsort(runs, n, sizeof(PackRun), compare_pack_runs);
+
+    int merged = 0;
+    for (int i = 0; i < n; i++)
+    {
+        if (merged > 0 && runs[i].start < runs[merged - 1].start + runs[merged - 1].length)
+        {
+            int end = runs[i].start + runs[i].length;
+            if (end > runs[merged - 1].start + runs[merged - 1].length)
+            {
+                runs[merged - 1].length = end - runs[merged - 1].start;
+            }
+            continue;
+        }
+        runs[merged] = runs[i];
+        runs[merged].current = runs[i].start;
+        runs[merged].target = -1;
+        merged++;
+    }
+    *count = merged;
+    return runs;
+}
+
+/*
+ * Función para buscar el rango que contiene un bloque (búsqueda binaria por bloque inicial)
+ * runs: Rangos ordenados
+ * count: Número de rangos
+ * block: Bloque original
+ * Retorna: Posición del rango, o -1 si el bloque no tiene datos
+ */
+int pack_find_run(PackRun *runs, int count, int block)
+{
+    int low = 0, high = count - 1;
+    while (low <= high)
+    {
+        int mid = (low + high) / 2;
+        if (block < runs[mid].start)
+        {
+            high = mid - 1;
+        }
+        else if (block >= runs[mid].start + runs[mid].length)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            return mid;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Función para mover bloques dentro del archivador, o copiarlos a otro archivo, con el búfer de
+ * copia de -p
+ * Se copia por tramos de menor a mayor posición, así que el destino puede solaparse con el
+ * origen si está antes. Dentro del archivador las sumas de verificación se mueven con los
+ * bloques; hacia otro archivo las copia quien llama.
+ * fd: Descriptor de archivo del archivador
+ * out_fd: Descriptor en el que se escriben los bloques (fd para moverlos dentro del archivador)
+ * buffer: Búfer de copia
+ * buffer_blocks: Bloques que caben en el búfer
+ * from: Primer bloque de origen
+ * to: Primer bloque de destino
+ * length: Número de bloques
+ */
+void pack_move(int fd, int out_fd, unsigned char *buffer, int buffer_blocks, int from, int to, int length)
+{
+    // io_uring lee varios tramos por delante de las escrituras, así que solo se usa si esas
+    // lecturas no pueden caer en bloques ya sobrescritos: otro archivo, rangos separados, o el
+    // destino al menos URING_BUFFER_BYTES antes del origen
+    int in_place = out_fd == fd;
+    int uring_safe = !in_place || to + length <= from || from + length <= to ||
+                     (off_t)(from - to) * block_size >= URING_BUFFER_BYTES;
+    int uring_fd = direct_fd >= 0 ? direct_fd : fd;
+    if (!uring_safe || !uring_copy(uring_fd, (off_t)from * block_size, in_place ? uring_fd : out_fd,
+                                   (off_t)to * block_size, (size_t)length * block_size, NULL))
+    {
+        for (int done = 0; done < length; done += buffer_blocks)
+        {
+            int chunk = length - done < buffer_blocks ? length - done : buffer_blocks;
+            size_t bytes = (size_t)chunk * block_size;
+            ssize_t bytes_read = archive_pread(fd, buffer, bytes, (off_t)(from + done) * block_size);
+            if (bytes_read < 0)
+            {
+                perror("Error al leer bloque de datos");
+                fail_operation();
+            }
+            memset(buffer + bytes_read, 0, bytes - bytes_read); // Último bloque incompleto
+            off_t offset = (off_t)(to + done) * block_size;
+            ssize_t written = in_place ? archive_pwrite(fd, buffer, bytes, offset) : io_pwrite(out_fd, buffer, bytes, offset);
+            if (written != (ssize_t)bytes)
+            {
+                perror("Error al escribir bloque");
+                fail_operation();
+            }
+            if (!in_place)
+            {
+                cache_release(out_fd, offset, bytes);
+            }
+        }
+    }
+    if (!in_place)
+    {
+        return;
+    }
+    checksum_reserve((from > to ? from : to) + length);
+    memmove(&checksum_table.entries[to], &checksum_table.entries[from], length * sizeof(BlockChecksum));
+    memmove(&checksum_table.verified[to], &checksum_table.verified[from], length);
+    checksum_table.dirty = 1;
+}
+
+/*
+ * Función para apartar al final del archivador los rangos que ocupan el destino de otro (parte de -p)
+ * Solo se apartan los rangos aún no colocados que siguen en su posición original; los ya
+ * apartados están después del final original, donde el destino nunca llega.
+ * fd: Descriptor de archivo del archivador
+ * buffer: Búfer de copia
+ * buffer_blocks: Bloques que caben en el búfer
+ * runs: Rangos ordenados
+ * run_count: Número de rangos
+ * first: Primer rango que puede llegar al destino
+ * skip: Rango que se va a colocar (no se aparta), o -1
+ * block: Primer bloque del destino
+ * length: Bloques del destino
+ * spill_block: Siguiente bloque libre al final del archivador
+ * Retorna: El nuevo siguiente bloque libre al final del archivador
+ */
+int pack_evict(int fd, unsigned char *buffer, int buffer_blocks, PackRun *runs, int run_count, int first,
+               int skip, int block, int length, int spill_block)
+{
+    for (int k = first; k < run_count && runs[k].start < block + length; k++)
+    {
+        PackRun *run = &runs[k];
+        if (k == skip || run->target != -1 || run->current != run->start || run->start + run->length <= block)
+        {
+            continue;
+        }
+        pack_move(fd, fd, buffer, buffer_blocks, run->current, spill_block, run->length);
+        run->current = spill_block;
+        spill_block += run->length;
+    }
+    return spill_block;
+}
+
+/*
+ * Función para compactar el archivador (-p)
+ * Los archivos se recorren en el orden en que empiezan en el archivador y sus rangos se copian
+ * uno detrás de otro desde el primer bloque después del encabezado, así que cada archivo queda
+ * en un solo extent (salvo los bloques compartidos por deduplicación); las colas van después.
+ * Con out_fd distinto de fd los rangos se copian a un archivo vacío y el original no cambia. En
+ * el mismo archivo (--in-place) todo lo que está antes del cursor de escritura ya está en su
+ * lugar; si el destino de un rango tiene datos de otro rango aún no colocado, ese rango se aparta
+ * primero al final del archivador. La memoria usada no depende del tamaño de los datos: un búfer
+ * de pack_buffer_size bytes y un rango por extent.
+ * Los metadatos (páginas del directorio y tablas) ya están en memoria, así que sus bloques se
+ * tratan como libres y write_header los escribe de nuevo al final.
+ * fd: Descriptor de archivo del archivador
+ * out_fd: Descriptor del archivo compactado (fd para compactar en el mismo archivo)
+ * header: Encabezado con todo el directorio cargado
+ */
+void pack_compact(int fd, int out_fd, StarHeader *header)
+{
+    int in_place = out_fd == fd;
+    int run_count;
+    PackRun *runs = pack_collect_runs(header, &run_count);
+    int buffer_blocks = (int)(pack_buffer_size / block_size);
+    if (buffer_blocks < 1)
+    {
+        buffer_blocks = 1;
+    }
+    unsigned char *buffer = aligned_buffer((size_t)buffer_blocks * block_size); // Sirve para O_DIRECT
+
+    // Orden de los archivos: por su primer bloque (bloque << 32 | posición en el directorio)
+    uint64_t *order = malloc((header->file_count + 1) * sizeof(uint64_t));
+    if (!buffer || !order)
+    {
+        perror("Error de memoria");
+        fail_operation();
+    }
+    int order_count = 0;
+    for (int i = 0; i < header->file_count; i++)
+    {
+        FileEntry *entry = &header->files[i];
+        if (entry->filename[0] == '\0')
+        {
+            continue;
+        }
+        uint32_t first = entry->extent_count > 0 ? (uint32_t)header->extents[entry->extent_index].start_block
+                         : entry->tail_length > 0 ? (uint32_t)entry->tail_block
+                                                  : UINT32_MAX;
+        order[order_count++] = (uint64_t)first << 32 | (uint32_t)i;
+    }
+    qsort(order, order_count, sizeof(uint64_t), compare_pack_keys);
+
+    int next_block = HEADER_BLOCKS, scan = 0;
+    int spill_block = append_block_index(fd);
+    if (run_count > 0 && runs[run_count - 1].start + runs[run_count - 1].length > spill_block)
+    {
+        spill_block = runs[run_count - 1].start + runs[run_count - 1].length;
+    }
+    int first_spill = spill_block;
+    long long moved_blocks = 0;
+    for (int o = 0; o < order_count; o++)
+    {
+        FileEntry *entry = &header->files[(uint32_t)order[o]];
+        for (int e = 0; e < entry->extent_count; e++)
+        {
+            int r = pack_find_run(runs, run_count, header->extents[entry->extent_index + e].start_block);
+            if (runs[r].target != -1)
+            {
+                continue; // Ya colocado por otro archivo
+            }
+            PackRun *run = &runs[r];
+            while (scan < run_count && runs[scan].start + runs[scan].length <= next_block)
+            {
+                scan++;
+            }
+            if (in_place)
+            {
+                spill_block = pack_evict(fd, buffer, buffer_blocks, runs, run_count, scan, r, next_block, run->length,
+                                         spill_block);
+            }
+            if (run->current != next_block || !in_place)
+            {
+                pack_move(fd, out_fd, buffer, buffer_blocks, run->current, next_block, run->length);
+                moved_blocks += run->length;
+            }
+            run->current = next_block;
+            run->target = next_block;
+            next_block += run->length;
+        }
+    }
+
+    // Hacia otro archivo las sumas de los rangos se copian al final desde una copia de la tabla,
+    // porque el destino de un rango puede ser en la tabla el origen de otro que aún no se copió
+    if (!in_place)
+    {
+        int source_count = checksum_table.count;
+        BlockChecksum *sums = malloc((source_count + 1) * sizeof(BlockChecksum));
+        unsigned char *verified = malloc(source_count + 1);
+        if (!sums || !verified)
+        {
+            perror("Error de memoria");
+            fail_operation();
+        }
+        memcpy(sums, checksum_table.entries, source_count * sizeof(BlockChecksum));
+        memcpy(verified, checksum_table.verified, source_count);
+        checksum_reserve(next_block);
+        memset(checksum_table.entries, 0, next_block * sizeof(BlockChecksum));
+        memset(checksum_table.verified, 0, next_block);
+        for (int r = 0; r < run_count; r++)
+        {
+            for (int k = 0; runs[r].target != -1 && k < runs[r].length && runs[r].start + k < source_count; k++)
+            {
+                checksum_table.entries[runs[r].target + k] = sums[runs[r].start + k];
+                checksum_table.verified[runs[r].target + k] = verified[runs[r].start + k];
+            }
+        }
+        free(sums);
+        free(verified);
+    }
+
+    // Las colas se vuelven a empaquetar juntas después de los datos, sin los huecos de las colas
+    // eliminadas. El mapa de bloques libres solo marca libre el bloque siguiente, así que
+    // tail_store abre ahí cada bloque de colas nuevo
+    tail_reset();
+    free_map_set(header, 0, header->free_map_count, 0);
+    for (int o = 0; o < order_count; o++)
+    {
+        FileEntry *entry = &header->files[(uint32_t)order[o]];
+        if (entry->tail_length == 0)
+        {
+            continue;
+        }
+        if (tail_table.count == 0 || tail_table.entries[tail_table.count - 1].used + entry->tail_length > block_size)
+        {
+            while (scan < run_count && runs[scan].start + runs[scan].length <= next_block)
+            {
+                scan++;
+            }
+            if (in_place)
+            {
+                spill_block = pack_evict(fd, buffer, buffer_blocks, runs, run_count, scan, -1, next_block, 1, spill_block);
+            }
+            free_map_reserve(header, next_block + 1);
+            free_map_set(header, next_block, 1, 1);
+        }
+        PackRun *run = &runs[pack_find_run(runs, run_count, entry->tail_block)];
+        off_t offset = (off_t)(run->current + entry->tail_block - run->start) * block_size + entry->tail_offset;
+        tail_copy(out_fd, header, entry, fd, offset, entry->tail_length);
+        if (entry->tail_block == next_block)
+        {
+            next_block++;
+        }
+    }
+    tail_flush();
+    free(order);
+    free(buffer);
+
+    // Trasladar los extents y la tabla de deduplicación a las nuevas posiciones
+    for (int i = 0; i < header->file_count; i++)
+    {
+        FileEntry *entry = &header->files[i];
+        if (entry->filename[0] == '\0')
+        {
+            continue;
+        }
+        int kept = 0;
+        for (int e = 0; e < entry->extent_count; e++)
+        {
+            Extent extent = header->extents[entry->extent_index + e];
+            PackRun *run = &runs[pack_find_run(runs, run_count, extent.start_block)];
+            extent.start_block = run->target + extent.start_block - run->start;
+            Extent *previous = kept > 0 ? &header->extents[entry->extent_index + kept - 1] : NULL;
+            if (previous && previous->start_block + previous->length == extent.start_block)
+            {
+                previous->length += extent.length;
+            }
+            else
+            {
+                header->extents[entry->extent_index + kept++] = extent;
+            }
+        }
+        header->pages[i / DIR_PAGE_ENTRIES].extent_used -= entry->extent_count - kept;
+        entry->extent_count = kept;
+        entry->start_block = kept > 0 ? header->extents[entry->extent_index].start_block : -1;
+    }
+    for (int i = 0; i < dedup_table.count; i++)
+    {
+        int r = pack_find_run(runs, run_count, dedup_table.entries[i].block);
+        if (r == -1)
+        {
+            dedup_table.entries[i].refcount = 0;
+            continue;
+        }
+        dedup_table.entries[i].block = runs[r].target + dedup_table.entries[i].block - runs[r].start;
+    }
+    dedup_rehash(dedup_table.count * 2);
+    free(runs);
+
+    // Los metadatos se vuelven a escribir completos después de los datos
+    for (int p = 0; p < header->page_count; p++)
+    {
+        header->pages[p].info.block = 0;
+        header->pages[p].dirty = 1;
+    }
+    header->dir_dirty = 1;
+    header->dir_table_block = header->dir_table_blocks = 0;
+    header->dedup_table_block = header->dedup_table_blocks = 0;
+    header->tail_table_block = header->tail_table_blocks = 0;
+    header->checksum_table_block = header->checksum_table_blocks = 0;
+    header->free_map_block = header->free_map_blocks = 0;
+    if (header->free_map)
+    {
+        memset(header->free_map, 0, (size_t)header->free_map_capacity / 64 * sizeof(uint64_t));
+    }
+    header->free_map_count = 0;
+    header->free_map_dirty = 1;
+    dedup_table.dirty = 1;
+    tail_table.dirty = 1;
+
+    if (ftruncate(out_fd, (off_t)next_block * block_size) != 0)
+    {
+        perror("Error al truncar archivo");
+        fail_operation();
+    }
+
+    // Las sumas que quedaron después de los datos ya no valen; los bloques que no tenían
+    // (los convertidos de v1) se calculan a partir de los datos
+    if (checksum_table.count > next_block)
+    {
+        checksum_table.count = next_block;
+    }
+    for (int b = HEADER_BLOCKS; b < next_block; b++)
+    {
+        if (b >= checksum_table.count || checksum_table.entries[b].length == 0)
+        {
+            checksum_record_from_archive(out_fd, b);
+        }
+    }
+    checksum_table.dirty = 1;
+    write_header(out_fd, header);
+
+    if (verbose_level >= 1)
+    {
+        printf("Bloques movidos: %lld; apartados temporalmente: %d (búfer de %d bloques)\n",
+               moved_blocks, spill_block - first_spill, buffer_blocks);
+    }
+}
+
+/*
+ * Función para desfragmentar el archivador por pasos, dentro de un presupuesto (--pack-incremental)
+ * Primero se mueven los archivos con más extents, cada uno a un rango contiguo libre (o al final
+ * del archivador). Después los archivos y bloques de colas que están más al final pasan a huecos
+ * libres anteriores donde quepan, y por último cada uno se desliza hasta el hueco que tenga justo
+ * antes, para poder recortar el archivo. Los datos nunca se copian sobre bloques que el
+ * encabezado guardado todavía usa, y después de cada paso se escribe el encabezado, así que el
+ * archivador queda consistente si el proceso se interrumpe. Repetido en varias ejecuciones, el
+ * resultado se acerca al de -p.
+ * star_filename: Nombre del archivo de archivado
+ */
+void pack_incremental(char *star_filename)
+{
+    int fd = open(star_filename, O_RDWR);
+    if (fd < 0)
+    {
+        perror("Error al abrir el archivo empaquetado");
+        fail_operation();
+    }
+
+    StarHeader header;
+    read_header(fd, &header);
+    if (header.version == 1)
+    {
+        fprintf(stderr, "Los empaquetados v1 se deben convertir primero con -p\n");
+        fail_operation();
+    }
+    load_directory(&header);
+    direct_open(star_filename, O_RDWR);
+
+    // Liberar los bloques que el mapa da por usados pero a los que nada apunta (por ejemplo, el
+    // hueco reservado de un deslizamiento que se interrumpió)
+    FragmentationInfo before_info = analyze_fragmentation(fd, &header);
+    for (int b = HEADER_BLOCKS; b < before_info.total_blocks; b++)
+    {
+        int is_free = b < header.free_map_count && (header.free_map[b / 64] >> (b % 64) & 1);
+        if (!before_info.block_status[b] && !is_free)
+        {
+            free_block(&header, b);
+        }
+    }
+    free(before_info.block_status);
+
+    // Claves de orden de los pasos: (prioridad << 32 | unidad); una unidad es la posición de un
+    // archivo, o PACK_TAIL_UNIT más la posición de un bloque de colas
+    uint64_t *order = malloc((header.file_count + tail_table.count + 1) * sizeof(uint64_t));
+    int buffer_blocks = (int)(pack_buffer_size / block_size);
+    if (buffer_blocks < 1)
+    {
+        buffer_blocks = 1;
+    }
+    unsigned char *buffer = aligned_buffer((size_t)buffer_blocks * block_size); // Sirve para O_DIRECT
+    if (!order || !buffer)
+    {
+        perror("Error de memoria");
+        fail_operation();
+    }
+
+    Extent *pending = NULL; // Rangos que el paso actual dejó de usar (se liberan en pack_commit)
+    int pending_count = 0, pending_capacity = 0;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    long long moved_bytes = 0;
+    int moved_files = 0, moved_tails = 0, skipped = 0;
+
+    // Continuar los deslizamientos que quedaron a medias en la ejecución anterior
+    for (int i = 0; i < header.file_count && pack_budget_allows(&start, moved_bytes, 0); i++)
+    {
+        FileEntry *entry = &header.files[i];
+        if (entry->filename[0] != '\0' && pack_partial_slide(&header, entry) && !pack_file_shared(&header, entry))
+        {
+            moved_files += pack_slide_file(fd, &header, i, buffer, buffer_blocks, &start, &moved_bytes);
+        }
+    }
+
+    // Primera fase: archivos en varios extents, del más fragmentado al menos
+    int order_count = 0;
+    for (int i = 0; i < header.file_count; i++)
+    {
+        FileEntry *entry = &header.files[i];
+        if (entry->filename[0] != '\0' && entry->extent_count > 1 && !pack_partial_slide(&header, entry) &&
+            !pack_file_shared(&header, entry))
+        {
+            order[order_count++] = (uint64_t)(UINT32_MAX - (uint32_t)entry->extent_count) << 32 | (uint32_t)i;
+        }
+    }
+    qsort(order, order_count, sizeof(uint64_t), compare_pack_keys);
+    int fragmented_count = order_count;
+    for (int o = 0; o < order_count && pack_budget_allows(&start, moved_bytes, 0); o++)
+    {
+        int index = (uint32_t)order[o];
+        FileEntry *entry = &header.files[index];
+        int block_count = 0;
+        for (int e = 0; e < entry->extent_count; e++)
+        {
+            block_count += header.extents[entry->extent_index + e].length;
+        }
+        if (!pack_budget_allows(&start, moved_bytes, (long long)block_count * block_size))
+        {
+            skipped++; // No cabe en lo que queda del presupuesto; puede caber uno menor
+            continue;
+        }
+        int old_count = entry->extent_count;
+        int target = allocate_run(fd, &header, block_count);
+        pack_relocate_file(fd, &header, index, target, buffer, buffer_blocks, &pending, &pending_count, &pending_capacity);
+        pack_commit(fd, &header, &pending, &pending_count);
+        moved_bytes += (long long)block_count * block_size;
+        moved_files++;
+        if (verbose_level >= 1)
+        {
+            printf("Archivo '%s': %d extents -> 1 (bloque %d)\n", entry->filename, old_count, target);
+        }
+    }
+
+    // Segunda fase: de atrás hacia adelante, mover archivos y bloques de colas a huecos anteriores
+    order_count = 0;
+    for (int i = 0; i < header.file_count; i++)
+    {
+        FileEntry *entry = &header.files[i];
+        if (entry->filename[0] != '\0' && entry->extent_count == 1 && !pack_file_shared(&header, entry))
+        {
+            order[order_count++] = (uint64_t)header.extents[entry->extent_index].start_block << 32 | (uint32_t)i;
+        }
+    }
+    for (int t = 0; t < tail_table.count; t++)
+    {
+        if (tail_table.entries[t].refcount > 0)
+        {
+            order[order_count++] = (uint64_t)tail_table.entries[t].block << 32 | (PACK_TAIL_UNIT + (uint32_t)t);
+        }
+    }
+    qsort(order, order_count, sizeof(uint64_t), compare_pack_keys);
+    for (int o = order_count - 1; o >= 0 && pack_budget_allows(&start, moved_bytes, 0); o--)
+    {
+        uint32_t unit = (uint32_t)order[o];
+        int block = (int)(order[o] >> 32);
+        int length = unit >= PACK_TAIL_UNIT ? 1 : header.extents[header.files[unit].extent_index].length;
+        if (!pack_budget_allows(&start, moved_bytes, (long long)length * block_size))
+        {
+            skipped++;
+            continue;
+        }
+        int target = free_map_find_hole(&header, length, block);
+        if (target == -1)
+        {
+            continue; // No hay un hueco anterior donde quepa
+        }
+        free_map_set(&header, target, length, 0);
+        if (unit >= PACK_TAIL_UNIT)
+        {
+            pack_relocate_tail(fd, &header, unit - PACK_TAIL_UNIT, target, buffer, &pending, &pending_count, &pending_capacity);
+            moved_tails++;
+        }
+        else
+        {
+            pack_relocate_file(fd, &header, unit, target, buffer, buffer_blocks, &pending, &pending_count, &pending_capacity);
+            moved_files++;
+        }
+        pack_commit(fd, &header, &pending, &pending_count);
+        moved_bytes += (long long)length * block_size;
+        if (verbose_level >= 2)
+        {
+            printf("Bloque %d -> %d (%d bloques)\n", block, target, length);
+        }
+    }
+
+    // Tercera fase: de adelante hacia atrás, deslizar cada archivo o bloque de colas hasta el
+    // hueco que tiene justo antes (también los archivos que quedaron a medio deslizar). Antes se
+    // llevan al final los metadatos que están después de algún hueco, para que no estorben
+    if (pack_budget_allows(&start, moved_bytes, 0) && pack_relocate_metadata(&header))
+    {
+        pack_write_header(fd, &header);
+    }
+    order_count = 0;
+    for (int i = 0; i < header.file_count; i++)
+    {
+        FileEntry *entry = &header.files[i];
+        if (entry->filename[0] != '\0' && (entry->extent_count == 1 || pack_partial_slide(&header, entry)) &&
+            !pack_file_shared(&header, entry))
+        {
+            order[order_count++] = (uint64_t)header.extents[entry->extent_index].start_block << 32 | (uint32_t)i;
+        }
+    }
+    for (int t = 0; t < tail_table.count; t++)
+    {
+        if (tail_table.entries[t].refcount > 0)
+        {
+            order[order_count++] = (uint64_t)tail_table.entries[t].block << 32 | (PACK_TAIL_UNIT + (uint32_t)t);
+        }
+    }
+    qsort(order, order_count, sizeof(uint64_t), compare_pack_keys);
+    for (int o = 0; o < order_count && pack_budget_allows(&start, moved_bytes, 0); o++)
+    {
+        uint32_t unit = (uint32_t)order[o];
+        if (unit < PACK_TAIL_UNIT)
+        {
+            moved_files += pack_slide_file(fd, &header, unit, buffer, buffer_blocks, &start, &moved_bytes);
+            continue;
+        }
+        int block = (int)(order[o] >> 32);
+        int hole = free_map_hole_before(&header, block);
+        if (hole == block || !pack_budget_allows(&start, moved_bytes, block_size))
+        {
+            continue; // Sin hueco justo antes, o sin presupuesto
+        }
+        free_map_set(&header, hole, 1, 0);
+        pack_relocate_tail(fd, &header, unit - PACK_TAIL_UNIT, hole, buffer, &pending, &pending_count, &pending_capacity);
+        pack_commit(fd, &header, &pending, &pending_count);
+        moved_bytes += block_size;
+        moved_tails++;
+    }
+    free(order);
+    free(buffer);
+
+    // Acercar los metadatos a los huecos, recortar los bloques libres del final y guardar los
+    // últimos bloques liberados
+    free(pending);
+    if (pack_relocate_metadata(&header))
+    {
+        write_header(fd, &header);
+    }
+    int end = append_block_index(fd);
+    int trimmed = free_map_hole_before(&header, end);
+    if (trimmed < end)
+    {
+        if (ftruncate(fd, (off_t)trimmed * block_size) != 0)
+        {
+            perror("Error al truncar archivo");
+            fail_operation();
+        }
+        free_map_set(&header, trimmed, end - trimmed, 0);
+        header.free_map_count = trimmed < header.free_map_count ? trimmed : header.free_map_count;
+    }
+    if (moved_bytes > 0 || trimmed < end)
+    {
+        write_header(fd, &header);
+    }
+
+    if (verbose_level >= 1)
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        double seconds = (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+        FragmentationInfo after_info = analyze_fragmentation(fd, &header);
+        printf("\nArchivos movidos: %d (%d estaban fragmentados); bloques de colas movidos: %d\n", moved_files,
+               fragmented_count, moved_tails);
+        printf("- Datos movidos: %.1f MB en %.2f s\n", moved_bytes / (1024.0 * 1024.0), seconds);
+        if (skipped > 0)
+        {
+            printf("- Pasos que no cupieron en el presupuesto: %d\n", skipped);
+        }
+        printf("- Bloques libres: %d -> %d (ratio de fragmentación %.2f -> %.2f)\n", before_info.free_blocks,
+               after_info.free_blocks, before_info.fragmentation_ratio, after_info.fragmentation_ratio);
+        printf("- Tamaño: %d -> %d bloques\n", before_info.total_blocks, after_info.total_blocks);
+        free(after_info.block_status);
+    }
+
+    free_header(&header);
+    direct_close(fd);
+    close(fd);
+}
+
+/*
+ * Función para saber si queda presupuesto de --pack-incremental para un paso
+ * El primer paso siempre cabe en un presupuesto de tiempo, para que cada ejecución avance.
+ * start: Momento en que empezó la desfragmentación
+ * moved_bytes: Bytes ya movidos
+ * bytes: Bytes que movería el paso
+ * Retorna: 1 si el paso cabe en el presupuesto, 0 si no
+ */
+int pack_budget_allows(struct timespec *start, long long moved_bytes, long long bytes)
+{
+    if (pack_budget_bytes > 0 && moved_bytes + bytes > pack_budget_bytes)
+    {
+        return 0;
+    }
+    if (pack_budget_ms > 0 && moved_bytes > 0)
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long long elapsed_ms = (now.tv_sec - start->tv_sec) * 1000LL + (now.tv_nsec - start->tv_nsec) / 1000000;
+        return elapsed_ms < pack_budget_ms;
+    }
+    return 1;
+}
+
+/*
+ * Función para saber si un archivo tiene bloques deduplicados (moverlos rompería el bloque compartido)
+ * header: Puntero al encabezado del archivador
+ * entry: Entrada del archivo
+ * Retorna: 1 si algún bloque del archivo está en la tabla de deduplicación, 0 si no
+ */
+int pack_file_shared(StarHeader *header, FileEntry *entry)
+{
+    if (dedup_table.count == 0)
+    {
+        return 0;
+    }
+    for (int e = 0; e < entry->extent_count; e++)
+    {
+        Extent *extent = &header->extents[entry->extent_index + e];
+        for (int b = 0; b < extent->length; b++)
+        {
+            if (dedup_find_block(extent->start_block + b) != -1)
+            {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * Función para agregar un rango a la lista de rangos que se liberan en el siguiente paso
+ * pending: Lista de rangos (se amplía si hace falta)
+ * count: Rangos en la lista
+ * capacity: Capacidad de la lista
+ * start_block: Primer bloque del rango
+ * length: Número de bloques
+ */
+void pack_defer_free(Extent **pending, int *count, int *capacity, int start_block, int length)
+{
+    if (*count == *capacity)
+    {
+        *capacity = *capacity ? *capacity * 2 : 16;
+        *pending = realloc(*pending, *capacity * sizeof(Extent));
+        if (!*pending)
+        {
+            perror("Error de memoria");
+            fail_operation();
+        }
+    }
+    (*pending)[*count].start_block = start_block;
+    (*pending)[*count].length = length;
+    (*count)++;
+}
+
+/*
+ * Función para escribir el encabezado en un paso de --pack-incremental
+ * Mientras se guardan las tablas, los huecos libres se marcan como usados para que las tablas
+ * vayan al final del archivador y no queden entre un hueco y los datos que se deslizan hacia él.
+ * En el mapa guardado los huecos quedan como usados hasta el siguiente encabezado; si el proceso
+ * se interrumpe antes, la siguiente ejecución los libera.
+ * fd: Descriptor de archivo del archivador
+ * header: Puntero al encabezado del archivador
+ */
+void pack_write_header(int fd, StarHeader *header)
+{
+    Extent *holes = NULL;
+    int hole_count = 0, hole_capacity = 0;
+    int length;
+    for (int start = free_map_next_run(header, HEADER_BLOCKS, &length); start != -1;
+         start = free_map_next_run(header, start + length, &length))
+    {
+        pack_defer_free(&holes, &hole_count, &hole_capacity, start, length);
+    }
+    for (int h = 0; h < hole_count; h++)
+    {
+        free_map_set(header, holes[h].start_block, holes[h].length, 0);
+    }
+    write_header(fd, header);
+    for (int h = 0; h < hole_count; h++)
+    {
+        free_map_set(header, holes[h].start_block, holes[h].length, 1);
+    }
+    free(holes);
+}
+
+/*
+ * Función para terminar un paso de --pack-incremental
+ * Se escribe el encabezado con las nuevas posiciones y solo después se liberan los rangos que el
+ * paso dejó de usar: hasta entonces el encabezado guardado todavía apuntaba a ellos.
+ * fd: Descriptor de archivo del archivador
+ * header: Puntero al encabezado del archivador
+ * pending: Rangos que se dejaron de usar
+ * count: Rangos en la lista (se vacía)
+ */
+void pack_commit(int fd, StarHeader *header, Extent **pending, int *count)
+{
+    pack_write_header(fd, header);
+    for (int e = 0; e < *count; e++)
+    {
+        for (int b = 0; b < (*pending)[e].length; b++)
+        {
+            free_block(header, (*pending)[e].start_block + b);
+        }
+    }
+    *count = 0;
+}
+
+/*
+ * Función para mover los datos de un archivo a un rango contiguo ya reservado
+ * El archivo queda en un solo extent, en la misma posición de su página; sus rangos anteriores
+ * se agregan a la lista de rangos por liberar.
+ * fd: Descriptor de archivo del archivador
+ * header: Puntero al encabezado del archivador
+ * index: Posición del archivo en el directorio
+ * target: Primer bloque del rango reservado
+ * buffer: Búfer de copia
+ * buffer_blocks: Bloques que caben en el búfer
+ * pending, pending_count, pending_capacity: Lista de rangos por liberar
+ */
+void pack_relocate_file(int fd, StarHeader *header, int index, int target, unsigned char *buffer, int buffer_blocks,
+                        Extent **pending, int *pending_count, int *pending_capacity)
+{
+    FileEntry *entry = &header->files[index];
+    int next = target;
+    for (int e = 0; e < entry->extent_count; e++)
+    {
+        Extent extent = header->extents[entry->extent_index + e];
+        pack_move(fd, fd, buffer, buffer_blocks, extent.start_block, next, extent.length);
+        pack_defer_free(pending, pending_count, pending_capacity, extent.start_block, extent.length);
+        next += extent.length;
+    }
+
+    DirPage *page = &header->pages[index / DIR_PAGE_ENTRIES];
+    page->extent_used -= entry->extent_count - 1;
+    page->dirty = 1;
+    header->extents[entry->extent_index].start_block = target;
+    header->extents[entry->extent_index].length = next - target;
+    entry->extent_count = 1;
+    entry->start_block = target;
+}
+
+/*
+ * Función para saber si un archivo quedó a medio deslizar por pack_slide_file
+ * header: Puntero al encabezado del archivador
+ * entry: Entrada del archivo
+ * Retorna: 1 si tiene dos extents separados solo por bloques libres, 0 si no
+ */
+int pack_partial_slide(StarHeader *header, FileEntry *entry)
+{
+    if (entry->extent_count != 2)
+    {
+        return 0;
+    }
+    Extent *moved = &header->extents[entry->extent_index];
+    Extent *rest = moved + 1;
+    int from = moved->start_block + moved->length;
+    if (rest->start_block <= from || rest->start_block > header->free_map_count)
+    {
+        return 0;
+    }
+    int length;
+    return free_map_next_run(header, from, &length) == from && from + length >= rest->start_block;
+}
+
+/*
+ * Función para deslizar un archivo hasta el hueco libre que tiene justo antes
+ * Cada tramo se copia a bloques libres y se guarda el encabezado antes de reutilizar los bloques
+ * de origen como destino del tramo siguiente. Mientras se desliza, el archivo tiene dos
+ * extents (lo ya movido y lo que falta); si se acaba el presupuesto a mitad de camino queda así
+ * y la siguiente ejecución de --pack-incremental continúa desde ahí.
+ * fd: Descriptor de archivo del archivador
+ * header: Puntero al encabezado del archivador
+ * index: Posición del archivo en el directorio (un extent, o dos según pack_partial_slide)
+ * buffer: Búfer de copia
+ * buffer_blocks: Bloques que caben en el búfer
+ * start: Momento en que empezó la desfragmentación (para el presupuesto)
+ * moved_bytes: Bytes ya movidos (se actualiza)
+ * Retorna: 1 si el archivo llegó al inicio del hueco, 0 si no
+ */
+int pack_slide_file(int fd, StarHeader *header, int index, unsigned char *buffer, int buffer_blocks,
+                    struct timespec *start, long long *moved_bytes)
+{
+    FileEntry *entry = &header->files[index];
+    DirPage *page = &header->pages[index / DIR_PAGE_ENTRIES];
+    int hole, done, source, remaining;
+    if (entry->extent_count == 2)
+    {
+        hole = header->extents[entry->extent_index].start_block;
+        done = header->extents[entry->extent_index].length;
+        source = header->extents[entry->extent_index + 1].start_block;
+        remaining = header->extents[entry->extent_index + 1].length;
+    }
+    else
+    {
+        done = 0;
+        source = header->extents[entry->extent_index].start_block;
+        remaining = header->extents[entry->extent_index].length;
+        hole = free_map_hole_before(header, source);
+        if (hole == source)
+        {
+            return 0;
+        }
+        if (source - hole < remaining ||
+            (pack_budget_bytes > 0 && (pack_budget_bytes - *moved_bytes) / block_size < remaining))
+        {
+            // Hacen falta dos extents mientras dura: van al final del array en memoria
+            if (page->extent_used + 1 > DIR_PAGE_EXTENTS)
+            {
+                return 0;
+            }
+            extent_reserve(header, 2);
+            header->extents[header->extent_count] = header->extents[entry->extent_index];
+            entry->extent_index = header->extent_count;
+            header->extent_count += 2;
+        }
+    }
+
+    // El hueco [hole + done, source) se mantiene reservado mientras dura, para que las tablas que
+    // guarda write_header no caigan en él; cada tramo de origen pasa a ser parte del hueco
+    int gap = source - (hole + done);
+    free_map_set(header, hole + done, gap, 0);
+    while (remaining > 0)
+    {
+        int chunk = remaining < gap ? remaining : gap;
+        if (pack_budget_bytes > 0 && (pack_budget_bytes - *moved_bytes) / block_size < chunk)
+        {
+            chunk = (int)((pack_budget_bytes - *moved_bytes) / block_size); // Lo que queda del presupuesto
+        }
+        if (chunk < 1 || !pack_budget_allows(start, *moved_bytes, (long long)chunk * block_size))
+        {
+            break;
+        }
+        pack_move(fd, fd, buffer, buffer_blocks, source, hole + done, chunk);
+        *moved_bytes += (long long)chunk * block_size;
+        done += chunk;
+        source += chunk;
+        remaining -= chunk;
+
+        // El archivo queda en [hole, hole + done) y [source, source + remaining)
+        int extent_count = remaining > 0 ? 2 : 1;
+        page->extent_used += extent_count - entry->extent_count;
+        header->extents[entry->extent_index].start_block = hole;
+        header->extents[entry->extent_index].length = done;
+        if (remaining > 0)
+        {
+            header->extents[entry->extent_index + 1].start_block = source;
+            header->extents[entry->extent_index + 1].length = remaining;
+        }
+        entry->extent_count = extent_count;
+        entry->start_block = hole;
+        page->dirty = 1;
+        pack_write_header(fd, header);
+    }
+    if (remaining > 0)
+    {
+        return 0; // El hueco sigue reservado; la siguiente ejecución lo libera y continúa
+    }
+    for (int b = hole + done; b < source; b++)
+    {
+        free_block(header, b);
+    }
+    return 1;
+}
+
+/*
+ * Función para reubicar las páginas del directorio y las tablas que están después del primer hueco
+ * Se liberan sus bloques y se marcan para reescribir: write_header las vuelve a ubicar en el
+ * hueco más ajustado, y pack_write_header al final del archivador.
+ * header: Puntero al encabezado del archivador
+ * Retorna: 1 si hay algo que reubicar, 0 si no
+ */
+int pack_relocate_metadata(StarHeader *header)
+{
+    int length;
+    int hole = free_map_next_run(header, HEADER_BLOCKS, &length);
+    if (hole == -1)
+    {
+        return 0;
+    }
+
+    int moved = 0;
+    for (int p = 0; p < header->page_count; p++)
+    {
+        DirPage *page = &header->pages[p];
+        if (page->info.block > hole)
+        {
+            for (int b = 0; b < DIR_PAGE_BLOCKS; b++)
+            {
+                free_block(header, page->info.block + b);
+            }
+            page->info.block = 0;
+            page->dirty = 1;
+            header->dir_dirty = 1;
+            moved = 1;
+        }
+    }
+    int *table_block[5] = {&header->dir_table_block, &header->dedup_table_block, &header->tail_table_block,
+                           &header->checksum_table_block, &header->free_map_block};
+    int *table_blocks[5] = {&header->dir_table_blocks, &header->dedup_table_blocks, &header->tail_table_blocks,
+                            &header->checksum_table_blocks, &header->free_map_blocks};
+    int *table_dirty[5] = {&header->dir_dirty, &dedup_table.dirty, &tail_table.dirty, &checksum_table.dirty,
+                           &header->free_map_dirty};
+    for (int t = 0; t < 5; t++)
+    {
+        if (*table_block[t] > hole)
+        {
+            for (int b = 0; b < *table_blocks[t]; b++)
+            {
+                free_block(header, *table_block[t] + b);
+            }
+            *table_block[t] = 0;
+            *table_blocks[t] = 0;
+            *table_dirty[t] = 1;
+            moved = 1;
+        }
+    }
+    return moved;
+}
+
+/*
+ * Función para mover un bloque de colas a un bloque ya reservado
+ * Se actualizan todas las entradas con una cola en el bloque.
+ * fd: Descriptor de archivo del archivador
+ * header: Puntero al encabezado del archivador
+ * tail_index: Posición del bloque en la tabla de bloques de colas
+ * target: Bloque reservado
+ * buffer: Búfer de copia (al menos un bloque)
+ * pending, pending_count, pending_capacity: Lista de rangos por liberar
+ */
+void pack_relocate_tail(int fd, StarHeader *header, int tail_index, int target, unsigned char *buffer,
+                        Extent **pending, int *pending_count, int *pending_capacity)
+{
+    int block = tail_table.entries[tail_index].block;
+    tail_flush();
+    pack_move(fd, fd, buffer, 1, block, target, 1);
+    pack_defer_free(pending, pending_count, pending_capacity, block, 1);
+    for (int i = 0; i < header->file_count; i++)
+    {
+        FileEntry *entry = &header->files[i];
+        if (entry->filename[0] != '\0' && entry->tail_length > 0 && entry->tail_block == block)
+        {
+            entry->tail_block = target;
+            header->pages[i / DIR_PAGE_ENTRIES].dirty = 1;
+        }
+    }
+    tail_table.entries[tail_index].block = target;
+    tail_table.open_index = -1;
+    tail_table.dirty = 1;
+    tail_rehash(tail_table.bucket_count);
+}
+
+/*
+ * Función para buscar el inicio del rango libre que termina justo antes de un bloque
+ * header: Puntero al encabezado del archivador
+ * block: Bloque
+ * Retorna: Primer bloque del rango libre, o block si el bloque anterior está en uso
+ */
+int free_map_hole_before(StarHeader *header, int block)
+{
+    int hole = block;
+    while (hole > HEADER_BLOCKS && hole <= header->free_map_count &&
+           (header->free_map[(hole - 1) / 64] >> ((hole - 1) % 64) & 1))
+    {
+        hole--;
+    }
+    return hole;
+}
+
+/*
+ * Función para buscar el hueco libre más pequeño donde caben count bloques antes de un límite
+ * header: Puntero al encabezado del archivador
+ * count: Número de bloques
+ * limit: El hueco debe terminar antes de este bloque
+ * Retorna: Primer bloque del hueco, o -1 si no hay (no se marca como usado)
+ */
+int free_map_find_hole(StarHeader *header, int count, int limit)
+{
+    int best = -1, best_length = 0;
+    int length;
+    for (int start = free_map_next_run(header, HEADER_BLOCKS, &length); start != -1 && start + count <= limit;
+         start = free_map_next_run(header, start + length, &length))
+    {
+        if (length >= count && (best == -1 || length < best_length))
+        {
+            best = start;
+            best_length = length;
+            if (length == count)
+            {
+                break;
+            }
+        }
+    }
+    return best;
+}
+
+/*
+ * Función para interpretar el argumento de --budget
+ * Un número con sufijo "ms" o "s" es un tiempo; si no, son bytes a mover, con sufijo K, M o G
+ * opcional (también KB, MB o GB).
+ * text: Presupuesto indicado por el usuario, por ejemplo "500ms" o "256MB"
+ */
+void parse_budget(const char *text)
+{
+    char number[64];
+    size_t length = strlen(text);
+    if (length >= sizeof(number))
+    {
+        length = 0; // Se rechaza abajo
+    }
+    memcpy(number, text, length);
+    number[length] = '\0';
+
+    char *end;
+    if (length > 2 && strcmp(number + length - 2, "ms") == 0)
+    {
+        pack_budget_ms = strtoll(number, &end, 10);
+        pack_budget_bytes = 0;
+        if (end == number + length - 2 && pack_budget_ms > 0)
+        {
+            return;
+        }
+    }
+    else if (length > 1 && number[length - 1] == 's')
+    {
+        pack_budget_ms = strtoll(number, &end, 10) * 1000;
+        pack_budget_bytes = 0;
+        if (end == number + length - 1 && pack_budget_ms > 0)
+        {
+            return;
+        }
+    }
+    else
+    {
+        if (length > 2 && (number[length - 1] == 'B' || number[length - 1] == 'b') &&
+            strchr("KkMmGg", number[length - 2]))
+        {
+            number[length - 1] = '\0';
+        }
+        pack_budget_bytes = parse_size(number);
+        pack_budget_ms = 0;
+        if (pack_budget_bytes > 0)
+        {
+            return;
+        }
+    }
+    fprintf(stderr, "Presupuesto no válido: '%s' (por ejemplo 500ms, 10s o 256MB)\n", text);
+    fail_operation();
+}
+
+/*
+ * Función para agregar un archivo al archivador
+ * fd: Descriptor de archivo del archivador
+ * header: Puntero al encabezado del archivador
+ * filename: Nombre del archivo a agregar
+ */
+void add_file_to_star(int fd, StarHeader *header, char *filename)
+{
+    // Copiar el nombre del archivo en la entrada de archivo; se agrega al directorio al final
+    FileEntry new_entry;
+    FileEntry *entry = &new_entry;
+    memset(entry, 0, sizeof(FileEntry));
+    strncpy(entry->filename, filename, MAX_FILENAME_LENGTH);
+    entry->filename[MAX_FILENAME_LENGTH - 1] = '\0'; // Asegurar terminación nula
+
+    // Abrir el archivo de entrada para lectura
+    int file_fd = open(filename, O_RDONLY);
+    if (file_fd < 0)
+    {
+        perror("Error al abrir archivo de entrada");
+        fail_operation();
+    }
+    library_track_fd(file_fd);
+
+    // Obtener el tamaño del archivo de entrada
+    struct stat st;
+    fstat(file_fd, &st);
+    entry->size = st.st_size;
+    entry_set_metadata(entry, &st, file_fd);
+
+    if (compress_codec != CODEC_NONE)
+    {
+        // Comprimir por tramos; los bloques se reservan a medida que se generan los datos
+        add_compressed_file(fd, header, entry, file_fd);
+        dir_add_entry(header, entry);
+        library_untrack(1);
+        close(file_fd);
+
+        char message[300];
+        snprintf(message, sizeof(message), "Archivo '%s' agregado al empaquetado (%s: %lld -> %lld bytes).",
+                 filename, find_codec(entry->codec)->name, (long long)entry->size, (long long)entry->stored_size);
+        verbose_print(message, 1);
+        return;
+    }
+    entry->codec = CODEC_NONE;
+    entry->stored_size = entry->size;
+    if (dedup_enabled)
+    {
+        // Reutilizar los bloques cuyo contenido ya está en el archivador
+        int shared = add_deduplicated_file(fd, header, entry, file_fd);
+        dir_add_entry(header, entry);
+        library_untrack(1);
+        close(file_fd);
+
+        char message[300];
+        snprintf(message, sizeof(message), "Archivo '%s' agregado al empaquetado (%d de %d bloques deduplicados).",
+                 filename, shared, file_block_count(header, entry));
+        verbose_print(message, 1);
+        return;
+    }
+
+    // Reservar los bloques completos del archivo antes de escribir y registrarlos como extents;
+    // una cola pequeña se empaqueta después en un bloque compartido
+    entry->tail_length = tail_pack_length(entry->size);
+    int block_count = file_block_count(header, entry);
+    int *blocks = allocate_blocks(fd, header, block_count);
+    library_track(free, blocks);
+    assign_extents(header, entry, blocks, block_count);
+    library_untrack(1);
+    free(blocks);
+
+    // Con io_uring se leen varios tramos a la vez mientras se escriben los ya leídos (los búferes
+    // registrados están alineados, así que también sirven para O_DIRECT)
+    off_t file_offset = 0;
+    int e = 0;
+    for (; e < entry->extent_count; e++)
+    {
+        Extent *extent = &header->extents[entry->extent_index + e];
+        size_t extent_bytes = (size_t)extent->length * block_size;
+        if (!uring_copy(file_fd, file_offset, direct_fd >= 0 ? direct_fd : fd,
+                        (off_t)extent->start_block * block_size, extent_bytes, uring_record_checksums))
+        {
+            break; // io_uring no está disponible: copiar el resto con la lectura anticipada
+        }
+        cache_release(file_fd, file_offset, extent_bytes);
+        file_offset += extent_bytes;
+    }
+
+    // Partir los extents que faltan en escrituras de hasta WRITE_BATCH_BLOCKS bloques
+    int chunk_count = 0;
+    for (int k = e; k < entry->extent_count; k++)
+    {
+        chunk_count += (header->extents[entry->extent_index + k].length + WRITE_BATCH_BLOCKS - 1) / WRITE_BATCH_BLOCKS;
+    }
+    PipelineChunk *chunks = malloc((chunk_count + 1) * sizeof(PipelineChunk));
+    if (!chunks)
+    {
+        perror("Error de memoria");
+        fail_operation();
+    }
+    library_track(free, chunks);
+    chunk_count = 0;
+    for (; e < entry->extent_count; e++)
+    {
+        Extent *extent = &header->extents[entry->extent_index + e];
+        for (int done = 0; done < extent->length; done += WRITE_BATCH_BLOCKS)
+        {
+            int run = extent->length - done < WRITE_BATCH_BLOCKS ? extent->length - done : WRITE_BATCH_BLOCKS;
+            PipelineChunk *chunk = &chunks[chunk_count++];
+            chunk->offset = file_offset;
+            chunk->length = (size_t)run * block_size;
+            chunk->skip = 0;
+            chunk->used = chunk->length;
+            chunk->target = (off_t)(extent->start_block + done) * block_size;
+            file_offset += chunk->length;
+        }
+    }
+
+    // Un hilo lee los tramos siguientes del archivo de entrada mientras se escriben los anteriores
+    // en el archivador (en la biblioteca se lee en el mismo hilo)
+    Pipeline pipeline;
+    pipeline_start(&pipeline, file_fd, 0, chunks, chunk_count, library_jump == NULL);
+    for (int c = 0; c < chunk_count; c++)
+    {
+        PipelineChunk *chunk = &chunks[c];
+        ssize_t filled;
+        unsigned char *batch = pipeline_next(&pipeline, &filled);
+        if (filled < 0)
+        {
+            perror("Error al leer el archivo");
+            pipeline_finish(&pipeline);
+            fail_operation();
+        }
+        memset(batch + filled, 0, chunk->length - filled); // Fin del archivo
+        cache_release(file_fd, chunk->offset, filled);
+
+        if (archive_pwrite(fd, batch, chunk->length, chunk->target) != (ssize_t)chunk->length)
+        {
+            perror("Error al escribir bloque");
+            pipeline_finish(&pipeline);
+            fail_operation();
+        }
+        for (size_t k = 0; k < chunk->length; k += block_size)
+        {
+            checksum_record((int)((chunk->target + (off_t)k) / block_size), batch + k, block_size);
+        }
+        pipeline_done(&pipeline);
+    }
+    pipeline_finish(&pipeline);
+    library_untrack(1);
+    free(chunks);
+
+    if (entry->tail_length > 0)
+    {
+        tail_copy(fd, header, entry, file_fd, entry->size - entry->tail_length, entry->tail_length);
+    }
+    dir_add_entry(header, entry);
+
+    cache_release(file_fd, 0, 0);
+    library_untrack(1);
+    close(file_fd);
+
+    // Mensaje consolidado de verbosidad
+    char message[300];
+    snprintf(message, sizeof(message), "Archivo '%s' agregado al empaquetado.", filename);
+    verbose_print(message, 1);
+}
+
+/*
+ * Función para obtener el índice del primer bloque disponible al final del archivador
+ * Nunca devuelve un bloque que se solape con el encabezado.
+ * fd: Descriptor de archivo del archivador
+ * Retorna: Índice del bloque
+ */
+int append_block_index(int fd)
+{
+    off_t end = io_lseek(fd, 0, SEEK_END);
+    int block = (int)((end + block_size - 1) / block_size);
+    return block < HEADER_BLOCKS ? HEADER_BLOCKS : block;
+}
+
+/*
+ * Función para ampliar el mapa de bloques libres hasta cubrir un número de bloques
+ * Los bloques nuevos quedan marcados como usados.
+ * header: Puntero al encabezado del archivador
+ * block_count: Número de bloques a cubrir
+ */
+void free_map_reserve(StarHeader *header, int block_count)
+{
+    if (block_count <= header->free_map_count)
+    {
+        return;
+    }
+    if (block_count > header->free_map_capacity)
+    {
+        int capacity = header->free_map_capacity ? header->free_map_capacity : 4096;
+        while (capacity < block_count)
+        {
+            capacity *= 2;
+        }
+        header->free_map = realloc(header->free_map, (size_t)capacity / 64 * sizeof(uint64_t));
+        if (!header->free_map)
+        {
+            perror("Error de memoria");
+            fail_operation();
+        }
+        memset(header->free_map + header->free_map_capacity / 64, 0,
+               (size_t)(capacity - header->free_map_capacity) / 64 * sizeof(uint64_t));
+        header->free_map_capacity = capacity;
+    }
+    header->free_map_count = block_count;
+}
+
+/*
+ * Función para marcar un rango de bloques como libre o usado en el mapa de bloques libres
+ * header: Puntero al encabezado del archivador
+ * start: Primer bloque del rango
+ * count: Número de bloques
+ * is_free: 1 para liberar, 0 para marcar como usado
+ */
+void free_map_set(StarHeader *header, int start, int count, int is_free)
+{
+    if (is_free)
+    {
+        free_map_reserve(header, start + count);
+    }
+    for (int b = start; b < start + count && b < header->free_map_count; b++)
+    {
+        uint64_t bit = (uint64_t)1 << (b % 64);
+        if (is_free)
+        {
+            header->free_map[b / 64] |= bit;
+        }
+        else
+        {
+            header->free_map[b / 64] &= ~bit;
+        }
+    }
+    header->free_map_dirty = 1;
+}
+
+/*
+ * Función para buscar el siguiente rango de bloques libres del mapa
+ * Las palabras sin bloques libres se saltan completas.
+ * header: Puntero al encabezado del archivador
+ * from: Bloque desde el que se busca
+ * length: Se llena con el número de bloques libres consecutivos del rango
+ * Retorna: Primer bloque del rango, o -1 si no hay más bloques libres
+ */
+int free_map_next_run(StarHeader *header, int from, int *length)
+{
+    int b = from;
+    while (b < header->free_map_count)
+    {
+        uint64_t word = header->free_map[b / 64] >> (b % 64);
+        if (word == 0)
+        {
+            b = (b / 64 + 1) * 64;
+            continue;
+        }
+        b += __builtin_ctzll(word);
+        break;
+    }
+    if (b >= header->free_map_count)
+    {
+        return -1;
+    }
+
+    int end = b;
+    while (end < header->free_map_count)
+    {
+        uint64_t word = ~header->free_map[end / 64] >> (end % 64);
+        if (word == 0)
+        {
+            end = (end / 64 + 1) * 64;
+            continue;
+        }
+        end += __builtin_ctzll(word);
+        break;
+    }
+    if (end > header->free_map_count)
+    {
+        end = header->free_map_count;
+    }
+    *length = end - b;
+    return b;
+}
+
+/*
+ * Función para comparar dos rangos libres por tamaño, de mayor a menor (para qsort)
+ */
+int compare_runs_by_length(const void *a, const void *b)
+{
+    const Extent *run_a = (const Extent *)a;
+    const Extent *run_b = (const Extent *)b;
+    return run_b->length - run_a->length;
+}
+
+/*
+ * Función para comparar dos rangos por posición en el archivador (para qsort)
+ */
+int compare_runs_by_start(const void *a, const void *b)
+{
+    return ((const Extent *)a)->start_block - ((const Extent *)b)->start_block;
+}
+
+/*
+ * Función para reservar bloques en el mapa de bloques libres
+ * Se elige el rango libre más pequeño en el que cabe todo (best-fit). Si no hay, se usa el
+ * rango libre que llega al final del archivador ampliándolo con bloques nuevos; si tampoco hay,
+ * se toman los rangos libres más grandes (a lo sumo max_runs - 1) y el resto se agrega al final.
+ * Nunca se leen bloques de datos.
+ * fd: Descriptor de archivo del archivador
+ * header: Puntero al encabezado del archivador
+ * count: Número de bloques
+ * max_runs: Máximo de rangos (1 para un rango contiguo; a lo sumo ALLOC_MAX_EXTENTS)
+ * runs: Se llena con los rangos reservados, en orden de posición
+ * Retorna: Número de rangos
+ */
+int allocate_runs(int fd, StarHeader *header, int count, int max_runs, Extent *runs)
+{
+    if (count <= 0)
+    {
+        return 0;
+    }
+
+    int end = append_block_index(fd);
+    int best = -1, best_length = 0;
+    int trailing = -1;
+    int hole_count = 0, hole_capacity = 0;
+    Extent *holes = NULL;
+    int length;
+    for (int start = free_map_next_run(header, HEADER_BLOCKS, &length); start != -1;
+         start = free_map_next_run(header, start + length, &length))
+    {
+        if (start + length >= end)
+        {
+            trailing = start; // Se puede ampliar con bloques nuevos
+            break;
+        }
+        if (length >= count && (best == -1 || length < best_length))
+        {
+            best = start;
+            best_length = length;
+            if (length == count)
+            {
+                break;
+            }
+        }
+        if (best == -1 && max_runs > 1)
+        {
+            // Guardar los rangos por si hay que repartir el archivo
+            if (hole_count == hole_capacity)
+            {
+                hole_capacity = hole_capacity ? hole_capacity * 2 : 64;
+                holes = realloc(holes, hole_capacity * sizeof(Extent));
+                if (!holes)
+                {
+                    perror("Error de memoria");
+                    fail_operation();
+                }
+            }
+            holes[hole_count].start_block = start;
+            holes[hole_count].length = length;
+            hole_count++;
+        }
+    }
+
+    int run_count = 0;
+    if (best != -1 || trailing != -1)
+    {
+        runs[0].start_block = best != -1 ? best : trailing;
+        runs[0].length = count;
+        run_count = 1;
+    }
+    else
+    {
+        if (hole_count > 0)
+        {
+            qsort(holes, hole_count, sizeof(Extent), compare_runs_by_length);
+        }
+        int remaining = count;
+        for (int i = 0; i < hole_count && run_count < max_runs - 1 && remaining > 0; i++)
+        {
+            runs[run_count] = holes[i];
+            if (runs[run_count].length > remaining)
+            {
+                runs[run_count].length = remaining;
+            }
+            remaining -= runs[run_count].length;
+            run_count++;
+        }
+        if (remaining > 0)
+        {
+            runs[run_count].start_block = end;
+            runs[run_count].length = remaining;
+            run_count++;
+        }
+        qsort(runs, run_count, sizeof(Extent), compare_runs_by_start);
+    }
+    free(holes);
+
+    for (int i = 0; i < run_count; i++)
+    {
+        free_map_set(header, runs[i].start_block, runs[i].length, 0);
+        int reused = runs[i].start_block < end ? end - runs[i].start_block : 0;
+        reused = reused < runs[i].length ? reused : runs[i].length;
+        stats_add(&io_stats.blocks_reused, reused);
+        stats_add(&io_stats.blocks_appended, runs[i].length - reused);
+    }
+    return run_count;
+}
+
+/*
+ * Función para reservar un rango contiguo de bloques (para las tablas y las páginas del directorio)
+ * fd: Descriptor de archivo del archivador
+ * header: Puntero al encabezado del archivador
+ * count: Número de bloques
+ * Retorna: Primer bloque del rango
+ */
+int allocate_run(int fd, StarHeader *header, int count)
+{
+    Extent run;
+    allocate_runs(fd, header, count, 1, &run);
+    return run.start_block;
+}
+
+/*
+ * Función para reservar los bloques de un archivo nuevo
+ * Los bloques se toman del mapa de bloques libres con allocate_runs, así que un archivo queda en
+ * un solo rango siempre que haya espacio contiguo.
+ * fd: Descriptor de archivo del archivador
+ * header: Puntero al encabezado del archivador
+ * count: Número de bloques a reservar
+ * Retorna: Array con los índices de los bloques en orden (el llamador lo libera)
+ */
+int *allocate_blocks(int fd, StarHeader *header, int count)
+{
+    int *blocks = malloc((count > 0 ? count : 1) * sizeof(int));
+    if (!blocks)
+    {
+        perror("Error de memoria");
+        fail_operation();
+    }
+
+    Extent runs[ALLOC_MAX_EXTENTS];
+    int run_count = allocate_runs(fd, header, count, ALLOC_MAX_EXTENTS, runs);
+    int i = 0;
+    for (int r = 0; r < run_count; r++)
+    {
+        for (int b = 0; b < runs[r].length; b++)
+        {
+            blocks[i++] = runs[r].start_block + b;
+        }
+    }
+    return blocks;
+}
+
+/*
+ * Función para registrar los bloques de un archivo como extents en el array del encabezado
+ * Los bloques consecutivos se agrupan en un solo extent.
+ * header: Puntero al encabezado del archivador
+ * entry: Entrada del archivo (se llenan start_block, extent_index y extent_count)
+ * blocks: Índices de los bloques del archivo en orden
+ * count: Número de bloques
+ */
+void assign_extents(StarHeader *header, FileEntry *entry, int *blocks, int count)
+{
+    entry->start_block = count > 0 ? blocks[0] : -1;
+    entry->extent_index = header->extent_count;
+    entry->extent_count = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        Extent *last = entry->extent_count > 0 ? &header->extents[header->extent_count - 1] : NULL;
+        if (last && blocks[i] == last->start_block + last->length)
+        {
+            last->length++;
+            continue;
+        }
+        extent_reserve(header, 1);
+        header->extents[header->extent_count].start_block = blocks[i];
+        header->extents[header->extent_count].length = 1;
+        header->extent_count++;
+        entry->extent_count++;
+    }
+}
+
+/*
+ * Función para eliminar un archivo del archivador
+ * header: Puntero al encabezado del archivador
+ * filename: Nombre del archivo a eliminar
+ */
+void remove_file_from_star(StarHeader *header, char *filename)
+{
+    int index = find_file_entry(header, filename);
+    if (index == -1)
+    {
+        fprintf(stderr, "El archivo '%s' no se encontró en el empaquetado.\n", filename);
+        return;
+    }
+
+    // Marcar los bloques del archivo como libres en el mapa; los bloques se obtienen
+    // de la tabla de extents. Un bloque deduplicado solo se libera con su última referencia
+    FileEntry *entry = &header->files[index];
+    for (int e = 0; e < entry->extent_count; e++)
+    {
+        Extent *extent = &header->extents[entry->extent_index + e];
+        for (int b = 0; b < extent->length; b++)
+        {
+            int current_block = extent->start_block + b;
+            int dedup_index = dedup_find_block(current_block);
+            if (dedup_index != -1)
+            {
+                dedup_table.dirty = 1;
+                if (--dedup_table.entries[dedup_index].refcount > 0)
+                {
+                    continue;
+                }
+            }
+            free_block(header, current_block);
+        }
+    }
+    if (entry->tail_length > 0)
+    {
+        tail_release(header, entry->tail_block);
+    }
+
+    // Marcar la entrada como eliminada; la entrada y sus extents se quitan al reescribir su página
+    file_index_remove(header, index);
+}
+
+/*
+ * Función para liberar un bloque
+ * El bloque se marca como libre en el mapa de bloques libres y pierde su suma de verificación;
+ * no se escribe nada en el bloque.
+ * header: Puntero al encabezado del archivador
+ * block: Índice del bloque a liberar
+ */
+void free_block(StarHeader *header, int block)
+{
+    checksum_clear(block);
+    free_map_set(header, block, 1, 1);
+}
+
+/*
+ * Función para cargar el mapa de bloques libres del archivador
+ * fd: Descriptor de archivo del archivador
+ * header: Puntero al encabezado del archivador
+ * block_count: Bloques que cubre el mapa guardado
+ */
+void free_map_load(int fd, StarHeader *header, int block_count)
+{
+    if (header->free_map_block <= 0 || block_count <= 0)
+    {
+        return;
+    }
+
+    free_map_reserve(header, block_count);
+    ssize_t bytes = (ssize_t)(block_count + 63) / 64 * sizeof(uint64_t);
+    if (io_pread(fd, header->free_map, bytes, (off_t)header->free_map_block * block_size) != bytes)
+    {
+        perror("Error al leer el mapa de bloques libres");
+        fail_operation();
+    }
+    // Los bits después del último bloque cubierto no cuentan
+    if (block_count % 64)
+    {
+        header->free_map[block_count / 64] &= ((uint64_t)1 << (block_count % 64)) - 1;
+    }
+}
+
+/*
+ * Función para guardar el mapa de bloques libres en bloques contiguos del archivador
+ * Se guarda después de las demás tablas, porque guardarlas reserva y libera bloques; el rango
+ * del mapa anterior se libera y el nuevo se reserva antes de copiar los bits.
+ * fd: Descriptor de archivo del archivador
+ * header: Puntero al encabezado del archivador
+ */
+void free_map_save(int fd, StarHeader *header)
+{
+    for (int b = 0; b < header->free_map_blocks; b++)
+    {
+        free_block(header, header->free_map_block + b);
+    }
+    header->free_map_block = 0;
+    header->free_map_blocks = 0;
+
+    // Los bloques libres al final del mapa que están fuera del archivador no se guardan
+    int end = append_block_index(fd);
+    while (header->free_map_count > end)
+    {
+        free_map_set(header, header->free_map_count - 1, 1, 0);
+        header->free_map_count--;
+    }
+    header->free_map_dirty = 0;
+    if (header->free_map_count == 0)
+    {
+        return;
+    }
+
+    size_t bytes = (size_t)(header->free_map_count + 63) / 64 * sizeof(uint64_t);
+    int blocks = (int)((bytes + block_size - 1) / block_size);
+    int start = allocate_run(fd, header, blocks);
+    unsigned char *buffer = calloc(blocks, block_size);
+    if (!buffer)
+    {
+        perror("Error de memoria");
+        fail_operation();
+    }
+    library_track(free, buffer);
+    memcpy(buffer, header->free_map, bytes);
+    if (io_pwrite(fd, buffer, (size_t)blocks * block_size, (off_t)start * block_size) != (ssize_t)blocks * block_size)
+    {
+        perror("Error al escribir el mapa de bloques libres");
+        fail_operation();
+    }
+    library_untrack(1);
+    free(buffer);
+
+    header->free_map_block = start;
+    header->free_map_blocks = blocks;
+    header->free_map_dirty = 0;
+}
+
+/*
+ * Función para abandonar la operación en curso después de reportar un error en stderr
+ * En el programa termina con EXIT_FAILURE; dentro de una función de la biblioteca vuelve a ella,
+ * que devuelve un código de error.
+ */
+void fail_operation(void)
+{
+    if (library_jump && pthread_equal(library_thread, pthread_self()))
+    {
+        library_unwind();
+        longjmp(*library_jump, 1);
+    }
+    exit(EXIT_FAILURE);
+}
+
+/*
+ * Función para imprimir un mensaje basado en el nivel de verbosidad
+ * message: El mensaje a imprimir
+ * level: El nivel de verbosidad requerido para imprimir el mensaje
+ */
+void verbose_print(const char *message, int level)
+{
+    if (verbose_level >= level)
+    {
+        printf("%s\n", message);
+    }
+}
+
+/*
+ * Función para encontrar el índice de una entrada de archivo en el encabezado del archivador
+ * Primero se busca en el índice de las páginas ya cargadas; si no está, solo se cargan las
+ * páginas cuyo filtro de Bloom puede contener el nombre.
+ * header: Puntero al encabezado del archivador
+ * filename: Nombre del archivo a encontrar
+ * Retorna: Índice del archivo en el encabezado, o -1 si no se encuentra
+ */
+int find_file_entry(StarHeader *header, char *filename)
+{
+    if (filename[0] == '\0')
+    {
+        return -1;
+    }
+    int index = file_index_find(header, filename);
+    for (int p = 0; p < header->page_count && index == -1; p++)
+    {
+        if (!header->pages[p].loaded && dir_bloom_test(&header->pages[p].info, filename))
+        {
+            dir_load_page(header, p);
+            index = file_index_find(header, filename);
+        }
+    }
+    return index;
+}
+
+/*
+ * Función para buscar un nombre entre las entradas ya cargadas del directorio
+ * header: Puntero al encabezado del archivador
+ * filename: Nombre del archivo a encontrar
+ * Retorna: Índice del archivo en el encabezado, o -1 si no está cargado
+ */
+int file_index_find(StarHeader *header, const char *filename)
+{
+    if (header->index.bucket_count == 0)
+    {
+        return -1;
+    }
+    uint64_t hash = hash_filename(filename);
+    for (int i = header->index.buckets[hash & (header->index.bucket_count - 1)]; i != -1; i = header->index.next[i])
+    {
+        if (strcmp(header->files[i].filename, filename) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Función para calcular el hash de un nombre de archivo (FNV-1a de 64 bits)
+ * filename: Nombre del archivo
+ * Retorna: Hash del nombre
+ */
+uint64_t hash_filename(const char *filename)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (const unsigned char *c = (const unsigned char *)filename; *c; c++)
+    {
+        hash = (hash ^ *c) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+/*
+ * Función para reconstruir el índice de nombres a partir de las entradas cargadas
+ * header: Puntero al encabezado del archivador
+ */
+void file_index_rebuild(StarHeader *header)
+{
+    FileIndex *index = &header->index;
+    int bucket_count = 64;
+    while (bucket_count < header->file_count * 2)
+    {
+        bucket_count *= 2;
+    }
+    free(index->buckets);
+    index->buckets = malloc(bucket_count * sizeof(int));
+    if (header->file_count + 1 > index->capacity)
+    {
+        index->capacity = (header->file_count + 1) * 2;
+        index->next = realloc(index->next, index->capacity * sizeof(int));
+    }
+    if (!index->buckets || !index->next)
+    {
+        perror("Error de memoria");
+        fail_operation();
+    }
+    index->bucket_count = bucket_count;
+    memset(index->buckets, -1, bucket_count * sizeof(int));
+
+    for (int i = 0; i < header->file_count; i++)
+    {
+        if (header->files[i].filename[0] == '\0')
+        {
+            continue;
+        }
+        int bucket = (int)(hash_filename(header->files[i].filename) & (bucket_count - 1));
+        index->next[i] = index->buckets[bucket];
+        index->buckets[bucket] = i;
+    }
+}
+
+/*
+ * Función para agregar al índice una entrada cargada o nueva del directorio
+ * header: Puntero al encabezado del archivador (file_count ya incluye la entrada)
+ * index: Posición de la entrada en header->files
+ * Retorna: 1 si se rehízo el índice completo (ya incluye todas las entradas cargadas), 0 si no
+ */
+int file_index_add(StarHeader *header, int index)
+{
+    if (index >= header->index.capacity || header->file_count * 2 > header->index.bucket_count)
+    {
+        // Rehacer el índice con más espacio; esto también agrega la entrada nueva
+        file_index_rebuild(header);
+        return 1;
+    }
+    int bucket = (int)(hash_filename(header->files[index].filename) & (header->index.bucket_count - 1));
+    header->index.next[index] = header->index.buckets[bucket];
+    header->index.buckets[bucket] = index;
+    return 0;
+}
+
+/*
+ * Función para quitar una entrada del directorio
+ * La entrada queda con el nombre vacío en su posición; se descarta al reescribir su página.
+ * header: Puntero al encabezado del archivador
+ * index: Posición de la entrada en header->files
+ */
+void file_index_remove(StarHeader *header, int index)
+{
+    int bucket = (int)(hash_filename(header->files[index].filename) & (header->index.bucket_count - 1));
+    for (int *link = &header->index.buckets[bucket]; *link != -1; link = &header->index.next[*link])
+    {
+        if (*link == index)
+        {
+            *link = header->index.next[index];
+            break;
+        }
+    }
+
+    DirPage *page = &header->pages[index / DIR_PAGE_ENTRIES];
+    page->extent_used -= header->files[index].extent_count;
+    page->dirty = 1;
+    header->dir_dirty = 1;
+    header->files[index].filename[0] = '\0';
+    header->files[index].extent_count = 0;
+}
+
+/*
+ * Función para calcular las posiciones de un nombre en el filtro de Bloom de una página
+ * filename: Nombre del archivo
+ * bits: Se llena con las 4 posiciones del nombre
+ */
+void dir_bloom_bits(const char *filename, int bits[4])
+{
+    uint64_t hash = hash_filename(filename);
+    uint32_t h1 = (uint32_t)hash;
+    uint32_t h2 = (uint32_t)(hash >> 32) | 1;
+    for (int k = 0; k < 4; k++)
+    {
+        bits[k] = (int)((h1 + k * h2) % (DIR_BLOOM_WORDS * 64));
+    }
+}
+
+/*
+ * Función para agregar un nombre al filtro de Bloom de una página
+ * info: Descripción de la página
+ * filename: Nombre del archivo
+ */
+void dir_bloom_add(DirPageInfo *info, const char *filename)
+{
+    int bits[4];
+    dir_bloom_bits(filename, bits);
+    for (int k = 0; k < 4; k++)
+    {
+        info->bloom[bits[k] / 64] |= 1ULL << (bits[k] % 64);
+    }
+}
+
+/*
+ * Función para saber si una página puede contener un nombre
+ * info: Descripción de la página
+ * filename: Nombre del archivo
+ * Retorna: 0 si la página seguro no lo contiene, 1 si puede contenerlo
+ */
+int dir_bloom_test(DirPageInfo *info, const char *filename)
+{
+    int bits[4];
+    dir_bloom_bits(filename, bits);
+    for (int k = 0; k < 4; k++)
+    {
+        if (!(info->bloom[bits[k] / 64] & (1ULL << (bits[k] % 64))))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Función para ampliar el array de entradas hasta cubrir un número de posiciones
+ * Las posiciones nuevas quedan vacías.
+ * header: Puntero al encabezado del archivador
+ * count: Número de posiciones a cubrir
+ */
+void dir_reserve_files(StarHeader *header, int count)
+{
+    if (count <= header->file_capacity)
+    {
+        return;
+    }
+    int capacity = header->file_capacity ? header->file_capacity : DIR_PAGE_ENTRIES;
+    while (capacity < count)
+    {
+        capacity *= 2;
+    }
+    header->files = realloc(header->files, capacity * sizeof(FileEntry));
+    if (!header->files)
+    {
+        perror("Error de memoria");
+        fail_operation();
+    }
+    memset(header->files + header->file_capacity, 0, (capacity - header->file_capacity) * sizeof(FileEntry));
+    header->file_capacity = capacity;
+}
+
+/*
+ * Función para asegurar espacio para más extents en el array de extents en memoria
+ * header: Puntero al encabezado del archivador
+ * count: Extents que se van a agregar
+ */
+void extent_reserve(StarHeader *header, int count)
+{
+    if (header->extent_count + count <= header->extent_capacity)
+    {
+        return;
+    }
+    int capacity = header->extent_capacity ? header->extent_capacity : 1024;
+    while (capacity < header->extent_count + count)
+    {
+        capacity *= 2;
+    }
+    header->extents = realloc(header->extents, capacity * sizeof(Extent));
+    if (!header->extents)
+    {
+        perror("Error de memoria");
+        fail_operation();
+    }
+    header->extent_capacity = capacity;
+}
+
+/*
+ * Función para agregar una página vacía al final del directorio
+ * Su bloque se reserva cuando se escribe por primera vez.
+ * header: Puntero al encabezado del archivador
+ * Retorna: Índice de la página
+ */
+int dir_new_page(StarHeader *header)
+{
+    if (header->page_count == header->page_capacity)
+    {
+        header->page_capacity = header->page_capacity ? header->page_capacity * 2 : 16;
+        header->pages = realloc(header->pages, header->page_capacity * sizeof(DirPage));
+        if (!header->pages)
+        {
+            perror("Error de memoria");
+            fail_operation();
+        }
+    }
+    DirPage *page = &header->pages[header->page_count];
+    memset(page, 0, sizeof(DirPage));
+    page->loaded = 1;
+    page->dirty = 1;
+    header->dir_dirty = 1;
+    return header->page_count++;
+}
+
+/*
+ * Función para agregar una entrada al final del directorio
+ * La entrada va a la última página si tiene espacio para ella y sus extents; si no, a una nueva.
+ * header: Puntero al encabezado del archivador
+ * entry: Entrada a copiar (su extent_index apunta al array de extents en memoria)
+ * Retorna: Posición de la entrada en header->files
+ */
+int dir_add_entry(StarHeader *header, FileEntry *entry)
+{
+    if (entry->extent_count > DIR_PAGE_EXTENTS)
+    {
+        fprintf(stderr, "El archivo '%s' tiene demasiados extents (%d); use la opción -p para desfragmentar el empaquetado.\n",
+                entry->filename, entry->extent_count);
+        fail_operation();
+    }
+
+    int p = header->page_count - 1;
+    if (p >= 0)
+    {
+        dir_load_page(header, p);
+    }
+    if (p < 0 || header->pages[p].info.entry_count == DIR_PAGE_ENTRIES ||
+        header->pages[p].extent_used + entry->extent_count > DIR_PAGE_EXTENTS)
+    {
+        p = dir_new_page(header);
+    }
+
+    DirPage *page = &header->pages[p];
+    int index = p * DIR_PAGE_ENTRIES + page->info.entry_count++;
+    dir_reserve_files(header, index + 1);
+    header->files[index] = *entry;
+    header->file_count = index + 1;
+    page->extent_used += entry->extent_count;
+    page->dirty = 1;
+    header->dir_dirty = 1;
+    dir_bloom_add(&page->info, entry->filename);
+    file_index_add(header, index);
+    return index;
+}
+
+/*
+ * Función para cargar una página del directorio en memoria (si no estaba cargada)
+ * header: Puntero al encabezado del archivador
+ * p: Índice de la página
+ */
+void dir_load_page(StarHeader *header, int p)
+{
+    DirPage *page = &header->pages[p];
+    if (page->loaded)
+    {
+        return;
+    }
+
+    unsigned char *buffer = malloc(DIR_PAGE_SIZE);
+    if (!buffer)
+    {
+        perror("Error de memoria");
+        fail_operation();
+    }
+    library_track(free, buffer);
+    if (io_pread(header->fd, buffer, DIR_PAGE_SIZE, (off_t)page->info.block * block_size) != DIR_PAGE_SIZE)
+    {
+        perror("Error al leer página del directorio");
+        fail_operation();
+    }
+    DirPageHeader *disk = (DirPageHeader *)buffer;
+    int entry_count = disk->entry_count;
+    int extent_count = disk->extent_count;
+    if (entry_count != page->info.entry_count || extent_count < 0 || extent_count > DIR_PAGE_EXTENTS)
+    {
+        fprintf(stderr, "Error: página %d del directorio dañada\n", p);
+        fail_operation();
+    }
+
+    // Los extents de la página se agregan al array en memoria (que no existe mientras no haya
+    // ninguno, así que una página sin extents no copia nada)
+    int base = header->extent_count;
+    if (extent_count > 0)
+    {
+        extent_reserve(header, extent_count);
+        memcpy(header->extents + base, buffer + sizeof(DirPageHeader), extent_count * sizeof(Extent));
+        header->extent_count += extent_count;
+    }
+
+    int first = p * DIR_PAGE_ENTRIES;
+    dir_reserve_files(header, first + entry_count);
+    for (int i = 0; i < entry_count; i++)
+    {
+        FileEntry *entry = &header->files[first + i];
+        *entry = disk->entries[i];
+        if (entry->extent_index < 0 || entry->extent_index + entry->extent_count > extent_count)
+        {
+            fprintf(stderr, "Error: página %d del directorio dañada\n", p);
+            fail_operation();
+        }
+        entry->extent_index += base;
+        page->extent_used += entry->extent_count;
+    }
+    page->loaded = 1;
+    library_untrack(1);
+    free(buffer);
+
+    for (int i = 0; i < entry_count; i++)
+    {
+        if (file_index_add(header, first + i))
+        {
+            break;
+        }
+    }
+}
+
+/*
+ * Función para cargar todas las páginas del directorio (para las operaciones que recorren
+ * todos los archivos)
+ * header: Puntero al encabezado del archivador
+ */
+void load_directory(StarHeader *header)
+{
+    for (int p = 0; p < header->page_count; p++)
+    {
+        dir_load_page(header, p);
+    }
+}
+
+/*
+ * Función para escribir las páginas del directorio que cambiaron
+ * Cada página se compacta al escribirla (se descartan sus entradas eliminadas); las páginas que
+ * quedan vacías se liberan y se quitan de la tabla de páginas. Una página nueva de varios bloques
+ * ocupa un rango contiguo.
+ * fd: Descriptor de archivo del archivador
+ * header: Puntero al encabezado del archivador
+ */
+void dir_write_pages(int fd, StarHeader *header)
+{
+    ssize_t page_bytes = (ssize_t)DIR_PAGE_BLOCKS * block_size;
+    unsigned char *buffer = malloc(page_bytes);
+    if (!buffer)
+    {
+        perror("Error de memoria");
+        fail_operation();
+    }
+    library_track(free, buffer);
+
+    int removed_pages = 0;
+    for (int p = 0; p < header->page_count; p++)
+    {
+        DirPage *page = &header->pages[p];
+        if (!page->dirty)
+        {
+            continue;
+        }
+
+        memset(buffer, 0, page_bytes);
+        memset(page->info.bloom, 0, sizeof(page->info.bloom));
+        DirPageHeader *disk = (DirPageHeader *)buffer;
+        Extent *disk_extents = (Extent *)(buffer + sizeof(DirPageHeader));
+        FileEntry *slots = &header->files[p * DIR_PAGE_ENTRIES];
+        int count = 0;
+        for (int i = 0; i < page->info.entry_count; i++)
+        {
+            if (slots[i].filename[0] == '\0')
+            {
+                continue;
+            }
+            slots[count] = slots[i];
+            disk->entries[count] = slots[i];
+            disk->entries[count].extent_index = disk->extent_count;
+            if (slots[i].extent_count > 0)
+            {
+                memcpy(&disk_extents[disk->extent_count], &header->extents[slots[i].extent_index],
+                       slots[i].extent_count * sizeof(Extent));
+            }
+            disk->extent_count += slots[i].extent_count;
+            dir_bloom_add(&page->info, slots[i].filename);
+            count++;
+        }
+        memset(&slots[count], 0, (page->info.entry_count - count) * sizeof(FileEntry));
+        page->info.entry_count = count;
+        disk->entry_count = count;
+        page->dirty = 0;
+        header->dir_dirty = 1;
+
+        if (count == 0)
+        {
+            for (int b = 0; page->info.block > 0 && b < DIR_PAGE_BLOCKS; b++)
+            {
+                free_block(header, page->info.block + b);
+            }
+            page->info.block = -1; // Se quita de la tabla más abajo
+            removed_pages++;
+            continue;
+        }
+        if (page->info.block <= 0)
+        {
+            page->info.block = allocate_run(fd, header, DIR_PAGE_BLOCKS);
+        }
+        if (io_pwrite(fd, buffer, page_bytes, (off_t)page->info.block * block_size) != page_bytes)
+        {
+            perror("Error al escribir página del directorio");
+            fail_operation();
+        }
+    }
+    library_untrack(1);
+    free(buffer);
+
+    // Quitar las páginas vacías moviendo las posiciones de las siguientes
+    if (removed_pages > 0)
+    {
+        int kept = 0;
+        for (int p = 0; p < header->page_count; p++)
+        {
+            if (header->pages[p].info.block == -1)
+            {
+                continue;
+            }
+            if (kept != p)
+            {
+                header->pages[kept] = header->pages[p];
+                memcpy(&header->files[kept * DIR_PAGE_ENTRIES], &header->files[p * DIR_PAGE_ENTRIES],
+                       DIR_PAGE_ENTRIES * sizeof(FileEntry));
+            }
+            kept++;
+        }
+        memset(&header->files[kept * DIR_PAGE_ENTRIES], 0,
+               (header->file_capacity - kept * DIR_PAGE_ENTRIES) * sizeof(FileEntry));
+        header->page_count = kept;
+    }
+    header->file_count = header->page_count > 0
+                             ? (header->page_count - 1) * DIR_PAGE_ENTRIES + header->pages[header->page_count - 1].info.entry_count
+                             : 0;
+    file_index_rebuild(header);
+}
+
+/*
+ * Función para cargar la tabla de páginas del directorio; las páginas se leen cuando se necesitan
+ * fd: Descriptor de archivo del archivador
+ * header: Puntero al encabezado del archivador (con los campos del superbloque ya llenos)
+ * page_count: Páginas guardadas en la tabla
+ */
+void dir_load_table(int fd, StarHeader *header, int page_count)
+{
+    if (header->dir_table_block <= 0 || page_count <= 0)
+    {
+        return;
+    }
+
+    DirPageInfo *infos = malloc(page_count * sizeof(DirPageInfo));
+    if (!infos)
+    {
+        perror("Error de memoria");
+        fail_operation();
+    }
+    library_track(free, infos);
+    ssize_t bytes = (ssize_t)page_count * sizeof(DirPageInfo);
+    if (io_pread(fd, infos, bytes, (off_t)header->dir_table_block * block_size) != bytes)
+    {
+        perror("Error al leer la tabla de páginas del directorio");
+        fail_operation();
+    }
+    for (int p = 0; p < page_count; p++)
+    {
+        if (infos[p].entry_count < 0 || infos[p].entry_count > DIR_PAGE_ENTRIES || infos[p].block < HEADER_BLOCKS)
+        {
+            fprintf(stderr, "Error: tabla de páginas del directorio dañada\n");
+            fail_operation();
+        }
+        int index = dir_new_page(header);
+        header->pages[index].info = infos[p];
+        header->pages[index].loaded = 0;
+        header->pages[index].dirty = 0;
+    }
+    header->dir_dirty = 0;
+    library_untrack(1);
+    free(infos);
+
+    header->file_count = (page_count - 1) * DIR_PAGE_ENTRIES + header->pages[page_count - 1].info.entry_count;
+    dir_reserve_files(header, header->file_count);
+}
+
+/*
+ * Función para guardar la tabla de páginas del directorio en bloques contiguos del archivador
+ * Los bloques de la tabla anterior se liberan.
+ * fd: Descriptor de archivo del archivador
+ * header: Puntero al encabezado del archivador
+ */
+void dir_save_table(int fd, StarHeader *header)
+{
+    for (int b = 0; b < header->dir_table_blocks; b++)
+    {
+        free_block(header, header->dir_table_block + b);
+    }
+    header->dir_table_block = 0;
+    header->dir_table_blocks = 0;
+    header->dir_dirty = 0;
+    if (header->page_count == 0)
+    {
+        return;
+    }
+
+    size_t bytes = (size_t)header->page_count * sizeof(DirPageInfo);
+    int blocks = (int)((bytes + block_size - 1) / block_size);
+    unsigned char *buffer = calloc(blocks, block_size);
+    if (!buffer)
+    {
+        perror("Error de memoria");
+        fail_operation();
+    }
+    library_track(free, buffer);
+    for (int p = 0; p < header->page_count; p++)
+    {
+        memcpy(buffer + p * sizeof(DirPageInfo), &header->pages[p].info, sizeof(DirPageInfo));
+    }
+    int start = allocate_run(fd, header, blocks);
+    if (io_pwrite(fd, buffer, (size_t)blocks * block_size, (off_t)start * block_size) != (ssize_t)blocks * block_size)
+    {
+        perror("Error al escribir la tabla de páginas del directorio");
+        fail_operation();
+    }
+    library_untrack(1);
+    free(buffer);
+
+    header->dir_table_block = start;
+    header->dir_table_blocks = blocks;
+}
+
+/*
+ * Función para liberar la memoria de un encabezado
+ * header: Puntero al encabezado del archivador
+ */
+void free_header(StarHeader *header)
+{
+    free(header->files);
+    free(header->extents);
+    free(header->pages);
+    free(header->free_map);
+    free(header->index.buckets);
+    free(header->index.next);
+    memset(header, 0, sizeof(StarHeader));
+}
+
+/*
+ * Función para leer el encabezado del archivador desde el archivo
+ * Del formato actual solo se lee la tabla de páginas del directorio; las páginas se cargan
+ * cuando se necesitan. También se fija el tamaño de bloque global con el del archivador. Los
+ * archivadores v1 se convierten en memoria (se recorren una vez sus cadenas de bloques para
+ * construir los extents) y solo se pueden leer o convertir con -p.
+ * fd: Descriptor de archivo del archivador
+ * header: Puntero a la estructura de encabezado a llenar
+ */
+void read_header(int fd, StarHeader *header)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    StarSuperblock superblock;
+    memset(header, 0, sizeof(StarHeader));
+    memset(&superblock, 0, sizeof(StarSuperblock));
+    header->fd = fd;
+    io_pread(fd, &superblock, sizeof(StarSuperblock), 0);
+    block_size = DEFAULT_BLOCK_SIZE;
+
+    if (memcmp(superblock.magic, STREAM_MAGIC, sizeof(superblock.magic)) == 0)
+    {
+        fprintf(stderr, "Error: el empaquetado es un flujo (-f -); solo se puede extraer (-x) o listar (-t)\n");
+        fail_operation();
+    }
+    else if (memcmp(superblock.magic, STAR_MAGIC, sizeof(superblock.magic)) != 0)
+    {
+        read_header_v1(fd, header);
+    }
+    else if (superblock.version == STAR_VERSION)
+    {
+        if (!valid_block_size(superblock.block_size))
+        {
+            fprintf(stderr, "Error: tamaño de bloque %d no válido en el encabezado\n", superblock.block_size);
+            fail_operation();
+        }
+        block_size = superblock.block_size;
+        memcpy(header->magic, superblock.magic, sizeof(header->magic));
+        header->version = STAR_VERSION;
+        header->dir_table_block = superblock.dir_table_block;
+        header->dir_table_blocks = superblock.dir_table_blocks;
+        header->dedup_table_block = superblock.dedup_table_block;
+        header->dedup_table_blocks = superblock.dedup_table_blocks;
+        header->dedup_entry_count = superblock.dedup_entry_count;
+        header->checksum_table_block = superblock.checksum_table_block;
+        header->checksum_table_blocks = superblock.checksum_table_blocks;
+        header->checksum_count = superblock.checksum_count;
+        header->tail_table_block = superblock.tail_table_block;
+        header->tail_table_blocks = superblock.tail_table_blocks;
+        header->tail_entry_count = superblock.tail_entry_count;
+        header->free_map_block = superblock.free_map_block;
+        header->free_map_blocks = superblock.free_map_blocks;
+        free_map_load(fd, header, superblock.free_map_count);
+        dir_load_table(fd, header, superblock.dir_page_count);
+    }
+    else
+    {
+        fprintf(stderr, "Error: versión de formato %d no soportada (solo v1 y v%d)\n", superblock.version,
+                STAR_VERSION);
+        fail_operation();
+    }
+
+    dedup_load(fd, header);
+    tail_load(fd, header);
+    checksum_load(fd, header);
+    file_index_rebuild(header);
+    stats_phase(&io_stats.header_load_seconds, &start);
+}
+
+/*
+ * Función para leer un encabezado v1 y convertirlo al formato en memoria
+ * fd: Descriptor de archivo del archivador
+ * header: Puntero a la estructura de encabezado a llenar
+ */
+void read_header_v1(int fd, StarHeader *header)
+{
+    StarHeaderV1 *old_header = calloc(1, sizeof(StarHeaderV1));
+    if (!old_header)
+    {
+        perror("Error de memoria");
+        fail_operation();
+    }
+    library_track(free, old_header);
+    io_pread(fd, old_header, sizeof(StarHeaderV1), 0);
+
+    memcpy(header->magic, STAR_MAGIC, sizeof(header->magic));
+    header->version = 1;
+
+    for (int i = 0; i < old_header->file_count && i < LEGACY_MAX_FILES; i++)
+    {
+        FileEntry entry;
+        memset(&entry, 0, sizeof(FileEntry));
+        memcpy(entry.filename, old_header->files[i].filename, MAX_FILENAME_LENGTH);
+        entry.size = old_header->files[i].size;
+        entry.stored_size = entry.size;
+
+        // Seguir la cadena leyendo solo el campo next_block de cada bloque
+        int block_count = file_block_count(header, &entry);
+        int *blocks = malloc((block_count > 0 ? block_count : 1) * sizeof(int));
+        if (!blocks)
+        {
+            perror("Error de memoria");
+            fail_operation();
+        }
+        library_track(free, blocks);
+        int count = 0;
+        int current_block = old_header->files[i].start_block;
+        while (count < block_count && current_block != -1)
+        {
+            blocks[count++] = current_block;
+            stats_add(&io_stats.chain_reads, 1);
+            if (io_pread(fd, &current_block, sizeof(int), (off_t)current_block * block_size) != sizeof(int))
+            {
+                break;
+            }
+        }
+        assign_extents(header, &entry, blocks, count);
+        library_untrack(1);
+        free(blocks);
+        dir_add_entry(header, &entry);
+    }
+    library_untrack(1);
+    free(old_header);
+}
+
+/*
+ * Función para verificar que el archivador se puede modificar con este programa
+ * Los archivadores v1 solo se leen; -p los reescribe en el formato actual.
+ * header: Puntero al encabezado del archivador
+ */
+void require_current_format(StarHeader *header)
+{
+    if (header->version != STAR_VERSION)
+    {
+        fprintf(stderr, "El empaquetado usa el formato v%d; use la opción -p para convertirlo al formato v%d.\n",
+                header->version, STAR_VERSION);
+        fail_operation();
+    }
+}
+
+/*
+ * Función para escribir el encabezado del archivador en el archivo
+ * Solo se reescriben las páginas del directorio que cambiaron y las tablas con cambios (las
+ * sumas de verificación y el mapa de bloques libres al final, porque guardar las demás tablas
+ * reserva y libera bloques).
+ * fd: Descriptor de archivo del archivador
+ * header: Puntero a la estructura de encabezado a escribir
+ */
+void write_header(int fd, StarHeader *header)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    tail_flush();
+    if (dedup_table.dirty)
+    {
+        dedup_save(fd, header);
+    }
+    if (tail_table.dirty)
+    {
+        tail_save(fd, header);
+    }
+    dir_write_pages(fd, header);
+    if (header->dir_dirty)
+    {
+        dir_save_table(fd, header);
+    }
+    if (checksum_table.dirty)
+    {
+        checksum_save(fd, header);
+    }
+    if (header->free_map_dirty)
+    {
+        free_map_save(fd, header);
+    }
+
+    StarSuperblock superblock;
+    memset(&superblock, 0, sizeof(StarSuperblock));
+    memcpy(superblock.magic, STAR_MAGIC, sizeof(superblock.magic));
+    superblock.version = STAR_VERSION;
+    superblock.free_block_list = -1;
+    superblock.dir_table_block = header->dir_table_block;
+    superblock.dir_table_blocks = header->dir_table_blocks;
+    superblock.dir_page_count = header->page_count;
+    superblock.dedup_table_block = header->dedup_table_block;
+    superblock.dedup_table_blocks = header->dedup_table_blocks;
+    superblock.dedup_entry_count = header->dedup_entry_count;
+    superblock.checksum_table_block = header->checksum_table_block;
+    superblock.checksum_table_blocks = header->checksum_table_blocks;
+    superblock.checksum_count = header->checksum_count;
+    superblock.block_size = block_size;
+    superblock.tail_table_block = header->tail_table_block;
+    superblock.tail_table_blocks = header->tail_table_blocks;
+    superblock.tail_entry_count = header->tail_entry_count;
+    superblock.free_map_block = header->free_map_block;
+    superblock.free_map_blocks = header->free_map_blocks;
+    superblock.free_map_count = header->free_map_count;
+    if (io_pwrite(fd, &superblock, sizeof(StarSuperblock), 0) != sizeof(StarSuperblock))
+    {
+        perror("Error al escribir el encabezado");
+        fail_operation();
+    }
+    stats_add(&io_stats.header_writes, 1);
+    stats_phase(&io_stats.header_flush_seconds, &start);
+}
+
+/*
+ * Función para empezar una llamada de la biblioteca: toma el mutex, pone el estado del
+ * empaquetado en las variables globales y registra el punto de retorno para los errores
+ * archive: Empaquetado de la llamada
+ * jump: Punto de retorno (preparado con setjmp después de esta llamada), o NULL
+ */
+void library_enter(StarArchive *archive, jmp_buf *jump)
+{
+    pthread_mutex_lock(&library_lock);
+    library_swap_state(archive);
+    library_jump = jump;
+    library_thread = pthread_self();
+    library_resource_count = 0;
+    pool_reset();
+}
+
+/*
+ * Función para terminar una llamada de la biblioteca: guarda el estado del empaquetado y suelta
+ * el mutex
+ * archive: Empaquetado de la llamada
+ */
+void library_leave(StarArchive *archive)
+{
+    library_jump = NULL;
+    library_swap_state(archive);
+    pthread_mutex_unlock(&library_lock);
+}
+
+/*
+ * Función para intercambiar el tamaño de bloque y las tablas globales con las del empaquetado
+ * archive: Empaquetado de la llamada
+ */
+void library_swap_state(StarArchive *archive)
+{
+    int saved_block_size = block_size;
+    block_size = archive->block_size;
+    archive->block_size = saved_block_size;
+
+    DedupTable saved_dedup = dedup_table;
+    dedup_table = archive->dedup_table;
+    archive->dedup_table = saved_dedup;
+
+    ChecksumTable saved_checksum = checksum_table;
+    checksum_table = archive->checksum_table;
+    archive->checksum_table = saved_checksum;
+
+    TailTable saved_tail = tail_table;
+    tail_table = archive->tail_table;
+    archive->tail_table = saved_tail;
+}
+
+/*
+ * Función para liberar el encabezado y las tablas de un empaquetado y cerrarlo (con su estado
+ * ya puesto en las variables globales)
+ * archive: Empaquetado a liberar
+ */
+void library_free_state(StarArchive *archive)
+{
+    free_header(&archive->header);
+    dedup_reset();
+    tail_reset();
+    free(checksum_table.entries);
+    free(checksum_table.verified);
+    memset(&checksum_table, 0, sizeof(ChecksumTable));
+    free(archive->segments);
+    archive->segments = NULL;
+    archive->segment_index = -1;
+    close(archive->fd);
+}
+
+/*
+ * Función para registrar un recurso temporal de la llamada de la biblioteca en curso
+ * Si la llamada falla antes de library_untrack, fail_operation libera el recurso. Fuera de la
+ * biblioteca, o desde otro hilo, no hace nada: el programa termina al primer error.
+ * release: Función que libera el recurso
+ * resource: Recurso a liberar (puede ser NULL)
+ */
+void library_track(void (*release)(void *), void *resource)
+{
+    if (!library_jump || !pthread_equal(library_thread, pthread_self()))
+    {
+        return;
+    }
+    if (library_resource_count == library_resource_capacity)
+    {
+        int capacity = library_resource_capacity ? library_resource_capacity * 2 : 16;
+        LibraryResource *resources = realloc(library_resources, capacity * sizeof(LibraryResource));
+        if (!resources)
+        {
+            perror("Error de memoria");
+            if (resource)
+            {
+                release(resource);
+            }
+            fail_operation();
+        }
+        library_resources = resources;
+        library_resource_capacity = capacity;
+    }
+    library_resources[library_resource_count].release = release;
+    library_resources[library_resource_count].resource = resource;
+    library_resource_count++;
+}
+
+/*
+ * Función para registrar un descriptor temporal de la llamada de la biblioteca en curso
+ * fd: Descriptor a cerrar si la llamada falla
+ */
+void library_track_fd(int fd)
+{
+    library_track(library_close, (void *)(intptr_t)(fd + 1)); // +1: el descriptor 0 no es NULL
+}
+
+/*
+ * Función para olvidar los últimos recursos registrados con library_track, antes de que su
+ * dueño los libere
+ * count: Número de recursos a olvidar
+ */
+void library_untrack(int count)
+{
+    if (!library_jump || !pthread_equal(library_thread, pthread_self()))
+    {
+        return;
+    }
+    library_resource_count -= count;
+}
+
+/*
+ * Función para liberar, del último al primero, los recursos de una llamada de la biblioteca que
+ * falló
+ */
+void library_unwind(void)
+{
+    while (library_resource_count > 0)
+    {
+        LibraryResource *resource = &library_resources[--library_resource_count];
+        if (resource->resource)
+        {
+            resource->release(resource->resource);
+        }
+    }
+}
+
+/*
+ * Función para cerrar un descriptor registrado con library_track_fd
+ * fd: Descriptor más 1, convertido con intptr_t
+ */
+void library_close(void *fd)
+{
+    close((int)(intptr_t)fd - 1);
+}
+
+/*
+ * Función para liberar las colas de tareas registradas con library_track
+ * queues: Colas de create_task_queues (una por hilo de job_count)
+ */
+void library_destroy_queues(void *queues)
+{
+    destroy_task_queues(queues, job_count);
+}
+
+/*
+ * Función para comprobar, con el mutex tomado, que el empaquetado se puede modificar
+ * archive: Empaquetado de la llamada
+ * Retorna: STAR_OK, STAR_ERROR_BROKEN o STAR_ERROR_FORMAT
+ */
+int library_check_writable(StarArchive *archive)
+{
+    if (archive->broken)
+    {
+        return STAR_ERROR_BROKEN;
+    }
+    return archive->header.version != STAR_VERSION ? STAR_ERROR_FORMAT : STAR_OK;
+}
+
+/*
+ * Función para llenar la descripción pública de un archivo
+ * entry: Descripción a llenar
+ * file: Entrada del directorio
+ * index: Posición de la entrada en el directorio
+ */
+void library_fill_entry(StarEntry *entry, FileEntry *file, int index)
+{
+    memset(entry, 0, sizeof(StarEntry));
+    memcpy(entry->name, file->filename, sizeof(entry->name));
+    entry->name[sizeof(entry->name) - 1] = '\0';
+    entry->size = file->size;
+    entry->stored_size = file->stored_size;
+    entry->mtime = file->mtime;
+    entry->mode = file->mode;
+    entry->compressed = file->codec != CODEC_NONE;
+    entry->index = index;
+}
+
+StarArchive *star_open(const char *path, int writable, int *error)
+{
+    StarArchive *volatile archive = calloc(1, sizeof(StarArchive));  // Se usa después de volver con longjmp
+    if (!archive)
+    {
+        if (error)
+        {
+            *error = STAR_ERROR;
+        }
+        return NULL;
+    }
+    archive->writable = writable;
+    archive->segment_index = -1;
+    archive->fd = open(path, writable ? O_RDWR : O_RDONLY);
+    if (archive->fd < 0 || is_stream(archive->fd))
+    {
+        if (error)
+        {
+            *error = archive->fd < 0 ? STAR_ERROR_OPEN : STAR_ERROR_FORMAT;
+        }
+        if (archive->fd >= 0)
+        {
+            close(archive->fd);
+        }
+        free(archive);
+        return NULL;
+    }
+
+    jmp_buf jump;
+    library_enter(archive, &jump);
+    if (setjmp(jump) != 0)
+    {
+        library_free_state(archive);
+        library_leave(archive);
+        free(archive);
+        if (error)
+        {
+            *error = STAR_ERROR;
+        }
+        return NULL;
+    }
+    read_header(archive->fd, &archive->header);
+    library_leave(archive);
+    return archive;
+}
+
+int star_close(StarArchive *archive)
+{
+    int result = star_flush(archive);
+    library_enter(archive, NULL);
+    library_free_state(archive);
+    library_leave(archive);
+    free(archive);
+    return result == STAR_ERROR_BROKEN ? STAR_OK : result;
+}
+
+int star_flush(StarArchive *archive)
+{
+    jmp_buf jump;
+    library_enter(archive, &jump);
+    if (setjmp(jump) != 0)
+    {
+        archive->broken = 1;
+        library_leave(archive);
+        return STAR_ERROR;
+    }
+    if (archive->broken || !archive->dirty)
+    {
+        int result = archive->broken ? STAR_ERROR_BROKEN : STAR_OK;
+        library_leave(archive);
+        return result;
+    }
+    write_header(archive->fd, &archive->header);
+    archive->dirty = 0;
+    library_leave(archive);
+    return STAR_OK;
+}
+
+int star_next(StarArchive *archive, int *cursor, StarEntry *entry)
+{
+    jmp_buf jump;
+    library_enter(archive, &jump);
+    if (setjmp(jump) != 0)
+    {
+        library_leave(archive);
+        return STAR_ERROR;
+    }
+
+    // Las páginas del directorio se cargan a medida que se recorren y quedan en memoria
+    StarHeader *header = &archive->header;
+    int found = 0;
+    while (!found && *cursor >= 0 && *cursor < header->file_count)
+    {
+        int i = (*cursor)++;
+        dir_load_page(header, i / DIR_PAGE_ENTRIES);
+        if (header->files[i].filename[0] != '\0')
+        {
+            library_fill_entry(entry, &header->files[i], i);
+            found = 1;
+        }
+    }
+    library_leave(archive);
+    return found;
+}
+
+int star_find(StarArchive *archive, const char *name, StarEntry *entry)
+{
+    if (strlen(name) >= MAX_FILENAME_LENGTH)
+    {
+        return STAR_ERROR_NOT_FOUND;
+    }
+
+    jmp_buf jump;
+    library_enter(archive, &jump);
+    if (setjmp(jump) != 0)
+    {
+        library_leave(archive);
+        return STAR_ERROR;
+    }
+    int index = find_file_entry(&archive->header, (char *)name);
+    if (index != -1)
+    {
+        library_fill_entry(entry, &archive->header.files[index], index);
+    }
+    library_leave(archive);
+    return index != -1 ? STAR_OK : STAR_ERROR_NOT_FOUND;
+}
+
+long long star_read(StarArchive *archive, const StarEntry *entry, long long offset, void *buffer, size_t length)
+{
+    jmp_buf jump;
+    library_enter(archive, &jump);
+    if (setjmp(jump) != 0)
+    {
+        library_leave(archive);
+        return STAR_ERROR;
+    }
+
+    // El estado del empaquetado se consulta con el mutex tomado: otro hilo puede estar modificándolo
+    if (archive->broken)
+    {
+        library_leave(archive);
+        return STAR_ERROR_BROKEN;
+    }
+    if (entry->index < 0 || entry->index >= archive->header.file_count)
+    {
+        library_leave(archive);
+        return STAR_ERROR_NOT_FOUND;
+    }
+
+    StarHeader *header = &archive->header;
+    dir_load_page(header, entry->index / DIR_PAGE_ENTRIES);
+    FileEntry *file = &header->files[entry->index];
+    if (strcmp(file->filename, entry->name) != 0)
+    {
+        library_leave(archive);
+        return STAR_ERROR_NOT_FOUND;
+    }
+    if (offset < 0 || offset > file->size)
+    {
+        library_leave(archive);
+        return STAR_ERROR_RANGE;
+    }
+
+    // Los rangos del último archivo leído se conservan: lecturas seguidas del mismo archivo solo
+    // hacen la búsqueda binaria
+    if (archive->segment_index != entry->index)
+    {
+        free(archive->segments);
+        archive->segments = NULL;
+        archive->segment_index = -1;
+        archive->segments = file_segments(header, file, &archive->segment_count);
+        archive->segment_index = entry->index;
+    }
+
+    long long count = (long long)length < file->size - offset ? (long long)length : file->size - offset;
+    if (count > 0 && file->codec != CODEC_NONE)
+    {
+        read_compressed_range(archive->fd, file, archive->segments, archive->segment_count, offset, count, buffer);
+    }
+    else if (count > 0)
+    {
+        read_stored_range(archive->fd, file, archive->segments, archive->segment_count, offset, buffer, count);
+    }
+    library_leave(archive);
+    return count;
+}
+
+int star_append(StarArchive *archive, const char *path)
+{
+    struct stat st;
+    if (!archive->writable)
+    {
+        return STAR_ERROR_READ_ONLY;
+    }
+    if (strlen(path) >= MAX_FILENAME_LENGTH || stat(path, &st) != 0 || access(path, R_OK) != 0)
+    {
+        return STAR_ERROR_OPEN;
+    }
+
+    jmp_buf jump;
+    library_enter(archive, &jump);
+    if (setjmp(jump) != 0)
+    {
+        archive->broken = 1;
+        library_leave(archive);
+        return STAR_ERROR;
+    }
+    int error = library_check_writable(archive);
+    if (error != STAR_OK)
+    {
+        library_leave(archive);
+        return error;
+    }
+    if (find_file_entry(&archive->header, (char *)path) != -1)
+    {
+        library_leave(archive);
+        return STAR_ERROR_EXISTS;
+    }
+    add_file_to_star(archive->fd, &archive->header, (char *)path);
+    archive->dirty = 1;
+    library_leave(archive);
+    return STAR_OK;
+}
+
+int star_delete(StarArchive *archive, const char *name)
+{
+    if (!archive->writable)
+    {
+        return STAR_ERROR_READ_ONLY;
+    }
+    if (strlen(name) >= MAX_FILENAME_LENGTH)
+    {
+        return STAR_ERROR_NOT_FOUND;
+    }
+
+    jmp_buf jump;
+    library_enter(archive, &jump);
+    if (setjmp(jump) != 0)
+    {
+        archive->broken = 1;
+        library_leave(archive);
+        return STAR_ERROR;
+    }
+    int error = library_check_writable(archive);
+    if (error != STAR_OK)
+    {
+        library_leave(archive);
+        return error;
+    }
+    if (find_file_entry(&archive->header, (char *)name) == -1)
+    {
+        library_leave(archive);
+        return STAR_ERROR_NOT_FOUND;
+    }
+    // La posición del archivo eliminado se puede reutilizar: los rangos guardados ya no sirven
+    free(archive->segments);
+    archive->segments = NULL;
+    archive->segment_index = -1;
+    remove_file_from_star(&archive->header, (char *)name);
+    archive->dirty = 1;
+    library_leave(archive);
+    return STAR_OK;
+}
+
+const char *star_strerror(int error)
+{
+    switch (error)
+    {
+    case STAR_OK:
+        return "Sin error";
+    case STAR_ERROR_OPEN:
+        return "No se pudo abrir el archivo";
+    case STAR_ERROR_NOT_FOUND:
+        return "El archivo no se encontró en el empaquetado";
+    case STAR_ERROR_EXISTS:
+        return "El archivo ya existe en el empaquetado";
+    case STAR_ERROR_RANGE:
+        return "Posición fuera del archivo";
+    case STAR_ERROR_READ_ONLY:
+        return "El empaquetado se abrió solo para lectura";
+    case STAR_ERROR_FORMAT:
+        return "El formato del empaquetado solo se puede leer";
+    case STAR_ERROR_BROKEN:
+        return "Una modificación anterior falló; el empaquetado solo se puede cerrar";
+    default:
+        return "La operación falló";
+    }
+}
@@ -0,0 +1,118 @@
+/*
+ * libstar: acceso a empaquetados .star desde otros programas
+ *
+ * Se compila desde star.c sin la función main, dejando visibles solo las funciones star_*:
+ *     gcc -c -fPIC -fvisibility=hidden -DSTAR_LIBRARY star.c -o libstar.o
+ *     objcopy --localize-hidden libstar.o
+ *
+ * Las funciones devuelven un código de error en lugar de terminar el programa; el detalle de los
+ * errores de lectura o de formato se sigue escribiendo en stderr. Un empaquetado abierto guarda
+ * su directorio y sus tablas en memoria entre llamadas. Todas las llamadas del proceso se
+ * serializan con un único mutex, incluidas las lecturas de empaquetados distintos: se pueden hacer
+ * desde varios hilos sin corromper nada, pero no avanzan en paralelo. Para leer en paralelo hay que
+ * usar varios procesos.
+ */
+#ifndef STAR_H
+#define STAR_H
+
+#include <stddef.h>
+
+// Marca las funciones públicas; el resto de star.c queda oculto con -fvisibility=hidden
+#define STAR_API __attribute__((visibility("default")))
+
+// Códigos de error (las funciones devuelven STAR_OK o un valor negativo)
+enum
+{
+    STAR_OK = 0,
+    STAR_ERROR = -1,           // La operación falló (el detalle se escribió en stderr)
+    STAR_ERROR_OPEN = -2,      // No se pudo abrir el empaquetado o el archivo a agregar
+    STAR_ERROR_NOT_FOUND = -3, // El archivo no está en el empaquetado
+    STAR_ERROR_EXISTS = -4,    // El archivo ya está en el empaquetado
+    STAR_ERROR_RANGE = -5,     // La posición está fuera del archivo
+    STAR_ERROR_READ_ONLY = -6, // El empaquetado se abrió solo para lectura
+    STAR_ERROR_FORMAT = -7,    // Formato que solo se puede leer (v1, o un flujo)
+    STAR_ERROR_BROKEN = -8     // Una modificación anterior falló a medias; solo se puede cerrar
+};
+
+// Empaquetado abierto
+typedef struct StarArchive StarArchive;
+
+// Descripción de un archivo del empaquetado
+typedef struct
+{
+    char name[256];         // Nombre del archivo
+    long long size;         // Tamaño en bytes
+    long long stored_size;  // Bytes que ocupa dentro del empaquetado
+    long long mtime;        // Fecha de modificación (segundos; 0 si el formato no la guarda)
+    unsigned int mode;      // Tipo y permisos (0 si el formato no los guarda)
+    int compressed;         // 1 si se guarda comprimido
+    int index;              // Posición en el directorio (la usa star_read)
+} StarEntry;
+
+/*
+ * Abre un empaquetado
+ * path: Nombre del empaquetado
+ * writable: 1 para poder agregar y eliminar archivos, 0 para solo leer
+ * error: Se llena con el código de error si no se pudo abrir (puede ser NULL)
+ * Retorna: Empaquetado abierto, o NULL
+ */
+STAR_API StarArchive *star_open(const char *path, int writable, int *error);
+
+/*
+ * Guarda los cambios pendientes y cierra el empaquetado; archive deja de ser válido aunque falle
+ * Retorna: STAR_OK o un código de error
+ */
+STAR_API int star_close(StarArchive *archive);
+
+/*
+ * Guarda los cambios pendientes sin cerrar el empaquetado
+ * Retorna: STAR_OK o un código de error
+ */
+STAR_API int star_flush(StarArchive *archive);
+
+/*
+ * Recorre el directorio
+ * cursor: Posición del recorrido; debe empezar en 0
+ * entry: Se llena con el siguiente archivo
+ * Retorna: 1 si se llenó entry, 0 al terminar, o un código de error
+ */
+STAR_API int star_next(StarArchive *archive, int *cursor, StarEntry *entry);
+
+/*
+ * Busca un archivo por nombre
+ * entry: Se llena con el archivo encontrado
+ * Retorna: STAR_OK, STAR_ERROR_NOT_FOUND u otro código de error
+ */
+STAR_API int star_find(StarArchive *archive, const char *name, StarEntry *entry);
+
+/*
+ * Lee un rango de bytes de un archivo
+ * entry: Archivo obtenido con star_next o star_find (después de star_delete hay que volver a buscarlo)
+ * offset: Primer byte a leer
+ * buffer: Destino de los datos
+ * length: Bytes a leer
+ * Retorna: Bytes leídos (menos de length al llegar al final del archivo), o un código de error
+ */
+STAR_API long long star_read(StarArchive *archive, const StarEntry *entry, long long offset, void *buffer, size_t length);
+
+/*
+ * Agrega un archivo al empaquetado
+ * path: Archivo a agregar (se guarda con este nombre)
+ * Retorna: STAR_OK o un código de error
+ */
+STAR_API int star_append(StarArchive *archive, const char *path);
+
+/*
+ * Elimina un archivo del empaquetado
+ * name: Nombre del archivo
+ * Retorna: STAR_OK o un código de error
+ */
+STAR_API int star_delete(StarArchive *archive, const char *name);
+
+/*
+ * Describe un código de error
+ * Retorna: Mensaje en español
+ */
+STAR_API const char *star_strerror(int error);
+
+#endif
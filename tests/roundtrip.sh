@@ -0,0 +1,176 @@
+#!/bin/bash
+# Prueba de ida y vuelta de star: para cada combinación de opciones crea un empaquetado, lo
+# modifica (actualizar, agregar y eliminar), lo empaca con -p, -p --in-place y --pack-incremental
+# y después de cada paso lo extrae y compara cada archivo con su original (cmp), además de la
+# lista de archivos, --verify y un rango con --cat. Incluye un bloque cambiado que conserva su
+# CRC32C, que -u tiene que detectar comparando los bytes, y una extracción con -j de más archivos
+# que el límite de descriptores.
+# Uso: tests/roundtrip.sh [ruta de star]
+# Variables: SEED (semilla de los datos, 1), COMBINATIONS (combinaciones de opciones separadas por
+# "|"; --block-size solo se pasa a -c), KEEP (1 para conservar el directorio de trabajo)
+# Requiere openssl para generar los datos.
+# Retorna 1 si alguna comprobación falla
+
+STAR=${1:-./star}
+SEED=${SEED:-1}
+COMBINATIONS=${COMBINATIONS:-"|--block-size=4K|--block-size=1M|--compress=zlib|--compress=zlib --block-size=4K|\
+--dedup|--dedup --block-size=4K|--hash|--direct|--direct --block-size=4K|-j 4|-j 4 --block-size=4K"}
+KEEP=${KEEP:-0}
+
+STAR=$(realpath "$STAR") || exit 1
+command -v openssl > /dev/null || { echo "Se necesita openssl para generar los datos" >&2; exit 1; }
+WORK=$(mktemp -d)
+if [ "$KEEP" = 1 ]; then
+    echo "Directorio de trabajo: $WORK" >&2
+else
+    trap 'rm -rf "$WORK"' EXIT
+fi
+ARCHIVE=$WORK/a.star
+FAILURES=0
+CHECKS=0
+
+source "$(dirname "$0")/../benchmarks/data.sh"
+
+# Registra el resultado de una comprobación
+# Uso: check descripción comando...
+check()
+{
+    local what=$1
+    shift
+    CHECKS=$((CHECKS + 1))
+    if ! "$@"; then
+        echo "FALLÓ: $CASE: $what" >&2
+        FAILURES=$((FAILURES + 1))
+    fi
+}
+
+# Aplica con XOR el polinomio generador de CRC32C (con su término x^32, en el orden de bits de
+# CRC32C) en una posición de un archivo. La diferencia es un múltiplo del polinomio, así que el
+# CRC32C de cualquier bloque que la contenga completa no cambia aunque cambien sus bytes
+# Uso: forge archivo posición
+forge()
+{
+    local pattern=(241 118 236 5 1) bytes i
+    read -r -a bytes < <(od -An -tu1 -j "$2" -N 5 "$1")
+    for i in 0 1 2 3 4; do
+        printf "$(printf '\\%03o' $((bytes[i] ^ pattern[i])))"
+    done | dd of="$1" bs=1 seek="$2" conv=notrunc status=none
+}
+
+# Extrae el empaquetado en un directorio nuevo y compara la lista de archivos y cada archivo con
+# los de src
+# Uso: check_extract paso
+check_extract()
+{
+    local out=$WORK/out name
+    rm -rf "$out"
+    mkdir "$out"
+    (cd "$out" && "$STAR" -x $EXTRACT_OPTIONS -f "$ARCHIVE") || { check "$1: -x" false; return; }
+    check "$1: lista de archivos" diff <("$STAR" -t -f "$ARCHIVE" | tail -n +2 | sort) <(cd "$WORK/src" && ls | sort)
+    for name in $(cd "$WORK/src" && ls); do
+        check "$1: contenido de $name" cmp -s "$WORK/src/$name" "$out/$name"
+    done
+    check "$1: --verify" "$STAR" --verify -f "$ARCHIVE" > /dev/null
+}
+
+# Archivos de prueba: tamaños alrededor de los bordes de bloque y de cola (con bloques de 4K,
+# 256K y 1M), vacíos, grandes y repetidos para --dedup
+SIZES="empty 0
+one 1
+small 100
+k4m1 4095
+k4 4096
+k4p1 4097
+k128 131072
+k128p1 131073
+k256 262144
+k256p1 262145
+m1p3 1048579
+m5p7 5242887"
+generate "$WORK/random" random "$SEED" <<< "$SIZES"
+generate "$WORK/text" text "$SEED" <<< "$SIZES"
+generate "$WORK/extra" random "$SEED-extra" <<< "new1 70000
+new2 300000
+new3 9"
+
+IFS='|' read -r -a COMBINATION_LIST <<< "$COMBINATIONS"
+for OPTIONS in "${COMBINATION_LIST[@]}"; do
+    CASE="opciones '$OPTIONS'"
+    # --block-size solo vale al crear; -j y --direct también se usan al extraer
+    COMMON=$(sed 's/--block-size=[^ ]*//' <<< "$OPTIONS")
+    EXTRACT_OPTIONS=$(grep -o -e '-j [0-9]*' -e '--direct' <<< "$OPTIONS" | tr '\n' ' ')
+
+    rm -rf "$WORK/src" "$ARCHIVE"
+    mkdir "$WORK/src"
+    for name in $(ls "$WORK/random"); do
+        cp "$WORK/random/$name" "$WORK/src/r_$name"
+        cp "$WORK/text/$name" "$WORK/src/t_$name"
+    done
+    cp "$WORK/random/m1p3" "$WORK/src/r_copy" # Mismos bloques que r_m1p3
+    cd "$WORK/src" || exit 1
+
+    "$STAR" -c $OPTIONS -f "$ARCHIVE" * || check "-c" false
+    check_extract "crear"
+    check "--cat" cmp -s <("$STAR" --cat r_m5p7 --offset=1000000 --length=300000 -f "$ARCHIVE") \
+        <(tail -c +1000001 r_m5p7 | head -c 300000)
+
+    # Modificar: crecer, achicar, reescribir el medio, reemplazar y cambiar el modo
+    head -c 5000 "$WORK/extra/new1" >> r_k4
+    truncate -s 200000 t_k256p1
+    dd if="$WORK/extra/new2" of=r_m5p7 bs=1 skip=100 seek=3000000 count=70000 conv=notrunc status=none
+    cp "$WORK/extra/new3" t_small
+    chmod 600 r_one
+    "$STAR" -u $COMMON -f "$ARCHIVE" * || check "-u" false
+    check_extract "actualizar"
+
+    # Agregar y eliminar
+    cp "$WORK/extra/new1" "$WORK/extra/new2" "$WORK/extra/new3" .
+    "$STAR" -r $COMMON -f "$ARCHIVE" new1 new2 new3 || check "-r" false
+    "$STAR" --delete -f "$ARCHIVE" r_k128 t_m1p3 r_empty > /dev/null || check "--delete" false
+    rm r_k128 t_m1p3 r_empty
+    check_extract "agregar y eliminar"
+
+    # Empacar de las tres formas, eliminando entre una y otra para que quede algo que mover
+    "$STAR" -p $(grep -o -e '--direct' <<< "$OPTIONS") -f "$ARCHIVE" || check "-p" false
+    check_extract "-p"
+    "$STAR" --delete -f "$ARCHIVE" r_k4m1 t_m5p7 > /dev/null && rm r_k4m1 t_m5p7
+    "$STAR" -p --in-place -f "$ARCHIVE" || check "-p --in-place" false
+    check_extract "-p --in-place"
+    "$STAR" --delete -f "$ARCHIVE" r_k256 t_k4 > /dev/null && rm r_k256 t_k4
+    "$STAR" --pack-incremental -f "$ARCHIVE" || check "--pack-incremental" false
+    check_extract "--pack-incremental"
+    cd "$WORK" || exit 1
+done
+
+# Un bloque cambiado con el mismo CRC32C: -u tiene que reescribirlo
+CASE="CRC falsificado"
+EXTRACT_OPTIONS=
+rm -rf "$WORK/src" "$ARCHIVE"
+mkdir "$WORK/src"
+cp "$WORK/random/m1p3" "$WORK/src/forged"
+cd "$WORK/src" || exit 1
+"$STAR" -c --block-size=4K -f "$ARCHIVE" forged || check "-c" false
+forge forged 5000
+forge forged 700000
+check "el archivo cambió" sh -c '! cmp -s forged "$1"' sh "$WORK/random/m1p3"
+"$STAR" -u -f "$ARCHIVE" forged || check "-u" false
+check_extract "actualizar"
+cd "$WORK" || exit 1
+
+# Más archivos que descriptores disponibles: -x -j abre cada archivo solo mientras lo escribe
+CASE="-x -j con pocos descriptores"
+EXTRACT_OPTIONS="-j 4"
+rm -rf "$WORK/src" "$ARCHIVE"
+mkdir "$WORK/src"
+for i in $(seq 300); do
+    printf 'archivo %d\n' "$i" > "$WORK/src/f$i"
+done
+cd "$WORK/src" || exit 1
+"$STAR" -c -f "$ARCHIVE" * || check "-c" false
+# El límite solo vale dentro del subshell, que no puede devolver sus contadores: cuenta como una
+# sola comprobación que pasa si pasaron todas las de adentro
+check "extraer con 64 descriptores" eval '(ulimit -n 64 && FAILURES=0 && check_extract "extraer" && [ "$FAILURES" -eq 0 ])'
+cd "$WORK" || exit 1
+
+echo "$CHECKS comprobaciones, $FAILURES fallaron"
+[ "$FAILURES" -eq 0 ]